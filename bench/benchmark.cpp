@@ -0,0 +1,491 @@
+// Benchmarks the diff, selection, load/save and texture upload paths on a
+// deterministic synthetic corpus and writes the timings as JSON, so runs on
+// different commits can be compared.
+
+#include "comparison.hpp"
+#include "diff_metrics.hpp"
+#include "diff_visualization.hpp"
+#include "image_loader.hpp"
+#include "image_utils.hpp"
+#include "mapped_image.hpp"
+#include "mip_pyramid.hpp"
+#include "multi_diff.hpp"
+#include "parallel.hpp"
+#include "precise_diff.hpp"
+#include "resample.hpp"
+
+#include <SFML/Graphics.hpp>
+#include <SFML/Window/Context.hpp>
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct BenchOptions {
+    std::string outputPath = "benchmark.json";
+    std::string workDirectory;
+    std::string label;
+    std::vector<unsigned> megapixels = {1, 4, 16, 64, 256};
+    std::vector<unsigned> threadCounts;
+    unsigned repeat = 3;
+    bool gpu = false;
+};
+
+struct BenchResult {
+    std::string name;
+    unsigned megapixels = 0;
+    sf::Vector2u size;
+    unsigned threads = 1;
+    std::vector<double> samplesMs;
+    std::string skipped;
+};
+
+void printUsage(const char* program) {
+    std::printf(
+        "Usage: %s [options]\n"
+        "  -o, --output PATH      JSON results (default benchmark.json)\n"
+        "      --sizes LIST       image sizes in megapixels (default 1,4,16,64,256)\n"
+        "      --threads LIST     worker thread counts (default: powers of two up to all cores)\n"
+        "      --repeat N         timed runs per measurement (default 3)\n"
+        "      --work-dir DIR     where load/save files go (default: system temp directory)\n"
+        "      --label TEXT       free-form tag stored in the JSON, e.g. a commit hash\n"
+        "      --gpu              also time texture uploads (needs an OpenGL context)\n",
+        program);
+}
+
+bool parseList(std::string_view text, std::vector<unsigned>& values) {
+    values.clear();
+    while (!text.empty()) {
+        std::size_t comma = text.find(',');
+        std::string_view item = text.substr(0, comma);
+        unsigned value = 0;
+        auto result = std::from_chars(item.data(), item.data() + item.size(), value);
+        if (result.ec != std::errc() || result.ptr != item.data() + item.size() || value == 0) {
+            return false;
+        }
+        values.push_back(value);
+        text = comma == std::string_view::npos ? std::string_view() : text.substr(comma + 1);
+    }
+    return !values.empty();
+}
+
+bool parseArguments(int argc, char* argv[], BenchOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if ((arg == "-o" || arg == "--output") && hasValue) {
+            options.outputPath = argv[++i];
+        }
+        else if (arg == "--sizes" && hasValue) {
+            if (!parseList(argv[++i], options.megapixels)) return false;
+        }
+        else if (arg == "--threads" && hasValue) {
+            if (!parseList(argv[++i], options.threadCounts)) return false;
+        }
+        else if (arg == "--repeat" && hasValue) {
+            std::vector<unsigned> repeat;
+            if (!parseList(argv[++i], repeat) || repeat.size() != 1) return false;
+            options.repeat = repeat[0];
+        }
+        else if (arg == "--work-dir" && hasValue) {
+            options.workDirectory = argv[++i];
+        }
+        else if (arg == "--label" && hasValue) {
+            options.label = argv[++i];
+        }
+        else if (arg == "--gpu") {
+            options.gpu = true;
+        }
+        else if (arg == "--no-gpu") {
+            options.gpu = false;
+        }
+        else {
+            return false;
+        }
+    }
+
+    if (options.threadCounts.empty()) {
+        unsigned cores = ThreadPool::defaultThreadCount();
+        for (unsigned threads = 1; threads < cores; threads *= 2) {
+            options.threadCounts.push_back(threads);
+        }
+        options.threadCounts.push_back(cores);
+    }
+    if (options.workDirectory.empty()) {
+        options.workDirectory = (fs::temp_directory_path() / "compare-images-bench").string();
+    }
+    return true;
+}
+
+// Roughly square, with a width that is a multiple of 16.
+sf::Vector2u corpusSize(unsigned megapixels) {
+    double pixels = static_cast<double>(megapixels) * 1024.0 * 1024.0;
+    unsigned width = static_cast<unsigned>(std::lround(std::sqrt(pixels) / 16.0)) * 16;
+    return {width, static_cast<unsigned>(pixels / width)};
+}
+
+std::uint32_t mixBits(std::uint32_t value) {
+    value ^= value >> 16;
+    value *= 0x7FEB352Du;
+    value ^= value >> 15;
+    value *= 0x846CA68Bu;
+    value ^= value >> 16;
+    return value;
+}
+
+// Gradients with per-pixel noise. The second image adds sub-tolerance noise
+// to one band and rewrites a grid of blocks, so both the kernel and the
+// region search have work to do. Every row depends only on its coordinates,
+// so the output does not depend on the thread count.
+void generatePair(sf::Vector2u size, sf::Image& image1, sf::Image& image2) {
+    image1.resize(size);
+    image2.resize(size);
+    std::uint8_t* pixels1 = mutablePixelsPtr(image1);
+    std::uint8_t* pixels2 = mutablePixelsPtr(image2);
+    const std::size_t stride = rowStride(image1);
+    const unsigned block = std::max(16u, size.x / 64);
+
+    parallelForRows(size.y, size.x, [&](unsigned firstRow, unsigned endRow) {
+        for (unsigned y = firstRow; y < endRow; ++y) {
+            std::uint8_t* row1 = pixels1 + y * stride;
+            std::uint8_t* row2 = pixels2 + y * stride;
+            bool noisyBand = (y / block) % 7 == 3;
+
+            for (unsigned x = 0; x < size.x; ++x) {
+                std::uint32_t noise = mixBits(y * 0x9E3779B9u ^ x);
+                std::uint8_t* p1 = row1 + static_cast<std::size_t>(x) * 4;
+                p1[0] = static_cast<std::uint8_t>(static_cast<std::uint64_t>(x) * 255 / size.x) ^ (noise & 0x0F);
+                p1[1] = static_cast<std::uint8_t>(static_cast<std::uint64_t>(y) * 255 / size.y);
+                p1[2] = static_cast<std::uint8_t>(noise >> 8);
+                p1[3] = 255;
+
+                std::uint8_t* p2 = row2 + static_cast<std::size_t>(x) * 4;
+                std::copy_n(p1, 4, p2);
+                if (noisyBand) {
+                    p2[1] = static_cast<std::uint8_t>(std::min(255u, p1[1] + ((noise >> 16) & 1u)));
+                }
+                if ((x / block) % 9 == 4 && (y / block) % 9 == 4) {
+                    p2[0] = static_cast<std::uint8_t>(255 - p1[0]);
+                    p2[2] = static_cast<std::uint8_t>(p1[2] / 2);
+                }
+            }
+        }
+    });
+}
+
+double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Runs `body` once untimed to warm caches, then `repeat` timed times.
+// `decoded` with its pixels as 16-bit or float RGB samples; the 8-bit copy
+// is shared.
+void widenForBench(const DecodedImage& decoded, const std::string& type, DecodedImage& widened) {
+    widened.image = decoded.image;
+    widened.contentHash = decoded.contentHash;
+    PixelView<std::uint8_t> view{decoded.image.getPixelsPtr(), decoded.image.getSize(), 4, rowStride(decoded.image)};
+    if (type == "float") {
+        convertPixels(view, 3, widened.precise.emplace().emplace<PixelBuffer<float>>());
+    }
+    else {
+        convertPixels(view, 3, widened.precise.emplace().emplace<PixelBuffer<std::uint16_t>>());
+    }
+}
+
+// A body returning false marks the measurement as failed.
+bool measure(BenchResult& result, unsigned repeat, const std::function<bool()>& body) {
+    if (!body()) {
+        return false;
+    }
+    for (unsigned i = 0; i < repeat; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        if (!body()) {
+            return false;
+        }
+        result.samplesMs.push_back(elapsedMs(start));
+    }
+    return true;
+}
+
+bool loadThroughApp(const std::string& path) {
+    ThreadPool pool(1);
+    std::shared_ptr<ImageLoadJob> job = startImageLoad(pool, path);
+    pool.waitIdle();
+    return job->stage.load() == LoadStage::Ready;
+}
+
+bool writeResults(const BenchOptions& options, const std::vector<BenchResult>& results);
+
+// Every result is written out as soon as it is measured, so a run that
+// crashes or is killed part way still leaves valid JSON behind.
+void runSize(const BenchOptions& options, unsigned megapixels, std::vector<BenchResult>& results) {
+    sf::Vector2u size = corpusSize(megapixels);
+    std::printf("%u MP (%ux%u): generating\n", megapixels, size.x, size.y);
+    std::fflush(stdout);
+
+    DecodedImage decoded1;
+    DecodedImage decoded2;
+    generatePair(size, decoded1.image, decoded2.image);
+    decoded1.contentHash = 1;
+    decoded2.contentHash = 2;
+
+    auto report = [&](BenchResult& result) {
+        if (!result.skipped.empty()) {
+            std::printf("  %-18s %2u thread(s): skipped (%s)\n", result.name.c_str(), result.threads,
+                        result.skipped.c_str());
+        }
+        else {
+            std::printf("  %-18s %2u thread(s): %10.2f ms (best of %zu)\n", result.name.c_str(), result.threads,
+                        *std::min_element(result.samplesMs.begin(), result.samplesMs.end()),
+                        result.samplesMs.size());
+        }
+        std::fflush(stdout);
+        results.push_back(std::move(result));
+        if (!writeResults(options, results)) {
+            std::fprintf(stderr, "Failed to write %s\n", options.outputPath.c_str());
+        }
+    };
+    auto newResult = [&](const char* name, unsigned threads) {
+        BenchResult result;
+        result.name = name;
+        result.megapixels = megapixels;
+        result.size = size;
+        result.threads = threads;
+        return result;
+    };
+
+    std::error_code ec;
+    fs::create_directories(options.workDirectory, ec);
+    std::string stem = (fs::path(options.workDirectory) / ("corpus-" + std::to_string(megapixels))).string();
+
+    for (unsigned threads : options.threadCounts) {
+        setSharedThreadCount(threads);
+
+        BenchResult diff = newResult("diff", threads);
+        sf::Image diffImage;
+        DiffMetrics metrics;
+        ChangeRegionIndex regions;
+        bool identical = false;
+        if (!measure(diff, options.repeat, [&] {
+                return compareDecodedImages(decoded1, decoded2, 0, {0, 0}, diffImage, metrics, regions, identical);
+            })) {
+            diff.skipped = "comparison failed";
+        }
+        report(diff);
+
+        // The cached deltas re-mapped, as when switching the display mode.
+        BenchResult display = newResult("display heatmap", threads);
+        sf::Image displayed;
+        DiffDisplaySettings displaySettings;
+        displaySettings.mode = DiffDisplayMode::Heatmap;
+        if (!measure(display, options.repeat, [&] {
+                return renderDiffDisplay(diffImage, decoded1.image, decoded2.image, {0, 0}, displaySettings, displayed);
+            })) {
+            display.skipped = "no difference image";
+        }
+        report(display);
+        displayed = sf::Image();
+        diffImage = sf::Image();
+
+        // Image 2 and two copies against image 1 in one fused pass.
+        BenchResult multi = newResult("diff 3 vs reference", threads);
+        std::vector<sf::Image> copies(2, decoded2.image);
+        std::vector<const sf::Image*> targets = {&decoded2.image, &copies[0], &copies[1]};
+        std::vector<ReferenceComparison> multiResults;
+        if (!measure(multi, options.repeat, [&] {
+                return computeMultiDifference(decoded1.image, targets, multiResults, 0, true);
+            })) {
+            multi.skipped = "comparison failed";
+        }
+        report(multi);
+        multiResults.clear();
+        copies.clear();
+
+        // The same pair as 16-bit and float RGB, through the precise kernels.
+        for (const char* type : {"16-bit", "float"}) {
+            BenchResult precise = newResult(("diff " + std::string(type)).c_str(), threads);
+            DecodedImage precise1;
+            DecodedImage precise2;
+            widenForBench(decoded1, type, precise1);
+            widenForBench(decoded2, type, precise2);
+            DiffSummary summary;
+            if (!measure(precise, options.repeat, [&] {
+                    return computeDecodedDifference(precise1, precise2, {0, 0}, diffImage, summary, 0, &metrics);
+                })) {
+                precise.skipped = "comparison failed";
+            }
+            report(precise);
+            diffImage = sf::Image();
+        }
+
+        BenchResult selection = newResult("selection", threads);
+        sf::Image combined;
+        if (!measure(selection, options.repeat, [&] {
+                PixelRect rect1, rect2;
+                std::string error;
+                sf::Vector2f minCoord(size.x / 4.0f, size.y / 4.0f);
+                sf::Vector2f maxCoord(size.x * 0.75f, size.y * 0.75f);
+                if (!mapSelectionRects(size, size, minCoord, maxCoord, 1.0f, {0.0f, 0.0f}, rect1, rect2, error)) {
+                    return false;
+                }
+                composeSelectionPair(decoded1.image, rect1, decoded2.image, rect2, combined);
+                return true;
+            })) {
+            selection.skipped = "selection failed";
+        }
+        report(selection);
+        combined = sf::Image();
+
+        // Image 2 brought onto a grid 3/4 the size, as for a mismatched render.
+        BenchResult resample = newResult("resample lanczos3", threads);
+        sf::Image resampled;
+        if (!measure(resample, options.repeat, [&] {
+                sf::Vector2u target(std::max(1u, size.x * 3 / 4), std::max(1u, size.y * 3 / 4));
+                return resampleImage(decoded2.image, target, ResampleFilter::Lanczos3, resampled);
+            })) {
+            resample.skipped = "resampling failed";
+        }
+        report(resample);
+        resampled = sf::Image();
+
+        for (const char* extension : {".ppm", ".bmp", ".qoi", ".png"}) {
+            std::string path = stem + extension;
+            std::string format = extension + 1;
+
+            BenchResult save = newResult(("save " + format).c_str(), threads);
+            if (!measure(save, options.repeat, [&] { return saveImageFile(decoded1.image, path); })) {
+                save.skipped = "cannot write " + path;
+            }
+            report(save);
+
+            BenchResult load = newResult(("load " + format).c_str(), threads);
+            if (!save.skipped.empty()) {
+                load.skipped = "nothing saved";
+            }
+            else if (!measure(load, options.repeat, [&] { return loadThroughApp(path); })) {
+                load.skipped = "cannot load " + path;
+            }
+            report(load);
+            fs::remove(path, ec);
+        }
+    }
+
+    if (options.gpu) {
+        // The same per-tile uploads TiledTexture does; GL is single-threaded.
+        BenchResult upload = newResult("texture upload", 1);
+        sf::Context context;
+        unsigned tilesX = (size.x + PyramidTileSize - 1) / PyramidTileSize;
+        unsigned tilesY = (size.y + PyramidTileSize - 1) / PyramidTileSize;
+        if (!measure(upload, options.repeat, [&] {
+                for (unsigned ty = 0; ty < tilesY; ++ty) {
+                    for (unsigned tx = 0; tx < tilesX; ++tx) {
+                        sf::Texture texture;
+                        sf::IntRect area({static_cast<int>(tx * PyramidTileSize), static_cast<int>(ty * PyramidTileSize)},
+                                         {static_cast<int>(std::min(PyramidTileSize, size.x - tx * PyramidTileSize)),
+                                          static_cast<int>(std::min(PyramidTileSize, size.y - ty * PyramidTileSize))});
+                        if (!texture.loadFromImage(decoded1.image, false, area)) {
+                            return false;
+                        }
+                    }
+                }
+                return true;
+            })) {
+            upload.skipped = "no OpenGL context";
+        }
+        report(upload);
+    }
+}
+
+std::string formatNumber(double value) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.3f", value);
+    return buffer;
+}
+
+bool writeResults(const BenchOptions& options, const std::vector<BenchResult>& results) {
+    std::ofstream file(options.outputPath);
+    if (!file) {
+        return false;
+    }
+
+    std::time_t now = std::time(nullptr);
+    char timestamp[32];
+    std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+    file << "{\n"
+         << "  \"schema\": 1,\n"
+         << "  \"label\": " << jsonQuote(options.label) << ",\n"
+         << "  \"timestamp\": " << jsonQuote(timestamp) << ",\n"
+         << "  \"hardware_threads\": " << ThreadPool::defaultThreadCount() << ",\n"
+         << "  \"repeat\": " << options.repeat << ",\n"
+         << "  \"results\": [";
+
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& result = results[i];
+        file << (i > 0 ? ",\n" : "\n") << "    {\"name\": " << jsonQuote(result.name)
+             << ", \"megapixels\": " << result.megapixels << ", \"width\": " << result.size.x
+             << ", \"height\": " << result.size.y << ", \"threads\": " << result.threads;
+
+        if (!result.skipped.empty()) {
+            file << ", \"skipped\": " << jsonQuote(result.skipped) << "}";
+            continue;
+        }
+
+        std::vector<double> sorted = result.samplesMs;
+        std::sort(sorted.begin(), sorted.end());
+        double median = sorted[sorted.size() / 2];
+        double pixels = static_cast<double>(result.size.x) * result.size.y;
+
+        file << ", \"min_ms\": " << formatNumber(sorted.front()) << ", \"median_ms\": " << formatNumber(median)
+             << ", \"max_ms\": " << formatNumber(sorted.back())
+             << ", \"megapixels_per_second\": " << formatNumber(pixels / 1e6 / (sorted.front() / 1000.0))
+             << ", \"samples_ms\": [";
+        for (std::size_t s = 0; s < result.samplesMs.size(); ++s) {
+            file << (s > 0 ? ", " : "") << formatNumber(result.samplesMs[s]);
+        }
+        file << "]}";
+    }
+    file << "\n  ]\n}\n";
+    return static_cast<bool>(file);
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    if (!parseArguments(argc, argv, options)) {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    std::vector<BenchResult> results;
+    if (!writeResults(options, results)) {
+        std::fprintf(stderr, "Failed to write %s\n", options.outputPath.c_str());
+        return 1;
+    }
+    for (unsigned megapixels : options.megapixels) {
+        runSize(options, megapixels, results);
+    }
+
+    if (!writeResults(options, results)) {
+        std::fprintf(stderr, "Failed to write %s\n", options.outputPath.c_str());
+        return 1;
+    }
+    std::printf("Wrote %zu result(s) to %s\n", results.size(), options.outputPath.c_str());
+    return 0;
+}
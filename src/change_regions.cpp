@@ -0,0 +1,224 @@
+#include "change_regions.hpp"
+
+#include "image_utils.hpp"
+#include "parallel.hpp"
+#include "profiler.hpp"
+
+#include <algorithm>
+
+namespace {
+
+constexpr unsigned BandRows = 64;
+
+struct Run {
+    unsigned y;
+    unsigned x0;
+    unsigned x1;
+};
+
+struct Band {
+    std::vector<Run> runs;
+    // rowStart[r] is the first run of row (firstRow + r); one extra entry at the end.
+    std::vector<std::size_t> rowStart;
+    unsigned firstRow = 0;
+    std::size_t offset = 0;
+};
+
+std::uint32_t findRoot(std::vector<std::uint32_t>& parent, std::uint32_t i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+void unite(std::vector<std::uint32_t>& parent, std::uint32_t a, std::uint32_t b) {
+    a = findRoot(parent, a);
+    b = findRoot(parent, b);
+    if (a < b) {
+        parent[b] = a;
+    }
+    else if (b < a) {
+        parent[a] = b;
+    }
+}
+
+// Runs [a, b) of one row against [c, d) of the row above; 8-connectivity lets
+// runs touch diagonally.
+void uniteOverlapping(std::vector<std::uint32_t>& parent, const std::vector<Run>& upperRuns, std::size_t upperBegin,
+                      std::size_t upperEnd, std::size_t upperOffset, const std::vector<Run>& lowerRuns,
+                      std::size_t lowerBegin, std::size_t lowerEnd, std::size_t lowerOffset) {
+    std::size_t i = upperBegin;
+    std::size_t j = lowerBegin;
+    while (i < upperEnd && j < lowerEnd) {
+        const Run& upper = upperRuns[i];
+        const Run& lower = lowerRuns[j];
+        if (upper.x0 <= lower.x1 && lower.x0 <= upper.x1) {
+            unite(parent, static_cast<std::uint32_t>(upperOffset + i), static_cast<std::uint32_t>(lowerOffset + j));
+        }
+        if (upper.x1 < lower.x1) {
+            ++i;
+        }
+        else {
+            ++j;
+        }
+    }
+}
+
+void extractRuns(const std::uint8_t* pixels, std::size_t stride, unsigned width, unsigned firstRow,
+                 unsigned endRow, std::uint8_t tolerance, Band& band) {
+    band.firstRow = firstRow;
+    band.rowStart.reserve(endRow - firstRow + 1);
+
+    for (unsigned y = firstRow; y < endRow; ++y) {
+        band.rowStart.push_back(band.runs.size());
+        const std::uint8_t* row = pixels + y * stride;
+
+        unsigned x = 0;
+        while (x < width) {
+            while (x < width && std::max({row[x * 4], row[x * 4 + 1], row[x * 4 + 2]}) <= tolerance) {
+                ++x;
+            }
+            if (x == width) {
+                break;
+            }
+            unsigned start = x;
+            while (x < width && std::max({row[x * 4], row[x * 4 + 1], row[x * 4 + 2]}) > tolerance) {
+                ++x;
+            }
+            band.runs.push_back({y, start, x});
+        }
+    }
+    band.rowStart.push_back(band.runs.size());
+}
+
+}
+
+void ChangeRegionIndex::clear() {
+    regionList.clear();
+    cells.clear();
+    cellsX = 0;
+    cellsY = 0;
+}
+
+void ChangeRegionIndex::buildGrid(unsigned width, unsigned height) {
+    cellsX = (width + CellSize - 1) / CellSize;
+    cellsY = (height + CellSize - 1) / CellSize;
+    cells.assign(static_cast<std::size_t>(cellsX) * cellsY, {});
+
+    for (std::size_t i = 0; i < regionList.size(); ++i) {
+        const ChangeRegion& region = regionList[i];
+        for (unsigned cy = region.top / CellSize; cy <= (region.bottom - 1) / CellSize; ++cy) {
+            for (unsigned cx = region.left / CellSize; cx <= (region.right - 1) / CellSize; ++cx) {
+                cells[static_cast<std::size_t>(cy) * cellsX + cx].push_back(static_cast<std::uint32_t>(i));
+            }
+        }
+    }
+}
+
+std::vector<std::size_t> ChangeRegionIndex::query(unsigned left, unsigned top, unsigned right, unsigned bottom) const {
+    std::vector<std::size_t> result;
+    if (cells.empty() || right <= left || bottom <= top) {
+        return result;
+    }
+
+    unsigned firstX = std::min(left / CellSize, cellsX - 1);
+    unsigned firstY = std::min(top / CellSize, cellsY - 1);
+    unsigned lastX = std::min((right - 1) / CellSize, cellsX - 1);
+    unsigned lastY = std::min((bottom - 1) / CellSize, cellsY - 1);
+
+    for (unsigned cy = firstY; cy <= lastY; ++cy) {
+        for (unsigned cx = firstX; cx <= lastX; ++cx) {
+            for (std::uint32_t i : cells[static_cast<std::size_t>(cy) * cellsX + cx]) {
+                const ChangeRegion& region = regionList[i];
+                if (region.left < right && left < region.right && region.top < bottom && top < region.bottom) {
+                    result.push_back(i);
+                }
+            }
+        }
+    }
+
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+bool findChangeRegions(const sf::Image& diffImage, std::uint8_t tolerance, ChangeRegionIndex& index) {
+    ScopedTimer timer("Find changed regions");
+    index.clear();
+
+    sf::Vector2u size = diffImage.getSize();
+    if (size.x == 0 || size.y == 0) {
+        return false;
+    }
+
+    const std::uint8_t* pixels = diffImage.getPixelsPtr();
+    std::size_t stride = rowStride(diffImage);
+    unsigned bandCount = (size.y + BandRows - 1) / BandRows;
+    std::vector<Band> bands(bandCount);
+
+    parallelForRows(bandCount, size.x * BandRows, [&](unsigned firstBand, unsigned endBand) {
+        for (unsigned b = firstBand; b < endBand; ++b) {
+            extractRuns(pixels, stride, size.x, b * BandRows, std::min((b + 1) * BandRows, size.y), tolerance, bands[b]);
+        }
+    });
+
+    std::size_t totalRuns = 0;
+    for (Band& band : bands) {
+        band.offset = totalRuns;
+        totalRuns += band.runs.size();
+    }
+    if (totalRuns == 0) {
+        return true;
+    }
+
+    std::vector<std::uint32_t> parent(totalRuns);
+    for (std::size_t i = 0; i < totalRuns; ++i) {
+        parent[i] = static_cast<std::uint32_t>(i);
+    }
+
+    // Each band only links runs inside its own index range, so bands can be
+    // labelled concurrently on the shared parent array.
+    parallelForRows(bandCount, size.x * BandRows, [&](unsigned firstBand, unsigned endBand) {
+        for (unsigned b = firstBand; b < endBand; ++b) {
+            const Band& band = bands[b];
+            for (std::size_t r = 1; r + 1 < band.rowStart.size(); ++r) {
+                uniteOverlapping(parent, band.runs, band.rowStart[r - 1], band.rowStart[r], band.offset,
+                                 band.runs, band.rowStart[r], band.rowStart[r + 1], band.offset);
+            }
+        }
+    });
+
+    for (unsigned b = 1; b < bandCount; ++b) {
+        const Band& upper = bands[b - 1];
+        const Band& lower = bands[b];
+        std::size_t lastRow = upper.rowStart.size() - 2;
+        uniteOverlapping(parent, upper.runs, upper.rowStart[lastRow], upper.rowStart[lastRow + 1], upper.offset,
+                         lower.runs, lower.rowStart[0], lower.rowStart[1], lower.offset);
+    }
+
+    std::vector<std::uint32_t> regionOfRoot(totalRuns, UINT32_MAX);
+    for (const Band& band : bands) {
+        for (std::size_t i = 0; i < band.runs.size(); ++i) {
+            const Run& run = band.runs[i];
+            std::uint32_t root = findRoot(parent, static_cast<std::uint32_t>(band.offset + i));
+
+            if (regionOfRoot[root] == UINT32_MAX) {
+                regionOfRoot[root] = static_cast<std::uint32_t>(index.regionList.size());
+                index.regionList.push_back({run.x0, run.y, run.x1, run.y + 1, 0});
+            }
+
+            ChangeRegion& region = index.regionList[regionOfRoot[root]];
+            region.left = std::min(region.left, run.x0);
+            region.right = std::max(region.right, run.x1);
+            region.top = std::min(region.top, run.y);
+            region.bottom = std::max(region.bottom, run.y + 1);
+            region.pixelCount += run.x1 - run.x0;
+        }
+    }
+
+    std::stable_sort(index.regionList.begin(), index.regionList.end(),
+                     [](const ChangeRegion& a, const ChangeRegion& b) { return a.pixelCount > b.pixelCount; });
+    index.buildGrid(size.x, size.y);
+    return true;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <cstdint>
+#include <vector>
+
+struct ChangeRegion {
+    // Bounding box in image pixels, right/bottom exclusive.
+    unsigned left = 0;
+    unsigned top = 0;
+    unsigned right = 0;
+    unsigned bottom = 0;
+    std::uint64_t pixelCount = 0;
+
+    unsigned width() const { return right - left; }
+    unsigned height() const { return bottom - top; }
+};
+
+// 8-connected regions of pixels whose largest RGB delta exceeds the
+// tolerance, largest first, with a uniform grid over their bounding boxes.
+class ChangeRegionIndex {
+public:
+    static constexpr unsigned CellSize = 256;
+
+    const std::vector<ChangeRegion>& regions() const { return regionList; }
+    bool empty() const { return regionList.empty(); }
+    void clear();
+
+    // Indices into regions() whose bounding box intersects the rectangle.
+    std::vector<std::size_t> query(unsigned left, unsigned top, unsigned right, unsigned bottom) const;
+
+private:
+    friend bool findChangeRegions(const sf::Image& diffImage, std::uint8_t tolerance, ChangeRegionIndex& index);
+
+    void buildGrid(unsigned width, unsigned height);
+
+    std::vector<ChangeRegion> regionList;
+    unsigned cellsX = 0;
+    unsigned cellsY = 0;
+    std::vector<std::vector<std::uint32_t>> cells;
+};
+
+// Thresholds `diffImage` into a run-length change mask and labels it with a
+// union-find over runs. Row bands are labelled in parallel and stitched
+// together afterwards.
+bool findChangeRegions(const sf::Image& diffImage, std::uint8_t tolerance, ChangeRegionIndex& index);
@@ -0,0 +1,961 @@
+#include "cli.hpp"
+
+#include "diff_server.hpp"
+#include "hash_index.hpp"
+#include "image_codecs.hpp"
+#include "image_diff.hpp"
+#include "image_loader.hpp"
+#include "mapped_image.hpp"
+#include "multi_diff.hpp"
+#include "parallel.hpp"
+#include "precise_diff.hpp"
+#include "precise_image.hpp"
+#include "profiler.hpp"
+#include "registration.hpp"
+#include "resample.hpp"
+#include "scanline_io.hpp"
+#include "sequence.hpp"
+#include "streaming_diff.hpp"
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+enum ExitCode {
+    ExitIdentical = 0,
+    ExitDifferent = 1,
+    ExitError = 2,
+};
+
+// --align gives up below this phase-correlation peak, where the estimate is
+// as likely to be noise as a shift.
+constexpr float MinAlignmentConfidence = 0.05f;
+// Share of A's pixels an aligned pair must compare; a shift that leaves less
+// fails the pair, since a few matching pixels say nothing about the rest.
+constexpr double MinAlignedOverlap = 0.5;
+
+enum class BatchMode {
+    None,
+    Pair,
+    Directory,
+    Reference,
+    Sequence,
+    BuildIndex,
+    FindSimilar,
+    Serve,
+};
+
+struct CliOptions {
+    BatchMode mode = BatchMode::None;
+    std::string inputA;
+    std::string inputB;
+    // Images compared against inputA with --reference.
+    std::vector<std::string> targets;
+    std::string output;
+    std::string metricsPath;
+    std::string tracePath;
+    unsigned tolerance = 0;
+    double thresholdPercent = 0.0;
+    unsigned jobs = 0;
+    bool stream = false;
+    bool align = false;
+    bool resample = false;
+    ResampleFilter resampleFilter = ResampleFilter::Lanczos3;
+    unsigned stripRows = DefaultStreamStripRows;
+    unsigned queueDepth = 4;
+    int pngLevel = DefaultPngLevel;
+    unsigned maxDistance = 10;
+    unsigned top = 10;
+    std::size_t cacheMegabytes = ImageCache::DefaultBudgetBytes >> 20;
+    bool quiet = false;
+    bool help = false;
+};
+
+struct PairJob {
+    std::string pathA;
+    std::string pathB;
+    std::string outputPath;
+};
+
+struct PairResult {
+    DiffSummary summary;
+    DiffMetrics metrics;
+    sf::Vector2i shift = {0, 0};
+    // Compared pixels over A's pixels; below 1 only with --align.
+    double overlapFraction = 1.0;
+    bool resampled = false;
+    bool failed = false;
+    bool overThreshold = false;
+    std::string error;
+};
+
+void printUsage(const char* program) {
+    std::printf(
+        "Usage:\n"
+        "  %s                                  start the GUI\n"
+        "  %s --diff A B [-o OUT] [options]    compare two images\n"
+        "  %s --diff-dir DIR_A DIR_B [-o OUT_DIR] [options]\n"
+        "                                      compare files with matching names\n"
+        "  %s --reference REF IMG... [-o OUT_DIR] [options]\n"
+        "                                      compare several images against REF in one pass\n"
+        "  %s --sequence SEQ_A SEQ_B [-o OUT_DIR] [options]\n"
+        "                                      compare numbered frames (directories or\n"
+        "                                      patterns like render_%%04d.png / render_####.png)\n"
+        "  %s --index DIR INDEX_FILE            add/update perceptual hashes of DIR's images\n"
+        "  %s --find-similar IMAGE INDEX_FILE   list indexed near-duplicates of IMAGE\n"
+        "  %s --serve SOCKET                    answer diff requests on a Unix domain socket\n"
+        "\n"
+        "Options:\n"
+        "  -o, --output PATH      write the difference image(s) here\n"
+        "  -m, --metrics PATH     write MSE/PSNR/SSIM/histogram per pair as JSON\n"
+        "                         (per frame with --sequence; CSV when PATH ends in .csv)\n"
+        "  -t, --tolerance N      ignore per-channel deltas up to N (0-255, default 0)\n"
+        "      --threshold PCT    allowed percentage of differing pixels (default 0)\n"
+        "  -j, --threads N        worker threads for pairs and row bands (default: all cores)\n"
+        "      --stream           diff strip by strip instead of decoding whole images\n"
+        "                         (output must be .bmp, .ppm, .pam, .rgba or .qoi;\n"
+        "                         --diff-dir writes other formats as .qoi)\n"
+        "      --strip-rows N     rows per strip with --stream (default 64)\n"
+        "      --align            estimate B's translation against A and diff the overlap\n"
+        "      --resample FILTER  scale B to A's size before diffing when they differ\n"
+        "                         (area, bilinear or lanczos3)\n"
+        "      --queue-depth N    frames waiting between --sequence stages (default 4)\n"
+        "      --png-level N      PNG compression level, 0 (stored) to 9 (smallest; default 6)\n"
+        "      --max-distance N   pHash Hamming distance for --find-similar (default 10)\n"
+        "      --top K            at most K matches for --find-similar (default 10)\n"
+        "      --cache-mb N       decoded images kept warm by --serve (default 2048)\n"
+        "      --trace PATH       record stage timings as Chrome trace-event JSON\n"
+        "  -q, --quiet            only report pairs that fail\n"
+        "  -h, --help             show this help\n"
+        "\n"
+        "Exit status: 0 all pairs within threshold, 1 differences over threshold, 2 error.\n"
+        "--find-similar exits with 0 when a match is found and 1 when none is.\n",
+        program, program, program, program, program, program, program, program);
+}
+
+template <typename T>
+bool parseNumber(std::string_view text, T& value) {
+    const char* end = text.data() + text.size();
+    auto result = std::from_chars(text.data(), end, value);
+    return result.ec == std::errc() && result.ptr == end;
+}
+
+bool parseArguments(int argc, char* argv[], CliOptions& options, std::string& error) {
+    auto needValue = [&](int& i, std::string_view flag) -> const char* {
+        if (i + 1 >= argc) {
+            error = "Missing value for " + std::string(flag);
+            return nullptr;
+        }
+        return argv[++i];
+    };
+
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+
+        if (arg == "-h" || arg == "--help") {
+            options.help = true;
+        }
+        else if (arg == "--diff" || arg == "--diff-dir") {
+            if (i + 2 >= argc) {
+                error = std::string(arg) + " needs two paths";
+                return false;
+            }
+            options.mode = arg == "--diff" ? BatchMode::Pair : BatchMode::Directory;
+            options.inputA = argv[++i];
+            options.inputB = argv[++i];
+        }
+        else if (arg == "--reference") {
+            if (i + 2 >= argc) {
+                error = "--reference needs a reference and at least one image";
+                return false;
+            }
+            options.mode = BatchMode::Reference;
+            options.inputA = argv[++i];
+            options.targets.clear();
+            while (i + 1 < argc && argv[i + 1][0] != '-') {
+                options.targets.push_back(argv[++i]);
+            }
+            if (options.targets.empty()) {
+                error = "--reference needs a reference and at least one image";
+                return false;
+            }
+        }
+        else if (arg == "--sequence") {
+            if (i + 2 >= argc) {
+                error = "--sequence needs two directories or frame patterns";
+                return false;
+            }
+            options.mode = BatchMode::Sequence;
+            options.inputA = argv[++i];
+            options.inputB = argv[++i];
+        }
+        else if (arg == "--index" || arg == "--find-similar") {
+            if (i + 2 >= argc) {
+                error = std::string(arg) + " needs two paths";
+                return false;
+            }
+            options.mode = arg == "--index" ? BatchMode::BuildIndex : BatchMode::FindSimilar;
+            options.inputA = argv[++i];
+            options.inputB = argv[++i];
+        }
+        else if (arg == "--serve") {
+            const char* value = needValue(i, arg);
+            if (!value) return false;
+            options.mode = BatchMode::Serve;
+            options.inputA = value;
+        }
+        else if (arg == "--cache-mb") {
+            const char* value = needValue(i, arg);
+            if (!value) return false;
+            if (!parseNumber(value, options.cacheMegabytes) || options.cacheMegabytes == 0) {
+                error = "Cache size must be a positive number of megabytes";
+                return false;
+            }
+        }
+        else if (arg == "--max-distance") {
+            const char* value = needValue(i, arg);
+            if (!value) return false;
+            if (!parseNumber(value, options.maxDistance) || options.maxDistance > 64) {
+                error = "Max distance must be an integer between 0 and 64";
+                return false;
+            }
+        }
+        else if (arg == "--top") {
+            const char* value = needValue(i, arg);
+            if (!value) return false;
+            if (!parseNumber(value, options.top) || options.top == 0) {
+                error = "Top must be a positive integer";
+                return false;
+            }
+        }
+        else if (arg == "-o" || arg == "--output") {
+            const char* value = needValue(i, arg);
+            if (!value) return false;
+            options.output = value;
+        }
+        else if (arg == "-m" || arg == "--metrics") {
+            const char* value = needValue(i, arg);
+            if (!value) return false;
+            options.metricsPath = value;
+        }
+        else if (arg == "-t" || arg == "--tolerance") {
+            const char* value = needValue(i, arg);
+            if (!value) return false;
+            if (!parseNumber(value, options.tolerance) || options.tolerance > 255) {
+                error = "Tolerance must be an integer between 0 and 255";
+                return false;
+            }
+        }
+        else if (arg == "--threshold") {
+            const char* value = needValue(i, arg);
+            if (!value) return false;
+            if (!parseNumber(value, options.thresholdPercent) ||
+                options.thresholdPercent < 0.0 || options.thresholdPercent > 100.0) {
+                error = "Threshold must be a percentage between 0 and 100";
+                return false;
+            }
+        }
+        else if (arg == "-j" || arg == "--jobs" || arg == "--threads") {
+            const char* value = needValue(i, arg);
+            if (!value) return false;
+            if (!parseNumber(value, options.jobs) || options.jobs == 0) {
+                error = "Jobs must be a positive integer";
+                return false;
+            }
+        }
+        else if (arg == "--stream") {
+            options.stream = true;
+        }
+        else if (arg == "--align") {
+            options.align = true;
+        }
+        else if (arg == "--resample") {
+            const char* value = needValue(i, arg);
+            if (!value) return false;
+            if (!parseResampleFilter(value, options.resampleFilter)) {
+                error = "Resample filter must be area, bilinear or lanczos3";
+                return false;
+            }
+            options.resample = true;
+        }
+        else if (arg == "--strip-rows") {
+            const char* value = needValue(i, arg);
+            if (!value) return false;
+            if (!parseNumber(value, options.stripRows) || options.stripRows == 0) {
+                error = "Strip rows must be a positive integer";
+                return false;
+            }
+        }
+        else if (arg == "--queue-depth") {
+            const char* value = needValue(i, arg);
+            if (!value) return false;
+            if (!parseNumber(value, options.queueDepth) || options.queueDepth == 0) {
+                error = "Queue depth must be a positive integer";
+                return false;
+            }
+        }
+        else if (arg == "--png-level") {
+            const char* value = needValue(i, arg);
+            if (!value) return false;
+            if (!parseNumber(value, options.pngLevel) || options.pngLevel < 0 || options.pngLevel > 9) {
+                error = "PNG level must be between 0 and 9";
+                return false;
+            }
+        }
+        else if (arg == "--trace") {
+            const char* value = needValue(i, arg);
+            if (!value) return false;
+            options.tracePath = value;
+        }
+        else if (arg == "-q" || arg == "--quiet") {
+            options.quiet = true;
+        }
+        else {
+            error = "Unknown argument: " + std::string(arg);
+            return false;
+        }
+    }
+
+    if (!options.help && options.mode == BatchMode::None) {
+        error = "Nothing to do: pass --diff, --diff-dir, --reference, --sequence, --index, --find-similar or --serve";
+        return false;
+    }
+    if ((options.align || options.resample) && options.stream) {
+        error = "--align and --resample need whole images and cannot be combined with --stream";
+        return false;
+    }
+    if (options.mode == BatchMode::Reference && (options.stream || options.align || options.resample)) {
+        error = "--reference compares top-left aligned images and does not support --stream, --align or --resample";
+        return false;
+    }
+    if (options.mode == BatchMode::Sequence && (options.stream || options.align)) {
+        error = "--sequence decodes whole frames and does not support --stream or --align";
+        return false;
+    }
+    return true;
+}
+
+bool collectDirectoryPairs(const CliOptions& options, std::vector<PairJob>& jobs, std::string& error) {
+    std::error_code ec;
+    if (!fs::is_directory(options.inputA, ec) || !fs::is_directory(options.inputB, ec)) {
+        error = "Both --diff-dir arguments must be directories";
+        return false;
+    }
+
+    if (!options.output.empty()) {
+        fs::create_directories(options.output, ec);
+        if (ec) {
+            error = "Cannot create output directory: " + options.output;
+            return false;
+        }
+    }
+
+    // error_code overloads throughout, so an entry that cannot be inspected
+    // is reported as an error instead of escaping as an exception.
+    fs::directory_iterator iterator(options.inputA, ec);
+    for (; !ec && iterator != fs::directory_iterator(); iterator.increment(ec)) {
+        const fs::directory_entry& entry = *iterator;
+        if (!entry.is_regular_file(ec)) {
+            if (ec && ec != std::errc::no_such_file_or_directory) {
+                error = "Cannot read " + entry.path().string() + ": " + ec.message();
+                return false;
+            }
+            ec.clear();
+            continue;
+        }
+
+        fs::path name = entry.path().filename();
+        fs::path counterpart = fs::path(options.inputB) / name;
+        if (!fs::is_regular_file(counterpart, ec)) {
+            if (ec && ec != std::errc::no_such_file_or_directory) {
+                error = "Cannot read " + counterpart.string() + ": " + ec.message();
+                return false;
+            }
+            ec.clear();
+            continue;
+        }
+
+        PairJob job;
+        job.pathA = entry.path().string();
+        job.pathB = counterpart.string();
+        if (!options.output.empty()) {
+            fs::path output = fs::path(options.output) / name;
+            // Streamed diffs are written as they go, which only some formats allow.
+            if (options.stream && !isScanlineWriterPath(output.string())) {
+                output.replace_extension(".qoi");
+            }
+            job.outputPath = output.string();
+        }
+        jobs.push_back(std::move(job));
+    }
+
+    if (ec) {
+        error = "Cannot read directory: " + options.inputA + ": " + ec.message();
+        return false;
+    }
+
+    std::sort(jobs.begin(), jobs.end(),
+              [](const PairJob& a, const PairJob& b) { return a.pathA < b.pathA; });
+    return true;
+}
+
+void runPair(const PairJob& job, const CliOptions& options, PairResult& result) {
+    ScopedTimer timer("Compare pair");
+    DiffMetrics* metrics = options.metricsPath.empty() ? nullptr : &result.metrics;
+    std::uint8_t tolerance = static_cast<std::uint8_t>(options.tolerance);
+
+    // Uncompressed 8-bit inputs skip SFML entirely and are diffed from the
+    // mapping. 16-bit and float inputs are decoded whole to keep their samples.
+    bool precise = isPreciseImageFile(job.pathA) || isPreciseImageFile(job.pathB);
+    if (options.stream && precise) {
+        result.failed = true;
+        result.error = "--stream needs 8-bit images";
+        return;
+    }
+    bool wholeImages = options.align || options.resample || precise;
+    if (options.stream || (!wholeImages && isRawFormatPath(job.pathA) && isRawFormatPath(job.pathB))) {
+        bool ok = options.stream
+                      ? streamDifference(job.pathA, job.pathB, job.outputPath, options.stripRows, tolerance,
+                                         result.summary, metrics, result.error)
+                      : mappedDifference(job.pathA, job.pathB, job.outputPath, tolerance, result.summary,
+                                         metrics, result.error, {options.pngLevel});
+        if (!ok) {
+            result.failed = true;
+            return;
+        }
+
+        result.overThreshold = result.summary.sizeMismatch ||
+                               result.summary.differingPercent() > options.thresholdPercent;
+        return;
+    }
+
+    DecodedImage image1;
+    DecodedImage image2;
+    auto load = [&](const std::string& path, DecodedImage& decoded) {
+        if (precise) {
+            return decodeImage(path, decoded, result.error);
+        }
+        if (!loadImageFile(path, decoded.image)) {
+            result.error = "Failed to load image: " + path;
+            return false;
+        }
+        return true;
+    };
+
+    if (!load(job.pathA, image1) || !load(job.pathB, image2)) {
+        result.failed = true;
+        return;
+    }
+
+    // A resampled image 2 is 8-bit, so the pair is then diffed at 8 bits.
+    if (options.resample && image1.image.getSize() != image2.image.getSize()) {
+        sf::Image resampled;
+        if (!resampleImage(image2.image, image1.image.getSize(), options.resampleFilter, resampled)) {
+            result.failed = true;
+            result.error = "Failed to resample image: " + job.pathB;
+            return;
+        }
+        image2.image = std::move(resampled);
+        image2.precise.reset();
+        result.resampled = true;
+    }
+
+    if (options.align) {
+        Alignment alignment;
+        if (!estimateAlignment(image1.image, image2.image, AlignmentOptions{}, alignment, result.error)) {
+            result.failed = true;
+            return;
+        }
+        if (alignment.confidence < MinAlignmentConfidence) {
+            char message[96];
+            std::snprintf(message, sizeof(message), "Alignment confidence %.3f is below %.2f; the images may not overlap",
+                          alignment.confidence, MinAlignmentConfidence);
+            result.failed = true;
+            result.error = message;
+            return;
+        }
+        if (!integerShift(alignment, result.shift)) {
+            result.failed = true;
+            result.error = "Alignment changes the scale; use --resample to diff scaled images";
+            return;
+        }
+    }
+
+    sf::Image diffImage;
+    std::optional<PrecisePixels> preciseDiff;
+    bool keepPrecise = !job.outputPath.empty() && isPreciseOutputPath(job.outputPath);
+    if (!computeDecodedDifference(image1, image2, result.shift, diffImage, result.summary, tolerance, metrics,
+                                  keepPrecise ? &preciseDiff : nullptr)) {
+        result.failed = true;
+        result.error = "Invalid image dimensions";
+        return;
+    }
+
+    sf::Vector2u size1 = image1.image.getSize();
+    result.overlapFraction = static_cast<double>(result.summary.width) * result.summary.height /
+                             (static_cast<double>(size1.x) * size1.y);
+    result.overThreshold = result.summary.sizeMismatch || result.overlapFraction < MinAlignedOverlap ||
+                           result.summary.differingPercent() > options.thresholdPercent;
+
+    if (job.outputPath.empty()) {
+        return;
+    }
+    if (preciseDiff) {
+        if (!savePreciseImage(*preciseDiff, job.outputPath, result.error)) {
+            result.failed = true;
+        }
+    }
+    else if (!saveImageFile(diffImage, job.outputPath, {options.pngLevel})) {
+        result.failed = true;
+        result.error = "Failed to save difference image: " + job.outputPath;
+    }
+}
+
+void reportPair(const PairJob& job, const PairResult& result, bool quiet) {
+    if (result.failed) {
+        std::fprintf(stderr, "ERROR %s | %s: %s\n", job.pathA.c_str(), job.pathB.c_str(), result.error.c_str());
+        return;
+    }
+    if (quiet && !result.overThreshold) {
+        return;
+    }
+
+    const DiffSummary& s = result.summary;
+    std::printf("%s %s | %s: %llu px differ (%.4f%%), max delta %u%s",
+                result.overThreshold ? "FAIL" : "OK  ",
+                job.pathA.c_str(), job.pathB.c_str(),
+                static_cast<unsigned long long>(s.differingPixels), s.differingPercent(),
+                static_cast<unsigned>(s.maxDelta),
+                s.sizeMismatch ? ", size mismatch" : "");
+    if (s.sampleType != SampleType::UInt8) {
+        std::printf(", %s max delta %.6g", sampleTypeName(s.sampleType), s.maxDeltaFraction);
+    }
+    if (s.nonFinitePixels > 0) {
+        std::printf(", %llu px NaN or infinite on one side", static_cast<unsigned long long>(s.nonFinitePixels));
+    }
+    if (result.resampled) {
+        std::printf(", B resampled to A's size");
+    }
+    if (result.shift != sf::Vector2i(0, 0)) {
+        std::printf(", B shifted by (%d, %d), overlap %.1f%% of A", result.shift.x, result.shift.y,
+                    100.0 * result.overlapFraction);
+    }
+    std::printf("\n");
+}
+
+bool writeMetricsReport(const std::string& path, const std::vector<PairJob>& jobs,
+                        const std::vector<PairResult>& results) {
+    std::ofstream file(path);
+    if (!file) {
+        return false;
+    }
+
+    file << "[\n";
+    bool first = true;
+    for (std::size_t i = 0; i < jobs.size(); ++i) {
+        if (results[i].failed) {
+            continue;
+        }
+        if (!first) {
+            file << ",\n";
+        }
+        first = false;
+
+        file << "  {\n"
+             << "    \"image_a\": " << jsonQuote(jobs[i].pathA) << ",\n"
+             << "    \"image_b\": " << jsonQuote(jobs[i].pathB) << ",\n"
+             << "    \"over_threshold\": " << (results[i].overThreshold ? "true" : "false") << ",\n"
+             << "    \"metrics\": " << diffMetricsToJson(results[i].metrics, 4) << "\n"
+             << "  }";
+    }
+    file << "\n]\n";
+    return static_cast<bool>(file);
+}
+
+int runBuildIndex(const CliOptions& options) {
+    PerceptualIndex index;
+    std::string error;
+    std::error_code ec;
+    if (fs::exists(options.inputB, ec) && !index.load(options.inputB, error)) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return ExitError;
+    }
+
+    IndexUpdateStats stats;
+    if (!index.updateFromDirectory(options.inputA, true, stats, error) || !index.save(options.inputB, error)) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return ExitError;
+    }
+
+    if (!options.quiet) {
+        std::printf("%zu image(s) indexed: %zu hashed, %zu unchanged, %zu removed, %zu unreadable\n",
+                    index.entries().size(), stats.hashed, stats.reused, stats.removed, stats.failed);
+    }
+    return ExitIdentical;
+}
+
+int runFindSimilar(const CliOptions& options) {
+    PerceptualIndex index;
+    std::string error;
+    if (!index.load(options.inputB, error)) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return ExitError;
+    }
+
+    PerceptualHashes query;
+    std::unique_ptr<ScanlineReader> reader = openScanlineReader(options.inputA, error);
+    if (!reader || !computePerceptualHashes(*reader, query)) {
+        std::fprintf(stderr, "%s\n", error.empty() ? ("Failed to read image: " + options.inputA).c_str() : error.c_str());
+        return ExitError;
+    }
+
+    std::vector<HashMatch> matches = index.findSimilar(query, options.maxDistance, options.top);
+    for (const HashMatch& match : matches) {
+        std::printf("%2u %2u %s\n", match.pHashDistance, match.dHashDistance, index.entries()[match.entry].path.c_str());
+    }
+    if (!options.quiet) {
+        std::printf("%zu match(es) within distance %u among %zu image(s)\n", matches.size(), options.maxDistance,
+                    index.entries().size());
+    }
+    return matches.empty() ? ExitDifferent : ExitIdentical;
+}
+
+void reportFrame(const SequenceFrame& frame, const SequenceFrameResult& result, bool quiet) {
+    if (result.failed) {
+        std::fprintf(stderr, "ERROR frame %ld (%s | %s): %s\n", frame.number, frame.pathA.c_str(),
+                     frame.pathB.c_str(), result.error.c_str());
+        return;
+    }
+    if (quiet && !result.overThreshold) {
+        return;
+    }
+
+    const DiffSummary& s = result.summary;
+    std::printf("%s frame %ld: %llu px differ (%.4f%%), max delta %u%s%s",
+                result.overThreshold ? "FAIL" : "OK  ", frame.number,
+                static_cast<unsigned long long>(s.differingPixels), s.differingPercent(),
+                static_cast<unsigned>(s.maxDelta),
+                s.sizeMismatch ? ", size mismatch" : "",
+                result.resampled ? ", B resampled to A's size" : "");
+    if (s.sampleType != SampleType::UInt8) {
+        std::printf(", %s max delta %.6g", sampleTypeName(s.sampleType), s.maxDeltaFraction);
+    }
+    if (s.nonFinitePixels > 0) {
+        std::printf(", %llu px NaN or infinite on one side", static_cast<unsigned long long>(s.nonFinitePixels));
+    }
+    std::printf("\n");
+}
+
+int runSequence(const CliOptions& options) {
+    std::vector<SequenceFrame> frames;
+    std::size_t unmatched = 0;
+    std::string error;
+    if (!collectSequenceFrames(options.inputA, options.inputB, frames, unmatched, error)) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return ExitError;
+    }
+
+    if (!options.output.empty()) {
+        std::error_code ec;
+        fs::create_directories(options.output, ec);
+        if (ec) {
+            std::fprintf(stderr, "Cannot create output directory: %s\n", options.output.c_str());
+            return ExitError;
+        }
+    }
+
+    SequenceOptions sequenceOptions;
+    sequenceOptions.tolerance = static_cast<std::uint8_t>(options.tolerance);
+    sequenceOptions.thresholdPercent = options.thresholdPercent;
+    sequenceOptions.withMetrics = !options.metricsPath.empty();
+    sequenceOptions.resample = options.resample;
+    sequenceOptions.resampleFilter = options.resampleFilter;
+    sequenceOptions.outputDirectory = options.output;
+    sequenceOptions.queueDepth = options.queueDepth;
+    sequenceOptions.pngLevel = options.pngLevel;
+
+    std::vector<SequenceFrameResult> results;
+    runSequenceComparison(frames, sequenceOptions, results);
+
+    std::size_t failedFrames = 0;
+    std::size_t differentFrames = 0;
+    for (std::size_t i = 0; i < frames.size(); ++i) {
+        reportFrame(frames[i], results[i], options.quiet);
+        failedFrames += results[i].failed ? 1 : 0;
+        differentFrames += (!results[i].failed && results[i].overThreshold) ? 1 : 0;
+    }
+
+    if (!options.metricsPath.empty() && !writeSequenceReport(options.metricsPath, frames, results)) {
+        std::fprintf(stderr, "Failed to write metrics: %s\n", options.metricsPath.c_str());
+        ++failedFrames;
+    }
+
+    std::printf("%zu frame(s) compared, %zu over threshold, %zu error(s)", frames.size(), differentFrames,
+                failedFrames);
+    if (unmatched > 0) {
+        std::printf(", %zu frame(s) without a counterpart skipped", unmatched);
+    }
+    std::printf("\n");
+
+    if (failedFrames > 0) {
+        return ExitError;
+    }
+    return differentFrames > 0 ? ExitDifferent : ExitIdentical;
+}
+
+int runReference(const CliOptions& options) {
+    if (!options.output.empty()) {
+        std::error_code ec;
+        fs::create_directories(options.output, ec);
+        if (ec) {
+            std::fprintf(stderr, "Cannot create output directory: %s\n", options.output.c_str());
+            return ExitError;
+        }
+    }
+
+    std::vector<PairJob> jobs;
+    for (const std::string& target : options.targets) {
+        PairJob job;
+        job.pathA = options.inputA;
+        job.pathB = target;
+        if (!options.output.empty()) {
+            job.outputPath = (fs::path(options.output) / fs::path(target).filename()).string();
+        }
+        jobs.push_back(std::move(job));
+    }
+    std::vector<PairResult> results(jobs.size());
+
+    // Pairs with 16-bit or float samples keep their precision through the
+    // pair path; all 8-bit images are decoded up front and share one fused
+    // pass over the reference.
+    bool preciseReference = isPreciseImageFile(options.inputA);
+    std::shared_ptr<ThreadPool> pool = sharedThreadPool();
+    std::vector<std::size_t> fused;
+    for (std::size_t i = 0; i < jobs.size(); ++i) {
+        if (!preciseReference && !isPreciseImageFile(jobs[i].pathB)) {
+            fused.push_back(i);
+        }
+        else {
+            pool->enqueue([&, i] { runPair(jobs[i], options, results[i]); });
+        }
+    }
+
+    if (!fused.empty()) {
+        sf::Image reference;
+        std::vector<sf::Image> images(fused.size());
+        std::vector<char> loaded(fused.size(), 0);
+        bool referenceLoaded = false;
+        pool->enqueue([&] { referenceLoaded = loadImageFile(options.inputA, reference); });
+        for (std::size_t f = 0; f < fused.size(); ++f) {
+            pool->enqueue([&, f] { loaded[f] = loadImageFile(jobs[fused[f]].pathB, images[f]); });
+        }
+        pool->waitIdle();
+
+        std::vector<std::size_t> lanes;
+        std::vector<const sf::Image*> targets;
+        for (std::size_t f = 0; f < fused.size(); ++f) {
+            PairResult& result = results[fused[f]];
+            if (!referenceLoaded || !loaded[f]) {
+                result.failed = true;
+                result.error = "Failed to load image: " + (referenceLoaded ? jobs[fused[f]].pathB : options.inputA);
+                continue;
+            }
+            lanes.push_back(fused[f]);
+            targets.push_back(&images[f]);
+        }
+
+        std::vector<ReferenceComparison> comparisons;
+        if (!targets.empty()) {
+            computeMultiDifference(reference, targets, comparisons, static_cast<std::uint8_t>(options.tolerance),
+                                   !options.metricsPath.empty());
+        }
+        for (std::size_t l = 0; l < lanes.size(); ++l) {
+            const PairJob& job = jobs[lanes[l]];
+            PairResult& result = results[lanes[l]];
+            ReferenceComparison& comparison = comparisons[l];
+            if (!comparison.valid) {
+                result.failed = true;
+                result.error = "Invalid image dimensions";
+                continue;
+            }
+            result.summary = comparison.summary;
+            result.metrics = comparison.metrics;
+            result.overThreshold = result.summary.sizeMismatch ||
+                                   result.summary.differingPercent() > options.thresholdPercent;
+            if (!job.outputPath.empty()) {
+                pool->enqueue([&, l] {
+                    if (!saveImageFile(comparisons[l].diffImage, jobs[lanes[l]].outputPath, {options.pngLevel})) {
+                        results[lanes[l]].failed = true;
+                        results[lanes[l]].error = "Failed to save difference image: " + jobs[lanes[l]].outputPath;
+                    }
+                });
+            }
+        }
+        // The saves read from this block's images.
+        pool->waitIdle();
+    }
+    pool->waitIdle();
+
+    std::size_t failedImages = 0;
+    std::size_t differentImages = 0;
+    for (std::size_t i = 0; i < jobs.size(); ++i) {
+        reportPair(jobs[i], results[i], options.quiet);
+        failedImages += results[i].failed ? 1 : 0;
+        differentImages += (!results[i].failed && results[i].overThreshold) ? 1 : 0;
+    }
+
+    if (!options.metricsPath.empty() && !writeMetricsReport(options.metricsPath, jobs, results)) {
+        std::fprintf(stderr, "Failed to write metrics: %s\n", options.metricsPath.c_str());
+        ++failedImages;
+    }
+
+    if (jobs.size() > 1 || !options.quiet) {
+        std::printf("%zu image(s) compared against %s, %zu over threshold, %zu error(s)\n", jobs.size(),
+                    options.inputA.c_str(), differentImages, failedImages);
+    }
+
+    if (failedImages > 0) {
+        return ExitError;
+    }
+    return differentImages > 0 ? ExitDifferent : ExitIdentical;
+}
+
+int runServer(const CliOptions& options) {
+    DiffServerOptions serverOptions;
+    serverOptions.socketPath = options.inputA;
+    serverOptions.cacheBytes = options.cacheMegabytes << 20;
+    serverOptions.pngLevel = options.pngLevel;
+    serverOptions.quiet = options.quiet;
+
+    std::string error;
+    if (!runDiffServer(serverOptions, error)) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return ExitError;
+    }
+    return ExitIdentical;
+}
+
+int runComparisons(const CliOptions& options) {
+    std::string error;
+    std::vector<PairJob> jobs;
+    if (options.mode == BatchMode::Pair) {
+        jobs.push_back({options.inputA, options.inputB, options.output});
+    }
+    else if (!collectDirectoryPairs(options, jobs, error)) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return ExitError;
+    }
+
+    if (jobs.empty()) {
+        std::fprintf(stderr, "No files with matching names found\n");
+        return ExitError;
+    }
+
+    std::vector<PairResult> results(jobs.size());
+    std::shared_ptr<ThreadPool> pool = sharedThreadPool();
+    for (std::size_t i = 0; i < jobs.size(); ++i) {
+        pool->enqueue([&, i] { runPair(jobs[i], options, results[i]); });
+    }
+    pool->waitIdle();
+
+    std::size_t failedPairs = 0;
+    std::size_t differentPairs = 0;
+    for (std::size_t i = 0; i < jobs.size(); ++i) {
+        reportPair(jobs[i], results[i], options.quiet);
+        failedPairs += results[i].failed ? 1 : 0;
+        differentPairs += (!results[i].failed && results[i].overThreshold) ? 1 : 0;
+    }
+
+    if (!options.metricsPath.empty() && !writeMetricsReport(options.metricsPath, jobs, results)) {
+        std::fprintf(stderr, "Failed to write metrics: %s\n", options.metricsPath.c_str());
+        ++failedPairs;
+    }
+
+    if (jobs.size() > 1 || !options.quiet) {
+        std::printf("%zu pair(s) compared, %zu over threshold, %zu error(s)\n",
+                    jobs.size(), differentPairs, failedPairs);
+    }
+
+    if (failedPairs > 0) {
+        return ExitError;
+    }
+    return differentPairs > 0 ? ExitDifferent : ExitIdentical;
+}
+
+}
+
+bool isHeadlessInvocation(int argc, char* argv[]) {
+    // Only the known mode flags: anything else, including arguments the OS
+    // adds (macOS -psn_...) and typos, starts the GUI.
+    constexpr std::string_view ModeFlags[] = {"--diff",  "--diff-dir",     "--reference", "--sequence", "--index",
+                                              "--serve", "--find-similar", "-h",          "--help"};
+    for (int i = 1; i < argc; ++i) {
+        if (std::find(std::begin(ModeFlags), std::end(ModeFlags), std::string_view(argv[i])) !=
+            std::end(ModeFlags)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int runHeadless(int argc, char* argv[]) {
+    CliOptions options;
+    std::string error;
+
+    if (!parseArguments(argc, argv, options, error)) {
+        std::fprintf(stderr, "%s\n\n", error.c_str());
+        printUsage(argv[0]);
+        return ExitError;
+    }
+    if (options.help) {
+        printUsage(argv[0]);
+        return ExitIdentical;
+    }
+
+    setSharedThreadCount(options.jobs);
+
+    if (!options.tracePath.empty()) {
+        setProfilingEnabled(true);
+    }
+
+    int status = ExitIdentical;
+    if (options.mode == BatchMode::BuildIndex) {
+        status = runBuildIndex(options);
+    }
+    else if (options.mode == BatchMode::FindSimilar) {
+        status = runFindSimilar(options);
+    }
+    else if (options.mode == BatchMode::Sequence) {
+        status = runSequence(options);
+    }
+    else if (options.mode == BatchMode::Serve) {
+        status = runServer(options);
+    }
+    else if (options.mode == BatchMode::Reference) {
+        status = runReference(options);
+    }
+    else {
+        status = runComparisons(options);
+    }
+
+    if (!options.tracePath.empty()) {
+        std::vector<ProfileEvent> events;
+        snapshotProfileEvents(events);
+        if (!saveChromeTrace(options.tracePath, events)) {
+            std::fprintf(stderr, "Failed to write trace: %s\n", options.tracePath.c_str());
+            status = ExitError;
+        }
+    }
+    return status;
+}
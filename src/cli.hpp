@@ -0,0 +1,7 @@
+#pragma once
+
+// Headless batch comparison. Never touches a window, OpenGL context or
+// texture, so it runs on machines without a display. Chosen when any argument
+// is a mode flag (--diff, --serve, ...) or -h/--help.
+bool isHeadlessInvocation(int argc, char* argv[]);
+int runHeadless(int argc, char* argv[]);
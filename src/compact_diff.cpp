@@ -0,0 +1,139 @@
+#include "compact_diff.hpp"
+
+#include "image_utils.hpp"
+#include "parallel.hpp"
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+constexpr std::size_t TileSamples = std::size_t{CompactDiff::TileSize} * CompactDiff::TileSize;
+
+inline std::uint8_t largestDelta(const std::uint8_t* pixel) {
+    return std::max({pixel[0], pixel[1], pixel[2]});
+}
+
+} // namespace
+
+void CompactDiff::build(const sf::Image& deltas, sf::Vector2u overlapStart) {
+    ScopedTimer timer("Compact difference");
+    size = deltas.getSize();
+    overlapMin = overlapStart;
+    tilesX = (size.x + TileSize - 1) / TileSize;
+    tilesY = (size.y + TileSize - 1) / TileSize;
+    storedTiles = 0;
+    tileOffsets.assign(static_cast<std::size_t>(tilesX) * tilesY, NoTile);
+    if (tileOffsets.empty()) {
+        samples.clear();
+        return;
+    }
+
+    const std::uint8_t* pixels = deltas.getPixelsPtr();
+    const std::size_t stride = rowStride(deltas);
+
+    // Which tiles hold a non-zero delta. Pixels outside the overlap are
+    // transparent black, so they never count.
+    std::vector<std::uint8_t> changed(tileOffsets.size(), 0);
+    parallelForRows(tilesY, size.x * TileSize, [&](unsigned firstTileRow, unsigned endTileRow) {
+        for (unsigned ty = firstTileRow; ty < endTileRow; ++ty) {
+            std::uint8_t* flags = changed.data() + static_cast<std::size_t>(ty) * tilesX;
+            unsigned endY = std::min(size.y, (ty + 1) * TileSize);
+            for (unsigned y = ty * TileSize; y < endY; ++y) {
+                const std::uint8_t* row = pixels + y * stride;
+                for (unsigned tx = 0; tx < tilesX; ++tx) {
+                    if (flags[tx]) {
+                        continue;
+                    }
+                    unsigned endX = std::min(size.x, (tx + 1) * TileSize);
+                    for (unsigned x = tx * TileSize; x < endX; ++x) {
+                        if (largestDelta(row + x * 4) != 0) {
+                            flags[tx] = 1;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+    });
+
+    for (std::size_t i = 0; i < changed.size(); ++i) {
+        if (changed[i]) {
+            tileOffsets[i] = static_cast<std::uint32_t>(storedTiles++);
+        }
+    }
+    samples.resize(storedTiles * TileSamples);
+
+    parallelForRows(tilesY, size.x * TileSize, [&](unsigned firstTileRow, unsigned endTileRow) {
+        for (unsigned ty = firstTileRow; ty < endTileRow; ++ty) {
+            unsigned endY = std::min(size.y, (ty + 1) * TileSize);
+            for (unsigned tx = 0; tx < tilesX; ++tx) {
+                std::uint32_t slot = tileOffsets[static_cast<std::size_t>(ty) * tilesX + tx];
+                if (slot == NoTile) {
+                    continue;
+                }
+                std::uint8_t* tile = samples.data() + slot * TileSamples;
+                unsigned endX = std::min(size.x, (tx + 1) * TileSize);
+                for (unsigned y = ty * TileSize; y < endY; ++y) {
+                    const std::uint8_t* row = pixels + y * stride;
+                    std::uint8_t* target = tile + static_cast<std::size_t>(y - ty * TileSize) * TileSize;
+                    for (unsigned x = tx * TileSize; x < endX; ++x) {
+                        target[x - tx * TileSize] = largestDelta(row + x * 4);
+                    }
+                }
+            }
+        }
+    });
+}
+
+void CompactDiff::clear() {
+    size = {0, 0};
+    overlapMin = {0, 0};
+    tilesX = tilesY = 0;
+    storedTiles = 0;
+    tileOffsets.clear();
+    samples.clear();
+}
+
+std::size_t CompactDiff::byteSize() const {
+    return tileOffsets.capacity() * sizeof(std::uint32_t) + samples.capacity();
+}
+
+void CompactDiff::expand(sf::Image& out) const {
+    ScopedTimer timer("Expand difference");
+    if (empty()) {
+        out = sf::Image();
+        return;
+    }
+    expandRows(0, size.y, out);
+}
+
+void CompactDiff::expandRows(unsigned firstRow, unsigned rows, sf::Image& out) const {
+    if (out.getSize() != sf::Vector2u(size.x, rows)) {
+        out.resize({size.x, rows});
+    }
+    std::uint8_t* pixels = mutablePixelsPtr(out);
+    const std::size_t stride = rowStride(out);
+
+    // Outside the overlap stays transparent, also in a reused band.
+    parallelForRows(rows, size.x, [&](unsigned firstBandRow, unsigned endBandRow) {
+        for (unsigned y = firstRow + firstBandRow; y < firstRow + endBandRow; ++y) {
+            std::uint8_t* row = pixels + (y - firstRow) * stride;
+            if (y < overlapMin.y) {
+                std::memset(row, 0, stride);
+                continue;
+            }
+            std::memset(row, 0, static_cast<std::size_t>(overlapMin.x) * 4);
+            const std::uint32_t* slots = tileOffsets.data() + static_cast<std::size_t>(y / TileSize) * tilesX;
+            std::size_t tileRow = static_cast<std::size_t>(y % TileSize) * TileSize;
+            for (unsigned x = overlapMin.x; x < size.x; ++x) {
+                std::uint32_t slot = slots[x / TileSize];
+                std::uint8_t delta = slot == NoTile ? 0 : samples[slot * TileSamples + tileRow + x % TileSize];
+                std::uint8_t* pixel = row + x * 4;
+                pixel[0] = pixel[1] = pixel[2] = delta;
+                pixel[3] = 255;
+            }
+        }
+    });
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A difference image reduced to the largest RGB delta of each pixel, one
+// byte instead of four, stored only for the tiles where something differs.
+// Rebuilding keeps the buffers, so diffing again reuses their memory.
+class CompactDiff {
+public:
+    static constexpr unsigned TileSize = 64;
+
+    // `deltas` is an RGBA difference image whose pixels left of or above
+    // `overlapStart` lie outside the overlap (transparent).
+    void build(const sf::Image& deltas, sf::Vector2u overlapStart);
+    void clear();
+
+    bool empty() const { return size.x == 0; }
+    sf::Vector2u getSize() const { return size; }
+    sf::Vector2u getOverlapMin() const { return overlapMin; }
+    std::size_t getStoredTiles() const { return storedTiles; }
+    std::size_t getTileCount() const { return tileOffsets.size(); }
+
+    // Bytes held, including spare capacity kept for the next build.
+    std::size_t byteSize() const;
+
+    // Back to an RGBA difference image of the same size, with the largest
+    // delta in all three channels, so modes that look at the largest
+    // channel see exactly what the full image would give.
+    void expand(sf::Image& out) const;
+
+    // The same for `rows` rows from `firstRow` on, into a band as wide as
+    // the image. A band of the right size is reused.
+    void expandRows(unsigned firstRow, unsigned rows, sf::Image& out) const;
+
+private:
+    static constexpr std::uint32_t NoTile = 0xFFFFFFFFu;
+
+    sf::Vector2u size;
+    sf::Vector2u overlapMin;
+    unsigned tilesX = 0;
+    unsigned tilesY = 0;
+    std::size_t storedTiles = 0;
+    // Per tile, the slot of its samples, or NoTile when all its deltas are
+    // zero. Every slot holds TileSize * TileSize samples.
+    std::vector<std::uint32_t> tileOffsets;
+    std::vector<std::uint8_t> samples;
+};
@@ -0,0 +1,76 @@
+#include "comparison.hpp"
+
+#include "image_diff.hpp"
+#include "image_utils.hpp"
+#include "precise_diff.hpp"
+
+#include <algorithm>
+
+bool compareDecodedImages(const DecodedImage& image1, const DecodedImage& image2, std::uint8_t tolerance,
+                          sf::Vector2i shift, sf::Image& diffImage, DiffMetrics& metrics, ChangeRegionIndex& regions,
+                          bool& identicalFiles) {
+    DiffSummary summary;
+    identicalFiles = shift == sf::Vector2i(0, 0) && haveSamePixels(image1, image2);
+    if (identicalFiles) {
+        identicalDifference(image1.image.getSize(), diffImage, summary, tolerance, &metrics);
+        if (image1.precise) {
+            metrics.sampleType = sampleTypeOf(*image1.precise);
+        }
+        regions.clear();
+        return true;
+    }
+
+    if (!computeDecodedDifference(image1, image2, shift, diffImage, summary, tolerance, &metrics)) {
+        return false;
+    }
+    findChangeRegions(diffImage, tolerance, regions);
+    return true;
+}
+
+bool mapSelectionRects(sf::Vector2u size1, sf::Vector2u size2, sf::Vector2f minCoord, sf::Vector2f maxCoord,
+                       float relativeZoom, sf::Vector2f offset, PixelRect& rect1, PixelRect& rect2,
+                       std::string& error) {
+    auto clampTo = [](float value, unsigned limit) {
+        return static_cast<unsigned>(std::clamp(value, 0.0f, static_cast<float>(limit)));
+    };
+
+    unsigned x1 = clampTo(minCoord.x, size1.x);
+    unsigned y1 = clampTo(minCoord.y, size1.y);
+    unsigned width1 = clampTo(maxCoord.x, size1.x) - x1;
+    unsigned height1 = clampTo(maxCoord.y, size1.y) - y1;
+    if (width1 == 0 || height1 == 0) {
+        error = "Selection is empty!";
+        return false;
+    }
+
+    unsigned x2 = clampTo((minCoord.x - offset.x) / relativeZoom, size2.x);
+    unsigned y2 = clampTo((minCoord.y - offset.y) / relativeZoom, size2.y);
+    unsigned width2 = clampTo((maxCoord.x - offset.x) / relativeZoom, size2.x) - x2;
+    unsigned height2 = clampTo((maxCoord.y - offset.y) / relativeZoom, size2.y) - y2;
+    if (width2 == 0 || height2 == 0) {
+        width2 = std::min(width1, size2.x - x2);
+        height2 = std::min(height1, size2.y - y2);
+        if (width2 == 0 || height2 == 0) {
+            error = "Cannot map selection to Image 2!";
+            return false;
+        }
+    }
+
+    rect1 = {{x1, y1}, {width1, height1}};
+    rect2 = {{x2, y2}, {width2, height2}};
+    return true;
+}
+
+void composeSelectionPair(const sf::Image& image1, PixelRect rect1, const sf::Image& image2, PixelRect rect2,
+                          sf::Image& output) {
+    output.resize({rect1.size.x + rect2.size.x, std::max(rect1.size.y, rect2.size.y)}, sf::Color::Black);
+
+    std::uint8_t* target = mutablePixelsPtr(output);
+    copyPixelRows(image1.getPixelsPtr() + rect1.position.y * rowStride(image1) +
+                      static_cast<std::size_t>(rect1.position.x) * 4,
+                  rowStride(image1), target, rowStride(output), rect1.size.x, rect1.size.y);
+    copyPixelRows(image2.getPixelsPtr() + rect2.position.y * rowStride(image2) +
+                      static_cast<std::size_t>(rect2.position.x) * 4,
+                  rowStride(image2), target + static_cast<std::size_t>(rect1.size.x) * 4, rowStride(output),
+                  rect2.size.x, rect2.size.y);
+}
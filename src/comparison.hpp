@@ -0,0 +1,29 @@
+#pragma once
+
+#include "change_regions.hpp"
+#include "diff_metrics.hpp"
+#include "image_cache.hpp"
+
+#include <SFML/Graphics.hpp>
+#include <cstdint>
+#include <string>
+
+using PixelRect = sf::Rect<unsigned>;
+
+// Full difference image, metrics and changed regions of two decoded images,
+// with image 2's origin at `shift` in image 1's coordinates. Byte-identical
+// files (same content hash and size) skip the pixel pass when unshifted.
+bool compareDecodedImages(const DecodedImage& image1, const DecodedImage& image2, std::uint8_t tolerance,
+                          sf::Vector2i shift, sf::Image& diffImage, DiffMetrics& metrics, ChangeRegionIndex& regions,
+                          bool& identicalFiles);
+
+// Maps a selection given in Image 1 coordinates to a crop of each image.
+// Image 2 coordinates are (p - offset) / relativeZoom; when that leaves no
+// area, Image 2 falls back to a crop of the same size at the mapped origin.
+bool mapSelectionRects(sf::Vector2u size1, sf::Vector2u size2, sf::Vector2f minCoord, sf::Vector2f maxCoord,
+                       float relativeZoom, sf::Vector2f offset, PixelRect& rect1, PixelRect& rect2,
+                       std::string& error);
+
+// Both crops side by side on black: [image1 crop | image2 crop].
+void composeSelectionPair(const sf::Image& image1, PixelRect rect1, const sf::Image& image2, PixelRect rect2,
+                          sf::Image& output);
@@ -0,0 +1,355 @@
+#include "diff_kernels.hpp"
+
+#include <algorithm>
+#include <bit>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CI_DIFF_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define CI_DIFF_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define CI_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define CI_TARGET_AVX2
+#endif
+
+namespace {
+
+void diffRowScalar(const std::uint8_t* a, const std::uint8_t* b, std::uint8_t* out,
+                   std::size_t pixels, std::uint8_t tolerance, DiffRowStats& stats) {
+    std::uint8_t maxDelta = stats.maxDelta;
+    std::uint64_t differing = 0;
+
+    for (std::size_t i = 0; i < pixels; ++i) {
+        const std::uint8_t* pa = a + i * 4;
+        const std::uint8_t* pb = b + i * 4;
+        std::uint8_t* po = out + i * 4;
+
+        std::uint8_t r = static_cast<std::uint8_t>(pa[0] > pb[0] ? pa[0] - pb[0] : pb[0] - pa[0]);
+        std::uint8_t g = static_cast<std::uint8_t>(pa[1] > pb[1] ? pa[1] - pb[1] : pb[1] - pa[1]);
+        std::uint8_t bl = static_cast<std::uint8_t>(pa[2] > pb[2] ? pa[2] - pb[2] : pb[2] - pa[2]);
+
+        po[0] = r;
+        po[1] = g;
+        po[2] = bl;
+        po[3] = 255;
+
+        std::uint8_t channelMax = std::max({r, g, bl});
+        maxDelta = std::max(maxDelta, channelMax);
+        differing += channelMax > tolerance ? 1 : 0;
+    }
+
+    stats.maxDelta = maxDelta;
+    stats.differingPixels += differing;
+}
+
+void histogramRow(const std::uint8_t* delta, std::size_t pixels, DeltaStats& stats) {
+    for (std::size_t i = 0; i < pixels; ++i) {
+        const std::uint8_t* p = delta + i * 4;
+        ++stats.histogram[std::max({p[0], p[1], p[2]})];
+    }
+}
+
+void squaresRowScalar(const std::uint8_t* delta, std::size_t pixels, DeltaStats& stats) {
+    for (std::size_t i = 0; i < pixels; ++i) {
+        const std::uint8_t* p = delta + i * 4;
+        for (int c = 0; c < 3; ++c) {
+            stats.sumSquares[c] += static_cast<std::uint64_t>(p[c]) * p[c];
+            stats.channelMax[c] = std::max(stats.channelMax[c], p[c]);
+        }
+    }
+}
+
+void deltaRowScalar(const std::uint8_t* delta, std::size_t pixels, DeltaStats& stats) {
+    squaresRowScalar(delta, pixels, stats);
+    histogramRow(delta, pixels, stats);
+}
+
+#if CI_DIFF_X86
+void diffRowSse2(const std::uint8_t* a, const std::uint8_t* b, std::uint8_t* out,
+                 std::size_t pixels, std::uint8_t tolerance, DiffRowStats& stats) {
+    const __m128i rgbMask = _mm_set1_epi32(0x00FFFFFF);
+    const __m128i alphaMask = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+    const __m128i tol = _mm_set1_epi8(static_cast<char>(tolerance));
+    const __m128i zero = _mm_setzero_si128();
+
+    __m128i maxAcc = zero;
+    std::uint64_t differing = 0;
+    std::size_t i = 0;
+
+    for (; i + 4 <= pixels; i += 4) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i * 4));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i * 4));
+        __m128i delta = _mm_and_si128(_mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va)), rgbMask);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 4), _mm_or_si128(delta, alphaMask));
+        maxAcc = _mm_max_epu8(maxAcc, delta);
+
+        __m128i same = _mm_cmpeq_epi32(_mm_subs_epu8(delta, tol), zero);
+        differing += 4 - static_cast<unsigned>(std::popcount(static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(same)))));
+    }
+
+    alignas(16) std::uint8_t lanes[16];
+    _mm_store_si128(reinterpret_cast<__m128i*>(lanes), maxAcc);
+    stats.maxDelta = std::max(stats.maxDelta, *std::max_element(lanes, lanes + 16));
+    stats.differingPixels += differing;
+
+    diffRowScalar(a + i * 4, b + i * 4, out + i * 4, pixels - i, tolerance, stats);
+}
+
+// Squares of 8-bit deltas fit in 16 bits, so _mm_mullo_epi16 is exact. The
+// 32-bit lane accumulators are flushed before they can overflow.
+constexpr std::size_t SquareFlushPixels = 4 * 16384;
+
+void deltaRowSse2(const std::uint8_t* delta, std::size_t pixels, DeltaStats& stats) {
+    const __m128i redBlueMask = _mm_set1_epi32(0x00FF00FF);
+    const __m128i lowHalfMask = _mm_set1_epi32(0x0000FFFF);
+    const __m128i byteMask = _mm_set1_epi32(0x000000FF);
+
+    __m128i maxAcc = _mm_setzero_si128();
+    std::size_t i = 0;
+
+    while (i + 4 <= pixels) {
+        std::size_t blockEnd = std::min(pixels & ~std::size_t{3}, i + SquareFlushPixels);
+        __m128i accR = _mm_setzero_si128();
+        __m128i accG = _mm_setzero_si128();
+        __m128i accB = _mm_setzero_si128();
+
+        for (; i < blockEnd; i += 4) {
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(delta + i * 4));
+            maxAcc = _mm_max_epu8(maxAcc, d);
+
+            __m128i redBlue = _mm_and_si128(d, redBlueMask);
+            __m128i redBlueSq = _mm_mullo_epi16(redBlue, redBlue);
+            accR = _mm_add_epi32(accR, _mm_and_si128(redBlueSq, lowHalfMask));
+            accB = _mm_add_epi32(accB, _mm_srli_epi32(redBlueSq, 16));
+
+            __m128i green = _mm_and_si128(_mm_srli_epi32(d, 8), byteMask);
+            accG = _mm_add_epi32(accG, _mm_mullo_epi16(green, green));
+        }
+
+        alignas(16) std::uint32_t lanes[3][4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes[0]), accR);
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes[1]), accG);
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes[2]), accB);
+        for (int c = 0; c < 3; ++c) {
+            stats.sumSquares[c] += std::uint64_t{lanes[c][0]} + lanes[c][1] + lanes[c][2] + lanes[c][3];
+        }
+    }
+
+    alignas(16) std::uint8_t maxLanes[16];
+    _mm_store_si128(reinterpret_cast<__m128i*>(maxLanes), maxAcc);
+    for (int lane = 0; lane < 16; ++lane) {
+        if (lane % 4 < 3) {
+            stats.channelMax[lane % 4] = std::max(stats.channelMax[lane % 4], maxLanes[lane]);
+        }
+    }
+
+    squaresRowScalar(delta + i * 4, pixels - i, stats);
+    histogramRow(delta, pixels, stats);
+}
+
+CI_TARGET_AVX2
+void diffRowAvx2(const std::uint8_t* a, const std::uint8_t* b, std::uint8_t* out,
+                 std::size_t pixels, std::uint8_t tolerance, DiffRowStats& stats) {
+    const __m256i rgbMask = _mm256_set1_epi32(0x00FFFFFF);
+    const __m256i alphaMask = _mm256_set1_epi32(static_cast<int>(0xFF000000u));
+    const __m256i tol = _mm256_set1_epi8(static_cast<char>(tolerance));
+    const __m256i zero = _mm256_setzero_si256();
+
+    __m256i maxAcc = zero;
+    std::uint64_t differing = 0;
+    std::size_t i = 0;
+
+    for (; i + 8 <= pixels; i += 8) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i * 4));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i * 4));
+        __m256i delta = _mm256_and_si256(_mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va)), rgbMask);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i * 4), _mm256_or_si256(delta, alphaMask));
+        maxAcc = _mm256_max_epu8(maxAcc, delta);
+
+        __m256i same = _mm256_cmpeq_epi32(_mm256_subs_epu8(delta, tol), zero);
+        differing += 8 - static_cast<unsigned>(std::popcount(static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(same)))));
+    }
+
+    alignas(32) std::uint8_t lanes[32];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), maxAcc);
+    stats.maxDelta = std::max(stats.maxDelta, *std::max_element(lanes, lanes + 32));
+    stats.differingPixels += differing;
+
+    diffRowSse2(a + i * 4, b + i * 4, out + i * 4, pixels - i, tolerance, stats);
+}
+
+CI_TARGET_AVX2
+void deltaRowAvx2(const std::uint8_t* delta, std::size_t pixels, DeltaStats& stats) {
+    const __m256i redBlueMask = _mm256_set1_epi32(0x00FF00FF);
+    const __m256i lowHalfMask = _mm256_set1_epi32(0x0000FFFF);
+    const __m256i byteMask = _mm256_set1_epi32(0x000000FF);
+
+    __m256i maxAcc = _mm256_setzero_si256();
+    std::size_t i = 0;
+
+    while (i + 8 <= pixels) {
+        std::size_t blockEnd = std::min(pixels & ~std::size_t{7}, i + SquareFlushPixels);
+        __m256i accR = _mm256_setzero_si256();
+        __m256i accG = _mm256_setzero_si256();
+        __m256i accB = _mm256_setzero_si256();
+
+        for (; i < blockEnd; i += 8) {
+            __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(delta + i * 4));
+            maxAcc = _mm256_max_epu8(maxAcc, d);
+
+            __m256i redBlue = _mm256_and_si256(d, redBlueMask);
+            __m256i redBlueSq = _mm256_mullo_epi16(redBlue, redBlue);
+            accR = _mm256_add_epi32(accR, _mm256_and_si256(redBlueSq, lowHalfMask));
+            accB = _mm256_add_epi32(accB, _mm256_srli_epi32(redBlueSq, 16));
+
+            __m256i green = _mm256_and_si256(_mm256_srli_epi32(d, 8), byteMask);
+            accG = _mm256_add_epi32(accG, _mm256_mullo_epi16(green, green));
+        }
+
+        alignas(32) std::uint32_t lanes[3][8];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes[0]), accR);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes[1]), accG);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes[2]), accB);
+        for (int c = 0; c < 3; ++c) {
+            for (int lane = 0; lane < 8; ++lane) {
+                stats.sumSquares[c] += lanes[c][lane];
+            }
+        }
+    }
+
+    alignas(32) std::uint8_t maxLanes[32];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(maxLanes), maxAcc);
+    for (int lane = 0; lane < 32; ++lane) {
+        if (lane % 4 < 3) {
+            stats.channelMax[lane % 4] = std::max(stats.channelMax[lane % 4], maxLanes[lane]);
+        }
+    }
+
+    squaresRowScalar(delta + i * 4, pixels - i, stats);
+    histogramRow(delta, pixels, stats);
+}
+
+#endif
+
+#if CI_DIFF_NEON
+void diffRowNeon(const std::uint8_t* a, const std::uint8_t* b, std::uint8_t* out,
+                 std::size_t pixels, std::uint8_t tolerance, DiffRowStats& stats) {
+    const uint8x16_t rgbMask = vreinterpretq_u8_u32(vdupq_n_u32(0x00FFFFFFu));
+    const uint8x16_t alphaMask = vreinterpretq_u8_u32(vdupq_n_u32(0xFF000000u));
+    const uint8x16_t tol = vdupq_n_u8(tolerance);
+
+    uint8x16_t maxAcc = vdupq_n_u8(0);
+    std::uint64_t differing = 0;
+    std::size_t i = 0;
+
+    for (; i + 4 <= pixels; i += 4) {
+        uint8x16_t va = vld1q_u8(a + i * 4);
+        uint8x16_t vb = vld1q_u8(b + i * 4);
+        uint8x16_t delta = vandq_u8(vabdq_u8(va, vb), rgbMask);
+
+        vst1q_u8(out + i * 4, vorrq_u8(delta, alphaMask));
+        maxAcc = vmaxq_u8(maxAcc, delta);
+
+        uint32x4_t over = vreinterpretq_u32_u8(vqsubq_u8(delta, tol));
+        differing += vaddvq_u32(vshrq_n_u32(vtstq_u32(over, over), 31));
+    }
+
+    stats.maxDelta = std::max(stats.maxDelta, vmaxvq_u8(maxAcc));
+    stats.differingPixels += differing;
+
+    diffRowScalar(a + i * 4, b + i * 4, out + i * 4, pixels - i, tolerance, stats);
+}
+
+void deltaRowNeon(const std::uint8_t* delta, std::size_t pixels, DeltaStats& stats) {
+    uint8x16_t maxAcc[3] = {vdupq_n_u8(0), vdupq_n_u8(0), vdupq_n_u8(0)};
+    std::size_t i = 0;
+
+    while (i + 16 <= pixels) {
+        std::size_t blockEnd = std::min(pixels & ~std::size_t{15}, i + 16 * 8192);
+        uint32x4_t acc[3] = {vdupq_n_u32(0), vdupq_n_u32(0), vdupq_n_u32(0)};
+
+        for (; i < blockEnd; i += 16) {
+            uint8x16x4_t d = vld4q_u8(delta + i * 4);
+            for (int c = 0; c < 3; ++c) {
+                maxAcc[c] = vmaxq_u8(maxAcc[c], d.val[c]);
+                acc[c] = vpadalq_u16(acc[c], vmull_u8(vget_low_u8(d.val[c]), vget_low_u8(d.val[c])));
+                acc[c] = vpadalq_u16(acc[c], vmull_high_u8(d.val[c], d.val[c]));
+            }
+        }
+
+        for (int c = 0; c < 3; ++c) {
+            stats.sumSquares[c] += vaddvq_u32(acc[c]);
+        }
+    }
+
+    for (int c = 0; c < 3; ++c) {
+        stats.channelMax[c] = std::max(stats.channelMax[c], vmaxvq_u8(maxAcc[c]));
+    }
+
+    squaresRowScalar(delta + i * 4, pixels - i, stats);
+    histogramRow(delta, pixels, stats);
+}
+#endif
+
+}
+
+void DeltaStats::merge(const DeltaStats& other) {
+    for (int c = 0; c < 3; ++c) {
+        sumSquares[c] += other.sumSquares[c];
+        channelMax[c] = std::max(channelMax[c], other.channelMax[c]);
+    }
+    for (std::size_t i = 0; i < histogram.size(); ++i) {
+        histogram[i] += other.histogram[i];
+    }
+}
+
+bool cpuHasAvx2() {
+#if CI_DIFF_X86 && defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (!osxsave || (_xgetbv(0) & 0x6) != 0x6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#elif CI_DIFF_X86
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+std::vector<DiffKernel> supportedDiffKernels() {
+    std::vector<DiffKernel> kernels;
+    kernels.push_back({"scalar", diffRowScalar, deltaRowScalar});
+#if CI_DIFF_X86
+    kernels.push_back({"sse2", diffRowSse2, deltaRowSse2});
+    if (cpuHasAvx2()) {
+        kernels.push_back({"avx2", diffRowAvx2, deltaRowAvx2});
+    }
+#endif
+#if CI_DIFF_NEON
+    kernels.push_back({"neon", diffRowNeon, deltaRowNeon});
+#endif
+    return kernels;
+}
+
+const DiffKernel& activeDiffKernel() {
+    static const DiffKernel kernel = supportedDiffKernels().back();
+    return kernel;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct DiffRowStats {
+    std::uint64_t differingPixels = 0;
+    std::uint8_t maxDelta = 0;
+};
+
+// Per-channel error terms of a row of delta pixels (the output of a DiffRowFn).
+struct DeltaStats {
+    std::array<std::uint64_t, 3> sumSquares{};
+    std::array<std::uint8_t, 3> channelMax{};
+    // Indexed by the largest RGB delta of each pixel.
+    std::array<std::uint64_t, 256> histogram{};
+
+    void merge(const DeltaStats& other);
+};
+
+// Processes one row of tightly packed RGBA pixels: out = |a - b| per RGB
+// channel with alpha forced to 255. All kernels produce identical bytes.
+using DiffRowFn = void (*)(const std::uint8_t* a, const std::uint8_t* b, std::uint8_t* out,
+                           std::size_t pixels, std::uint8_t tolerance, DiffRowStats& stats);
+
+// Accumulates DeltaStats over one row of delta pixels. Meant to run right
+// after the DiffRowFn for the same row, while it is still in cache.
+using DeltaRowFn = void (*)(const std::uint8_t* delta, std::size_t pixels, DeltaStats& stats);
+
+struct DiffKernel {
+    const char* name;
+    DiffRowFn run;
+    DeltaRowFn accumulate;
+};
+
+// Best kernel for the running CPU, chosen once on first use.
+const DiffKernel& activeDiffKernel();
+
+// Whether the CPU and OS support AVX2; false on non-x86 targets.
+bool cpuHasAvx2();
+
+// Every kernel the running CPU can execute, scalar first.
+std::vector<DiffKernel> supportedDiffKernels();
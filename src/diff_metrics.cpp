@@ -0,0 +1,226 @@
+#include "diff_metrics.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <utility>
+
+namespace {
+
+constexpr double SsimC1 = (0.01 * 255.0) * (0.01 * 255.0);
+constexpr double SsimC2 = (0.03 * 255.0) * (0.03 * 255.0);
+
+inline unsigned luma(const std::uint8_t* p) {
+    return (77u * p[0] + 150u * p[1] + 29u * p[2] + 128u) >> 8;
+}
+
+double psnrFromMse(double mse) {
+    if (mse <= 0.0) {
+        return std::numeric_limits<double>::infinity();
+    }
+    return 10.0 * std::log10(255.0 * 255.0 / mse);
+}
+
+// JSON has no infinity, so identical channels report a null PSNR.
+std::string formatNumber(double value) {
+    if (!std::isfinite(value)) {
+        return "null";
+    }
+    char buffer[64];
+    std::snprintf(buffer, sizeof(buffer), "%.6g", value);
+    return buffer;
+}
+
+}
+
+SsimAccumulator::SsimAccumulator(unsigned width)
+    : width(width), strip((width + SsimBlockSize - 1) / SsimBlockSize) {}
+
+void SsimAccumulator::addRow(const std::uint8_t* row1, const std::uint8_t* row2) {
+    unsigned fullWindows = width / SsimBlockSize;
+
+    for (unsigned w = 0; w < fullWindows; ++w) {
+        std::uint32_t sum1 = 0, sum2 = 0, sumSq1 = 0, sumSq2 = 0, sumProduct = 0;
+        for (unsigned k = 0; k < SsimBlockSize; ++k) {
+            std::size_t offset = (static_cast<std::size_t>(w) * SsimBlockSize + k) * 4;
+            std::uint32_t a = luma(row1 + offset);
+            std::uint32_t b = luma(row2 + offset);
+            sum1 += a;
+            sum2 += b;
+            sumSq1 += a * a;
+            sumSq2 += b * b;
+            sumProduct += a * b;
+        }
+
+        Window& window = strip[w];
+        window.sum1 += sum1;
+        window.sum2 += sum2;
+        window.sumSq1 += sumSq1;
+        window.sumSq2 += sumSq2;
+        window.sumProduct += sumProduct;
+    }
+
+    if (fullWindows < strip.size()) {
+        Window& window = strip.back();
+        for (unsigned x = fullWindows * SsimBlockSize; x < width; ++x) {
+            std::uint32_t a = luma(row1 + static_cast<std::size_t>(x) * 4);
+            std::uint32_t b = luma(row2 + static_cast<std::size_t>(x) * 4);
+            window.sum1 += a;
+            window.sum2 += b;
+            window.sumSq1 += a * a;
+            window.sumSq2 += b * b;
+            window.sumProduct += a * b;
+        }
+    }
+
+    ++rows;
+}
+
+void SsimAccumulator::finishStrip() {
+    if (rows == 0) {
+        return;
+    }
+
+    for (std::size_t w = 0; w < strip.size(); ++w) {
+        unsigned columns = std::min(SsimBlockSize, width - static_cast<unsigned>(w) * SsimBlockSize);
+        double n = static_cast<double>(columns) * rows;
+
+        const Window& window = strip[w];
+        ssimSum += windowSsim(static_cast<double>(window.sum1), static_cast<double>(window.sum2),
+                              static_cast<double>(window.sumSq1), static_cast<double>(window.sumSq2),
+                              static_cast<double>(window.sumProduct), n);
+        ++windows;
+    }
+
+    std::fill(strip.begin(), strip.end(), Window{});
+    rows = 0;
+}
+
+double windowSsim(double sum1, double sum2, double sumSq1, double sumSq2, double sumProduct, double n) {
+    double mean1 = sum1 / n;
+    double mean2 = sum2 / n;
+    double var1 = sumSq1 / n - mean1 * mean1;
+    double var2 = sumSq2 / n - mean2 * mean2;
+    double covariance = sumProduct / n - mean1 * mean2;
+
+    return ((2.0 * mean1 * mean2 + SsimC1) * (2.0 * covariance + SsimC2)) /
+           ((mean1 * mean1 + mean2 * mean2 + SsimC1) * (var1 + var2 + SsimC2));
+}
+
+void finalizeDiffMetrics(DiffMetrics& metrics, const DeltaStats& delta, std::uint64_t pixelsOverTolerance,
+                         double ssimSum, std::uint64_t ssimWindows) {
+    std::array<double, 3> sumSquares{};
+    std::array<double, 3> maxDeltaFraction{};
+    for (int c = 0; c < 3; ++c) {
+        sumSquares[c] = static_cast<double>(delta.sumSquares[c]);
+        maxDeltaFraction[c] = delta.channelMax[c] / 255.0;
+    }
+    finalizeDiffMetrics(metrics, sumSquares, maxDeltaFraction, delta.histogram, pixelsOverTolerance, ssimSum,
+                        ssimWindows);
+}
+
+void finalizeDiffMetrics(DiffMetrics& metrics, const std::array<double, 3>& sumSquares,
+                         const std::array<double, 3>& maxDeltaFraction,
+                         const std::array<std::uint64_t, 256>& histogram, std::uint64_t pixelsOverTolerance,
+                         double ssimSum, std::uint64_t ssimWindows) {
+    double pixels = static_cast<double>(metrics.width) * metrics.height;
+    double totalSquares = 0.0;
+
+    for (int c = 0; c < 3; ++c) {
+        metrics.mse[c] = pixels > 0.0 ? sumSquares[c] / pixels : 0.0;
+        metrics.psnr[c] = psnrFromMse(metrics.mse[c]);
+        metrics.maxDeltaFraction[c] = maxDeltaFraction[c];
+        metrics.maxDelta[c] = static_cast<std::uint8_t>(std::min(255.0, std::ceil(maxDeltaFraction[c] * 255.0 - 1e-9)));
+        totalSquares += sumSquares[c];
+    }
+
+    metrics.mseAll = pixels > 0.0 ? totalSquares / (3.0 * pixels) : 0.0;
+    metrics.psnrAll = psnrFromMse(metrics.mseAll);
+    metrics.pixelsOverTolerance = pixelsOverTolerance;
+    metrics.histogram = histogram;
+    metrics.ssim = ssimWindows > 0 ? ssimSum / static_cast<double>(ssimWindows) : 1.0;
+}
+
+std::string jsonQuote(const std::string& text) {
+    std::string out = "\"";
+    for (char ch : text) {
+        switch (ch) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(ch) < 0x20) {
+                    char buffer[8];
+                    std::snprintf(buffer, sizeof(buffer), "\\u%04x", static_cast<unsigned>(ch));
+                    out += buffer;
+                }
+                else {
+                    out += ch;
+                }
+        }
+    }
+    return out + "\"";
+}
+
+std::string diffMetricsToJson(const DiffMetrics& metrics, int indent) {
+    auto channels = [](const auto& values) {
+        std::string list = "[";
+        for (int c = 0; c < 3; ++c) {
+            if (c > 0) list += ", ";
+            list += formatNumber(static_cast<double>(values[c]));
+        }
+        return list + "]";
+    };
+
+    std::string histogram = "[";
+    for (std::size_t i = 0; i < metrics.histogram.size(); ++i) {
+        if (i > 0) histogram += ",";
+        histogram += std::to_string(metrics.histogram[i]);
+    }
+    histogram += "]";
+
+    std::vector<std::pair<const char*, std::string>> fields = {
+        {"width", std::to_string(metrics.width)},
+        {"height", std::to_string(metrics.height)},
+        {"tolerance", std::to_string(metrics.tolerance)},
+        {"sample_type", jsonQuote(sampleTypeName(metrics.sampleType))},
+        {"mse", channels(metrics.mse)},
+        {"psnr", channels(metrics.psnr)},
+        {"max_delta", channels(metrics.maxDelta)},
+        {"max_delta_fraction", channels(metrics.maxDeltaFraction)},
+        {"mse_all", formatNumber(metrics.mseAll)},
+        {"psnr_all", formatNumber(metrics.psnrAll)},
+        {"ssim", formatNumber(metrics.ssim)},
+        {"pixels_over_tolerance", std::to_string(metrics.pixelsOverTolerance)},
+        {"percent_over_tolerance", formatNumber(metrics.overTolerancePercent())},
+        {"histogram", histogram},
+    };
+
+    if (indent < 0) {
+        std::string out = "{";
+        for (std::size_t i = 0; i < fields.size(); ++i) {
+            out += std::string(i > 0 ? ", \"" : "\"") + fields[i].first + "\": " + fields[i].second;
+        }
+        return out + "}";
+    }
+
+    std::string pad(static_cast<std::size_t>(indent), ' ');
+    std::string out = "{\n";
+    for (std::size_t i = 0; i < fields.size(); ++i) {
+        out += pad + "  \"" + fields[i].first + "\": " + fields[i].second;
+        out += i + 1 < fields.size() ? ",\n" : "\n";
+    }
+    return out + pad + "}";
+}
+
+bool saveDiffMetricsJson(const std::string& path, const DiffMetrics& metrics) {
+    std::ofstream file(path);
+    if (!file) {
+        return false;
+    }
+    file << diffMetricsToJson(metrics) << '\n';
+    return static_cast<bool>(file);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "diff_kernels.hpp"
+#include "pixel_buffer.hpp"
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct DiffMetrics {
+    unsigned width = 0;
+    unsigned height = 0;
+    std::uint8_t tolerance = 0;
+    // Precision the images were compared at. Deltas below are in 8-bit units
+    // whatever it is, so a 16-bit delta of 257 counts as 1.
+    SampleType sampleType = SampleType::UInt8;
+
+    // Per RGB channel; PSNR is +infinity when the channel is identical.
+    std::array<double, 3> mse{};
+    std::array<double, 3> psnr{};
+    // Rounded up, so any change shows as at least 1.
+    std::array<std::uint8_t, 3> maxDelta{};
+    // Largest delta as a fraction of full scale, exact at any precision.
+    std::array<double, 3> maxDeltaFraction{};
+    double mseAll = 0.0;
+    double psnrAll = 0.0;
+
+    std::uint64_t pixelsOverTolerance = 0;
+    // Pixel counts indexed by the largest RGB delta of each pixel.
+    std::array<std::uint64_t, 256> histogram{};
+
+    // Mean SSIM of the luma over SsimBlockSize x SsimBlockSize windows.
+    double ssim = 1.0;
+
+    double overTolerancePercent() const {
+        std::uint64_t total = static_cast<std::uint64_t>(width) * height;
+        return total == 0 ? 0.0 : 100.0 * static_cast<double>(pixelsOverTolerance) / static_cast<double>(total);
+    }
+};
+
+constexpr unsigned SsimBlockSize = 8;
+
+// Sums the SSIM terms of one horizontal strip of SsimBlockSize-row windows at
+// a time. Feed it the rows of a strip in order, then call finishStrip().
+class SsimAccumulator {
+public:
+    explicit SsimAccumulator(unsigned width);
+
+    void addRow(const std::uint8_t* row1, const std::uint8_t* row2);
+    void finishStrip();
+
+    double ssimSum = 0.0;
+    std::uint64_t windows = 0;
+
+private:
+    struct Window {
+        std::uint64_t sum1 = 0;
+        std::uint64_t sum2 = 0;
+        std::uint64_t sumSq1 = 0;
+        std::uint64_t sumSq2 = 0;
+        std::uint64_t sumProduct = 0;
+    };
+
+    unsigned width;
+    unsigned rows = 0;
+    std::vector<Window> strip;
+};
+
+// SSIM of one window from its sums over `n` pixels of luma in 0-255 units.
+double windowSsim(double sum1, double sum2, double sumSq1, double sumSq2, double sumProduct, double n);
+
+void finalizeDiffMetrics(DiffMetrics& metrics, const DeltaStats& delta, std::uint64_t pixelsOverTolerance,
+                         double ssimSum, std::uint64_t ssimWindows);
+
+// The same from totals of any precision: squared deltas in 8-bit units and
+// the largest delta per channel as a fraction of full scale.
+void finalizeDiffMetrics(DiffMetrics& metrics, const std::array<double, 3>& sumSquares,
+                         const std::array<double, 3>& maxDeltaFraction,
+                         const std::array<std::uint64_t, 256>& histogram, std::uint64_t pixelsOverTolerance,
+                         double ssimSum, std::uint64_t ssimWindows);
+
+std::string jsonQuote(const std::string& text);
+
+// Pretty-printed with `indent` extra spaces per line, or on a single line
+// when `indent` is negative.
+std::string diffMetricsToJson(const DiffMetrics& metrics, int indent = 0);
+bool saveDiffMetricsJson(const std::string& path, const DiffMetrics& metrics);
@@ -0,0 +1,612 @@
+#include "diff_server.hpp"
+
+#ifdef _WIN32
+
+bool runDiffServer(const DiffServerOptions&, std::string& error) {
+    error = "--serve needs Unix domain sockets, which this platform does not provide";
+    return false;
+}
+
+#else
+
+#include "diff_metrics.hpp"
+#include "image_diff.hpp"
+#include "image_loader.hpp"
+#include "mapped_image.hpp"
+#include "parallel.hpp"
+#include "precise_diff.hpp"
+#include "precise_image.hpp"
+#include "profiler.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// How often the accept loop looks at the stop flags.
+constexpr int AcceptPollMs = 200;
+
+// A line longer than this is not a request; the connection is dropped.
+constexpr std::size_t MaxRequestBytes = 64 * 1024;
+
+// A connection stops reading requests while this many diffs are running for
+// it, or this many reply bytes wait for the client to read them, so a client
+// that sends faster than it reads is held back by its own socket.
+constexpr std::size_t MaxPendingRequests = 64;
+constexpr std::size_t MaxQueuedReplyBytes = 4 << 20;
+
+// A client that reads nothing for this long is dropped.
+constexpr int SendTimeoutSeconds = 30;
+
+volatile std::sig_atomic_t stopSignalled = 0;
+
+void handleStopSignal(int) {
+    stopSignalled = 1;
+}
+
+std::vector<std::string_view> splitFields(std::string_view line) {
+    std::vector<std::string_view> fields;
+    std::size_t start = 0;
+    while (true) {
+        std::size_t end = line.find('\t', start);
+        fields.push_back(line.substr(start, end == std::string_view::npos ? end : end - start));
+        if (end == std::string_view::npos) {
+            return fields;
+        }
+        start = end + 1;
+    }
+}
+
+template <typename T>
+bool parseValue(std::string_view text, T& value) {
+    const char* end = text.data() + text.size();
+    auto result = std::from_chars(text.data(), end, value);
+    return result.ec == std::errc() && result.ptr == end;
+}
+
+// JSON has no NaN or infinity.
+std::string formatDouble(double value) {
+    if (!std::isfinite(value)) {
+        return "null";
+    }
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.6g", value);
+    return buffer;
+}
+
+struct DiffRequest {
+    std::string id;
+    std::string inputA;
+    std::string inputB;
+    std::string outputPath;
+    unsigned tolerance = 0;
+    double thresholdPercent = 0.0;
+    bool withMetrics = false;
+};
+
+bool parseDiffRequest(const std::vector<std::string_view>& fields, DiffRequest& request, std::string& error) {
+    if (fields.size() < 3 || fields[1].empty() || fields[2].empty()) {
+        error = "diff needs two inputs";
+        return false;
+    }
+    request.inputA = fields[1];
+    request.inputB = fields[2];
+
+    for (std::size_t i = 3; i < fields.size(); ++i) {
+        std::size_t equals = fields[i].find('=');
+        std::string_view key = fields[i].substr(0, equals);
+        std::string_view value = equals == std::string_view::npos ? std::string_view() : fields[i].substr(equals + 1);
+        if (key == "id") {
+            request.id = value;
+        }
+        else if (key == "tolerance") {
+            if (!parseValue(value, request.tolerance) || request.tolerance > 255) {
+                error = "Tolerance must be an integer between 0 and 255";
+                return false;
+            }
+        }
+        else if (key == "threshold") {
+            if (!parseValue(value, request.thresholdPercent) || request.thresholdPercent < 0.0 ||
+                request.thresholdPercent > 100.0) {
+                error = "Threshold must be a percentage between 0 and 100";
+                return false;
+            }
+        }
+        else if (key == "metrics") {
+            request.withMetrics = value == "1" || value == "true";
+        }
+        else if (key == "output") {
+            request.outputPath = value;
+        }
+        else {
+            error = "Unknown diff option: " + std::string(key);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Shared memory is read on every request: the client may reuse the object
+// for the next image, so it is never cached. It is copied out with pread
+// rather than mapped, since a client shrinking a mapped object would kill
+// the server with SIGBUS.
+bool decodeSharedMemory(const std::string& name, DecodedImage& decoded, std::string& error) {
+    std::string objectName = name.empty() || name[0] != '/' ? "/" + name : name;
+    int fd = shm_open(objectName.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        error = "Cannot open shared memory: " + name;
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        ::close(fd);
+        error = "Shared memory is empty: " + name;
+        return false;
+    }
+    std::vector<std::uint8_t> bytes(static_cast<std::size_t>(info.st_size));
+    std::size_t size = 0;
+    while (size < bytes.size()) {
+        ssize_t got = pread(fd, bytes.data() + size, bytes.size() - size, static_cast<off_t>(size));
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            break;
+        }
+        size += static_cast<std::size_t>(got);
+    }
+    ::close(fd);
+    if (size < bytes.size()) {
+        error = "Shared memory shrank while being read: " + name;
+        return false;
+    }
+
+    bool ok = decodeImageMemory(bytes.data(), size, decoded, error);
+    if (!ok) {
+        error += ": " + name;
+    }
+    return ok;
+}
+
+class DiffServer {
+public:
+    explicit DiffServer(const DiffServerOptions& options) : options(options), cache(options.cacheBytes) {}
+
+    bool run(std::string& error);
+
+private:
+    // The accept loop owns `fd` and closes it after joining `thread`, so a
+    // shutdown() from that loop never hits a reused descriptor. Replies are
+    // queued and sent by a writer thread per connection, so pool workers
+    // never block on a client that is slow to read.
+    struct Connection {
+        int fd = -1;
+        std::thread thread;
+        std::atomic<bool> finished{false};
+        // Guards everything below; `changed` is signalled whenever any of
+        // it changes.
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::deque<std::string> outbox;
+        std::size_t outboxBytes = 0;
+        std::size_t pending = 0;
+        // No more requests will be read.
+        bool closing = false;
+        // A send failed; later replies are dropped.
+        bool broken = false;
+    };
+
+    void serveConnection(Connection& connection);
+    void writeReplies(Connection& connection);
+    void handleLine(Connection& connection, std::string_view line, std::uint64_t lineNumber);
+    void reply(Connection& connection, const std::string& line);
+    void reapConnections(bool all);
+
+    std::shared_ptr<const DecodedImage> loadInput(const std::string& input, bool& fromCache, std::string& error);
+    std::string runDiff(const DiffRequest& request);
+    std::string statsReply(const std::string& id);
+
+    const DiffServerOptions& options;
+    ImageCache cache;
+    std::atomic<bool> stopRequested{false};
+    std::atomic<std::uint64_t> requestsServed{0};
+    std::atomic<std::uint64_t> requestsFailed{0};
+    std::list<Connection> connections;
+};
+
+std::string errorReply(const std::string& id, const std::string& error) {
+    return "{\"id\": " + jsonQuote(id) + ", \"status\": \"error\", \"error\": " + jsonQuote(error) + "}";
+}
+
+std::string okReply(const std::string& id) {
+    return "{\"id\": " + jsonQuote(id) + ", \"status\": \"ok\"}";
+}
+
+bool DiffServer::run(std::string& error) {
+    const std::string& path = options.socketPath;
+    sockaddr_un address{};
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        error = "Socket path must be 1 to " + std::to_string(sizeof(address.sun_path) - 1) + " bytes: " + path;
+        return false;
+    }
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    // A socket left behind by a server that died is replaced; a live one is not.
+    std::error_code ec;
+    if (fs::is_socket(path, ec)) {
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        bool live = probe >= 0 && connect(probe, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+        if (probe >= 0) {
+            ::close(probe);
+        }
+        if (live) {
+            error = "A server is already listening on " + path;
+            return false;
+        }
+        fs::remove(path, ec);
+    }
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0 || bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(listenFd, SOMAXCONN) != 0) {
+        error = "Cannot listen on " + path + ": " + std::strerror(errno);
+        if (listenFd >= 0) {
+            ::close(listenFd);
+        }
+        return false;
+    }
+
+    stopSignalled = 0;
+    auto previousInt = std::signal(SIGINT, handleStopSignal);
+    auto previousTerm = std::signal(SIGTERM, handleStopSignal);
+    auto previousPipe = std::signal(SIGPIPE, SIG_IGN);
+
+    if (!options.quiet) {
+        std::printf("Serving on %s\n", path.c_str());
+        std::fflush(stdout);
+    }
+
+    while (!stopRequested.load() && !stopSignalled) {
+        pollfd listening{listenFd, POLLIN, 0};
+        int ready = poll(&listening, 1, AcceptPollMs);
+        reapConnections(false);
+        if (ready <= 0 || !(listening.revents & POLLIN)) {
+            continue;
+        }
+
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0) {
+            continue;
+        }
+        timeval sendTimeout{SendTimeoutSeconds, 0};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+        Connection& connection = connections.emplace_back();
+        connection.fd = fd;
+        connection.thread = std::thread([this, &connection] {
+            serveConnection(connection);
+            connection.finished.store(true);
+        });
+    }
+
+    // Stop reading new requests; what was already received is answered.
+    for (Connection& connection : connections) {
+        ::shutdown(connection.fd, SHUT_RD);
+    }
+    reapConnections(true);
+    ::close(listenFd);
+    fs::remove(path, ec);
+
+    std::signal(SIGINT, previousInt);
+    std::signal(SIGTERM, previousTerm);
+    std::signal(SIGPIPE, previousPipe);
+
+    if (!options.quiet) {
+        std::printf("Served %llu request(s), %llu failed\n", static_cast<unsigned long long>(requestsServed.load()),
+                    static_cast<unsigned long long>(requestsFailed.load()));
+    }
+    return true;
+}
+
+void DiffServer::reapConnections(bool all) {
+    for (auto it = connections.begin(); it != connections.end();) {
+        if (!all && !it->finished.load()) {
+            ++it;
+            continue;
+        }
+        it->thread.join();
+        ::close(it->fd);
+        it = connections.erase(it);
+    }
+}
+
+void DiffServer::serveConnection(Connection& connection) {
+    std::thread writer([this, &connection] { writeReplies(connection); });
+    std::string buffer;
+    char chunk[4096];
+    std::uint64_t lineNumber = 0;
+    bool reading = true;
+
+    while (reading) {
+        ssize_t received = recv(connection.fd, chunk, sizeof(chunk), 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            break;
+        }
+        buffer.append(chunk, static_cast<std::size_t>(received));
+
+        std::size_t start = 0;
+        for (std::size_t end; (end = buffer.find('\n', start)) != std::string::npos; start = end + 1) {
+            std::string_view line(buffer.data() + start, end - start);
+            if (!line.empty() && line.back() == '\r') {
+                line.remove_suffix(1);
+            }
+            ++lineNumber;
+            if (line.empty()) {
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(connection.mutex);
+            connection.changed.wait(lock, [&] {
+                return connection.broken || (connection.pending < MaxPendingRequests &&
+                                             connection.outboxBytes < MaxQueuedReplyBytes);
+            });
+            if (connection.broken) {
+                reading = false;
+                break;
+            }
+            lock.unlock();
+            handleLine(connection, line, lineNumber);
+        }
+        buffer.erase(0, start);
+
+        if (buffer.size() > MaxRequestBytes) {
+            reply(connection, errorReply(std::to_string(lineNumber + 1), "Request line too long"));
+            break;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(connection.mutex);
+        connection.closing = true;
+    }
+    connection.changed.notify_all();
+    writer.join();
+}
+
+void DiffServer::writeReplies(Connection& connection) {
+    std::unique_lock<std::mutex> lock(connection.mutex);
+    while (true) {
+        connection.changed.wait(lock, [&] {
+            return !connection.outbox.empty() || (connection.closing && connection.pending == 0);
+        });
+        if (connection.outbox.empty()) {
+            break;
+        }
+        std::string message = std::move(connection.outbox.front());
+        connection.outbox.pop_front();
+        lock.unlock();
+
+        std::size_t sent = 0;
+        while (sent < message.size()) {
+            ssize_t written = send(connection.fd, message.data() + sent, message.size() - sent, 0);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                break;
+            }
+            sent += static_cast<std::size_t>(written);
+        }
+
+        lock.lock();
+        connection.outboxBytes -= message.size();
+        if (sent < message.size()) {
+            // The client went away or stopped reading; its remaining replies
+            // are dropped.
+            connection.broken = true;
+            for (const std::string& dropped : connection.outbox) {
+                connection.outboxBytes -= dropped.size();
+            }
+            connection.outbox.clear();
+            ::shutdown(connection.fd, SHUT_RD);
+        }
+        connection.changed.notify_all();
+    }
+
+    // The client sees the end of the replies now rather than when the accept
+    // loop gets round to closing the descriptor.
+    ::shutdown(connection.fd, SHUT_WR);
+}
+
+void DiffServer::handleLine(Connection& connection, std::string_view line, std::uint64_t lineNumber) {
+    std::vector<std::string_view> fields = splitFields(line);
+    std::string id = std::to_string(lineNumber);
+
+    if (fields[0] == "ping") {
+        reply(connection, okReply(id));
+    }
+    else if (fields[0] == "stats") {
+        reply(connection, statsReply(id));
+    }
+    else if (fields[0] == "shutdown") {
+        stopRequested.store(true);
+        reply(connection, okReply(id));
+    }
+    else if (fields[0] == "diff") {
+        requestsServed.fetch_add(1);
+        DiffRequest request;
+        request.id = id;
+        std::string error;
+        if (!parseDiffRequest(fields, request, error)) {
+            requestsFailed.fetch_add(1);
+            reply(connection, errorReply(request.id, error));
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(connection.mutex);
+            ++connection.pending;
+        }
+        sharedThreadPool()->enqueue([this, &connection, request = std::move(request)] {
+            reply(connection, runDiff(request));
+            // Notified under the lock: once pending reaches zero the writer
+            // may return and the connection be reaped, so nothing here may
+            // touch it after the unlock.
+            std::lock_guard<std::mutex> lock(connection.mutex);
+            --connection.pending;
+            connection.changed.notify_all();
+        });
+    }
+    else {
+        reply(connection, errorReply(id, "Unknown request: " + std::string(fields[0])));
+    }
+}
+
+void DiffServer::reply(Connection& connection, const std::string& line) {
+    {
+        std::lock_guard<std::mutex> lock(connection.mutex);
+        if (connection.broken) {
+            return;
+        }
+        connection.outbox.push_back(line + '\n');
+        connection.outboxBytes += connection.outbox.back().size();
+    }
+    connection.changed.notify_all();
+}
+
+std::shared_ptr<const DecodedImage> DiffServer::loadInput(const std::string& input, bool& fromCache,
+                                                          std::string& error) {
+    fromCache = false;
+    if (input.rfind("shm:", 0) == 0) {
+        auto decoded = std::make_shared<DecodedImage>();
+        if (!decodeSharedMemory(input.substr(4), *decoded, error)) {
+            return nullptr;
+        }
+        return decoded;
+    }
+    return decodeCachedImage(input, cache, fromCache, error);
+}
+
+std::string DiffServer::runDiff(const DiffRequest& request) {
+    ScopedTimer timer("Serve diff");
+    std::uint64_t startNs = profileClockNs();
+
+    auto fail = [&](const std::string& error) {
+        requestsFailed.fetch_add(1);
+        return errorReply(request.id, error);
+    };
+
+    std::string error;
+    bool cached1 = false;
+    bool cached2 = false;
+    std::shared_ptr<const DecodedImage> image1 = loadInput(request.inputA, cached1, error);
+    if (!image1) {
+        return fail(error);
+    }
+    std::shared_ptr<const DecodedImage> image2 = loadInput(request.inputB, cached2, error);
+    if (!image2) {
+        return fail(error);
+    }
+
+    std::uint8_t tolerance = static_cast<std::uint8_t>(request.tolerance);
+    DiffSummary summary;
+    DiffMetrics metrics;
+    DiffMetrics* metricsOut = request.withMetrics ? &metrics : nullptr;
+    sf::Image diffImage;
+    std::optional<PrecisePixels> preciseDiff;
+    bool keepPrecise = !request.outputPath.empty() && isPreciseOutputPath(request.outputPath);
+
+    sf::Vector2u size = image1->image.getSize();
+    bool identicalFiles = haveSamePixels(*image1, *image2);
+    if (identicalFiles) {
+        identicalDifference(size, diffImage, summary, tolerance, metricsOut);
+        if (image1->precise) {
+            summary.sampleType = sampleTypeOf(*image1->precise);
+            metrics.sampleType = summary.sampleType;
+        }
+    }
+    else if (!computeDecodedDifference(*image1, *image2, {0, 0}, diffImage, summary, tolerance, metricsOut,
+                                       keepPrecise ? &preciseDiff : nullptr)) {
+        return fail("Invalid image dimensions");
+    }
+
+    if (!request.outputPath.empty()) {
+        bool saved = preciseDiff ? savePreciseImage(*preciseDiff, request.outputPath, error)
+                                 : saveImageFile(diffImage, request.outputPath, {options.pngLevel});
+        if (!saved) {
+            return fail(error.empty() ? "Failed to save difference image: " + request.outputPath : error);
+        }
+    }
+
+    bool overThreshold = summary.sizeMismatch || summary.differingPercent() > request.thresholdPercent;
+    double elapsedMs = static_cast<double>(profileClockNs() - startNs) / 1e6;
+
+    std::string out = "{\"id\": " + jsonQuote(request.id) + ", \"status\": \"ok\"";
+    out += ", \"width\": " + std::to_string(summary.width);
+    out += ", \"height\": " + std::to_string(summary.height);
+    out += ", \"differing_pixels\": " + std::to_string(summary.differingPixels);
+    out += ", \"differing_percent\": " + formatDouble(summary.differingPercent());
+    out += ", \"max_delta\": " + std::to_string(summary.maxDelta);
+    out += ", \"max_delta_fraction\": " + formatDouble(summary.maxDeltaFraction);
+    out += ", \"sample_type\": " + jsonQuote(sampleTypeName(summary.sampleType));
+    out += ", \"non_finite_pixels\": " + std::to_string(summary.nonFinitePixels);
+    out += std::string(", \"size_mismatch\": ") + (summary.sizeMismatch ? "true" : "false");
+    out += std::string(", \"identical_files\": ") + (identicalFiles ? "true" : "false");
+    out += std::string(", \"over_threshold\": ") + (overThreshold ? "true" : "false");
+    out += std::string(", \"cached\": [") + (cached1 ? "true" : "false") + ", " + (cached2 ? "true" : "false") + "]";
+    out += ", \"ms\": " + formatDouble(elapsedMs);
+    if (metricsOut) {
+        out += ", \"metrics\": " + diffMetricsToJson(metrics, -1);
+    }
+    return out + "}";
+}
+
+std::string DiffServer::statsReply(const std::string& id) {
+    ImageCacheStats stats = cache.getStats();
+    std::string out = "{\"id\": " + jsonQuote(id) + ", \"status\": \"ok\"";
+    out += ", \"requests\": " + std::to_string(requestsServed.load());
+    out += ", \"failed\": " + std::to_string(requestsFailed.load());
+    out += ", \"cache_hits\": " + std::to_string(stats.hits);
+    out += ", \"cache_misses\": " + std::to_string(stats.misses);
+    out += ", \"cache_entries\": " + std::to_string(stats.entries);
+    out += ", \"cache_bytes\": " + std::to_string(stats.bytes);
+    out += ", \"cache_budget_bytes\": " + std::to_string(stats.budgetBytes);
+    return out + "}";
+}
+
+}
+
+bool runDiffServer(const DiffServerOptions& options, std::string& error) {
+    DiffServer server(options);
+    return server.run(error);
+}
+
+#endif
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "image_cache.hpp"
+#include "image_codecs.hpp"
+
+#include <cstddef>
+#include <string>
+
+// A long-running comparison service on a Unix domain socket, so test
+// harnesses pay for process startup and decoding reference images once
+// instead of per comparison.
+//
+// Requests are lines of tab-separated fields:
+//
+//   diff<TAB>A<TAB>B[<TAB>key=value...]   compare two images
+//   stats                                 cache and request counters
+//   ping
+//   shutdown                              stop the server
+//
+// A and B are file paths, or shm:NAME for a POSIX shared-memory object
+// holding a whole image file (any loadable format, the raw ones included).
+// Files are decoded once and kept in an LRU cache for as long as their
+// size and modification time stay the same. Keys for diff:
+//
+//   id=TEXT        echoed in the reply (default: the request's line number)
+//   tolerance=N    per-channel deltas up to N are ignored (0-255)
+//   threshold=PCT  differing pixels allowed before "over_threshold"
+//   metrics=1      include MSE/PSNR/SSIM/histogram
+//   output=PATH    write the difference image
+//
+// Every request gets one JSON object on one line. Requests run on the shared
+// thread pool, concurrently even within a connection, and are answered as
+// they finish, so replies can come out of order; match them by "id". Once
+// the client shuts down its writing side, outstanding requests are answered
+// and the connection is closed. A connection reads no further requests while
+// 64 of its diffs are running or 4 MB of its replies are unread, and is
+// dropped when it reads nothing for 30 seconds.
+struct DiffServerOptions {
+    std::string socketPath;
+    std::size_t cacheBytes = ImageCache::DefaultBudgetBytes;
+    int pngLevel = DefaultPngLevel;
+    bool quiet = false;
+};
+
+// Serves until a client sends "shutdown" or the process receives SIGINT or
+// SIGTERM. Fails when the socket cannot be created, or on Windows.
+bool runDiffServer(const DiffServerOptions& options, std::string& error);
@@ -0,0 +1,500 @@
+#include "diff_visualization.hpp"
+
+#include "diff_kernels.hpp"
+#include "image_utils.hpp"
+#include "parallel.hpp"
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CI_DISPLAY_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define CI_DISPLAY_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define CI_DISPLAY_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define CI_DISPLAY_TARGET_AVX2
+#endif
+
+namespace {
+
+// Colormap stops for the heatmap, dark to bright (a coarse magma).
+constexpr std::array<std::array<int, 3>, 5> HeatmapStops = {{
+    {0, 0, 0},
+    {80, 18, 123},
+    {182, 54, 121},
+    {251, 136, 97},
+    {252, 253, 191},
+}};
+
+inline std::uint8_t lumaIndex(const std::uint8_t* pixel) {
+    return static_cast<std::uint8_t>((77 * pixel[0] + 150 * pixel[1] + 29 * pixel[2]) >> 8);
+}
+
+inline std::uint8_t amplifySample(unsigned value, std::uint16_t gain) {
+    return static_cast<std::uint8_t>(std::min(255u, (value * gain) >> 8));
+}
+
+inline std::uint32_t packPixel(std::uint8_t r, std::uint8_t g, std::uint8_t b, std::uint8_t a = 255) {
+    const std::uint8_t bytes[4] = {r, g, b, a};
+    std::uint32_t pixel;
+    std::memcpy(&pixel, bytes, sizeof(pixel));
+    return pixel;
+}
+
+void amplifyScalar(const std::uint8_t* delta, std::uint8_t* out, std::size_t pixels, std::uint16_t gain) {
+    for (std::size_t i = 0; i < pixels; ++i) {
+        const std::uint8_t* p = delta + i * 4;
+        std::uint8_t* o = out + i * 4;
+        o[0] = amplifySample(p[0], gain);
+        o[1] = amplifySample(p[1], gain);
+        o[2] = amplifySample(p[2], gain);
+        o[3] = 255;
+    }
+}
+
+void lookupScalar(const std::uint8_t* delta, std::uint8_t* out, std::size_t pixels, const std::uint32_t* lut,
+                  bool luminance) {
+    for (std::size_t i = 0; i < pixels; ++i) {
+        const std::uint8_t* p = delta + i * 4;
+        std::uint8_t index = luminance ? lumaIndex(p) : std::max({p[0], p[1], p[2]});
+        std::memcpy(out + i * 4, &lut[index], 4);
+    }
+}
+
+void blendScalar(const std::uint8_t* a, const std::uint8_t* b, std::uint8_t* out, std::size_t pixels,
+                 unsigned weight) {
+    const unsigned inverse = 256 - weight;
+    for (std::size_t i = 0; i < pixels * 4; ++i) {
+        out[i] = static_cast<std::uint8_t>((a[i] * inverse + b[i] * weight) >> 8);
+    }
+}
+
+#if CI_DISPLAY_X86
+
+void amplifySse2(const std::uint8_t* delta, std::uint8_t* out, std::size_t pixels, std::uint16_t gain) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i factor = _mm_set1_epi16(static_cast<short>(gain));
+    const __m128i alphaMask = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+    std::size_t i = 0;
+
+    for (; i + 4 <= pixels; i += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(delta + i * 4));
+        // Interleaving zero below each byte gives value * 256, so the high
+        // half of the product is value * gain / 256.
+        __m128i lo = _mm_mulhi_epu16(_mm_unpacklo_epi8(zero, v), factor);
+        __m128i hi = _mm_mulhi_epu16(_mm_unpackhi_epi8(zero, v), factor);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 4), _mm_or_si128(_mm_packus_epi16(lo, hi), alphaMask));
+    }
+
+    amplifyScalar(delta + i * 4, out + i * 4, pixels - i, gain);
+}
+
+// Table indices of four pixels in 32-bit lanes.
+inline __m128i lookupIndicesSse2(__m128i v, bool luminance) {
+    const __m128i byteMask = _mm_set1_epi32(0xFF);
+    __m128i g = _mm_srli_epi32(v, 8);
+    __m128i b = _mm_srli_epi32(v, 16);
+    if (!luminance) {
+        return _mm_and_si128(_mm_max_epu8(_mm_max_epu8(v, g), b), byteMask);
+    }
+    // Each product fits the low 16 bits of its lane and the upper halves
+    // stay zero, so 16-bit arithmetic is exact.
+    __m128i sum = _mm_mullo_epi16(_mm_and_si128(v, byteMask), _mm_set1_epi32(77));
+    sum = _mm_add_epi16(sum, _mm_mullo_epi16(_mm_and_si128(g, byteMask), _mm_set1_epi32(150)));
+    sum = _mm_add_epi16(sum, _mm_mullo_epi16(_mm_and_si128(b, byteMask), _mm_set1_epi32(29)));
+    return _mm_srli_epi32(sum, 8);
+}
+
+void lookupSse2(const std::uint8_t* delta, std::uint8_t* out, std::size_t pixels, const std::uint32_t* lut,
+                bool luminance) {
+    alignas(16) std::uint32_t indices[4];
+    std::size_t i = 0;
+
+    for (; i + 4 <= pixels; i += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(delta + i * 4));
+        _mm_store_si128(reinterpret_cast<__m128i*>(indices), lookupIndicesSse2(v, luminance));
+        std::uint32_t mapped[4] = {lut[indices[0]], lut[indices[1]], lut[indices[2]], lut[indices[3]]};
+        std::memcpy(out + i * 4, mapped, sizeof(mapped));
+    }
+
+    lookupScalar(delta + i * 4, out + i * 4, pixels - i, lut, luminance);
+}
+
+void blendSse2(const std::uint8_t* a, const std::uint8_t* b, std::uint8_t* out, std::size_t pixels,
+               unsigned weight) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i weightA = _mm_set1_epi16(static_cast<short>(256 - weight));
+    const __m128i weightB = _mm_set1_epi16(static_cast<short>(weight));
+    std::size_t i = 0;
+
+    for (; i + 4 <= pixels; i += 4) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i * 4));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i * 4));
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), weightA),
+                                   _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), weightB));
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), weightA),
+                                   _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), weightB));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 4),
+                         _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+    }
+
+    blendScalar(a + i * 4, b + i * 4, out + i * 4, pixels - i, weight);
+}
+
+CI_DISPLAY_TARGET_AVX2
+void amplifyAvx2(const std::uint8_t* delta, std::uint8_t* out, std::size_t pixels, std::uint16_t gain) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i factor = _mm256_set1_epi16(static_cast<short>(gain));
+    const __m256i alphaMask = _mm256_set1_epi32(static_cast<int>(0xFF000000u));
+    std::size_t i = 0;
+
+    // Unpack and pack both work within 128-bit lanes, so pixels keep their order.
+    for (; i + 8 <= pixels; i += 8) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(delta + i * 4));
+        __m256i lo = _mm256_mulhi_epu16(_mm256_unpacklo_epi8(zero, v), factor);
+        __m256i hi = _mm256_mulhi_epu16(_mm256_unpackhi_epi8(zero, v), factor);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i * 4),
+                            _mm256_or_si256(_mm256_packus_epi16(lo, hi), alphaMask));
+    }
+
+    amplifySse2(delta + i * 4, out + i * 4, pixels - i, gain);
+}
+
+CI_DISPLAY_TARGET_AVX2
+void lookupAvx2(const std::uint8_t* delta, std::uint8_t* out, std::size_t pixels, const std::uint32_t* lut,
+                bool luminance) {
+    const __m256i byteMask = _mm256_set1_epi32(0xFF);
+    const int* table = reinterpret_cast<const int*>(lut);
+    std::size_t i = 0;
+
+    for (; i + 8 <= pixels; i += 8) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(delta + i * 4));
+        __m256i g = _mm256_srli_epi32(v, 8);
+        __m256i b = _mm256_srli_epi32(v, 16);
+        __m256i index;
+        if (luminance) {
+            index = _mm256_mullo_epi16(_mm256_and_si256(v, byteMask), _mm256_set1_epi32(77));
+            index = _mm256_add_epi16(index, _mm256_mullo_epi16(_mm256_and_si256(g, byteMask), _mm256_set1_epi32(150)));
+            index = _mm256_add_epi16(index, _mm256_mullo_epi16(_mm256_and_si256(b, byteMask), _mm256_set1_epi32(29)));
+            index = _mm256_srli_epi32(index, 8);
+        }
+        else {
+            index = _mm256_and_si256(_mm256_max_epu8(_mm256_max_epu8(v, g), b), byteMask);
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i * 4), _mm256_i32gather_epi32(table, index, 4));
+    }
+
+    lookupSse2(delta + i * 4, out + i * 4, pixels - i, lut, luminance);
+}
+
+CI_DISPLAY_TARGET_AVX2
+void blendAvx2(const std::uint8_t* a, const std::uint8_t* b, std::uint8_t* out, std::size_t pixels,
+               unsigned weight) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i weightA = _mm256_set1_epi16(static_cast<short>(256 - weight));
+    const __m256i weightB = _mm256_set1_epi16(static_cast<short>(weight));
+    std::size_t i = 0;
+
+    for (; i + 8 <= pixels; i += 8) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i * 4));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i * 4));
+        __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(va, zero), weightA),
+                                      _mm256_mullo_epi16(_mm256_unpacklo_epi8(vb, zero), weightB));
+        __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(va, zero), weightA),
+                                      _mm256_mullo_epi16(_mm256_unpackhi_epi8(vb, zero), weightB));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i * 4),
+                            _mm256_packus_epi16(_mm256_srli_epi16(lo, 8), _mm256_srli_epi16(hi, 8)));
+    }
+
+    blendSse2(a + i * 4, b + i * 4, out + i * 4, pixels - i, weight);
+}
+
+#endif
+
+#if CI_DISPLAY_NEON
+
+void amplifyNeon(const std::uint8_t* delta, std::uint8_t* out, std::size_t pixels, std::uint16_t gain) {
+    const uint8x16_t alphaMask = vreinterpretq_u8_u32(vdupq_n_u32(0xFF000000u));
+    std::size_t i = 0;
+
+    for (; i + 4 <= pixels; i += 4) {
+        uint8x16_t v = vld1q_u8(delta + i * 4);
+        uint16x8_t lo = vmovl_u8(vget_low_u8(v));
+        uint16x8_t hi = vmovl_u8(vget_high_u8(v));
+        // value * gain / 256 stays below 2^15, so only the final narrowing
+        // needs to saturate.
+        uint16x8_t scaledLo = vcombine_u16(vshrn_n_u32(vmull_n_u16(vget_low_u16(lo), gain), 8),
+                                           vshrn_n_u32(vmull_n_u16(vget_high_u16(lo), gain), 8));
+        uint16x8_t scaledHi = vcombine_u16(vshrn_n_u32(vmull_n_u16(vget_low_u16(hi), gain), 8),
+                                           vshrn_n_u32(vmull_n_u16(vget_high_u16(hi), gain), 8));
+        uint8x16_t result = vcombine_u8(vqmovn_u16(scaledLo), vqmovn_u16(scaledHi));
+        vst1q_u8(out + i * 4, vorrq_u8(result, alphaMask));
+    }
+
+    amplifyScalar(delta + i * 4, out + i * 4, pixels - i, gain);
+}
+
+void lookupNeon(const std::uint8_t* delta, std::uint8_t* out, std::size_t pixels, const std::uint32_t* lut,
+                bool luminance) {
+    std::uint8_t indices[8];
+    std::size_t i = 0;
+
+    for (; i + 8 <= pixels; i += 8) {
+        uint8x8x4_t v = vld4_u8(delta + i * 4);
+        uint8x8_t index;
+        if (luminance) {
+            uint16x8_t sum = vmull_u8(v.val[0], vdup_n_u8(77));
+            sum = vmlal_u8(sum, v.val[1], vdup_n_u8(150));
+            sum = vmlal_u8(sum, v.val[2], vdup_n_u8(29));
+            index = vshrn_n_u16(sum, 8);
+        }
+        else {
+            index = vmax_u8(vmax_u8(v.val[0], v.val[1]), v.val[2]);
+        }
+        vst1_u8(indices, index);
+        std::uint32_t mapped[8];
+        for (int k = 0; k < 8; ++k) {
+            mapped[k] = lut[indices[k]];
+        }
+        std::memcpy(out + i * 4, mapped, sizeof(mapped));
+    }
+
+    lookupScalar(delta + i * 4, out + i * 4, pixels - i, lut, luminance);
+}
+
+void blendNeon(const std::uint8_t* a, const std::uint8_t* b, std::uint8_t* out, std::size_t pixels,
+               unsigned weight) {
+    const uint8x8_t weightA = vdup_n_u8(static_cast<std::uint8_t>(256 - weight));
+    const uint8x8_t weightB = vdup_n_u8(static_cast<std::uint8_t>(weight));
+    std::size_t i = 0;
+
+    for (; i + 4 <= pixels; i += 4) {
+        uint8x16_t va = vld1q_u8(a + i * 4);
+        uint8x16_t vb = vld1q_u8(b + i * 4);
+        uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(va), weightA), vget_low_u8(vb), weightB);
+        uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(va), weightA), vget_high_u8(vb), weightB);
+        vst1q_u8(out + i * 4, vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8)));
+    }
+
+    blendScalar(a + i * 4, b + i * 4, out + i * 4, pixels - i, weight);
+}
+
+#endif
+
+std::uint16_t fixedGain(float gain) {
+    return static_cast<std::uint16_t>(std::lround(std::clamp(gain, 0.0f, MaxDisplayGain) * 256.0f));
+}
+
+std::uint32_t heatmapColor(unsigned value) {
+    // Four equal segments between the five stops.
+    unsigned scaled = value * 4;
+    unsigned segment = std::min(3u, scaled / 255);
+    unsigned t = scaled - segment * 255;
+    const auto& from = HeatmapStops[segment];
+    const auto& to = HeatmapStops[segment + 1];
+    std::uint8_t rgb[3];
+    for (int c = 0; c < 3; ++c) {
+        rgb[c] = static_cast<std::uint8_t>((from[c] * static_cast<int>(255 - t) + to[c] * static_cast<int>(t) + 127) /
+                                           255);
+    }
+    return packPixel(rgb[0], rgb[1], rgb[2]);
+}
+
+// The pixel table of a lookup mode, indexed by the raw delta.
+std::array<std::uint32_t, 256> buildLookupTable(const DiffDisplaySettings& settings) {
+    std::array<std::uint32_t, 256> lut{};
+    std::uint16_t gain = fixedGain(settings.gain);
+    for (unsigned i = 0; i < 256; ++i) {
+        std::uint8_t amplified = amplifySample(i, gain);
+        switch (settings.mode) {
+            case DiffDisplayMode::Luminance:
+                lut[i] = packPixel(amplified, amplified, amplified);
+                break;
+            case DiffDisplayMode::Heatmap:
+                lut[i] = heatmapColor(amplified);
+                break;
+            case DiffDisplayMode::ThresholdMask:
+                lut[i] = i > settings.threshold ? 0xFFFFFFFFu : packPixel(0, 0, 0);
+                break;
+            default:
+                lut[i] = packPixel(0, 0, 0);
+                break;
+        }
+    }
+    return lut;
+}
+
+// Differences in red over image 1 in dimmed gray; the red weight (0-256)
+// comes from the largest channel delta through `alpha`.
+void overlayRow(const std::uint8_t* delta, const std::uint8_t* image1, std::uint8_t* out, std::size_t pixels,
+                const std::array<std::uint16_t, 256>& alpha) {
+    for (std::size_t i = 0; i < pixels; ++i) {
+        const std::uint8_t* d = delta + i * 4;
+        unsigned weight = alpha[std::max({d[0], d[1], d[2]})];
+        unsigned base = (lumaIndex(image1 + i * 4) >> 1) * (256 - weight);
+        std::uint8_t* o = out + i * 4;
+        o[0] = static_cast<std::uint8_t>((base + 255 * weight) >> 8);
+        o[1] = static_cast<std::uint8_t>(base >> 8);
+        o[2] = o[1];
+        o[3] = 255;
+    }
+}
+
+} // namespace
+
+const char* diffDisplayModeName(DiffDisplayMode mode) {
+    switch (mode) {
+        case DiffDisplayMode::Raw: return "Raw";
+        case DiffDisplayMode::Amplified: return "Amplified";
+        case DiffDisplayMode::Luminance: return "Luminance";
+        case DiffDisplayMode::Heatmap: return "Heatmap";
+        case DiffDisplayMode::ThresholdMask: return "Threshold mask";
+        case DiffDisplayMode::Overlay: return "Overlay";
+        case DiffDisplayMode::OnionSkin: return "Onion skin";
+        case DiffDisplayMode::Flicker: return "Flicker";
+    }
+    return "Unknown";
+}
+
+bool isDeltaDisplayMode(DiffDisplayMode mode) {
+    return mode != DiffDisplayMode::OnionSkin && mode != DiffDisplayMode::Flicker;
+}
+
+std::vector<DisplayKernel> supportedDisplayKernels() {
+    std::vector<DisplayKernel> kernels;
+    kernels.push_back({"scalar", amplifyScalar, lookupScalar, blendScalar});
+#if CI_DISPLAY_X86
+    kernels.push_back({"sse2", amplifySse2, lookupSse2, blendSse2});
+    if (cpuHasAvx2()) {
+        kernels.push_back({"avx2", amplifyAvx2, lookupAvx2, blendAvx2});
+    }
+#endif
+#if CI_DISPLAY_NEON
+    kernels.push_back({"neon", amplifyNeon, lookupNeon, blendNeon});
+#endif
+    return kernels;
+}
+
+const DisplayKernel& activeDisplayKernel() {
+    static const DisplayKernel kernel = supportedDisplayKernels().back();
+    return kernel;
+}
+
+bool renderDiffDisplayRows(const sf::Image& deltas, unsigned firstRow, const sf::Image& image1,
+                           const sf::Image& image2, sf::Vector2i shift, const DiffDisplaySettings& settings,
+                           sf::Image& out, const DisplayKernel& kernel) {
+    ScopedTimer timer("Render diff display");
+    sf::Vector2u size = deltas.getSize();
+    unsigned endRow = firstRow + size.y;
+    unsigned left = static_cast<unsigned>(std::max(0, shift.x));
+    unsigned top = std::clamp(static_cast<unsigned>(std::max(0, shift.y)), firstRow, endRow) - firstRow;
+    if (left >= size.x) {
+        return false;
+    }
+    if (settings.mode == DiffDisplayMode::Raw) {
+        out = deltas;
+        return true;
+    }
+
+    // The deltas end where image 1 or image 2 does, so both cover them.
+    bool needsImage1 = settings.mode == DiffDisplayMode::Overlay || !isDeltaDisplayMode(settings.mode);
+    bool needsImage2 = !isDeltaDisplayMode(settings.mode);
+    if (needsImage1 && (image1.getSize().x < size.x || image1.getSize().y < endRow)) {
+        return false;
+    }
+    if (needsImage2 && (static_cast<long long>(image2.getSize().x) + shift.x < size.x ||
+                        static_cast<long long>(image2.getSize().y) + shift.y < endRow)) {
+        return false;
+    }
+
+    if (out.getSize() != size) {
+        out.resize(size, sf::Color::Transparent);
+    }
+    else {
+        std::memset(mutablePixelsPtr(out), 0, static_cast<std::size_t>(top) * rowStride(out));
+    }
+    if (top >= size.y) {
+        return true;
+    }
+
+    const std::uint16_t gain = fixedGain(settings.gain);
+    const std::array<std::uint32_t, 256> lut = buildLookupTable(settings);
+    std::array<std::uint16_t, 256> overlayAlpha{};
+    float mix = std::clamp(settings.mix, 0.0f, 1.0f);
+    for (unsigned i = 0; i < 256; ++i) {
+        overlayAlpha[i] = static_cast<std::uint16_t>(std::lround(mix * 256.0f * amplifySample(i, gain) / 255.0f));
+    }
+    unsigned blendWeight = settings.mode == DiffDisplayMode::Flicker ? (settings.showImage2 ? 256u : 0u)
+                                                                     : static_cast<unsigned>(std::lround(mix * 256.0f));
+
+    const unsigned width = size.x - left;
+    const std::size_t leftBytes = static_cast<std::size_t>(left) * 4;
+    const std::uint8_t* deltaPixels = deltas.getPixelsPtr();
+    const std::uint8_t* pixels1 = image1.getPixelsPtr();
+    const std::uint8_t* pixels2 = image2.getPixelsPtr();
+    std::uint8_t* outPixels = mutablePixelsPtr(out);
+
+    parallelForRows(size.y - top, width, [&](unsigned firstBandRow, unsigned endBandRow) {
+        for (unsigned y = top + firstBandRow; y < top + endBandRow; ++y) {
+            unsigned imageRow = firstRow + y;
+            std::uint8_t* target = outPixels + y * rowStride(out);
+            std::memset(target, 0, leftBytes);
+            target += leftBytes;
+            const std::uint8_t* delta = deltaPixels + y * rowStride(deltas) + leftBytes;
+            const std::uint8_t* row1 = needsImage1 ? pixels1 + imageRow * rowStride(image1) + leftBytes : nullptr;
+            const std::uint8_t* row2 = nullptr;
+            if (needsImage2) {
+                row2 = pixels2 + static_cast<std::size_t>(static_cast<long long>(imageRow) - shift.y) * rowStride(image2) +
+                       static_cast<std::size_t>(static_cast<long long>(left) - shift.x) * 4;
+            }
+
+            switch (settings.mode) {
+                case DiffDisplayMode::Amplified:
+                    kernel.amplify(delta, target, width, gain);
+                    break;
+                case DiffDisplayMode::Luminance:
+                    kernel.lookup(delta, target, width, lut.data(), true);
+                    break;
+                case DiffDisplayMode::Heatmap:
+                case DiffDisplayMode::ThresholdMask:
+                    kernel.lookup(delta, target, width, lut.data(), false);
+                    break;
+                case DiffDisplayMode::Overlay:
+                    overlayRow(delta, row1, target, width, overlayAlpha);
+                    break;
+                case DiffDisplayMode::OnionSkin:
+                case DiffDisplayMode::Flicker:
+                    if (blendWeight == 0) {
+                        std::memcpy(target, row1, static_cast<std::size_t>(width) * 4);
+                    }
+                    else if (blendWeight >= 256) {
+                        std::memcpy(target, row2, static_cast<std::size_t>(width) * 4);
+                    }
+                    else {
+                        kernel.blend(row1, row2, target, width, blendWeight);
+                    }
+                    break;
+                case DiffDisplayMode::Raw:
+                    break;
+            }
+        }
+    });
+    return true;
+}
+
+bool renderDiffDisplay(const sf::Image& deltas, const sf::Image& image1, const sf::Image& image2, sf::Vector2i shift,
+                       const DiffDisplaySettings& settings, sf::Image& out, const DisplayKernel& kernel) {
+    if (std::max(0, shift.y) >= static_cast<int>(deltas.getSize().y)) {
+        return false;
+    }
+    return renderDiffDisplayRows(deltas, 0, image1, image2, shift, settings, out, kernel);
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Ways of showing a computed difference. All of them are re-mapped from the
+// cached delta image (or the two inputs), so switching between them or
+// moving a slider never runs the diff again.
+enum class DiffDisplayMode {
+    Raw,           // |a - b| per channel as diffed
+    Amplified,     // deltas multiplied by the gain
+    Luminance,     // gray level of the amplified delta
+    Heatmap,       // largest amplified channel delta through a colormap
+    ThresholdMask, // white where a channel differs by more than the threshold
+    Overlay,       // differences in red over a dimmed gray image 1
+    OnionSkin,     // image 1 and image 2 blended by the mix
+    Flicker,       // image 1 and image 2 alternating
+};
+
+constexpr int DiffDisplayModeCount = 8;
+
+const char* diffDisplayModeName(DiffDisplayMode mode);
+
+// Modes drawn from the deltas; onion skin and flicker show the inputs.
+bool isDeltaDisplayMode(DiffDisplayMode mode);
+
+struct DiffDisplaySettings {
+    DiffDisplayMode mode = DiffDisplayMode::Raw;
+    // Delta multiplier, 1-64, used by every delta mode but the mask.
+    float gain = 8.0f;
+    // Largest channel delta still shown black by the mask.
+    std::uint8_t threshold = 0;
+    // Weight of the differences in the overlay, and of image 2 in the onion
+    // skin, 0-1.
+    float mix = 0.5f;
+    // Which image flicker shows.
+    bool showImage2 = false;
+};
+
+// Largest accepted gain; higher values saturate every delta anyway.
+constexpr float MaxDisplayGain = 64.0f;
+
+// out = min(255, delta * gain / 256) per RGB channel with alpha 255, for
+// `pixels` RGBA pixels; `gain` is 8.8 fixed point.
+using DisplayAmplifyFn = void (*)(const std::uint8_t* delta, std::uint8_t* out, std::size_t pixels,
+                                  std::uint16_t gain);
+
+// out = lut[index] per pixel, where index is the luma (77r + 150g + 29b) / 256
+// of the delta when `luminance` is set and its largest RGB channel otherwise.
+// Table entries are RGBA pixels in memory order.
+using DisplayLookupFn = void (*)(const std::uint8_t* delta, std::uint8_t* out, std::size_t pixels,
+                                 const std::uint32_t* lut, bool luminance);
+
+// out = (a * (256 - weight) + b * weight) / 256 per byte, weight 1-255.
+using DisplayBlendFn = void (*)(const std::uint8_t* a, const std::uint8_t* b, std::uint8_t* out,
+                                std::size_t pixels, unsigned weight);
+
+// All kernels produce identical bytes.
+struct DisplayKernel {
+    const char* name;
+    DisplayAmplifyFn amplify;
+    DisplayLookupFn lookup;
+    DisplayBlendFn blend;
+};
+
+// Best kernel for the running CPU, chosen once on first use.
+const DisplayKernel& activeDisplayKernel();
+
+// Every kernel the running CPU can execute, scalar first.
+std::vector<DisplayKernel> supportedDisplayKernels();
+
+// Renders `deltas` (a difference image on image 1's grid, with image 2's
+// origin at `shift`) in the given mode. `out` gets the size of `deltas` and
+// stays transparent outside the overlap, like the deltas themselves. Image 2
+// is the one that was diffed, i.e. already resampled if it had to be.
+// Rows are processed in bands on the shared pool.
+bool renderDiffDisplay(const sf::Image& deltas, const sf::Image& image1, const sf::Image& image2, sf::Vector2i shift,
+                       const DiffDisplaySettings& settings, sf::Image& out,
+                       const DisplayKernel& kernel = activeDisplayKernel());
+
+// renderDiffDisplay for a band: `deltas` holds the rows from `firstRow` on of
+// such a difference image, and `out` gets the same rows of the display.
+bool renderDiffDisplayRows(const sf::Image& deltas, unsigned firstRow, const sf::Image& image1,
+                           const sf::Image& image2, sf::Vector2i shift, const DiffDisplaySettings& settings,
+                           sf::Image& out, const DisplayKernel& kernel = activeDisplayKernel());
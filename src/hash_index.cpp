@@ -0,0 +1,318 @@
+#include "hash_index.hpp"
+
+#include "image_cache.hpp"
+#include "image_utils.hpp"
+#include "parallel.hpp"
+#include "raw_formats.hpp"
+#include "scanline_io.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr char IndexMagic[8] = {'C', 'I', 'P', 'H', 'A', 'S', 'H', '1'};
+
+void writeLittleEndian(std::ostream& out, std::uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+        out.put(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+}
+
+bool readLittleEndian(std::istream& in, std::uint64_t& value, int bytes) {
+    unsigned char buffer[8];
+    if (!in.read(reinterpret_cast<char*>(buffer), bytes)) {
+        return false;
+    }
+    value = 0;
+    for (int i = 0; i < bytes; ++i) {
+        value |= static_cast<std::uint64_t>(buffer[i]) << (8 * i);
+    }
+    return true;
+}
+
+bool isUnder(const std::string& path, const std::string& directory) {
+    return path.size() > directory.size() && path.compare(0, directory.size(), directory) == 0 &&
+           (directory.back() == fs::path::preferred_separator || path[directory.size()] == fs::path::preferred_separator);
+}
+
+}
+
+bool isIndexableImagePath(const std::string& path) {
+    static const char* const extensions[] = {".png", ".jpg", ".jpeg", ".bmp", ".tga", ".gif", ".psd", ".hdr", ".pic"};
+    std::string extension = lowercaseExtension(path);
+    return isRawFormatPath(path) ||
+           std::any_of(std::begin(extensions), std::end(extensions),
+                       [&](const char* candidate) { return extension == candidate; });
+}
+
+bool PerceptualIndex::load(const std::string& path, std::string& error) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        error = "Cannot open index: " + path;
+        return false;
+    }
+    std::streamoff fileSize = file.tellg();
+    file.seekg(0);
+
+    char magic[sizeof(IndexMagic)];
+    std::uint64_t count = 0;
+    if (!file.read(magic, sizeof(magic)) || std::memcmp(magic, IndexMagic, sizeof(magic)) != 0 ||
+        !readLittleEndian(file, count, 8)) {
+        error = "Not a perceptual hash index: " + path;
+        return false;
+    }
+
+    std::vector<IndexedImage> loaded;
+    loaded.reserve(static_cast<std::size_t>(std::min<std::uint64_t>(count, 1u << 20)));
+    for (std::uint64_t i = 0; i < count; ++i) {
+        IndexedImage image;
+        std::uint64_t modified = 0, pathLength = 0;
+        if (!readLittleEndian(file, image.hashes.pHash, 8) || !readLittleEndian(file, image.hashes.dHash, 8) ||
+            !readLittleEndian(file, modified, 8) || !readLittleEndian(file, image.fileSize, 8) ||
+            !readLittleEndian(file, pathLength, 4)) {
+            error = "Truncated index: " + path;
+            return false;
+        }
+
+        // A corrupt length would otherwise allocate up to 4 GiB before the
+        // read fails.
+        if (static_cast<std::streamoff>(pathLength) > fileSize - file.tellg()) {
+            error = "Truncated index: " + path;
+            return false;
+        }
+
+        image.modifiedTime = static_cast<std::int64_t>(modified);
+        image.path.resize(static_cast<std::size_t>(pathLength));
+        if (!file.read(image.path.data(), static_cast<std::streamsize>(pathLength))) {
+            error = "Truncated index: " + path;
+            return false;
+        }
+        loaded.push_back(std::move(image));
+    }
+
+    images = std::move(loaded);
+    rebuildTree();
+    return true;
+}
+
+bool PerceptualIndex::save(const std::string& path, std::string& error) const {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        error = "Cannot write index: " + path;
+        return false;
+    }
+
+    file.write(IndexMagic, sizeof(IndexMagic));
+    writeLittleEndian(file, images.size(), 8);
+    for (const IndexedImage& image : images) {
+        writeLittleEndian(file, image.hashes.pHash, 8);
+        writeLittleEndian(file, image.hashes.dHash, 8);
+        writeLittleEndian(file, static_cast<std::uint64_t>(image.modifiedTime), 8);
+        writeLittleEndian(file, image.fileSize, 8);
+        writeLittleEndian(file, image.path.size(), 4);
+        file.write(image.path.data(), static_cast<std::streamsize>(image.path.size()));
+    }
+
+    if (!file) {
+        error = "Cannot write index: " + path;
+        return false;
+    }
+    return true;
+}
+
+bool PerceptualIndex::updateFromDirectory(const std::string& directory, bool recursive, IndexUpdateStats& stats,
+                                          std::string& error, IndexUpdateProgress* progress) {
+    stats = IndexUpdateStats{};
+
+    std::error_code ec;
+    fs::path root = fs::weakly_canonical(directory, ec);
+    if (ec || !fs::is_directory(root, ec)) {
+        error = "Not a directory: " + directory;
+        return false;
+    }
+    std::string rootString = root.string();
+
+    std::vector<ImageFileKey> files;
+    auto visit = [&](const fs::directory_entry& entry) {
+        std::error_code entryError;
+        if (!entry.is_regular_file(entryError) || !isIndexableImagePath(entry.path().string())) {
+            return;
+        }
+        ImageFileKey key;
+        if (makeImageFileKey(entry.path().string(), key)) {
+            files.push_back(std::move(key));
+        }
+    };
+    if (recursive) {
+        for (const auto& entry : fs::recursive_directory_iterator(root, fs::directory_options::skip_permission_denied, ec)) {
+            visit(entry);
+        }
+    }
+    else {
+        for (const auto& entry : fs::directory_iterator(root, ec)) {
+            visit(entry);
+        }
+    }
+    if (ec) {
+        error = "Cannot read directory: " + directory;
+        return false;
+    }
+    std::sort(files.begin(), files.end(), [](const ImageFileKey& a, const ImageFileKey& b) { return a.path < b.path; });
+
+    std::unordered_map<std::string, std::size_t> existing;
+    for (std::size_t i = 0; i < images.size(); ++i) {
+        existing.emplace(images[i].path, i);
+    }
+
+    // Unchanged files keep their hashes; the rest are hashed in parallel.
+    std::vector<IndexedImage> scanned(files.size());
+    std::vector<std::size_t> toHash;
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        scanned[i].path = files[i].path;
+        scanned[i].modifiedTime = files[i].modifiedTime;
+        scanned[i].fileSize = files[i].fileSize;
+
+        auto it = existing.find(files[i].path);
+        if (it != existing.end() && images[it->second].modifiedTime == files[i].modifiedTime &&
+            images[it->second].fileSize == files[i].fileSize) {
+            scanned[i].hashes = images[it->second].hashes;
+            ++stats.reused;
+        }
+        else {
+            toHash.push_back(i);
+        }
+    }
+
+    if (progress) {
+        progress->total.store(toHash.size());
+        progress->done.store(0);
+    }
+
+    std::vector<char> hashed(files.size(), 1);
+    sharedThreadPool()->parallelFor(toHash.size(), 1, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            std::size_t fileIndex = toHash[i];
+            if (progress && progress->cancelRequested.load()) {
+                hashed[fileIndex] = 0;
+                continue;
+            }
+
+            std::string readError;
+            std::unique_ptr<ScanlineReader> reader = openScanlineReader(files[fileIndex].path, readError);
+            hashed[fileIndex] = reader && computePerceptualHashes(*reader, scanned[fileIndex].hashes);
+            if (progress) {
+                progress->done.fetch_add(1);
+            }
+        }
+    });
+
+    if (progress && progress->cancelRequested.load()) {
+        error = "Indexing cancelled";
+        return false;
+    }
+
+    std::unordered_set<std::string> present;
+    for (const ImageFileKey& file : files) {
+        present.insert(file.path);
+    }
+
+    std::vector<IndexedImage> updated;
+    updated.reserve(images.size() + files.size());
+    for (IndexedImage& image : images) {
+        if (!isUnder(image.path, rootString)) {
+            updated.push_back(std::move(image));
+        }
+        else if (!present.count(image.path)) {
+            ++stats.removed;
+        }
+    }
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        if (hashed[i]) {
+            updated.push_back(std::move(scanned[i]));
+        }
+        else {
+            ++stats.failed;
+        }
+    }
+
+    stats.hashed = toHash.size() - stats.failed;
+
+    images = std::move(updated);
+    rebuildTree();
+    return true;
+}
+
+void PerceptualIndex::rebuildTree() {
+    tree.clear();
+    tree.reserve(images.size());
+
+    for (std::size_t entry = 0; entry < images.size(); ++entry) {
+        Node node;
+        node.entry = entry;
+        if (tree.empty()) {
+            tree.push_back(std::move(node));
+            continue;
+        }
+
+        std::uint64_t hash = images[entry].hashes.pHash;
+        std::size_t current = 0;
+        while (true) {
+            unsigned distance = hammingDistance(hash, images[tree[current].entry].hashes.pHash);
+            auto& children = tree[current].children;
+            auto child = std::find_if(children.begin(), children.end(),
+                                      [distance](const auto& edge) { return edge.first == distance; });
+            if (child == children.end()) {
+                children.emplace_back(distance, tree.size());
+                tree.push_back(std::move(node));
+                break;
+            }
+            current = child->second;
+        }
+    }
+}
+
+std::vector<HashMatch> PerceptualIndex::findSimilar(const PerceptualHashes& query, unsigned maxDistance,
+                                                    std::size_t limit) const {
+    std::vector<HashMatch> matches;
+    if (tree.empty()) {
+        return matches;
+    }
+
+    // Triangle inequality: only subtrees whose edge distance lies within
+    // maxDistance of the query's distance to the node can hold matches.
+    std::vector<std::size_t> pending{0};
+    while (!pending.empty()) {
+        const Node& node = tree[pending.back()];
+        pending.pop_back();
+
+        const IndexedImage& image = images[node.entry];
+        unsigned distance = hammingDistance(query.pHash, image.hashes.pHash);
+        if (distance <= maxDistance) {
+            matches.push_back({node.entry, distance, hammingDistance(query.dHash, image.hashes.dHash)});
+        }
+
+        for (const auto& [edge, child] : node.children) {
+            if (edge + maxDistance >= distance && edge <= distance + maxDistance) {
+                pending.push_back(child);
+            }
+        }
+    }
+
+    std::sort(matches.begin(), matches.end(), [this](const HashMatch& a, const HashMatch& b) {
+        if (a.pHashDistance != b.pHashDistance) return a.pHashDistance < b.pHashDistance;
+        if (a.dHashDistance != b.dHashDistance) return a.dHashDistance < b.dHashDistance;
+        return images[a.entry].path < images[b.entry].path;
+    });
+    if (matches.size() > limit) {
+        matches.resize(limit);
+    }
+    return matches;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "perceptual_hash.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct IndexedImage {
+    std::string path;
+    std::int64_t modifiedTime = 0;
+    std::uintmax_t fileSize = 0;
+    PerceptualHashes hashes;
+};
+
+struct HashMatch {
+    std::size_t entry = 0;
+    unsigned pHashDistance = 0;
+    unsigned dHashDistance = 0;
+};
+
+struct IndexUpdateProgress {
+    std::atomic<std::size_t> total{0};
+    std::atomic<std::size_t> done{0};
+    std::atomic<bool> cancelRequested{false};
+};
+
+struct IndexUpdateStats {
+    std::size_t hashed = 0;
+    std::size_t reused = 0;
+    std::size_t removed = 0;
+    std::size_t failed = 0;
+};
+
+// Perceptual hashes of many images, saved to a small binary file and searched
+// by Hamming distance through a BK-tree on the pHash. dHash breaks ties.
+class PerceptualIndex {
+public:
+    bool load(const std::string& path, std::string& error);
+    bool save(const std::string& path, std::string& error) const;
+
+    // Hashes the images under `directory` that are new or whose mtime/size
+    // changed, on the shared pool. Entries under `directory` whose files are
+    // gone are dropped; entries elsewhere are kept.
+    bool updateFromDirectory(const std::string& directory, bool recursive, IndexUpdateStats& stats,
+                             std::string& error, IndexUpdateProgress* progress = nullptr);
+
+    // Entries within `maxDistance` of `query`'s pHash, closest first.
+    std::vector<HashMatch> findSimilar(const PerceptualHashes& query, unsigned maxDistance,
+                                       std::size_t limit) const;
+
+    const std::vector<IndexedImage>& entries() const { return images; }
+    bool empty() const { return images.empty(); }
+
+private:
+    struct Node {
+        std::size_t entry = 0;
+        std::vector<std::pair<unsigned, std::size_t>> children;
+    };
+
+    void rebuildTree();
+
+    std::vector<IndexedImage> images;
+    std::vector<Node> tree;
+};
+
+// Extensions the indexer picks up: everything SFML decodes plus the raw formats.
+bool isIndexableImagePath(const std::string& path);
@@ -0,0 +1,200 @@
+#include "image_cache.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <system_error>
+#include <type_traits>
+#include <variant>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr std::uint64_t Prime1 = 0x9E3779B185EBCA87ull;
+constexpr std::uint64_t Prime2 = 0xC2B2AE3D27D4EB4Full;
+constexpr std::uint64_t Prime3 = 0x165667B19E3779F9ull;
+
+std::uint64_t rotateLeft(std::uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+std::uint64_t load64(const std::uint8_t* bytes) {
+    std::uint64_t value;
+    std::memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+std::uint64_t mixLane(std::uint64_t lane, std::uint64_t input) {
+    return rotateLeft(lane + input * Prime2, 31) * Prime1;
+}
+
+}
+
+std::size_t DecodedImage::byteSize() const {
+    std::size_t bytes = static_cast<std::size_t>(image.getSize().x) * image.getSize().y * 4;
+    for (const sf::Image& level : mipLevels) {
+        bytes += static_cast<std::size_t>(level.getSize().x) * level.getSize().y * 4;
+    }
+    if (precise) {
+        bytes += byteSizeOf(*precise);
+    }
+    return bytes;
+}
+
+bool haveSamePixels(const DecodedImage& image1, const DecodedImage& image2) {
+    if (&image1 == &image2) {
+        return true;
+    }
+    sf::Vector2u size = image1.image.getSize();
+    if (image1.contentHash != image2.contentHash || size != image2.image.getSize() ||
+        image1.precise.has_value() != image2.precise.has_value()) {
+        return false;
+    }
+
+    std::size_t bytes = static_cast<std::size_t>(size.x) * size.y * 4;
+    if (bytes > 0 && std::memcmp(image1.image.getPixelsPtr(), image2.image.getPixelsPtr(), bytes) != 0) {
+        return false;
+    }
+    if (!image1.precise) {
+        return true;
+    }
+    return std::visit(
+        [&](const auto& buffer1) {
+            using Buffer = std::decay_t<decltype(buffer1)>;
+            const Buffer* buffer2 = std::get_if<Buffer>(&*image2.precise);
+            return buffer2 && buffer1.size == buffer2->size && buffer1.channels == buffer2->channels &&
+                   std::memcmp(buffer1.samples.data(), buffer2->samples.data(), buffer1.byteSize()) == 0;
+        },
+        *image1.precise);
+}
+
+// Four independent multiply-rotate lanes over 32-byte blocks, so the loop is
+// limited by memory bandwidth rather than by one long dependency chain.
+std::uint64_t hashBytes(const void* data, std::size_t size) {
+    const std::uint8_t* bytes = static_cast<const std::uint8_t*>(data);
+    std::uint64_t lanes[4] = {Prime1 + Prime2, Prime2, 0, 0 - Prime1};
+
+    std::size_t offset = 0;
+    for (; offset + 32 <= size; offset += 32) {
+        for (int i = 0; i < 4; ++i) {
+            lanes[i] = mixLane(lanes[i], load64(bytes + offset + i * 8));
+        }
+    }
+
+    std::uint64_t hash = rotateLeft(lanes[0], 1) + rotateLeft(lanes[1], 7) + rotateLeft(lanes[2], 12) +
+                         rotateLeft(lanes[3], 18);
+    hash += static_cast<std::uint64_t>(size);
+
+    for (; offset < size; ++offset) {
+        hash = rotateLeft(hash ^ (bytes[offset] * Prime3), 11) * Prime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= Prime2;
+    hash ^= hash >> 29;
+    hash *= Prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+bool makeImageFileKey(const std::string& path, ImageFileKey& key) {
+    std::error_code ec;
+    fs::path canonical = fs::weakly_canonical(path, ec);
+    if (ec) {
+        return false;
+    }
+
+    std::uintmax_t fileSize = fs::file_size(canonical, ec);
+    if (ec) {
+        return false;
+    }
+    fs::file_time_type modified = fs::last_write_time(canonical, ec);
+    if (ec) {
+        return false;
+    }
+
+    key.path = canonical.string();
+    key.fileSize = fileSize;
+    key.modifiedTime = static_cast<std::int64_t>(modified.time_since_epoch().count());
+    return true;
+}
+
+std::size_t ImageCache::KeyHash::operator()(const ImageFileKey& key) const {
+    std::size_t hash = std::hash<std::string>{}(key.path);
+    hash ^= std::hash<std::int64_t>{}(key.modifiedTime) + 0x9E3779B9u + (hash << 6) + (hash >> 2);
+    hash ^= std::hash<std::uintmax_t>{}(key.fileSize) + 0x9E3779B9u + (hash << 6) + (hash >> 2);
+    return hash;
+}
+
+std::shared_ptr<const DecodedImage> ImageCache::find(const ImageFileKey& key) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = index.find(key);
+    if (it == index.end()) {
+        ++misses;
+        return nullptr;
+    }
+
+    ++hits;
+    lru.splice(lru.begin(), lru, it->second);
+    return it->second->image;
+}
+
+void ImageCache::insert(const ImageFileKey& key, std::shared_ptr<const DecodedImage> image) {
+    std::size_t bytes = image->byteSize();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (bytes > budget) {
+        return;
+    }
+
+    // Any older version of the same file is stale now.
+    for (auto it = lru.begin(); it != lru.end();) {
+        if (it->key.path == key.path) {
+            usedBytes -= it->bytes;
+            index.erase(it->key);
+            it = lru.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+
+    lru.push_front(Entry{key, std::move(image), bytes});
+    index.emplace(key, lru.begin());
+    usedBytes += bytes;
+    evictOverBudget();
+}
+
+void ImageCache::setBudget(std::size_t budgetBytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    budget = budgetBytes;
+    evictOverBudget();
+}
+
+void ImageCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    lru.clear();
+    index.clear();
+    usedBytes = 0;
+}
+
+ImageCacheStats ImageCache::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    ImageCacheStats stats;
+    stats.hits = hits;
+    stats.misses = misses;
+    stats.entries = lru.size();
+    stats.bytes = usedBytes;
+    stats.budgetBytes = budget;
+    return stats;
+}
+
+void ImageCache::evictOverBudget() {
+    while (usedBytes > budget && !lru.empty()) {
+        usedBytes -= lru.back().bytes;
+        index.erase(lru.back().key);
+        lru.pop_back();
+    }
+}
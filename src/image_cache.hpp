@@ -0,0 +1,95 @@
+#pragma once
+
+#include "pixel_buffer.hpp"
+
+#include <SFML/Graphics.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A fully loaded image: the pixels, their mip chain and a hash of the file
+// bytes they were decoded from. Shared read-only between the cache, the
+// textures and the diff once loading has finished. Files with 16-bit or float
+// samples also keep them in `precise`; `image` is then their 8-bit version.
+struct DecodedImage {
+    sf::Image image;
+    std::vector<sf::Image> mipLevels;
+    std::uint64_t contentHash = 0;
+    std::optional<PrecisePixels> precise;
+
+    std::size_t byteSize() const;
+};
+
+// Byte-identical files hash alike; used to skip the diff, not as a checksum.
+std::uint64_t hashBytes(const void* data, std::size_t size);
+
+// True when both decoded to the same pixels. The hashes only rule pairs out;
+// a match is confirmed by comparing the samples, so a collision cannot hide
+// a difference.
+bool haveSamePixels(const DecodedImage& image1, const DecodedImage& image2);
+
+// Identifies one version of a file on disk.
+struct ImageFileKey {
+    std::string path;
+    std::int64_t modifiedTime = 0;
+    std::uintmax_t fileSize = 0;
+
+    bool operator==(const ImageFileKey&) const = default;
+};
+
+// Fails when the file cannot be stat'ed; the caller then skips the cache.
+bool makeImageFileKey(const std::string& path, ImageFileKey& key);
+
+struct ImageCacheStats {
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    std::size_t entries = 0;
+    std::size_t bytes = 0;
+    std::size_t budgetBytes = 0;
+};
+
+// LRU of decoded images bounded by their pixel memory. Safe to use from the
+// loader threads. Evicted images stay alive for as long as someone still
+// holds them.
+class ImageCache {
+public:
+    static constexpr std::size_t DefaultBudgetBytes = std::size_t{2} << 30;
+
+    explicit ImageCache(std::size_t budgetBytes = DefaultBudgetBytes) : budget(budgetBytes) {}
+
+    std::shared_ptr<const DecodedImage> find(const ImageFileKey& key);
+
+    // Images larger than the whole budget are not kept.
+    void insert(const ImageFileKey& key, std::shared_ptr<const DecodedImage> image);
+
+    void setBudget(std::size_t budgetBytes);
+    void clear();
+    ImageCacheStats getStats() const;
+
+private:
+    struct KeyHash {
+        std::size_t operator()(const ImageFileKey& key) const;
+    };
+
+    struct Entry {
+        ImageFileKey key;
+        std::shared_ptr<const DecodedImage> image;
+        std::size_t bytes = 0;
+    };
+
+    void evictOverBudget();
+
+    mutable std::mutex mutex;
+    std::list<Entry> lru;
+    std::unordered_map<ImageFileKey, std::list<Entry>::iterator, KeyHash> index;
+    std::size_t budget;
+    std::size_t usedBytes = 0;
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+};
@@ -0,0 +1,1119 @@
+#include "image_codecs.hpp"
+
+#include "image_utils.hpp"
+#include "parallel.hpp"
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <queue>
+
+namespace {
+
+// Raw filtered bytes per independently deflated PNG band.
+constexpr std::size_t PngBandBytes = 512 * 1024;
+// Tokens per deflate block; each block gets its own Huffman tables.
+constexpr std::size_t BlockTokens = 1 << 15;
+
+constexpr unsigned WindowSize = 32768;
+constexpr unsigned HashBits = 15;
+constexpr unsigned MinMatch = 4;
+constexpr unsigned MaxMatch = 258;
+constexpr unsigned MaxCodeBits = 15;
+constexpr unsigned MaxCodeLengthBits = 7;
+
+constexpr std::uint8_t QoiOpIndex = 0x00;
+constexpr std::uint8_t QoiOpDiff = 0x40;
+constexpr std::uint8_t QoiOpLuma = 0x80;
+constexpr std::uint8_t QoiOpRun = 0xc0;
+constexpr std::uint8_t QoiOpRgb = 0xfe;
+constexpr std::uint8_t QoiOpRgba = 0xff;
+constexpr std::uint8_t QoiMask = 0xc0;
+constexpr std::size_t QoiHeaderBytes = 14;
+constexpr std::uint8_t QoiPadding[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+// Anything larger is rejected as corrupt rather than allocated.
+constexpr std::uint64_t MaxDecodedPixels = 400'000'000;
+
+constexpr std::uint8_t SparseDiffVersion = 1;
+constexpr std::size_t SparseDiffHeaderBytes = 4 + 4 + 12 + 4 + 4;
+constexpr std::uint8_t SparseTileSolid = 1;
+constexpr std::uint8_t SparseTileRaw = 2;
+constexpr std::uint8_t SparseTilePixels = 3;
+constexpr std::size_t SparsePixelBytes = 2 + 4;
+static_assert(SparseDiffTileSize * SparseDiffTileSize <= 65536, "pixel offsets are 16-bit");
+constexpr std::uint8_t SparseBackground[4] = {0, 0, 0, 255};
+
+// How hard each zlib-style level searches for matches. Low levels skip
+// indexing the inside of matches, which is most of the work on long runs.
+struct DeflateLevel {
+    unsigned maxChain;
+    unsigned niceLength;
+    bool indexInsideMatches;
+};
+
+constexpr DeflateLevel DeflateLevels[10] = {
+    {0, 0, false},    {4, 16, false},   {8, 32, false},    {16, 64, false},   {32, 128, true},
+    {64, 128, true},  {128, 258, true}, {256, 258, true},  {1024, 258, true}, {4096, 258, true},
+};
+
+constexpr std::uint16_t LengthBase[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                          31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+constexpr std::uint8_t LengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                          2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+constexpr std::uint16_t DistanceBase[30] = {1,   2,   3,   4,   5,   7,    9,    13,   17,   25,
+                                            33,  49,  65,  97,  129, 193,  257,  385,  513,  769,
+                                            1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+constexpr std::uint8_t DistanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                            6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+constexpr std::uint8_t CodeLengthOrder[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+// Symbol lookups for match lengths and distances.
+struct DeflateTables {
+    std::array<std::uint8_t, MaxMatch + 1> lengthCode{};
+    std::array<std::uint8_t, 256> nearDistanceCode{};
+    std::array<std::uint8_t, 256> farDistanceCode{};
+
+    DeflateTables() {
+        for (unsigned code = 0; code < 29; ++code) {
+            unsigned end = code + 1 < 29 ? LengthBase[code + 1] : MaxMatch + 1;
+            for (unsigned length = LengthBase[code]; length < end; ++length) {
+                lengthCode[length] = static_cast<std::uint8_t>(code);
+            }
+        }
+        lengthCode[MaxMatch] = 28;
+        for (unsigned code = 0; code < 30; ++code) {
+            unsigned end = code + 1 < 30 ? DistanceBase[code + 1] : WindowSize + 1;
+            for (unsigned distance = DistanceBase[code]; distance < end; ++distance) {
+                if (distance <= 256) {
+                    nearDistanceCode[distance - 1] = static_cast<std::uint8_t>(code);
+                }
+                else {
+                    farDistanceCode[(distance - 1) >> 7] = static_cast<std::uint8_t>(code);
+                }
+            }
+        }
+    }
+
+    unsigned distanceCode(unsigned distance) const {
+        return distance <= 256 ? nearDistanceCode[distance - 1] : farDistanceCode[(distance - 1) >> 7];
+    }
+};
+
+const DeflateTables& deflateTables() {
+    static const DeflateTables tables;
+    return tables;
+}
+
+// Deflate bit order: values go out least significant bit first.
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<std::uint8_t>& out) : out(out) {}
+
+    void put(std::uint32_t value, unsigned count) {
+        buffer |= static_cast<std::uint64_t>(value) << used;
+        used += count;
+        while (used >= 8) {
+            out.push_back(static_cast<std::uint8_t>(buffer));
+            buffer >>= 8;
+            used -= 8;
+        }
+    }
+
+    void alignToByte() {
+        if (used > 0) {
+            put(0, 8 - used);
+        }
+    }
+
+private:
+    std::vector<std::uint8_t>& out;
+    std::uint64_t buffer = 0;
+    unsigned used = 0;
+};
+
+struct Token {
+    std::uint16_t value;     // literal byte, or match length when distance > 0
+    std::uint16_t distance;
+};
+
+// Huffman code lengths of at most `maxBits`. When the optimal tree is too
+// deep, the frequencies are flattened and the tree rebuilt.
+void buildCodeLengths(const std::uint32_t* frequencies, unsigned count, unsigned maxBits, std::uint8_t* lengths) {
+    std::vector<std::uint32_t> weights(frequencies, frequencies + count);
+    std::vector<unsigned> symbols;
+    for (unsigned i = 0; i < count; ++i) {
+        if (weights[i] > 0) {
+            symbols.push_back(i);
+        }
+    }
+
+    std::fill(lengths, lengths + count, 0);
+    if (symbols.size() == 1) {
+        lengths[symbols[0]] = 1;
+    }
+    if (symbols.size() <= 1) {
+        return;
+    }
+
+    using Node = std::pair<std::uint64_t, unsigned>;
+    std::vector<int> parent(symbols.size() * 2);
+    while (true) {
+        std::priority_queue<Node, std::vector<Node>, std::greater<Node>> heap;
+        for (unsigned k = 0; k < symbols.size(); ++k) {
+            heap.push({weights[symbols[k]], k});
+        }
+        std::fill(parent.begin(), parent.end(), -1);
+        unsigned next = static_cast<unsigned>(symbols.size());
+        while (heap.size() > 1) {
+            Node a = heap.top();
+            heap.pop();
+            Node b = heap.top();
+            heap.pop();
+            parent[a.second] = static_cast<int>(next);
+            parent[b.second] = static_cast<int>(next);
+            heap.push({a.first + b.first, next++});
+        }
+
+        unsigned longest = 0;
+        for (unsigned k = 0; k < symbols.size(); ++k) {
+            unsigned depth = 0;
+            for (int node = static_cast<int>(k); parent[node] >= 0; node = parent[node]) {
+                ++depth;
+            }
+            lengths[symbols[k]] = static_cast<std::uint8_t>(depth);
+            longest = std::max(longest, depth);
+        }
+        if (longest <= maxBits) {
+            return;
+        }
+        for (unsigned symbol : symbols) {
+            weights[symbol] = (weights[symbol] >> 1) | 1;
+        }
+    }
+}
+
+// Canonical codes, bit-reversed for the LSB-first writer.
+void assignCodes(const std::uint8_t* lengths, unsigned count, std::uint16_t* codes) {
+    unsigned lengthCounts[MaxCodeBits + 1] = {};
+    for (unsigned i = 0; i < count; ++i) {
+        ++lengthCounts[lengths[i]];
+    }
+    lengthCounts[0] = 0;
+
+    unsigned nextCode[MaxCodeBits + 1] = {};
+    unsigned code = 0;
+    for (unsigned bits = 1; bits <= MaxCodeBits; ++bits) {
+        code = (code + lengthCounts[bits - 1]) << 1;
+        nextCode[bits] = code;
+    }
+
+    for (unsigned i = 0; i < count; ++i) {
+        unsigned length = lengths[i];
+        if (length == 0) {
+            codes[i] = 0;
+            continue;
+        }
+        unsigned value = nextCode[length]++;
+        unsigned reversed = 0;
+        for (unsigned bit = 0; bit < length; ++bit) {
+            reversed = (reversed << 1) | ((value >> bit) & 1);
+        }
+        codes[i] = static_cast<std::uint16_t>(reversed);
+    }
+}
+
+void writeStoredBlocks(BitWriter& bits, std::vector<std::uint8_t>& out, const std::uint8_t* data, std::size_t size) {
+    do {
+        std::size_t chunk = std::min<std::size_t>(size, 65535);
+        bits.put(0, 3);
+        bits.alignToByte();
+        bits.put(static_cast<std::uint32_t>(chunk), 16);
+        bits.put(static_cast<std::uint32_t>(~chunk & 0xFFFF), 16);
+        out.insert(out.end(), data, data + chunk);
+        data += chunk;
+        size -= chunk;
+    } while (size > 0);
+}
+
+struct CodeLengthSymbol {
+    std::uint8_t symbol;
+    std::uint8_t extra;
+};
+
+// Run-length codes 16-18 over the literal/length and distance code lengths.
+void encodeCodeLengths(const std::uint8_t* lengths, unsigned count, std::vector<CodeLengthSymbol>& symbols) {
+    for (unsigned i = 0; i < count;) {
+        std::uint8_t value = lengths[i];
+        unsigned run = 1;
+        while (i + run < count && lengths[i + run] == value) {
+            ++run;
+        }
+        i += run;
+
+        if (value == 0) {
+            while (run >= 11) {
+                unsigned chunk = std::min(run, 138u);
+                symbols.push_back({18, static_cast<std::uint8_t>(chunk - 11)});
+                run -= chunk;
+            }
+            if (run >= 3) {
+                symbols.push_back({17, static_cast<std::uint8_t>(run - 3)});
+                run = 0;
+            }
+        }
+        else {
+            symbols.push_back({value, 0});
+            --run;
+            while (run >= 3) {
+                unsigned chunk = std::min(run, 6u);
+                symbols.push_back({16, static_cast<std::uint8_t>(chunk - 3)});
+                run -= chunk;
+            }
+        }
+        for (; run > 0; --run) {
+            symbols.push_back({value, 0});
+        }
+    }
+}
+
+unsigned codeLengthExtraBits(std::uint8_t symbol) {
+    return symbol == 16 ? 2 : symbol == 17 ? 3 : symbol == 18 ? 7 : 0;
+}
+
+// One block with its own Huffman tables, or stored blocks when the raw bytes
+// it covers would be smaller.
+void writeBlock(BitWriter& bits, std::vector<std::uint8_t>& out, const std::vector<Token>& tokens,
+                const std::uint8_t* raw, std::size_t rawBytes) {
+    const DeflateTables& tables = deflateTables();
+    std::uint32_t literalCounts[286] = {};
+    std::uint32_t distanceCounts[30] = {};
+    for (const Token& token : tokens) {
+        if (token.distance == 0) {
+            ++literalCounts[token.value];
+        }
+        else {
+            ++literalCounts[257 + tables.lengthCode[token.value]];
+            ++distanceCounts[tables.distanceCode(token.distance)];
+        }
+    }
+    literalCounts[256] = 1;
+
+    std::uint8_t literalLengths[286] = {};
+    std::uint8_t distanceLengths[30] = {};
+    buildCodeLengths(literalCounts, 286, MaxCodeBits, literalLengths);
+    buildCodeLengths(distanceCounts, 30, MaxCodeBits, distanceLengths);
+    if (std::all_of(distanceLengths, distanceLengths + 30, [](std::uint8_t l) { return l == 0; })) {
+        distanceLengths[0] = 1;
+    }
+
+    unsigned literalCount = 286;
+    while (literalCount > 257 && literalLengths[literalCount - 1] == 0) {
+        --literalCount;
+    }
+    unsigned distanceCount = 30;
+    while (distanceCount > 1 && distanceLengths[distanceCount - 1] == 0) {
+        --distanceCount;
+    }
+    std::uint8_t lengths[286 + 30] = {};
+    std::copy_n(literalLengths, literalCount, lengths);
+    std::copy_n(distanceLengths, distanceCount, lengths + literalCount);
+
+    std::vector<CodeLengthSymbol> lengthSymbols;
+    encodeCodeLengths(lengths, literalCount + distanceCount, lengthSymbols);
+    std::uint32_t lengthCounts[19] = {};
+    for (const CodeLengthSymbol& entry : lengthSymbols) {
+        ++lengthCounts[entry.symbol];
+    }
+    std::uint8_t codeLengthLengths[19] = {};
+    buildCodeLengths(lengthCounts, 19, MaxCodeLengthBits, codeLengthLengths);
+    unsigned codeLengthCount = 19;
+    while (codeLengthCount > 4 && codeLengthLengths[CodeLengthOrder[codeLengthCount - 1]] == 0) {
+        --codeLengthCount;
+    }
+
+    std::uint64_t dynamicBits = 3 + 14 + 3 * codeLengthCount;
+    for (const CodeLengthSymbol& entry : lengthSymbols) {
+        dynamicBits += codeLengthLengths[entry.symbol] + codeLengthExtraBits(entry.symbol);
+    }
+    for (unsigned symbol = 0; symbol < 286; ++symbol) {
+        unsigned extra = symbol > 256 ? LengthExtra[symbol - 257] : 0;
+        dynamicBits += static_cast<std::uint64_t>(literalCounts[symbol]) * (literalLengths[symbol] + extra);
+    }
+    for (unsigned symbol = 0; symbol < 30; ++symbol) {
+        dynamicBits += static_cast<std::uint64_t>(distanceCounts[symbol]) * (distanceLengths[symbol] + DistanceExtra[symbol]);
+    }
+    std::uint64_t storedBits = 8 * static_cast<std::uint64_t>(rawBytes) + 40 * (rawBytes / 65535 + 1);
+    if (storedBits < dynamicBits) {
+        writeStoredBlocks(bits, out, raw, rawBytes);
+        return;
+    }
+
+    std::uint16_t literalCodes[286];
+    std::uint16_t distanceCodes[30];
+    std::uint16_t codeLengthCodes[19];
+    assignCodes(literalLengths, 286, literalCodes);
+    assignCodes(distanceLengths, 30, distanceCodes);
+    assignCodes(codeLengthLengths, 19, codeLengthCodes);
+
+    bits.put(2 << 1, 3);
+    bits.put(literalCount - 257, 5);
+    bits.put(distanceCount - 1, 5);
+    bits.put(codeLengthCount - 4, 4);
+    for (unsigned i = 0; i < codeLengthCount; ++i) {
+        bits.put(codeLengthLengths[CodeLengthOrder[i]], 3);
+    }
+    for (const CodeLengthSymbol& entry : lengthSymbols) {
+        bits.put(codeLengthCodes[entry.symbol], codeLengthLengths[entry.symbol]);
+        bits.put(entry.extra, codeLengthExtraBits(entry.symbol));
+    }
+
+    for (const Token& token : tokens) {
+        if (token.distance == 0) {
+            bits.put(literalCodes[token.value], literalLengths[token.value]);
+            continue;
+        }
+        unsigned lengthCode = tables.lengthCode[token.value];
+        bits.put(literalCodes[257 + lengthCode], literalLengths[257 + lengthCode]);
+        bits.put(token.value - LengthBase[lengthCode], LengthExtra[lengthCode]);
+        unsigned distanceCode = tables.distanceCode(token.distance);
+        bits.put(distanceCodes[distanceCode], distanceLengths[distanceCode]);
+        bits.put(token.distance - DistanceBase[distanceCode], DistanceExtra[distanceCode]);
+    }
+    bits.put(literalCodes[256], literalLengths[256]);
+}
+
+inline std::uint32_t hashFour(const std::uint8_t* p) {
+    std::uint32_t value;
+    std::memcpy(&value, p, 4);
+    return (value * 2654435761u) >> (32 - HashBits);
+}
+
+inline unsigned matchLength(const std::uint8_t* a, const std::uint8_t* b, unsigned maxLength) {
+    unsigned length = 0;
+    while (length + 8 <= maxLength) {
+        std::uint64_t x, y;
+        std::memcpy(&x, a + length, 8);
+        std::memcpy(&y, b + length, 8);
+        if (x != y) {
+            return length + static_cast<unsigned>(__builtin_ctzll(x ^ y) >> 3);
+        }
+        length += 8;
+    }
+    while (length < maxLength && a[length] == b[length]) {
+        ++length;
+    }
+    return length;
+}
+
+// Deflates `data` as non-final blocks and ends with an empty stored block,
+// so the output is byte-aligned and can be followed by another band's.
+void deflateBand(const std::uint8_t* data, std::size_t size, int level, std::vector<std::uint8_t>& out) {
+    BitWriter bits(out);
+    if (level == 0) {
+        writeStoredBlocks(bits, out, data, size);
+        bits.put(0, 3);
+        bits.alignToByte();
+        bits.put(0xFFFF0000u, 32);
+        return;
+    }
+
+    const DeflateLevel& params = DeflateLevels[level];
+    std::vector<std::int32_t> head(std::size_t{1} << HashBits, -1);
+    std::vector<std::int32_t> previous(WindowSize, -1);
+    std::vector<Token> tokens;
+    tokens.reserve(BlockTokens);
+
+    auto index = [&](std::size_t position) {
+        std::uint32_t hash = hashFour(data + position);
+        previous[position & (WindowSize - 1)] = head[hash];
+        head[hash] = static_cast<std::int32_t>(position);
+    };
+
+    std::size_t blockStart = 0;
+    std::size_t position = 0;
+    while (position < size) {
+        unsigned bestLength = 0;
+        unsigned bestDistance = 0;
+        if (position + MinMatch <= size) {
+            unsigned maxLength = static_cast<unsigned>(std::min<std::size_t>(MaxMatch, size - position));
+            std::int32_t candidate = head[hashFour(data + position)];
+            for (unsigned chain = params.maxChain; candidate >= 0 && chain > 0; --chain) {
+                std::size_t distance = position - static_cast<std::size_t>(candidate);
+                if (distance > WindowSize) {
+                    break;
+                }
+                if (data[candidate + bestLength] == data[position + bestLength]) {
+                    unsigned length = matchLength(data + candidate, data + position, maxLength);
+                    if (length > bestLength) {
+                        bestLength = length;
+                        bestDistance = static_cast<unsigned>(distance);
+                        if (length >= params.niceLength || length == maxLength) {
+                            break;
+                        }
+                    }
+                }
+                std::int32_t next = previous[candidate & (WindowSize - 1)];
+                if (next >= candidate) {
+                    break;
+                }
+                candidate = next;
+            }
+            index(position);
+        }
+
+        if (bestLength >= MinMatch) {
+            tokens.push_back({static_cast<std::uint16_t>(bestLength), static_cast<std::uint16_t>(bestDistance)});
+            if (params.indexInsideMatches) {
+                std::size_t end = std::min(position + bestLength, size - MinMatch + 1);
+                for (std::size_t p = position + 1; p < end; ++p) {
+                    index(p);
+                }
+            }
+            position += bestLength;
+        }
+        else {
+            tokens.push_back({data[position], 0});
+            ++position;
+        }
+
+        if (tokens.size() == BlockTokens) {
+            writeBlock(bits, out, tokens, data + blockStart, position - blockStart);
+            tokens.clear();
+            blockStart = position;
+        }
+    }
+    if (!tokens.empty()) {
+        writeBlock(bits, out, tokens, data + blockStart, position - blockStart);
+    }
+
+    bits.put(0, 3);
+    bits.alignToByte();
+    bits.put(0xFFFF0000u, 32);
+}
+
+std::uint32_t adler32(const std::uint8_t* data, std::size_t size) {
+    constexpr std::uint32_t Base = 65521;
+    constexpr std::size_t MaxRun = 5552;
+    std::uint32_t a = 1;
+    std::uint32_t b = 0;
+    while (size > 0) {
+        std::size_t run = std::min(size, MaxRun);
+        size -= run;
+        for (; run > 0; --run) {
+            a += *data++;
+            b += a;
+        }
+        a %= Base;
+        b %= Base;
+    }
+    return (b << 16) | a;
+}
+
+// Checksum of two concatenated pieces from their checksums, as zlib does it.
+std::uint32_t combineAdler32(std::uint32_t first, std::uint32_t second, std::size_t secondSize) {
+    constexpr std::uint32_t Base = 65521;
+    std::uint32_t remainder = static_cast<std::uint32_t>(secondSize % Base);
+    std::uint32_t sum1 = first & 0xFFFF;
+    std::uint32_t sum2 = static_cast<std::uint32_t>((static_cast<std::uint64_t>(remainder) * sum1) % Base);
+    sum1 += (second & 0xFFFF) + Base - 1;
+    sum2 += ((first >> 16) & 0xFFFF) + ((second >> 16) & 0xFFFF) + Base - remainder;
+    if (sum1 >= Base) sum1 -= Base;
+    if (sum1 >= Base) sum1 -= Base;
+    if (sum2 >= (Base << 1)) sum2 -= (Base << 1);
+    if (sum2 >= Base) sum2 -= Base;
+    return sum1 | (sum2 << 16);
+}
+
+const std::array<std::uint32_t, 256>& crcTable() {
+    static const std::array<std::uint32_t, 256> table = [] {
+        std::array<std::uint32_t, 256> values{};
+        for (std::uint32_t n = 0; n < 256; ++n) {
+            std::uint32_t c = n;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            values[n] = c;
+        }
+        return values;
+    }();
+    return table;
+}
+
+std::uint32_t crc32(const std::uint8_t* data, std::size_t size) {
+    const std::array<std::uint32_t, 256>& table = crcTable();
+    std::uint32_t c = 0xFFFFFFFFu;
+    for (std::size_t i = 0; i < size; ++i) {
+        c = table[(c ^ data[i]) & 0xFF] ^ (c >> 8);
+    }
+    return c ^ 0xFFFFFFFFu;
+}
+
+void putBigEndian(std::vector<std::uint8_t>& out, std::uint32_t value) {
+    out.push_back(static_cast<std::uint8_t>(value >> 24));
+    out.push_back(static_cast<std::uint8_t>(value >> 16));
+    out.push_back(static_cast<std::uint8_t>(value >> 8));
+    out.push_back(static_cast<std::uint8_t>(value));
+}
+
+void putLittleEndian(std::vector<std::uint8_t>& out, std::uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out.push_back(static_cast<std::uint8_t>(value >> (8 * i)));
+    }
+}
+
+std::uint32_t readBigEndian(const std::uint8_t* p) {
+    return (static_cast<std::uint32_t>(p[0]) << 24) | (static_cast<std::uint32_t>(p[1]) << 16) |
+           (static_cast<std::uint32_t>(p[2]) << 8) | p[3];
+}
+
+std::uint32_t readLittleEndian(const std::uint8_t* p) {
+    return p[0] | (static_cast<std::uint32_t>(p[1]) << 8) | (static_cast<std::uint32_t>(p[2]) << 16) |
+           (static_cast<std::uint32_t>(p[3]) << 24);
+}
+
+// Writes a whole chunk with the CRC over its type and data. `chunk` holds
+// 8 placeholder bytes followed by the data.
+void sealChunk(std::vector<std::uint8_t>& chunk, const char* type) {
+    std::uint32_t dataBytes = static_cast<std::uint32_t>(chunk.size() - 8);
+    chunk[0] = static_cast<std::uint8_t>(dataBytes >> 24);
+    chunk[1] = static_cast<std::uint8_t>(dataBytes >> 16);
+    chunk[2] = static_cast<std::uint8_t>(dataBytes >> 8);
+    chunk[3] = static_cast<std::uint8_t>(dataBytes);
+    std::memcpy(chunk.data() + 4, type, 4);
+    putBigEndian(chunk, crc32(chunk.data() + 4, chunk.size() - 4));
+}
+
+bool isOpaque(const sf::Image& image) {
+    sf::Vector2u size = image.getSize();
+    std::size_t pixels = static_cast<std::size_t>(size.x) * size.y;
+    const std::uint8_t* p = image.getPixelsPtr();
+    for (std::size_t i = 0; i < pixels; ++i) {
+        if (p[i * 4 + 3] != 255) {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline std::uint8_t paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = std::abs(p - a);
+    int pb = std::abs(p - b);
+    int pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) {
+        return static_cast<std::uint8_t>(a);
+    }
+    return static_cast<std::uint8_t>(pb <= pc ? b : c);
+}
+
+// Filters one row with each PNG filter and keeps the one with the smallest
+// sum of absolute (signed) bytes, the usual heuristic. Level 0 stores
+// unfiltered rows.
+void filterRow(const std::uint8_t* row, const std::uint8_t* above, std::size_t rowBytes, unsigned bpp, int level,
+               std::uint8_t* out, std::vector<std::uint8_t>& scratch) {
+    if (level == 0) {
+        out[0] = 0;
+        std::memcpy(out + 1, row, rowBytes);
+        return;
+    }
+
+    scratch.resize(5 * rowBytes);
+    std::uint64_t bestCost = ~std::uint64_t{0};
+    unsigned bestFilter = 0;
+    for (unsigned filter = 0; filter < 5; ++filter) {
+        std::uint8_t* candidate = scratch.data() + filter * rowBytes;
+        std::uint64_t cost = 0;
+        for (std::size_t i = 0; i < rowBytes; ++i) {
+            int left = i >= bpp ? row[i - bpp] : 0;
+            int up = above ? above[i] : 0;
+            int upLeft = (above && i >= bpp) ? above[i - bpp] : 0;
+            std::uint8_t predicted = 0;
+            switch (filter) {
+                case 1: predicted = static_cast<std::uint8_t>(left); break;
+                case 2: predicted = static_cast<std::uint8_t>(up); break;
+                case 3: predicted = static_cast<std::uint8_t>((left + up) >> 1); break;
+                case 4: predicted = paeth(left, up, upLeft); break;
+                default: break;
+            }
+            std::uint8_t value = static_cast<std::uint8_t>(row[i] - predicted);
+            candidate[i] = value;
+            cost += value < 128 ? value : 256 - value;
+        }
+        if (cost < bestCost) {
+            bestCost = cost;
+            bestFilter = filter;
+        }
+    }
+    out[0] = static_cast<std::uint8_t>(bestFilter);
+    std::memcpy(out + 1, scratch.data() + bestFilter * rowBytes, rowBytes);
+}
+
+// Pixel rows in the PNG's channel layout.
+void packRow(const std::uint8_t* rgba, unsigned width, bool withAlpha, std::uint8_t* out) {
+    if (withAlpha) {
+        std::memcpy(out, rgba, static_cast<std::size_t>(width) * 4);
+        return;
+    }
+    for (unsigned x = 0; x < width; ++x) {
+        std::memcpy(out + x * 3, rgba + x * 4, 3);
+    }
+}
+
+inline unsigned qoiHash(const std::uint8_t* p) {
+    return (p[0] * 3u + p[1] * 5u + p[2] * 7u + p[3] * 11u) % 64u;
+}
+
+}
+
+bool encodePng(const sf::Image& image, int level, std::vector<std::uint8_t>& out) {
+    ScopedTimer timer("Encode PNG");
+    sf::Vector2u size = image.getSize();
+    if (size.x == 0 || size.y == 0) {
+        return false;
+    }
+    level = std::clamp(level, 0, 9);
+
+    bool withAlpha = !isOpaque(image);
+    unsigned bpp = withAlpha ? 4 : 3;
+    std::size_t rowBytes = static_cast<std::size_t>(size.x) * bpp;
+    std::size_t filteredRowBytes = rowBytes + 1;
+    unsigned bandRows = static_cast<unsigned>(std::max<std::size_t>(1, PngBandBytes / filteredRowBytes));
+    std::size_t bands = (size.y + bandRows - 1) / bandRows;
+
+    // Each band becomes one IDAT chunk; the zlib header rides on the first.
+    std::vector<std::vector<std::uint8_t>> chunks(bands);
+    std::vector<std::uint32_t> checksums(bands);
+    sharedThreadPool()->parallelFor(bands, 1, [&](std::size_t begin, std::size_t end) {
+        std::vector<std::uint8_t> filtered;
+        std::vector<std::uint8_t> row, above, scratch;
+        row.resize(rowBytes);
+        above.resize(rowBytes);
+        for (std::size_t band = begin; band < end; ++band) {
+            unsigned firstRow = static_cast<unsigned>(band * bandRows);
+            unsigned rows = std::min(bandRows, size.y - firstRow);
+            filtered.resize(static_cast<std::size_t>(rows) * filteredRowBytes);
+            if (firstRow > 0) {
+                packRow(image.getPixelsPtr() + (firstRow - 1) * rowStride(image), size.x, withAlpha, above.data());
+            }
+            for (unsigned r = 0; r < rows; ++r) {
+                packRow(image.getPixelsPtr() + (firstRow + r) * rowStride(image), size.x, withAlpha, row.data());
+                filterRow(row.data(), firstRow + r > 0 ? above.data() : nullptr, rowBytes, bpp, level,
+                          filtered.data() + r * filteredRowBytes, scratch);
+                std::swap(row, above);
+            }
+            checksums[band] = adler32(filtered.data(), filtered.size());
+
+            std::vector<std::uint8_t>& chunk = chunks[band];
+            chunk.assign(8, 0);
+            if (band == 0) {
+                static constexpr std::uint8_t LevelFlags[10] = {0x01, 0x01, 0x5E, 0x5E, 0x5E,
+                                                                0x5E, 0x9C, 0xDA, 0xDA, 0xDA};
+                chunk.push_back(0x78);
+                chunk.push_back(LevelFlags[level]);
+            }
+            deflateBand(filtered.data(), filtered.size(), level, chunk);
+            sealChunk(chunk, "IDAT");
+        }
+    });
+
+    std::uint32_t checksum = checksums[0];
+    for (std::size_t band = 1; band < bands; ++band) {
+        unsigned rows = std::min<unsigned>(bandRows, size.y - static_cast<unsigned>(band * bandRows));
+        checksum = combineAdler32(checksum, checksums[band], rows * filteredRowBytes);
+    }
+
+    static constexpr std::uint8_t Signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    out.assign(Signature, Signature + 8);
+
+    std::vector<std::uint8_t> header(8, 0);
+    putBigEndian(header, size.x);
+    putBigEndian(header, size.y);
+    header.insert(header.end(), {8, static_cast<std::uint8_t>(withAlpha ? 6 : 2), 0, 0, 0});
+    sealChunk(header, "IHDR");
+    out.insert(out.end(), header.begin(), header.end());
+
+    std::size_t total = out.size();
+    for (const std::vector<std::uint8_t>& chunk : chunks) {
+        total += chunk.size();
+    }
+    out.reserve(total + 64);
+    for (std::vector<std::uint8_t>& chunk : chunks) {
+        out.insert(out.end(), chunk.begin(), chunk.end());
+        chunk = {};
+    }
+
+    // A final empty stored block closes the deflate stream.
+    std::vector<std::uint8_t> trailer(8, 0);
+    trailer.insert(trailer.end(), {0x01, 0x00, 0x00, 0xFF, 0xFF});
+    putBigEndian(trailer, checksum);
+    sealChunk(trailer, "IDAT");
+    out.insert(out.end(), trailer.begin(), trailer.end());
+
+    std::vector<std::uint8_t> end(8, 0);
+    sealChunk(end, "IEND");
+    out.insert(out.end(), end.begin(), end.end());
+    return true;
+}
+
+void QoiStreamEncoder::begin(sf::Vector2u size, std::vector<std::uint8_t>& out, unsigned channels) {
+    std::memset(index, 0, sizeof(index));
+    previous[0] = previous[1] = previous[2] = 0;
+    previous[3] = 255;
+    run = 0;
+
+    out.insert(out.end(), {'q', 'o', 'i', 'f'});
+    putBigEndian(out, size.x);
+    putBigEndian(out, size.y);
+    out.push_back(static_cast<std::uint8_t>(channels));
+    out.push_back(0);
+}
+
+void QoiStreamEncoder::encode(const std::uint8_t* rgba, std::size_t pixels, std::vector<std::uint8_t>& out) {
+    std::size_t start = out.size();
+    out.resize(start + pixels * 5 + 1);
+    std::uint8_t* p = out.data() + start;
+
+    for (std::size_t i = 0; i < pixels; ++i, rgba += 4) {
+        if (std::memcmp(rgba, previous, 4) == 0) {
+            if (++run == 62) {
+                *p++ = static_cast<std::uint8_t>(QoiOpRun | (run - 1));
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0) {
+            *p++ = static_cast<std::uint8_t>(QoiOpRun | (run - 1));
+            run = 0;
+        }
+
+        unsigned slot = qoiHash(rgba);
+        if (std::memcmp(index[slot], rgba, 4) == 0) {
+            *p++ = static_cast<std::uint8_t>(QoiOpIndex | slot);
+        }
+        else {
+            std::memcpy(index[slot], rgba, 4);
+            if (rgba[3] == previous[3]) {
+                int dr = static_cast<std::int8_t>(rgba[0] - previous[0]);
+                int dg = static_cast<std::int8_t>(rgba[1] - previous[1]);
+                int db = static_cast<std::int8_t>(rgba[2] - previous[2]);
+                int drDg = dr - dg;
+                int dbDg = db - dg;
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                    *p++ = static_cast<std::uint8_t>(QoiOpDiff | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+                }
+                else if (dg >= -32 && dg <= 31 && drDg >= -8 && drDg <= 7 && dbDg >= -8 && dbDg <= 7) {
+                    *p++ = static_cast<std::uint8_t>(QoiOpLuma | (dg + 32));
+                    *p++ = static_cast<std::uint8_t>((drDg + 8) << 4 | (dbDg + 8));
+                }
+                else {
+                    *p++ = QoiOpRgb;
+                    std::memcpy(p, rgba, 3);
+                    p += 3;
+                }
+            }
+            else {
+                *p++ = QoiOpRgba;
+                std::memcpy(p, rgba, 4);
+                p += 4;
+            }
+        }
+        std::memcpy(previous, rgba, 4);
+    }
+    out.resize(static_cast<std::size_t>(p - out.data()));
+}
+
+void QoiStreamEncoder::finish(std::vector<std::uint8_t>& out) {
+    if (run > 0) {
+        out.push_back(static_cast<std::uint8_t>(QoiOpRun | (run - 1)));
+        run = 0;
+    }
+    out.insert(out.end(), QoiPadding, QoiPadding + 8);
+}
+
+bool encodeQoi(const sf::Image& image, std::vector<std::uint8_t>& out) {
+    ScopedTimer timer("Encode QOI");
+    sf::Vector2u size = image.getSize();
+    if (size.x == 0 || size.y == 0) {
+        return false;
+    }
+
+    // Encoding band by band keeps the worst-case scratch space to one band
+    // instead of five bytes per pixel of the whole image.
+    constexpr unsigned BandRows = 64;
+    QoiStreamEncoder encoder;
+    out.clear();
+    encoder.begin(size, out, isOpaque(image) ? 3 : 4);
+    for (unsigned top = 0; top < size.y; top += BandRows) {
+        unsigned rows = std::min(BandRows, size.y - top);
+        encoder.encode(image.getPixelsPtr() + static_cast<std::size_t>(top) * size.x * 4,
+                       static_cast<std::size_t>(size.x) * rows, out);
+    }
+    encoder.finish(out);
+    return true;
+}
+
+bool decodeQoi(const std::uint8_t* data, std::size_t size, sf::Image& image) {
+    ScopedTimer timer("Decode QOI");
+    if (size < QoiHeaderBytes + sizeof(QoiPadding) || std::memcmp(data, "qoif", 4) != 0) {
+        return false;
+    }
+    sf::Vector2u imageSize(readBigEndian(data + 4), readBigEndian(data + 8));
+    std::uint64_t pixels = static_cast<std::uint64_t>(imageSize.x) * imageSize.y;
+    if (pixels == 0 || pixels > MaxDecodedPixels) {
+        return false;
+    }
+
+    image.resize(imageSize);
+    std::uint8_t* out = mutablePixelsPtr(image);
+    std::uint8_t index[64][4] = {};
+    std::uint8_t pixel[4] = {0, 0, 0, 255};
+    const std::uint8_t* p = data + QoiHeaderBytes;
+    const std::uint8_t* end = data + size - sizeof(QoiPadding);
+
+    for (std::uint64_t i = 0; i < pixels;) {
+        if (p >= end) {
+            return false;
+        }
+        std::uint8_t op = *p++;
+        unsigned repeat = 1;
+        if (op == QoiOpRgb) {
+            if (end - p < 3) return false;
+            std::memcpy(pixel, p, 3);
+            p += 3;
+        }
+        else if (op == QoiOpRgba) {
+            if (end - p < 4) return false;
+            std::memcpy(pixel, p, 4);
+            p += 4;
+        }
+        else if ((op & QoiMask) == QoiOpIndex) {
+            std::memcpy(pixel, index[op], 4);
+        }
+        else if ((op & QoiMask) == QoiOpDiff) {
+            pixel[0] = static_cast<std::uint8_t>(pixel[0] + ((op >> 4) & 3) - 2);
+            pixel[1] = static_cast<std::uint8_t>(pixel[1] + ((op >> 2) & 3) - 2);
+            pixel[2] = static_cast<std::uint8_t>(pixel[2] + (op & 3) - 2);
+        }
+        else if ((op & QoiMask) == QoiOpLuma) {
+            if (p >= end) return false;
+            std::uint8_t second = *p++;
+            int dg = (op & 0x3f) - 32;
+            pixel[0] = static_cast<std::uint8_t>(pixel[0] + dg - 8 + ((second >> 4) & 0x0f));
+            pixel[1] = static_cast<std::uint8_t>(pixel[1] + dg);
+            pixel[2] = static_cast<std::uint8_t>(pixel[2] + dg - 8 + (second & 0x0f));
+        }
+        else {
+            repeat = (op & 0x3f) + 1u;
+        }
+
+        std::memcpy(index[qoiHash(pixel)], pixel, 4);
+        repeat = static_cast<unsigned>(std::min<std::uint64_t>(repeat, pixels - i));
+        for (unsigned r = 0; r < repeat; ++r, ++i) {
+            std::memcpy(out + i * 4, pixel, 4);
+        }
+    }
+    return true;
+}
+
+bool encodeSparseDiff(const sf::Image& image, std::vector<std::uint8_t>& out) {
+    ScopedTimer timer("Encode sparse diff");
+    sf::Vector2u size = image.getSize();
+    if (size.x == 0 || size.y == 0) {
+        return false;
+    }
+
+    unsigned tilesX = (size.x + SparseDiffTileSize - 1) / SparseDiffTileSize;
+    unsigned tilesY = (size.y + SparseDiffTileSize - 1) / SparseDiffTileSize;
+    std::vector<std::vector<std::uint8_t>> tileRows(tilesY);
+    std::vector<std::uint32_t> storedCounts(tilesY, 0);
+    const std::uint8_t* pixels = image.getPixelsPtr();
+    std::size_t stride = rowStride(image);
+
+    sharedThreadPool()->parallelFor(tilesY, 1, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t ty = begin; ty < end; ++ty) {
+            unsigned y0 = static_cast<unsigned>(ty) * SparseDiffTileSize;
+            unsigned h = std::min(SparseDiffTileSize, size.y - y0);
+            for (unsigned tx = 0; tx < tilesX; ++tx) {
+                unsigned x0 = tx * SparseDiffTileSize;
+                unsigned w = std::min(SparseDiffTileSize, size.x - x0);
+                const std::uint8_t* first = pixels + y0 * stride + x0 * 4;
+
+                std::size_t setPixels = 0;
+                bool uniform = true;
+                for (unsigned y = 0; y < h; ++y) {
+                    const std::uint8_t* p = first + y * stride;
+                    for (unsigned x = 0; x < w; ++x, p += 4) {
+                        setPixels += std::memcmp(p, SparseBackground, 4) != 0;
+                        uniform = uniform && std::memcmp(p, first, 4) == 0;
+                    }
+                }
+                if (setPixels == 0) {
+                    continue;
+                }
+
+                std::vector<std::uint8_t>& row = tileRows[ty];
+                putLittleEndian(row, static_cast<std::uint32_t>(ty * tilesX + tx));
+                if (uniform) {
+                    row.push_back(SparseTileSolid);
+                    row.insert(row.end(), first, first + 4);
+                }
+                else if (4 + setPixels * SparsePixelBytes < static_cast<std::size_t>(w) * h * 4) {
+                    row.push_back(SparseTilePixels);
+                    putLittleEndian(row, static_cast<std::uint32_t>(setPixels));
+                    for (unsigned y = 0; y < h; ++y) {
+                        const std::uint8_t* p = first + y * stride;
+                        for (unsigned x = 0; x < w; ++x, p += 4) {
+                            if (std::memcmp(p, SparseBackground, 4) != 0) {
+                                unsigned offset = y * w + x;
+                                row.push_back(static_cast<std::uint8_t>(offset));
+                                row.push_back(static_cast<std::uint8_t>(offset >> 8));
+                                row.insert(row.end(), p, p + 4);
+                            }
+                        }
+                    }
+                }
+                else {
+                    row.push_back(SparseTileRaw);
+                    for (unsigned y = 0; y < h; ++y) {
+                        const std::uint8_t* p = first + y * stride;
+                        row.insert(row.end(), p, p + w * 4);
+                    }
+                }
+                ++storedCounts[ty];
+            }
+        }
+    });
+
+    std::uint32_t storedTiles = 0;
+    std::size_t total = SparseDiffHeaderBytes;
+    for (unsigned ty = 0; ty < tilesY; ++ty) {
+        storedTiles += storedCounts[ty];
+        total += tileRows[ty].size();
+    }
+
+    out.clear();
+    out.reserve(total);
+    out.insert(out.end(), {'S', 'D', 'I', 'F', SparseDiffVersion, 0, 0, 0});
+    putLittleEndian(out, size.x);
+    putLittleEndian(out, size.y);
+    putLittleEndian(out, SparseDiffTileSize);
+    out.insert(out.end(), SparseBackground, SparseBackground + 4);
+    putLittleEndian(out, storedTiles);
+    for (std::vector<std::uint8_t>& row : tileRows) {
+        out.insert(out.end(), row.begin(), row.end());
+        row = {};
+    }
+    return true;
+}
+
+bool decodeSparseDiff(const std::uint8_t* data, std::size_t size, sf::Image& image) {
+    ScopedTimer timer("Decode sparse diff");
+    if (size < SparseDiffHeaderBytes || std::memcmp(data, "SDIF", 4) != 0 || data[4] != SparseDiffVersion) {
+        return false;
+    }
+    sf::Vector2u imageSize(readLittleEndian(data + 8), readLittleEndian(data + 12));
+    unsigned tileSize = readLittleEndian(data + 16);
+    const std::uint8_t* background = data + 20;
+    std::uint32_t storedTiles = readLittleEndian(data + 24);
+    std::uint64_t pixelCount = static_cast<std::uint64_t>(imageSize.x) * imageSize.y;
+    if (pixelCount == 0 || pixelCount > MaxDecodedPixels || tileSize == 0) {
+        return false;
+    }
+
+    image.resize(imageSize, sf::Color(background[0], background[1], background[2], background[3]));
+    std::uint8_t* pixels = mutablePixelsPtr(image);
+    std::size_t stride = rowStride(image);
+    std::uint64_t tilesX = (imageSize.x + tileSize - 1) / tileSize;
+    std::uint64_t tilesY = (imageSize.y + tileSize - 1) / tileSize;
+    const std::uint8_t* p = data + SparseDiffHeaderBytes;
+    const std::uint8_t* end = data + size;
+
+    for (std::uint32_t i = 0; i < storedTiles; ++i) {
+        if (end - p < 5) {
+            return false;
+        }
+        std::uint64_t tile = readLittleEndian(p);
+        std::uint8_t kind = p[4];
+        p += 5;
+        if (tile >= tilesX * tilesY) {
+            return false;
+        }
+
+        unsigned x0 = static_cast<unsigned>(tile % tilesX) * tileSize;
+        unsigned y0 = static_cast<unsigned>(tile / tilesX) * tileSize;
+        unsigned w = std::min(tileSize, imageSize.x - x0);
+        unsigned h = std::min(tileSize, imageSize.y - y0);
+        std::uint8_t* target = pixels + y0 * stride + x0 * 4;
+        if (kind == SparseTileSolid) {
+            if (end - p < 4) {
+                return false;
+            }
+            for (unsigned y = 0; y < h; ++y) {
+                for (unsigned x = 0; x < w; ++x) {
+                    std::memcpy(target + y * stride + x * 4, p, 4);
+                }
+            }
+            p += 4;
+        }
+        else if (kind == SparseTileRaw) {
+            std::size_t tileBytes = static_cast<std::size_t>(w) * h * 4;
+            if (static_cast<std::size_t>(end - p) < tileBytes) {
+                return false;
+            }
+            copyPixelRows(p, static_cast<std::size_t>(w) * 4, target, stride, w, h);
+            p += tileBytes;
+        }
+        else if (kind == SparseTilePixels) {
+            if (end - p < 4) {
+                return false;
+            }
+            std::uint64_t count = readLittleEndian(p);
+            p += 4;
+            if (static_cast<std::uint64_t>(end - p) < count * SparsePixelBytes) {
+                return false;
+            }
+            for (std::uint64_t k = 0; k < count; ++k, p += SparsePixelBytes) {
+                unsigned offset = p[0] | (static_cast<unsigned>(p[1]) << 8);
+                if (offset >= w * h) {
+                    return false;
+                }
+                std::memcpy(target + (offset / w) * stride + (offset % w) * 4, p + 2, 4);
+            }
+        }
+        else {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool decodeImageBytes(const void* data, std::size_t size, sf::Image& image) {
+    const auto* bytes = static_cast<const std::uint8_t*>(data);
+    if (size >= 4 && std::memcmp(bytes, "qoif", 4) == 0) {
+        return decodeQoi(bytes, size, image);
+    }
+    if (size >= 4 && std::memcmp(bytes, "SDIF", 4) == 0) {
+        return decodeSparseDiff(bytes, size, image);
+    }
+    return image.loadFromMemory(data, size);
+}
+
+bool loadImageFile(const std::string& path, sf::Image& image) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        return false;
+    }
+    std::streamsize fileSize = file.tellg();
+    if (fileSize <= 0) {
+        return false;
+    }
+    std::vector<std::uint8_t> bytes(static_cast<std::size_t>(fileSize));
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char*>(bytes.data()), fileSize)) {
+        return false;
+    }
+    return decodeImageBytes(bytes.data(), bytes.size(), image);
+}
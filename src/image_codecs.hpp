@@ -0,0 +1,62 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// zlib-style levels: 0 stores, 1 is fastest, 9 searches longest.
+constexpr int DefaultPngLevel = 6;
+
+// Edge of the square tiles of the sparse difference format.
+constexpr unsigned SparseDiffTileSize = 64;
+
+struct ImageSaveOptions {
+    int pngLevel = DefaultPngLevel;
+};
+
+// 8-bit PNG, RGB when every pixel is opaque and RGBA otherwise. Row bands of
+// a fixed size are filtered and deflated independently on the shared pool,
+// so the output does not depend on the thread count.
+bool encodePng(const sf::Image& image, int level, std::vector<std::uint8_t>& out);
+
+// The Quite OK Image format: a single fast pass with no entropy coding.
+bool encodeQoi(const sf::Image& image, std::vector<std::uint8_t>& out);
+bool decodeQoi(const std::uint8_t* data, std::size_t size, sf::Image& image);
+
+// QOI written a few rows at a time, for streaming output. Streams declare 4
+// channels since the alpha channel is not known in advance; the channel
+// count is informative only and does not change the encoding.
+class QoiStreamEncoder {
+public:
+    void begin(sf::Vector2u size, std::vector<std::uint8_t>& out, unsigned channels = 4);
+    void encode(const std::uint8_t* rgba, std::size_t pixels, std::vector<std::uint8_t>& out);
+    void finish(std::vector<std::uint8_t>& out);
+
+private:
+    std::uint8_t index[64][4] = {};
+    std::uint8_t previous[4] = {0, 0, 0, 255};
+    unsigned run = 0;
+};
+
+// Difference images are mostly one colour, so this stores only the tiles
+// that are not: a tile is skipped when all its pixels equal the background
+// (opaque black), kept as one colour when uniform, as a list of its
+// non-background pixels when few are set, and raw otherwise.
+//
+//   "SDIF" u8 version=1 u8[3] 0   u32 width   u32 height   u32 tileSize
+//   u8[4] background RGBA          u32 storedTiles
+//   storedTiles x { u32 tileIndex (row-major)  u8 kind  payload }
+//   kind 1: u8[4] RGBA
+//   kind 2: the tile's RGBA rows, clipped at the edges
+//   kind 3: u32 count, count x { u16 y * tileWidth + x  u8[4] RGBA }
+//
+// All integers are little-endian.
+bool encodeSparseDiff(const sf::Image& image, std::vector<std::uint8_t>& out);
+bool decodeSparseDiff(const std::uint8_t* data, std::size_t size, sf::Image& image);
+
+// QOI and sparse differences are recognized by their magic bytes; everything
+// else goes to SFML.
+bool decodeImageBytes(const void* data, std::size_t size, sf::Image& image);
+bool loadImageFile(const std::string& path, sf::Image& image);
@@ -0,0 +1,128 @@
+#include "image_diff.hpp"
+
+#include "image_utils.hpp"
+#include "parallel.hpp"
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <mutex>
+
+void DiffAccumulator::merge(const DiffAccumulator& other) {
+    rows.differingPixels += other.rows.differingPixels;
+    rows.maxDelta = std::max(rows.maxDelta, other.rows.maxDelta);
+    delta.merge(other.delta);
+    ssimSum += other.ssimSum;
+    ssimWindows += other.ssimWindows;
+}
+
+void diffStrip(const std::uint8_t* pixels1, std::size_t stride1, const std::uint8_t* pixels2, std::size_t stride2,
+               std::uint8_t* out, std::size_t strideOut, unsigned width, unsigned rows, std::uint8_t tolerance,
+               bool withMetrics, DiffAccumulator& accumulator) {
+    const DiffKernel& kernel = activeDiffKernel();
+    std::mutex accumulatorMutex;
+
+    // Bands are whole SSIM strips so the windowed terms never straddle two
+    // workers; the metrics read each delta row right after it is written.
+    unsigned ssimStrips = (rows + SsimBlockSize - 1) / SsimBlockSize;
+    parallelForRows(ssimStrips, width * SsimBlockSize, [&](unsigned firstStrip, unsigned endStrip) {
+        DiffAccumulator band;
+        SsimAccumulator ssim(withMetrics ? width : 0);
+
+        unsigned firstRow = firstStrip * SsimBlockSize;
+        unsigned endRow = std::min(endStrip * SsimBlockSize, rows);
+        for (unsigned int y = firstRow; y < endRow; ++y) {
+            const std::uint8_t* row1 = pixels1 + y * stride1;
+            const std::uint8_t* row2 = pixels2 + y * stride2;
+            std::uint8_t* rowOut = out + y * strideOut;
+
+            kernel.run(row1, row2, rowOut, width, tolerance, band.rows);
+            if (withMetrics) {
+                kernel.accumulate(rowOut, width, band.delta);
+                ssim.addRow(row1, row2);
+                if ((y + 1) % SsimBlockSize == 0 || y + 1 == rows) {
+                    ssim.finishStrip();
+                }
+            }
+        }
+        band.ssimSum = ssim.ssimSum;
+        band.ssimWindows = ssim.windows;
+
+        std::lock_guard<std::mutex> lock(accumulatorMutex);
+        accumulator.merge(band);
+    });
+}
+
+void finishDifference(const DiffAccumulator& accumulator, std::uint8_t tolerance, DiffSummary& summary,
+                      DiffMetrics* metrics) {
+    summary.differingPixels = accumulator.rows.differingPixels;
+    summary.maxDelta = accumulator.rows.maxDelta;
+    summary.maxDeltaFraction = accumulator.rows.maxDelta / 255.0;
+
+    if (metrics) {
+        *metrics = DiffMetrics{};
+        metrics->width = summary.width;
+        metrics->height = summary.height;
+        metrics->tolerance = tolerance;
+        finalizeDiffMetrics(*metrics, accumulator.delta, accumulator.rows.differingPixels,
+                            accumulator.ssimSum, accumulator.ssimWindows);
+    }
+}
+
+bool computeDifference(const sf::Image& image1, const sf::Image& image2, sf::Image& diffImage,
+                       DiffSummary& summary, std::uint8_t tolerance, DiffMetrics* metrics) {
+    return computeShiftedDifference(image1, image2, {0, 0}, diffImage, summary, tolerance, metrics);
+}
+
+bool computeShiftedDifference(const sf::Image& image1, const sf::Image& image2, sf::Vector2i shift,
+                              sf::Image& diffImage, DiffSummary& summary, std::uint8_t tolerance,
+                              DiffMetrics* metrics) {
+    ScopedTimer timer("Compute difference");
+    sf::Vector2u size1 = image1.getSize();
+    sf::Vector2u size2 = image2.getSize();
+
+    // Overlap in image 1's coordinates.
+    long long left = std::max(0, shift.x);
+    long long top = std::max(0, shift.y);
+    long long right = std::min<long long>(size1.x, static_cast<long long>(size2.x) + shift.x);
+    long long bottom = std::min<long long>(size1.y, static_cast<long long>(size2.y) + shift.y);
+
+    summary = DiffSummary{};
+    summary.sizeMismatch = size1 != size2;
+
+    if (right <= left || bottom <= top) {
+        return false;
+    }
+    unsigned int width = static_cast<unsigned>(right - left);
+    unsigned int height = static_cast<unsigned>(bottom - top);
+    summary.width = width;
+    summary.height = height;
+
+    diffImage.resize({static_cast<unsigned>(right), static_cast<unsigned>(bottom)}, sf::Color::Transparent);
+
+    const std::uint8_t* pixels1 = image1.getPixelsPtr() + static_cast<std::size_t>(top) * rowStride(image1) +
+                                  static_cast<std::size_t>(left) * 4;
+    const std::uint8_t* pixels2 = image2.getPixelsPtr() +
+                                  static_cast<std::size_t>(top - shift.y) * rowStride(image2) +
+                                  static_cast<std::size_t>(left - shift.x) * 4;
+    std::uint8_t* out = mutablePixelsPtr(diffImage) + static_cast<std::size_t>(top) * rowStride(diffImage) +
+                        static_cast<std::size_t>(left) * 4;
+
+    DiffAccumulator accumulator;
+    diffStrip(pixels1, rowStride(image1), pixels2, rowStride(image2), out, rowStride(diffImage), width, height,
+              tolerance, metrics != nullptr, accumulator);
+
+    finishDifference(accumulator, tolerance, summary, metrics);
+    return true;
+}
+
+void identicalDifference(sf::Vector2u size, sf::Image& diffImage, DiffSummary& summary,
+                         std::uint8_t tolerance, DiffMetrics* metrics) {
+    summary = DiffSummary{};
+    summary.width = size.x;
+    summary.height = size.y;
+    diffImage.resize(size, sf::Color::Black);
+
+    DiffAccumulator accumulator;
+    accumulator.delta.histogram[0] = static_cast<std::uint64_t>(size.x) * size.y;
+    finishDifference(accumulator, tolerance, summary, metrics);
+}
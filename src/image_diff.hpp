@@ -0,0 +1,69 @@
+#pragma once
+
+#include "diff_kernels.hpp"
+#include "diff_metrics.hpp"
+
+#include <SFML/Graphics.hpp>
+#include <cstddef>
+#include <cstdint>
+
+struct DiffSummary {
+    unsigned width = 0;
+    unsigned height = 0;
+    std::uint64_t differingPixels = 0;
+    // In 8-bit units, rounded up; maxDeltaFraction is exact at any precision.
+    std::uint8_t maxDelta = 0;
+    double maxDeltaFraction = 0.0;
+    SampleType sampleType = SampleType::UInt8;
+    // Float pixels with a NaN or infinite delta, included in differingPixels
+    // but left out of the MSE.
+    std::uint64_t nonFinitePixels = 0;
+    bool sizeMismatch = false;
+
+    double differingPercent() const {
+        std::uint64_t total = static_cast<std::uint64_t>(width) * height;
+        return total == 0 ? 0.0 : 100.0 * static_cast<double>(differingPixels) / static_cast<double>(total);
+    }
+};
+
+// Running totals of a difference pass. Strips can be diffed independently and
+// their accumulators merged, which is how both the in-memory and the
+// streaming paths reach identical results.
+struct DiffAccumulator {
+    DiffRowStats rows;
+    DeltaStats delta;
+    double ssimSum = 0.0;
+    std::uint64_t ssimWindows = 0;
+
+    void merge(const DiffAccumulator& other);
+};
+
+// Diffs `rows` rows of RGBA pixels into `out`. For the SSIM windows to line
+// up, every strip except the last one of an image must be a multiple of
+// SsimBlockSize rows.
+void diffStrip(const std::uint8_t* pixels1, std::size_t stride1, const std::uint8_t* pixels2, std::size_t stride2,
+               std::uint8_t* out, std::size_t strideOut, unsigned width, unsigned rows, std::uint8_t tolerance,
+               bool withMetrics, DiffAccumulator& accumulator);
+
+void finishDifference(const DiffAccumulator& accumulator, std::uint8_t tolerance, DiffSummary& summary,
+                      DiffMetrics* metrics);
+
+// Writes |image1 - image2| per RGB channel (alpha forced to 255) over the
+// overlapping area. A pixel counts as differing when any channel delta
+// exceeds `tolerance`. When `metrics` is given, MSE/PSNR, the delta histogram
+// and SSIM are gathered in the same pass over the pixels.
+bool computeDifference(const sf::Image& image1, const sf::Image& image2, sf::Image& diffImage,
+                       DiffSummary& summary, std::uint8_t tolerance = 0, DiffMetrics* metrics = nullptr);
+
+// As computeDifference, with image 2's origin placed at `shift` in image 1's
+// coordinates (see estimateAlignment). The difference image stays on image
+// 1's grid and reaches the far corner of the overlap; pixels before the
+// overlap are transparent. Summary and metrics cover the overlap only.
+bool computeShiftedDifference(const sf::Image& image1, const sf::Image& image2, sf::Vector2i shift,
+                              sf::Image& diffImage, DiffSummary& summary, std::uint8_t tolerance = 0,
+                              DiffMetrics* metrics = nullptr);
+
+// Summary, metrics and a black difference image for inputs already known to
+// be identical (e.g. byte-identical files), without reading any pixels.
+void identicalDifference(sf::Vector2u size, sf::Image& diffImage, DiffSummary& summary,
+                         std::uint8_t tolerance = 0, DiffMetrics* metrics = nullptr);
@@ -0,0 +1,264 @@
+#include "image_loader.hpp"
+
+#include "image_codecs.hpp"
+#include "image_utils.hpp"
+#include "mapped_image.hpp"
+#include "mip_pyramid.hpp"
+#include "precise_image.hpp"
+#include "profiler.hpp"
+#include "raw_formats.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace {
+
+constexpr std::size_t ReadChunkBytes = 4 * 1024 * 1024;
+
+// Rows copied out of a mapped raw image between cancellation checks.
+constexpr unsigned MappedCopyRows = 256;
+
+// Raw formats need no decoding: the file is mapped and its rows are copied
+// (and widened to RGBA if needed) straight into the image. 16-bit and float
+// files keep their samples in `decoded.precise` next to an 8-bit copy.
+bool loadMappedImage(ImageLoadJob& job, DecodedImage& decoded) {
+    ScopedTimer timer("Load raw image");
+    MappedImage mapped;
+    if (!mapped.open(job.path, job.error)) {
+        return false;
+    }
+
+    decoded.contentHash = hashBytes(mapped.getFile().data(), mapped.getFile().size());
+
+    job.stage.store(LoadStage::Decoding);
+    if (!mapped.isEightBit()) {
+        PrecisePixels pixels;
+        if (!decodePrecisePixels(mapped.getHeader(), mapped.getSamples(), pixels)) {
+            job.error = "Failed to decode samples: " + job.path;
+            return false;
+        }
+        convertToDisplay(pixels, decoded.image);
+        decoded.precise = std::move(pixels);
+        job.progress.store(1.0f);
+        return true;
+    }
+
+    sf::Vector2u size = mapped.getSize();
+    decoded.image.resize(size);
+    std::uint8_t* pixels = mutablePixelsPtr(decoded.image);
+
+    for (unsigned y = 0; y < size.y; y += MappedCopyRows) {
+        if (job.cancelRequested.load()) {
+            job.error = "Loading cancelled: " + job.path;
+            return false;
+        }
+
+        unsigned rows = std::min(MappedCopyRows, size.y - y);
+        mapped.copyRowsAsRgba(y, rows, pixels + y * rowStride(decoded.image));
+        job.progress.store(static_cast<float>(y + rows) / static_cast<float>(size.y));
+    }
+    return true;
+}
+
+bool decodeImageFile(ImageLoadJob& job, DecodedImage& decoded) {
+    ScopedTimer timer("Read file");
+    std::ifstream file(job.path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        job.error = "Failed to load image: " + job.path;
+        return false;
+    }
+
+    std::streamsize fileSize = file.tellg();
+    file.seekg(0);
+    if (fileSize <= 0) {
+        job.error = "Failed to load image: " + job.path;
+        return false;
+    }
+
+    std::vector<char> bytes(static_cast<std::size_t>(fileSize));
+    std::size_t offset = 0;
+    while (offset < bytes.size()) {
+        if (job.cancelRequested.load()) {
+            job.error = "Loading cancelled: " + job.path;
+            return false;
+        }
+
+        std::size_t chunk = std::min(ReadChunkBytes, bytes.size() - offset);
+        if (!file.read(bytes.data() + offset, static_cast<std::streamsize>(chunk))) {
+            job.error = "Failed to read file: " + job.path;
+            return false;
+        }
+        offset += chunk;
+        job.progress.store(static_cast<float>(offset) / static_cast<float>(bytes.size()));
+    }
+
+    if (job.cancelRequested.load()) {
+        job.error = "Loading cancelled: " + job.path;
+        return false;
+    }
+
+    decoded.contentHash = hashBytes(bytes.data(), bytes.size());
+    timer.stop();
+
+    job.stage.store(LoadStage::Decoding);
+    ScopedTimer decodeTimer("Decode");
+    if (!decodeImageBytes(bytes.data(), bytes.size(), decoded.image)) {
+        job.error = "Failed to load image: " + job.path;
+        return false;
+    }
+    bytes = {};
+    return true;
+}
+
+void runImageLoad(ImageLoadJob& job, ImageCache* cache) {
+    auto fail = [&job](std::string message) {
+        job.error = std::move(message);
+        job.stage.store(LoadStage::Failed, std::memory_order_release);
+    };
+
+    if (job.cancelRequested.load()) {
+        fail("Loading cancelled: " + job.path);
+        return;
+    }
+
+    ImageFileKey key;
+    bool cacheable = cache && makeImageFileKey(job.path, key);
+    if (cacheable) {
+        if (std::shared_ptr<const DecodedImage> cached = cache->find(key)) {
+            job.result = std::move(cached);
+            job.fromCache = true;
+            job.stage.store(LoadStage::Ready, std::memory_order_release);
+            return;
+        }
+    }
+
+    job.stage.store(LoadStage::Reading);
+
+    auto decoded = std::make_shared<DecodedImage>();
+    if (isRawFormatPath(job.path)) {
+        if (!loadMappedImage(job, *decoded)) {
+            fail(job.error);
+            return;
+        }
+    }
+    else if (!decodeImageFile(job, *decoded)) {
+        fail(job.error);
+        return;
+    }
+
+    if (job.cancelRequested.load()) {
+        fail("Loading cancelled: " + job.path);
+        return;
+    }
+
+    job.stage.store(LoadStage::BuildingMipmaps);
+    {
+        ScopedTimer timer("Build mipmaps");
+        buildMipChain(decoded->image, decoded->mipLevels);
+    }
+
+    if (cacheable) {
+        cache->insert(key, decoded);
+    }
+    job.result = std::move(decoded);
+    job.stage.store(LoadStage::Ready, std::memory_order_release);
+}
+
+}
+
+std::shared_ptr<ImageLoadJob> startImageLoad(ThreadPool& pool, const std::string& path, ImageCache* cache) {
+    auto job = std::make_shared<ImageLoadJob>();
+    job->path = path;
+    pool.enqueue([job, cache] { runImageLoad(*job, cache); });
+    return job;
+}
+
+bool decodeImage(const std::string& path, DecodedImage& decoded, std::string& error) {
+    ImageLoadJob job;
+    job.path = path;
+    bool ok = isRawFormatPath(path) ? loadMappedImage(job, decoded) : decodeImageFile(job, decoded);
+    if (!ok) {
+        error = std::move(job.error);
+    }
+    return ok;
+}
+
+const char* loadStageName(LoadStage stage) {
+    switch (stage) {
+        case LoadStage::Queued: return "Queued";
+        case LoadStage::Reading: return "Reading";
+        case LoadStage::Decoding: return "Decoding";
+        case LoadStage::BuildingMipmaps: return "Building mipmaps";
+        case LoadStage::Ready: return "Ready";
+        case LoadStage::Failed: return "Failed";
+    }
+    return "";
+}
+
+std::shared_ptr<const DecodedImage> decodeCachedImage(const std::string& path, ImageCache& cache, bool& fromCache,
+                                                      std::string& error) {
+    fromCache = false;
+    ImageFileKey key;
+    bool cacheable = makeImageFileKey(path, key);
+    if (cacheable) {
+        if (std::shared_ptr<const DecodedImage> cached = cache.find(key)) {
+            fromCache = true;
+            return cached;
+        }
+    }
+
+    auto decoded = std::make_shared<DecodedImage>();
+    if (!decodeImage(path, *decoded, error)) {
+        return nullptr;
+    }
+    if (cacheable) {
+        cache.insert(key, decoded);
+    }
+    return decoded;
+}
+
+bool decodeImageMemory(const std::uint8_t* data, std::size_t size, DecodedImage& decoded, std::string& error) {
+    ScopedTimer timer("Decode from memory");
+    decoded.contentHash = hashBytes(data, size);
+
+    // parseRawImageHeader only looks at the extension to tell .rgba apart.
+    bool rgba = size >= 4 && std::memcmp(data, "RGBA", 4) == 0;
+    bool netpbm = size >= 2 && data[0] == 'P' &&
+                  (data[1] == '5' || data[1] == '6' || data[1] == '7' || data[1] == 'F' || data[1] == 'f');
+    if (!rgba && !netpbm) {
+        if (!decodeImageBytes(data, size, decoded.image)) {
+            error = "Unsupported image data";
+            return false;
+        }
+        return true;
+    }
+
+    RawImageHeader header;
+    if (!parseRawImageHeader(rgba ? "memory.rgba" : "memory.pam", data, std::min(size, MaxRawHeaderBytes), header,
+                             error)) {
+        return false;
+    }
+    if (size - header.dataOffset < header.dataBytes()) {
+        error = "Image data is truncated";
+        return false;
+    }
+
+    const std::uint8_t* samples = data + header.dataOffset;
+    if (header.sampleType != SampleType::UInt8) {
+        PrecisePixels pixels;
+        if (!decodePrecisePixels(header, samples, pixels)) {
+            error = "Failed to decode samples";
+            return false;
+        }
+        convertToDisplay(pixels, decoded.image);
+        decoded.precise = std::move(pixels);
+        return true;
+    }
+
+    decoded.image.resize(header.size);
+    expandToRgba(samples, header.channels, mutablePixelsPtr(decoded.image),
+                 static_cast<std::size_t>(header.size.x) * header.size.y);
+    return true;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "image_cache.hpp"
+#include "thread_pool.hpp"
+
+#include <SFML/Graphics.hpp>
+#include <atomic>
+#include <memory>
+#include <string>
+
+enum class LoadStage {
+    Queued,
+    Reading,
+    Decoding,
+    BuildingMipmaps,
+    Ready,
+    Failed,
+};
+
+// One background decode. The worker owns `result`, `fromCache` and `error`
+// until it publishes Ready or Failed; after that they belong to the main thread.
+struct ImageLoadJob {
+    std::string path;
+    std::atomic<LoadStage> stage{LoadStage::Queued};
+    std::atomic<float> progress{0.0f};
+    std::atomic<bool> cancelRequested{false};
+
+    std::shared_ptr<const DecodedImage> result;
+    bool fromCache = false;
+    std::string error;
+
+    bool finished() const {
+        LoadStage current = stage.load(std::memory_order_acquire);
+        return current == LoadStage::Ready || current == LoadStage::Failed;
+    }
+};
+
+// Reads, decodes and builds the mip chain for `path` on `pool`. Only the CPU
+// side happens there; the texture upload is left to the caller on the thread
+// that owns the GL context. With a `cache`, an unchanged file that was loaded
+// before is returned without touching the disk, and new results are added.
+std::shared_ptr<ImageLoadJob> startImageLoad(ThreadPool& pool, const std::string& path,
+                                             ImageCache* cache = nullptr);
+
+// Reads and decodes `path` on the calling thread, without mipmaps or the
+// cache, for pipelines that manage their own threads.
+bool decodeImage(const std::string& path, DecodedImage& decoded, std::string& error);
+
+// decodeImage through `cache`: an unchanged file decoded before is returned
+// as is (`fromCache` set), anything else is decoded and added. No mipmaps.
+std::shared_ptr<const DecodedImage> decodeCachedImage(const std::string& path, ImageCache& cache, bool& fromCache,
+                                                      std::string& error);
+
+// Decodes an image file held in memory: any format decodeImageBytes reads,
+// or one of the raw formats, recognised by its header.
+bool decodeImageMemory(const std::uint8_t* data, std::size_t size, DecodedImage& decoded, std::string& error);
+
+const char* loadStageName(LoadStage stage);
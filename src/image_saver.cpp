@@ -0,0 +1,48 @@
+#include "image_saver.hpp"
+
+#include "mapped_image.hpp"
+#include "profiler.hpp"
+
+#include <filesystem>
+#include <system_error>
+
+namespace {
+
+void runImageSave(ImageSaveJob& job, const sf::Image& image, const ImageSaveOptions& options) {
+    job.stage.store(SaveStage::Encoding);
+    std::uint64_t start = profileClockNs();
+    bool saved = saveImageFile(image, job.path, options);
+    job.encodeMs = static_cast<float>(profileClockNs() - start) / 1e6f;
+
+    if (!saved) {
+        job.error = "Failed to save image: " + job.path;
+        job.stage.store(SaveStage::Failed, std::memory_order_release);
+        return;
+    }
+
+    std::error_code ec;
+    std::uintmax_t size = std::filesystem::file_size(job.path, ec);
+    job.bytes = ec ? 0 : size;
+    job.stage.store(SaveStage::Done, std::memory_order_release);
+}
+
+}
+
+std::shared_ptr<ImageSaveJob> startImageSave(ThreadPool& pool, sf::Image image, const std::string& path,
+                                             const ImageSaveOptions& options) {
+    auto job = std::make_shared<ImageSaveJob>();
+    job->path = path;
+    auto pixels = std::make_shared<const sf::Image>(std::move(image));
+    pool.enqueue([job, pixels, options] { runImageSave(*job, *pixels, options); });
+    return job;
+}
+
+const char* saveStageName(SaveStage stage) {
+    switch (stage) {
+        case SaveStage::Queued: return "Queued";
+        case SaveStage::Encoding: return "Encoding";
+        case SaveStage::Done: return "Saved";
+        case SaveStage::Failed: return "Failed";
+    }
+    return "";
+}
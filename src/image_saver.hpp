@@ -0,0 +1,41 @@
+#pragma once
+
+#include "image_codecs.hpp"
+#include "thread_pool.hpp"
+
+#include <SFML/Graphics.hpp>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+enum class SaveStage {
+    Queued,
+    Encoding,
+    Done,
+    Failed,
+};
+
+// One background save. The worker owns `bytes`, `encodeMs` and `error` until
+// it publishes Done or Failed; after that they belong to the main thread.
+struct ImageSaveJob {
+    std::string path;
+    std::atomic<SaveStage> stage{SaveStage::Queued};
+
+    std::uintmax_t bytes = 0;
+    float encodeMs = 0.0f;
+    std::string error;
+
+    bool finished() const {
+        SaveStage current = stage.load(std::memory_order_acquire);
+        return current == SaveStage::Done || current == SaveStage::Failed;
+    }
+};
+
+// Encodes and writes `image` to `path` on `pool` with saveImageFile. The job
+// keeps its own copy of the pixels, so the caller may change or drop the
+// image right away.
+std::shared_ptr<ImageSaveJob> startImageSave(ThreadPool& pool, sf::Image image, const std::string& path,
+                                             const ImageSaveOptions& options = {});
+
+const char* saveStageName(SaveStage stage);
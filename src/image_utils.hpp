@@ -0,0 +1,36 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+// sf::Image only hands out a const pointer to its pixel storage. The storage
+// itself is a plain, non-const buffer owned by the image, so bulk writers
+// use this instead of going through setPixel one pixel at a time.
+inline std::uint8_t* mutablePixelsPtr(sf::Image& image) {
+    return const_cast<std::uint8_t*>(image.getPixelsPtr());
+}
+
+inline std::size_t rowStride(const sf::Image& image) {
+    return static_cast<std::size_t>(image.getSize().x) * 4;
+}
+
+// Lower-cased extension including the dot, e.g. ".png".
+inline std::string lowercaseExtension(const std::string& path) {
+    std::string extension = std::filesystem::path(path).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char ch) { return static_cast<char>(std::tolower(ch)); });
+    return extension;
+}
+
+// Copies `height` rows of `width` RGBA pixels between two buffers with
+// arbitrary row strides.
+inline void copyPixelRows(const std::uint8_t* source, std::size_t sourceStride, std::uint8_t* target,
+                          std::size_t targetStride, unsigned width, unsigned height) {
+    for (unsigned y = 0; y < height; ++y) {
+        std::copy_n(source + y * sourceStride, static_cast<std::size_t>(width) * 4, target + y * targetStride);
+    }
+}
@@ -0,0 +1,401 @@
+#include "lazy_diff.hpp"
+
+#include "image_diff.hpp"
+#include "image_utils.hpp"
+#include "imgui.h"
+#include "parallel.hpp"
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+
+namespace {
+
+constexpr int MaxUploadsPerFrame = 4;
+constexpr std::size_t GpuBudgetBytes = std::size_t{512} << 20;
+
+// Full-resolution rows diffed between cancellation checks.
+constexpr unsigned LevelZeroStripRows = 64;
+
+// Diffs the level-`level` pixels [x, x + width) x [y, y + height) of the
+// difference of `image1` and `image2`, with image 2's origin at `shift` in
+// image 1's coordinates. Only [overlapMin, overlapMax) holds both images;
+// level pixels outside it stay transparent. Each level pixel is the box
+// average of the 2^level x 2^level full-resolution diff pixels it covers, so
+// only one band of full-resolution rows is held at a time.
+bool diffTileAtLevel(const sf::Image& image1, const sf::Image& image2, sf::Vector2i shift, sf::Vector2u overlapMin,
+                     sf::Vector2u overlapMax, std::uint8_t tolerance, unsigned level, unsigned x, unsigned y,
+                     unsigned width, unsigned height, std::vector<std::uint8_t>& pixels,
+                     const std::atomic<bool>& cancelled) {
+    const std::size_t stride1 = rowStride(image1);
+    const std::size_t stride2 = rowStride(image2);
+    const unsigned scale = 1u << level;
+    const std::size_t outStride = static_cast<std::size_t>(width) * 4;
+
+    pixels.assign(outStride * height, 0);
+    DiffAccumulator unused;
+
+    // Full-resolution columns of the tile that both images cover.
+    const unsigned baseX = x << level;
+    const unsigned validX0 = std::max(baseX, overlapMin.x);
+    const unsigned validX1 = static_cast<unsigned>(
+        std::min<std::uint64_t>(static_cast<std::uint64_t>(x + width) << level, overlapMax.x));
+    if (validX1 <= validX0) {
+        return true;
+    }
+    const unsigned validWidth = validX1 - validX0;
+
+    auto rowPointers = [&](unsigned baseY) {
+        return std::make_pair(image1.getPixelsPtr() + baseY * stride1 + static_cast<std::size_t>(validX0) * 4,
+                              image2.getPixelsPtr() + (baseY - shift.y) * stride2 +
+                                  static_cast<std::size_t>(static_cast<int>(validX0) - shift.x) * 4);
+    };
+
+    if (level == 0) {
+        unsigned firstRow = std::max(y, overlapMin.y);
+        unsigned endRow = std::min(y + height, overlapMax.y);
+        for (unsigned row = firstRow; row < endRow; row += LevelZeroStripRows) {
+            if (cancelled.load(std::memory_order_relaxed)) {
+                return false;
+            }
+            unsigned rows = std::min(LevelZeroStripRows, endRow - row);
+            auto [pixels1, pixels2] = rowPointers(row);
+            diffStrip(pixels1, stride1, pixels2, stride2,
+                      pixels.data() + (row - y) * outStride + static_cast<std::size_t>(validX0 - x) * 4, outStride,
+                      validWidth, rows, tolerance, false, unused);
+        }
+        return true;
+    }
+
+    const std::size_t bandStride = static_cast<std::size_t>(validWidth) * 4;
+    std::vector<std::uint8_t> band(bandStride * scale);
+    std::vector<std::uint32_t> sums(static_cast<std::size_t>(width) * 3);
+
+    for (unsigned row = 0; row < height; ++row) {
+        if (cancelled.load(std::memory_order_relaxed)) {
+            return false;
+        }
+
+        unsigned baseY = (y + row) << level;
+        unsigned firstY = std::max(baseY, overlapMin.y);
+        unsigned endY = std::min(baseY + scale, overlapMax.y);
+        if (endY <= firstY) {
+            continue;
+        }
+        unsigned rows = endY - firstY;
+        auto [pixels1, pixels2] = rowPointers(firstY);
+        diffStrip(pixels1, stride1, pixels2, stride2, band.data(), bandStride, validWidth, rows, tolerance, false,
+                  unused);
+
+        std::fill(sums.begin(), sums.end(), 0u);
+        for (unsigned r = 0; r < rows; ++r) {
+            const std::uint8_t* source = band.data() + r * bandStride;
+            for (unsigned px = 0; px < validWidth; ++px) {
+                std::uint32_t* sum = sums.data() + static_cast<std::size_t>((validX0 + px - baseX) >> level) * 3;
+                sum[0] += source[px * 4];
+                sum[1] += source[px * 4 + 1];
+                sum[2] += source[px * 4 + 2];
+            }
+        }
+
+        std::uint8_t* target = pixels.data() + row * outStride;
+        for (unsigned column = 0; column < width; ++column) {
+            unsigned columnStart = baseX + (column << level);
+            unsigned first = std::max(columnStart, validX0);
+            unsigned end = std::min(columnStart + scale, validX1);
+            if (end <= first) {
+                continue;
+            }
+            std::uint32_t count = (end - first) * rows;
+            for (int c = 0; c < 3; ++c) {
+                target[column * 4 + c] = static_cast<std::uint8_t>((sums[column * 3 + c] + count / 2) / count);
+            }
+            target[column * 4 + 3] = 255;
+        }
+    }
+    return true;
+}
+
+}
+
+LazyDiffTexture::~LazyDiffTexture() {
+    clear();
+}
+
+std::uint64_t LazyDiffTexture::tileKey(unsigned level, unsigned tileX, unsigned tileY) {
+    return (static_cast<std::uint64_t>(level) << 56) | (static_cast<std::uint64_t>(tileY) << 28) | tileX;
+}
+
+unsigned LazyDiffTexture::levelWidth(unsigned level) const {
+    return static_cast<unsigned>((static_cast<std::uint64_t>(size.x) + (1u << level) - 1) >> level);
+}
+
+unsigned LazyDiffTexture::levelHeight(unsigned level) const {
+    return static_cast<unsigned>((static_cast<std::uint64_t>(size.y) + (1u << level) - 1) >> level);
+}
+
+bool LazyDiffTexture::start(std::shared_ptr<const DecodedImage> image1, std::shared_ptr<const DecodedImage> image2,
+                            std::uint8_t diffTolerance, sf::Vector2i imageShift) {
+    clear();
+    if (!image1 || !image2) {
+        return false;
+    }
+
+    // Same extent as computeShiftedDifference: image 1's grid up to the far
+    // corner of the overlap.
+    sf::Vector2u size1 = image1->image.getSize();
+    sf::Vector2u size2 = image2->image.getSize();
+    long long right = std::min<long long>(size1.x, static_cast<long long>(size2.x) + imageShift.x);
+    long long bottom = std::min<long long>(size1.y, static_cast<long long>(size2.y) + imageShift.y);
+    overlapMin = {static_cast<unsigned>(std::max(0, imageShift.x)), static_cast<unsigned>(std::max(0, imageShift.y))};
+    if (right <= static_cast<long long>(overlapMin.x) || bottom <= static_cast<long long>(overlapMin.y)) {
+        overlapMin = {0, 0};
+        return false;
+    }
+    size = {static_cast<unsigned>(right), static_cast<unsigned>(bottom)};
+
+    source1 = std::move(image1);
+    source2 = std::move(image2);
+    tolerance = diffTolerance;
+    shift = imageShift;
+
+    levelCount = 1;
+    while (levelWidth(levelCount - 1) > LazyDiffTileSize || levelHeight(levelCount - 1) > LazyDiffTileSize) {
+        ++levelCount;
+    }
+    return true;
+}
+
+void LazyDiffTexture::clear() {
+    for (auto& [key, tile] : tiles) {
+        if (tile.job) {
+            tile.job->cancelled.store(true);
+        }
+    }
+    tiles.clear();
+    source1.reset();
+    source2.reset();
+    size = {0, 0};
+    shift = {0, 0};
+    overlapMin = {0, 0};
+    levelCount = 0;
+    inFlight = 0;
+    pendingTiles = 0;
+    residentBytes = 0;
+}
+
+bool LazyDiffTexture::collectFinished(Tile& tile) {
+    TileJob& job = *tile.job;
+    if (!job.finished.load(std::memory_order_acquire)) {
+        return false;
+    }
+
+    ScopedTimer timer("Upload diff tile");
+    auto texture = std::make_unique<sf::Texture>();
+    if (!job.cancelled.load() && texture->resize({job.width, job.height})) {
+        texture->update(job.pixels.data(), {job.width, job.height}, {0, 0});
+        texture->setSmooth(job.level > 0);
+        tile.texture = std::move(texture);
+        tile.lastUsedFrame = frame;
+        residentBytes += static_cast<std::size_t>(job.width) * job.height * 4;
+    }
+    tile.job.reset();
+    --inFlight;
+    return true;
+}
+
+void LazyDiffTexture::schedule(unsigned level, unsigned firstX, unsigned lastX, unsigned firstY, unsigned lastY) {
+    auto wanted = [&](std::uint64_t key) {
+        unsigned keyLevel = static_cast<unsigned>(key >> 56);
+        unsigned tileY = static_cast<unsigned>((key >> 28) & 0xFFFFFFF);
+        unsigned tileX = static_cast<unsigned>(key & 0xFFFFFFF);
+        return keyLevel == level && tileX >= firstX && tileX <= lastX && tileY >= firstY && tileY <= lastY;
+    };
+
+    // Jobs the view has moved away from give their place to the new
+    // viewport; finished ones are uploaded a few per frame.
+    int uploadBudget = MaxUploadsPerFrame;
+    for (auto it = tiles.begin(); it != tiles.end();) {
+        Tile& tile = it->second;
+        if (tile.job && !wanted(it->first)) {
+            tile.job->cancelled.store(true);
+            tile.job.reset();
+            --inFlight;
+        }
+        else if (tile.job && uploadBudget > 0 && collectFinished(tile)) {
+            --uploadBudget;
+        }
+
+        if (!tile.job && !tile.texture) {
+            it = tiles.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+
+    float centerX = (static_cast<float>(firstX) + static_cast<float>(lastX)) / 2.0f;
+    float centerY = (static_cast<float>(firstY) + static_cast<float>(lastY)) / 2.0f;
+    std::vector<std::tuple<float, unsigned, unsigned>> candidates;
+    for (unsigned ty = firstY; ty <= lastY; ++ty) {
+        for (unsigned tx = firstX; tx <= lastX; ++tx) {
+            auto it = tiles.find(tileKey(level, tx, ty));
+            if (it == tiles.end() || (!it->second.texture && !it->second.job)) {
+                float dx = static_cast<float>(tx) - centerX;
+                float dy = static_cast<float>(ty) - centerY;
+                candidates.emplace_back(dx * dx + dy * dy, tx, ty);
+            }
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    std::shared_ptr<ThreadPool> pool = sharedThreadPool();
+    std::size_t maxInFlight = static_cast<std::size_t>(pool->size()) * 2;
+    for (const auto& [distance, tx, ty] : candidates) {
+        if (inFlight >= maxInFlight) {
+            break;
+        }
+
+        auto job = std::make_shared<TileJob>();
+        job->level = level;
+        job->x = tx * LazyDiffTileSize;
+        job->y = ty * LazyDiffTileSize;
+        job->width = std::min(LazyDiffTileSize, levelWidth(level) - job->x);
+        job->height = std::min(LazyDiffTileSize, levelHeight(level) - job->y);
+
+        pool->enqueue([job, image1 = source1, image2 = source2, shift = shift, overlapMin = overlapMin,
+                       overlapMax = size, tolerance = tolerance] {
+            ScopedTimer timer("Lazy diff tile");
+            if (!job->cancelled.load() &&
+                !diffTileAtLevel(image1->image, image2->image, shift, overlapMin, overlapMax, tolerance, job->level,
+                                 job->x, job->y, job->width, job->height, job->pixels, job->cancelled)) {
+                job->cancelled.store(true);
+            }
+            job->finished.store(true, std::memory_order_release);
+        });
+
+        tiles[tileKey(level, tx, ty)].job = std::move(job);
+        ++inFlight;
+    }
+}
+
+void LazyDiffTexture::drawTile(const Tile& tile, unsigned level, unsigned tileX, unsigned tileY, float originX,
+                               float originY, float zoom) {
+    sf::Vector2u tileSize = tile.texture->getSize();
+    std::uint64_t x0 = static_cast<std::uint64_t>(tileX) * LazyDiffTileSize << level;
+    std::uint64_t y0 = static_cast<std::uint64_t>(tileY) * LazyDiffTileSize << level;
+    std::uint64_t x1 = std::min<std::uint64_t>((static_cast<std::uint64_t>(tileX) * LazyDiffTileSize + tileSize.x)
+                                                   << level, size.x);
+    std::uint64_t y1 = std::min<std::uint64_t>((static_cast<std::uint64_t>(tileY) * LazyDiffTileSize + tileSize.y)
+                                                   << level, size.y);
+
+    ImVec2 pMin(originX + x0 * zoom, originY + y0 * zoom);
+    ImVec2 pMax(originX + x1 * zoom, originY + y1 * zoom);
+    ImTextureID texId = static_cast<ImTextureID>(static_cast<uintptr_t>(tile.texture->getNativeHandle()));
+    ImGui::GetWindowDrawList()->AddImage(texId, pMin, pMax);
+}
+
+void LazyDiffTexture::draw(float zoom) {
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    ImGui::Dummy(ImVec2(size.x * zoom, size.y * zoom));
+
+    if (!active() || zoom <= 0.0f) {
+        return;
+    }
+    ++frame;
+
+    unsigned level = 0;
+    if (zoom < 1.0f) {
+        level = static_cast<unsigned>(std::floor(std::log2(1.0f / zoom)));
+        level = std::min(level, levelCount - 1);
+    }
+
+    ImDrawList* drawList = ImGui::GetWindowDrawList();
+    ImVec2 clipMin = drawList->GetClipRectMin();
+    ImVec2 clipMax = drawList->GetClipRectMax();
+
+    auto tileRange = [&](unsigned atLevel, float lo, float hi, float start, unsigned levelExtent) {
+        float tileExtent = static_cast<float>(LazyDiffTileSize) * static_cast<float>(1u << atLevel) * zoom;
+        int count = static_cast<int>((levelExtent + LazyDiffTileSize - 1) / LazyDiffTileSize);
+        int first = static_cast<int>(std::floor((lo - start) / tileExtent));
+        int last = static_cast<int>(std::floor((hi - start) / tileExtent));
+        return std::make_pair(static_cast<unsigned>(std::clamp(first, 0, count - 1)),
+                              static_cast<unsigned>(std::clamp(last, 0, count - 1)));
+    };
+
+    auto [firstX, lastX] = tileRange(level, clipMin.x, clipMax.x, origin.x, levelWidth(level));
+    auto [firstY, lastY] = tileRange(level, clipMin.y, clipMax.y, origin.y, levelHeight(level));
+
+    // One ring of tiles around the viewport is diffed ahead of panning.
+    unsigned tilesX = (levelWidth(level) + LazyDiffTileSize - 1) / LazyDiffTileSize;
+    unsigned tilesY = (levelHeight(level) + LazyDiffTileSize - 1) / LazyDiffTileSize;
+    schedule(level, firstX > 0 ? firstX - 1 : 0, std::min(lastX + 1, tilesX - 1), firstY > 0 ? firstY - 1 : 0,
+             std::min(lastY + 1, tilesY - 1));
+
+    pendingTiles = 0;
+    for (unsigned ty = firstY; ty <= lastY; ++ty) {
+        for (unsigned tx = firstX; tx <= lastX; ++tx) {
+            auto it = tiles.find(tileKey(level, tx, ty));
+            if (it == tiles.end() || !it->second.texture) {
+                ++pendingTiles;
+            }
+        }
+    }
+
+    // Finished tiles of coarser levels cover the gaps, coarsest first.
+    if (pendingTiles > 0) {
+        for (unsigned coarse = levelCount - 1; coarse > level; --coarse) {
+            auto [coarseFirstX, coarseLastX] = tileRange(coarse, clipMin.x, clipMax.x, origin.x, levelWidth(coarse));
+            auto [coarseFirstY, coarseLastY] = tileRange(coarse, clipMin.y, clipMax.y, origin.y, levelHeight(coarse));
+            for (unsigned ty = coarseFirstY; ty <= coarseLastY; ++ty) {
+                for (unsigned tx = coarseFirstX; tx <= coarseLastX; ++tx) {
+                    auto it = tiles.find(tileKey(coarse, tx, ty));
+                    if (it != tiles.end() && it->second.texture) {
+                        it->second.lastUsedFrame = frame;
+                        drawTile(it->second, coarse, tx, ty, origin.x, origin.y, zoom);
+                    }
+                }
+            }
+        }
+    }
+
+    for (unsigned ty = firstY; ty <= lastY; ++ty) {
+        for (unsigned tx = firstX; tx <= lastX; ++tx) {
+            auto it = tiles.find(tileKey(level, tx, ty));
+            if (it != tiles.end() && it->second.texture) {
+                it->second.lastUsedFrame = frame;
+                drawTile(it->second, level, tx, ty, origin.x, origin.y, zoom);
+            }
+        }
+    }
+
+    evictUnusedTiles();
+}
+
+void LazyDiffTexture::evictUnusedTiles() {
+    if (residentBytes <= GpuBudgetBytes) {
+        return;
+    }
+
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> candidates;
+    for (const auto& [key, tile] : tiles) {
+        if (tile.texture && tile.lastUsedFrame < frame) {
+            candidates.emplace_back(tile.lastUsedFrame, key);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    for (const auto& [lastUsed, key] : candidates) {
+        if (residentBytes <= GpuBudgetBytes) {
+            break;
+        }
+        Tile& tile = tiles[key];
+        sf::Vector2u tileSize = tile.texture->getSize();
+        residentBytes -= static_cast<std::size_t>(tileSize.x) * tileSize.y * 4;
+        tile.texture.reset();
+        if (!tile.job) {
+            tiles.erase(key);
+        }
+    }
+}
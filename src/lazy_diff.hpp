@@ -0,0 +1,91 @@
+#pragma once
+
+#include "image_cache.hpp"
+
+#include <SFML/Graphics.hpp>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// Edge length, in level pixels, of the tiles a LazyDiffTexture computes.
+constexpr unsigned LazyDiffTileSize = 512;
+
+// Overlaps below this are cheap enough to diff in full right away.
+constexpr std::uint64_t LazyDiffMinPixels = std::uint64_t{4096} * 4096;
+
+// Difference view that computes only what the diff window shows. Tiles are
+// diffed on the shared pool at the mip level matching the zoom, nearest to
+// the middle of the viewport first, and kept until the GPU budget runs out.
+// Coarser tiles that are already done stand in while the others arrive.
+class LazyDiffTexture {
+public:
+    LazyDiffTexture() = default;
+    ~LazyDiffTexture();
+
+    LazyDiffTexture(const LazyDiffTexture&) = delete;
+    LazyDiffTexture& operator=(const LazyDiffTexture&) = delete;
+
+    // Keeps both images alive until clear(). The view covers the same area
+    // as computeShiftedDifference with image 2's origin at `shift`.
+    bool start(std::shared_ptr<const DecodedImage> image1, std::shared_ptr<const DecodedImage> image2,
+               std::uint8_t tolerance, sf::Vector2i shift = {0, 0});
+    void clear();
+
+    bool active() const { return static_cast<bool>(source1); }
+    sf::Vector2u getSize() const { return size; }
+    std::uint8_t getTolerance() const { return tolerance; }
+    sf::Vector2i getShift() const { return shift; }
+    std::size_t getResidentBytes() const { return residentBytes; }
+
+    // Tiles of the current view still being diffed or waiting for upload.
+    std::size_t getPendingTiles() const { return pendingTiles; }
+    bool isBusy() const { return inFlight > 0 || pendingTiles > 0; }
+
+    // Same contract as TiledTexture::draw.
+    void draw(float zoom);
+
+private:
+    struct TileJob {
+        unsigned level = 0;
+        unsigned x = 0;
+        unsigned y = 0;
+        unsigned width = 0;
+        unsigned height = 0;
+        std::vector<std::uint8_t> pixels;
+        std::atomic<bool> cancelled{false};
+        std::atomic<bool> finished{false};
+    };
+
+    struct Tile {
+        std::unique_ptr<sf::Texture> texture;
+        std::shared_ptr<TileJob> job;
+        std::uint64_t lastUsedFrame = 0;
+    };
+
+    static std::uint64_t tileKey(unsigned level, unsigned tileX, unsigned tileY);
+    unsigned levelWidth(unsigned level) const;
+    unsigned levelHeight(unsigned level) const;
+
+    void schedule(unsigned level, unsigned firstX, unsigned lastX, unsigned firstY, unsigned lastY);
+    bool collectFinished(Tile& tile);
+    void drawTile(const Tile& tile, unsigned level, unsigned tileX, unsigned tileY, float originX, float originY,
+                  float zoom);
+    void evictUnusedTiles();
+
+    std::shared_ptr<const DecodedImage> source1;
+    std::shared_ptr<const DecodedImage> source2;
+    std::uint8_t tolerance = 0;
+    sf::Vector2i shift;
+    sf::Vector2u overlapMin;
+    sf::Vector2u size;
+    unsigned levelCount = 0;
+
+    std::unordered_map<std::uint64_t, Tile> tiles;
+    std::size_t inFlight = 0;
+    std::size_t pendingTiles = 0;
+    std::uint64_t frame = 0;
+    std::size_t residentBytes = 0;
+};
@@ -2,35 +2,186 @@
 #include <SFML/System/Clock.hpp>
 #include "imgui.h"
 #include "imgui-SFML.h"
+#include "change_regions.hpp"
+#include "cli.hpp"
+#include "compact_diff.hpp"
+#include "comparison.hpp"
+#include "diff_visualization.hpp"
+#include "hash_index.hpp"
+#include "image_cache.hpp"
+#include "image_diff.hpp"
+#include "image_loader.hpp"
+#include "image_saver.hpp"
+#include "image_utils.hpp"
+#include "lazy_diff.hpp"
+#include "mapped_image.hpp"
+#include "multi_diff.hpp"
+#include "parallel.hpp"
+#include "precise_diff.hpp"
+#include "profiler.hpp"
+#include "registration.hpp"
+#include "resample.hpp"
+#include "selection_view.hpp"
+#include "sequence.hpp"
+#include "tiled_texture.hpp"
 #include <string>
 #include <cmath>
 #include <algorithm>
 #include <cstring>
+#include <cstdio>
+#include <cfloat>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <optional>
+
+// Frames drawn after the last input, so ImGui can settle hover and layout.
+constexpr int FramesAfterInput = 3;
+// Wake-up interval while a load, index or sequence scan job runs, for its
+// progress bar.
+constexpr int BackgroundPollMs = 50;
+// Wake-up interval when idle, for tooltips and the text cursor.
+constexpr int IdleWakeMs = 500;
+// Released tile textures kept for the next load in low-footprint mode.
+constexpr std::size_t TexturePoolBytes = std::size_t{64} << 20;
+
+enum class RedrawNeed {
+    Idle,
+    Background,
+    Continuous,
+};
+
+// Index update running on the load pool. The worker owns `index`, `stats`,
+// `ok` and `error` until it sets `finished`.
+struct IndexBuildJob {
+    std::string directory;
+    std::string indexPath;
+    PerceptualIndex index;
+    IndexUpdateProgress progress;
+    IndexUpdateStats stats;
+    bool ok = false;
+    std::string error;
+    std::atomic<bool> finished{false};
+};
+
+// Whole-sequence scan running on the load pool. The worker owns `results`
+// until it sets `finished`; `differingPercent` fills in under `mutex` as
+// frames complete, so the timeline grows while the scan runs.
+struct SequenceScanJob {
+    std::vector<SequenceFrame> frames;
+    SequenceOptions options;
+    SequenceProgress progress;
+    std::vector<SequenceFrameResult> results;
+    std::mutex mutex;
+    std::vector<float> differingPercent;
+    std::atomic<bool> finished{false};
+};
+
+// N-way comparison running on the load pool. The images are held here so
+// they outlive the job; the worker owns `results`, `ok` and `elapsedMs`
+// until it sets `finished`.
+struct MultiCompareJob {
+    int referenceIndex = 0;
+    std::shared_ptr<const DecodedImage> reference;
+    std::vector<int> targetIndices;
+    std::vector<std::shared_ptr<const DecodedImage>> targets;
+    std::uint8_t tolerance = 0;
+    std::vector<ReferenceComparison> results;
+    bool ok = false;
+    std::int32_t elapsedMs = 0;
+    std::atomic<bool> finished{false};
+};
+
+// Re-diff of the last full diff running on the load pool, for when
+// low-footprint mode kept only the compact deltas. With a `savePath` the
+// result is saved, rendered in `display` first if set; without one it
+// becomes diffImage again. The worker owns `image` and `ok` until it sets
+// `finished`.
+struct RediffJob {
+    std::shared_ptr<const DecodedImage> image1;
+    std::shared_ptr<const DecodedImage> image2;
+    sf::Vector2i shift;
+    std::uint8_t tolerance = 0;
+    std::optional<DiffDisplaySettings> display;
+    std::string savePath;
+    std::uint64_t diffGeneration = 0;
+    sf::Image image;
+    bool ok = false;
+    std::atomic<bool> finished{false};
+};
+
+// A queued save and whether its outcome has been shown in the status line.
+struct SaveEntry {
+    std::shared_ptr<ImageSaveJob> job;
+    bool reported = false;
+};
+
+// An image beyond the two panes, compared against the reference in the
+// N-way comparison.
+struct ExtraImage {
+    char path[512] = "";
+    std::shared_ptr<ImageLoadJob> loadJob;
+    std::shared_ptr<const DecodedImage> source;
+    TiledTexture texture;
+};
 
 struct AppState {
-    sf::Image image1;
-    sf::Image image2;
+    std::shared_ptr<const DecodedImage> source1;
+    std::shared_ptr<const DecodedImage> source2;
     sf::Image diffImage;
-    sf::Image selectionImage;
+    // What the Difference window shows when the display mode is not Raw,
+    // re-mapped from diffImage.
+    sf::Image diffDisplayImage;
+    // Low-footprint mode keeps the difference only as this and on the GPU;
+    // diffImage and diffDisplayImage are then empty between uses.
+    bool lowFootprint = false;
+    CompactDiff compactDiff;
+    std::vector<std::shared_ptr<RediffJob>> rediffJobs;
+    // Changes whenever the difference is recomputed or dropped, so a re-diff
+    // that finishes afterwards knows it is stale.
+    std::uint64_t diffGeneration = 0;
 
-    sf::Texture texture1;
-    sf::Texture texture2;
-    sf::Texture diffTexture;
-    sf::Texture selectionTexture;
+    TiledTexture texture1;
+    TiledTexture texture2;
+    TiledTexture diffTexture;
+    LazyDiffTexture lazyDiff;
+    SelectionComparison selectionView;
+    
+    ImageCache imageCache;
+    int cacheBudgetMB = static_cast<int>(ImageCache::DefaultBudgetBytes >> 20);
+    ThreadPool loadPool{2};
+    std::shared_ptr<ImageLoadJob> loadJob1;
+    std::shared_ptr<ImageLoadJob> loadJob2;
+    
+    // Encoding runs here so large PNGs don't stall the UI; one worker keeps
+    // saves in order.
+    ThreadPool savePool{1};
+    std::vector<SaveEntry> saves;
+    // Index builds and other long scans run here, so loadPool's two workers
+    // stay free to decode both images side by side.
+    ThreadPool jobPool{2};
+    int pngLevel = DefaultPngLevel;
     
     bool image1Loaded = false;
     bool image2Loaded = false;
     bool diffImageGenerated = false;
+    bool fullDiffComputed = false;
+    bool lazyDiffEnabled = true;
     bool selectionImageGenerated = false;
+    bool liveSelection = false;
     
     bool showDiffWindow = false;
     bool showSelectionWindow = false;
     
     char filePath1[512] = "";
     char filePath2[512] = "";
-    char savePathDiff[512] = "difference.bmp";
-    char savePathSelection[512] = "selection.bmp";
+    char savePathDiff[512] = "difference.png";
+    char savePathSelection[512] = "selection.png";
+    char savePathMetrics[512] = "metrics.json";
+    char indexPath[512] = "images.phash";
+    char indexDirectory[512] = "";
+    char tracePath[512] = "trace.json";
     
     float zoomLevel = 1.0f;  
     float zoomMin = 0.1f;    
@@ -40,99 +191,1611 @@ struct AppState {
     float relativeZoom2 = 1.0f;  
     bool autoMatchSizes = true;  
     
+    bool alignOnLoad = false;
+    bool alignEstimateScale = false;
+    bool alignmentValid = false;
+    Alignment alignment;
+    float alignmentMs = 0.0f;
+    
+    bool resampleImage2 = true;
+    int resampleFilter = static_cast<int>(ResampleFilter::Lanczos3);
+    ResampledImageCache resampledImage2;
+    
     sf::Vector2f panOffset = {0.0f, 0.0f};
     bool isPanning = false;
     sf::Vector2i lastMousePos;
     
-    bool isSelecting = false;
-    bool hasSelection = false;
-    sf::Vector2f selectionStart = {0.0f, 0.0f};
-    sf::Vector2f selectionEnd = {0.0f, 0.0f};    
-    int activePane = 0;
+    bool isSelecting = false;
+    bool hasSelection = false;
+    sf::Vector2f selectionStart = {0.0f, 0.0f};
+    sf::Vector2f selectionEnd = {0.0f, 0.0f};    
+    int activePane = 0;
+    
+    int threadCount = 1;
+    
+    int diffTolerance = 0;
+    DiffDisplaySettings diffDisplay;
+    float flickerPeriod = 0.5f;
+    sf::Clock flickerClock;
+    // Image 2 and its offset as the last full diff saw them, for the modes
+    // that show the inputs.
+    std::shared_ptr<const DecodedImage> diffSource2;
+    sf::Vector2i diffShift;
+    std::uint8_t fullDiffTolerance = 0;
+    DiffMetrics diffMetrics;
+    ChangeRegionIndex changeRegions;
+    int currentRegion = -1;
+    sf::Vector2f paneSize = {0.0f, 0.0f};
+    
+    PerceptualIndex hashIndex;
+    std::shared_ptr<IndexBuildJob> indexJob;
+    std::vector<HashMatch> similarMatches;
+    int similarMaxDistance = 10;
+    
+    char sequencePathA[512] = "";
+    char sequencePathB[512] = "";
+    std::vector<SequenceFrame> sequenceFrames;
+    // Differing percentage per frame once scanned, 0 before.
+    std::vector<float> sequenceTimeline;
+    int sequenceFrame = 0;
+    std::shared_ptr<SequenceScanJob> sequenceJob;
+    
+    // N-way comparison. Images are numbered Image 1, Image 2, then the
+    // extra ones; every loaded image is diffed against the reference.
+    std::vector<std::unique_ptr<ExtraImage>> extraImages;
+    int referenceIndex = 0;
+    int multiReference = -1;
+    std::vector<int> multiTargets;
+    std::vector<ReferenceComparison> multiResults;
+    std::vector<std::unique_ptr<TiledTexture>> multiDiffTextures;
+    std::shared_ptr<MultiCompareJob> multiJob;
+    bool showReferenceGrid = false;
+    bool gridShowsDiffs = false;
+    
+    bool powerSaving = true;
+    bool uiHasTimers = false;
+    
+    bool showProfiler = false;
+    sf::Clock profileRefreshClock;
+    std::vector<ProfileEvent> profileEvents;
+    std::vector<StageTimings> profileStages;
+    std::vector<float> frameTimesMs;
+    
+    std::string statusMessage = "Load two images to compare";
+};
+
+bool requestImageLoad(ThreadPool& pool, ImageCache& cache, const std::string& path,
+                      std::shared_ptr<ImageLoadJob>& job, std::string& statusMessage) {
+    if (path.empty()) {
+        statusMessage = "Error: Please enter a file path first";
+        return false;
+    }
+    
+    if (job) {
+        job->cancelRequested = true;
+    }
+    job = startImageLoad(pool, path, &cache);
+    statusMessage = "Loading: " + path;
+    return true;
+}
+
+void cancelImageLoad(std::shared_ptr<ImageLoadJob>& job, std::string& statusMessage) {
+    if (!job) {
+        return;
+    }
+    
+    job->cancelRequested = true;
+    statusMessage = "Loading cancelled: " + job->path;
+    job.reset();
+}
+
+bool finishImageLoad(std::shared_ptr<ImageLoadJob>& job, std::shared_ptr<const DecodedImage>& source,
+                     TiledTexture& texture, std::string& statusMessage) {
+    if (!job || !job->finished()) {
+        return false;
+    }
+    
+    std::shared_ptr<ImageLoadJob> done = std::move(job);
+    if (done->stage.load() == LoadStage::Failed) {
+        statusMessage = done->error;
+        return false;
+    }
+    
+    if (!texture.loadFromImage(done->result)) {
+        statusMessage = "Failed to create texture from image: " + done->path;
+        return false;
+    }
+    source = done->result;
+    
+    statusMessage = (done->fromCache ? "Loaded (cached): " : "Loaded: ") + done->path;
+    return true;
+}
+
+void renderLoadProgress(std::shared_ptr<ImageLoadJob>& job, std::string& statusMessage) {
+    if (!job) {
+        return;
+    }
+    
+    LoadStage stage = job->stage.load();
+    char overlay[64];
+    std::snprintf(overlay, sizeof(overlay), "%s...", loadStageName(stage));
+    
+    float fraction = stage == LoadStage::Decoding ? -1.0f * static_cast<float>(ImGui::GetTime())
+                                                  : job->progress.load();
+    ImGui::ProgressBar(fraction, ImVec2(200.0f, 0.0f), overlay);
+    ImGui::SameLine();
+    if (ImGui::Button("Cancel")) {
+        cancelImageLoad(job, statusMessage);
+    }
+}
+
+void renderImageCacheStats(AppState& state) {
+    ImageCacheStats stats = state.imageCache.getStats();
+    std::uint64_t lookups = stats.hits + stats.misses;
+    
+    ImGui::Text("Image cache: %llu hit(s), %llu miss(es)%s",
+                static_cast<unsigned long long>(stats.hits), static_cast<unsigned long long>(stats.misses),
+                lookups > 0 ? "" : " (no loads yet)");
+    ImGui::Text("%zu image(s), %.1f / %.0f MB", stats.entries,
+                static_cast<double>(stats.bytes) / (1024.0 * 1024.0),
+                static_cast<double>(stats.budgetBytes) / (1024.0 * 1024.0));
+    
+    ImGui::SliderInt("Cache budget (MB)", &state.cacheBudgetMB, 0, 16384);
+    if (ImGui::IsItemDeactivatedAfterEdit()) {
+        state.imageCache.setBudget(static_cast<std::size_t>(state.cacheBudgetMB) << 20);
+    }
+    if (ImGui::Button("Clear Cache")) {
+        state.imageCache.clear();
+    }
+}
+
+void refreshProfileStats(AppState& state) {
+    snapshotProfileEvents(state.profileEvents);
+    state.profileStages = summarizeProfileEvents(state.profileEvents);
+    
+    state.frameTimesMs.clear();
+    for (const ProfileEvent& event : state.profileEvents) {
+        if (std::strcmp(event.name, "Frame") == 0) {
+            state.frameTimesMs.push_back(static_cast<float>(event.durationNs / 1e6));
+        }
+    }
+    constexpr std::size_t MaxPlottedFrames = 240;
+    if (state.frameTimesMs.size() > MaxPlottedFrames) {
+        state.frameTimesMs.erase(state.frameTimesMs.begin(), state.frameTimesMs.end() - MaxPlottedFrames);
+    }
+}
+
+void renderProfiler(AppState& state) {
+    ImGui::SetNextWindowSize(ImVec2(560, 420), ImGuiCond_FirstUseEver);
+    if (!ImGui::Begin("Profiler", &state.showProfiler)) {
+        ImGui::End();
+        return;
+    }
+    
+    // Snapshots are cheap but sorting every stage each frame is not.
+    if (state.profileRefreshClock.getElapsedTime().asMilliseconds() >= 250) {
+        refreshProfileStats(state);
+        state.profileRefreshClock.restart();
+    }
+    
+    if (!state.frameTimesMs.empty()) {
+        float total = 0.0f;
+        for (float ms : state.frameTimesMs) {
+            total += ms;
+        }
+        float average = total / static_cast<float>(state.frameTimesMs.size());
+        ImGui::Text("Frame: %.2f ms average (%.0f FPS) over %zu frames", average,
+                    average > 0.0f ? 1000.0f / average : 0.0f, state.frameTimesMs.size());
+        ImGui::PlotLines("##FrameTimes", state.frameTimesMs.data(), static_cast<int>(state.frameTimesMs.size()), 0,
+                         nullptr, 0.0f, FLT_MAX, ImVec2(-1.0f, 80.0f));
+    }
+    else {
+        ImGui::TextDisabled("No frames recorded yet");
+    }
+    
+    if (ImGui::BeginTable("ProfileStages", 7, ImGuiTableFlags_Borders | ImGuiTableFlags_SizingFixedFit)) {
+        ImGui::TableSetupColumn("Stage");
+        ImGui::TableSetupColumn("Count");
+        ImGui::TableSetupColumn("Total ms");
+        ImGui::TableSetupColumn("p50");
+        ImGui::TableSetupColumn("p95");
+        ImGui::TableSetupColumn("p99");
+        ImGui::TableSetupColumn("Max");
+        ImGui::TableHeadersRow();
+        for (const StageTimings& stage : state.profileStages) {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(stage.name.c_str());
+            ImGui::TableNextColumn();
+            ImGui::Text("%zu", stage.count);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.1f", stage.totalMs);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", stage.p50Ms);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", stage.p95Ms);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", stage.p99Ms);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", stage.maxMs);
+        }
+        ImGui::EndTable();
+    }
+    
+    if (ImGui::Button("Clear")) {
+        clearProfileEvents();
+        refreshProfileStats(state);
+    }
+    ImGui::InputText("Trace Path", state.tracePath, sizeof(state.tracePath));
+    if (ImGui::Button("Export Chrome Trace")) {
+        snapshotProfileEvents(state.profileEvents);
+        std::string path = state.tracePath[0] != '\0' ? state.tracePath : "trace.json";
+        state.statusMessage = saveChromeTrace(path, state.profileEvents)
+                                  ? "Saved " + std::to_string(state.profileEvents.size()) + " event(s) to: " + path
+                                  : "Failed to save trace!";
+    }
+    ImGui::End();
+}
+
+void startIndexBuild(AppState& state) {
+    if (state.indexJob) {
+        return;
+    }
+    if (state.indexDirectory[0] == '\0' || state.indexPath[0] == '\0') {
+        state.statusMessage = "Enter a directory and an index file first!";
+        return;
+    }
+    
+    auto job = std::make_shared<IndexBuildJob>();
+    job->directory = state.indexDirectory;
+    job->indexPath = state.indexPath;
+    job->index = state.hashIndex;
+    state.indexJob = job;
+    state.statusMessage = "Indexing: " + job->directory;
+    
+    state.jobPool.enqueue([job] {
+        job->ok = job->index.updateFromDirectory(job->directory, true, job->stats, job->error, &job->progress) &&
+                  job->index.save(job->indexPath, job->error);
+        job->finished.store(true, std::memory_order_release);
+    });
+}
+
+void finishIndexBuild(AppState& state) {
+    if (!state.indexJob || !state.indexJob->finished.load(std::memory_order_acquire)) {
+        return;
+    }
+    
+    std::shared_ptr<IndexBuildJob> job = std::move(state.indexJob);
+    if (!job->ok) {
+        state.statusMessage = job->error;
+        return;
+    }
+    
+    state.hashIndex = std::move(job->index);
+    state.similarMatches.clear();
+    state.statusMessage = "Indexed " + std::to_string(state.hashIndex.entries().size()) + " image(s): " +
+                          std::to_string(job->stats.hashed) + " hashed, " + std::to_string(job->stats.removed) +
+                          " removed, " + std::to_string(job->stats.failed) + " unreadable.";
+}
+
+void loadHashIndex(AppState& state) {
+    std::string error;
+    if (!state.hashIndex.load(state.indexPath, error)) {
+        state.statusMessage = error;
+        return;
+    }
+    state.similarMatches.clear();
+    state.statusMessage = "Loaded index with " + std::to_string(state.hashIndex.entries().size()) + " image(s).";
+}
+
+void findSimilarImages(AppState& state) {
+    if (!state.image1Loaded) {
+        state.statusMessage = "Load Image 1 first!";
+        return;
+    }
+    if (state.hashIndex.empty()) {
+        state.statusMessage = "Load or build an index first!";
+        return;
+    }
+    
+    PerceptualHashes query = computePerceptualHashes(state.source1->image);
+    state.similarMatches = state.hashIndex.findSimilar(query, static_cast<unsigned>(state.similarMaxDistance), 100);
+    state.statusMessage = std::to_string(state.similarMatches.size()) + " similar image(s) found.";
+}
+
+void renderSimilarImages(AppState& state) {
+    ImGui::InputText("Index File", state.indexPath, sizeof(state.indexPath));
+    if (ImGui::Button("Load Index")) {
+        loadHashIndex(state);
+    }
+    ImGui::SameLine();
+    ImGui::Text("%zu image(s) indexed", state.hashIndex.entries().size());
+    
+    ImGui::InputText("Image Directory", state.indexDirectory, sizeof(state.indexDirectory));
+    if (!state.indexJob) {
+        if (ImGui::Button("Build/Update Index")) {
+            startIndexBuild(state);
+        }
+    }
+    else {
+        std::size_t total = state.indexJob->progress.total.load();
+        std::size_t done = state.indexJob->progress.done.load();
+        char overlay[64];
+        std::snprintf(overlay, sizeof(overlay), "%zu / %zu", done, total);
+        ImGui::ProgressBar(total > 0 ? static_cast<float>(done) / static_cast<float>(total)
+                                     : -1.0f * static_cast<float>(ImGui::GetTime()),
+                           ImVec2(200.0f, 0.0f), overlay);
+        ImGui::SameLine();
+        if (ImGui::Button("Cancel Indexing")) {
+            state.indexJob->progress.cancelRequested = true;
+        }
+    }
+    
+    ImGui::SliderInt("Max Distance", &state.similarMaxDistance, 0, 32);
+    if (ImGui::Button("Find Similar to Image 1")) {
+        findSimilarImages(state);
+    }
+    
+    if (state.similarMatches.empty()) {
+        return;
+    }
+    
+    ImGui::BeginChild("SimilarList", ImVec2(0, 140), true);
+    ImGuiListClipper clipper;
+    clipper.Begin(static_cast<int>(state.similarMatches.size()));
+    while (clipper.Step()) {
+        for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
+            const HashMatch& match = state.similarMatches[i];
+            const std::string& path = state.hashIndex.entries()[match.entry].path;
+            
+            ImGui::PushID(i);
+            if (ImGui::SmallButton("As 1")) {
+                std::snprintf(state.filePath1, sizeof(state.filePath1), "%s", path.c_str());
+                requestImageLoad(state.loadPool, state.imageCache, state.filePath1, state.loadJob1, state.statusMessage);
+            }
+            ImGui::SameLine();
+            if (ImGui::SmallButton("As 2")) {
+                std::snprintf(state.filePath2, sizeof(state.filePath2), "%s", path.c_str());
+                requestImageLoad(state.loadPool, state.imageCache, state.filePath2, state.loadJob2, state.statusMessage);
+            }
+            ImGui::SameLine();
+            ImGui::Text("%2u  %s", match.pHashDistance, path.c_str());
+            ImGui::PopID();
+        }
+    }
+    ImGui::EndChild();
+}
+
+// Loads frame `index` of the open sequence into both panes.
+void showSequenceFrame(AppState& state, int index) {
+    if (state.sequenceFrames.empty()) {
+        return;
+    }
+    
+    index = std::clamp(index, 0, static_cast<int>(state.sequenceFrames.size()) - 1);
+    state.sequenceFrame = index;
+    const SequenceFrame& frame = state.sequenceFrames[index];
+    std::snprintf(state.filePath1, sizeof(state.filePath1), "%s", frame.pathA.c_str());
+    std::snprintf(state.filePath2, sizeof(state.filePath2), "%s", frame.pathB.c_str());
+    requestImageLoad(state.loadPool, state.imageCache, state.filePath1, state.loadJob1, state.statusMessage);
+    requestImageLoad(state.loadPool, state.imageCache, state.filePath2, state.loadJob2, state.statusMessage);
+    state.statusMessage = "Loading frame " + std::to_string(frame.number);
+}
+
+void openSequence(AppState& state) {
+    if (state.sequenceJob) {
+        state.statusMessage = "Wait for the sequence scan to finish!";
+        return;
+    }
+    
+    std::vector<SequenceFrame> frames;
+    std::size_t unmatched = 0;
+    std::string error;
+    if (!collectSequenceFrames(state.sequencePathA, state.sequencePathB, frames, unmatched, error)) {
+        state.statusMessage = error;
+        return;
+    }
+    
+    state.sequenceFrames = std::move(frames);
+    state.sequenceTimeline.assign(state.sequenceFrames.size(), 0.0f);
+    showSequenceFrame(state, 0);
+    state.statusMessage = "Opened " + std::to_string(state.sequenceFrames.size()) + " frame pair(s)" +
+                          (unmatched > 0 ? ", " + std::to_string(unmatched) + " frame(s) without a counterpart" : "");
+}
+
+void startSequenceScan(AppState& state) {
+    if (state.sequenceJob || state.sequenceFrames.empty()) {
+        return;
+    }
+    
+    auto job = std::make_shared<SequenceScanJob>();
+    job->frames = state.sequenceFrames;
+    job->options.tolerance = static_cast<std::uint8_t>(state.diffTolerance);
+    job->options.withMetrics = false;
+    job->options.resample = state.resampleImage2;
+    job->options.resampleFilter = static_cast<ResampleFilter>(state.resampleFilter);
+    job->differingPercent.assign(job->frames.size(), 0.0f);
+    state.sequenceJob = job;
+    state.statusMessage = "Scanning " + std::to_string(job->frames.size()) + " frame pair(s)";
+    
+    state.jobPool.enqueue([job] {
+        runSequenceComparison(job->frames, job->options, job->results, &job->progress, [&job = *job](std::size_t i) {
+            std::lock_guard<std::mutex> lock(job.mutex);
+            job.differingPercent[i] = job.results[i].failed ? 0.0f
+                                                             : static_cast<float>(job.results[i].summary.differingPercent());
+        });
+        job->finished.store(true, std::memory_order_release);
+    });
+}
+
+void updateSequenceScan(AppState& state) {
+    if (!state.sequenceJob) {
+        return;
+    }
+    
+    std::shared_ptr<SequenceScanJob> job = state.sequenceJob;
+    {
+        std::lock_guard<std::mutex> lock(job->mutex);
+        state.sequenceTimeline = job->differingPercent;
+    }
+    if (!job->finished.load(std::memory_order_acquire)) {
+        return;
+    }
+    
+    state.sequenceJob.reset();
+    std::size_t changed = 0;
+    std::size_t failed = 0;
+    for (const SequenceFrameResult& result : job->results) {
+        failed += result.failed ? 1 : 0;
+        changed += (!result.failed && result.summary.differingPixels > 0) ? 1 : 0;
+    }
+    state.statusMessage = "Scanned " + std::to_string(job->results.size()) + " frame pair(s): " +
+                          std::to_string(changed) + " differ, " + std::to_string(failed) + " failed.";
+}
+
+// Next frame after the current one (or before it, for `step` -1) whose scan
+// found differing pixels.
+void jumpToChangedFrame(AppState& state, int step) {
+    int count = static_cast<int>(state.sequenceTimeline.size());
+    for (int i = state.sequenceFrame + step; i >= 0 && i < count; i += step) {
+        if (state.sequenceTimeline[i] > 0.0f) {
+            showSequenceFrame(state, i);
+            return;
+        }
+    }
+    state.statusMessage = "No other changed frame found.";
+}
+
+void renderSequencePanel(AppState& state) {
+    ImGui::InputText("Sequence A", state.sequencePathA, sizeof(state.sequencePathA));
+    ImGui::InputText("Sequence B", state.sequencePathB, sizeof(state.sequencePathB));
+    if (ImGui::IsItemHovered()) {
+        ImGui::SetTooltip("A directory of numbered frames, or a pattern like render_%%04d.png or render_####.png");
+    }
+    if (ImGui::Button("Open Sequence")) {
+        openSequence(state);
+    }
+    
+    if (state.sequenceFrames.empty()) {
+        return;
+    }
+    
+    int count = static_cast<int>(state.sequenceFrames.size());
+    ImGui::SameLine();
+    ImGui::Text("%d frame pair(s)", count);
+    
+    // Click or drag on the timeline to scrub; bar heights are the scanned
+    // differing percentage. Plots take no input, so an invisible button
+    // underneath catches the drag.
+    ImVec2 timelinePos = ImGui::GetCursorScreenPos();
+    ImVec2 timelineSize(std::max(1.0f, ImGui::GetContentRegionAvail().x), 50.0f);
+    ImGui::InvisibleButton("##sequenceScrub", timelineSize);
+    if (ImGui::IsItemActive()) {
+        int index = static_cast<int>((ImGui::GetMousePos().x - timelinePos.x) / timelineSize.x * count);
+        index = std::clamp(index, 0, count - 1);
+        if (index != state.sequenceFrame) {
+            showSequenceFrame(state, index);
+        }
+    }
+    ImGui::SetCursorScreenPos(timelinePos);
+    char overlay[64];
+    std::snprintf(overlay, sizeof(overlay), "Frame %ld", state.sequenceFrames[state.sequenceFrame].number);
+    ImGui::PlotHistogram("##sequenceTimeline", state.sequenceTimeline.data(), count, 0, overlay, 0.0f, FLT_MAX,
+                         timelineSize);
+    
+    int frame = state.sequenceFrame;
+    if (ImGui::SliderInt("Frame", &frame, 0, count - 1)) {
+        showSequenceFrame(state, frame);
+    }
+    if (ImGui::Button("< Prev Frame")) {
+        showSequenceFrame(state, state.sequenceFrame - 1);
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Next Frame >")) {
+        showSequenceFrame(state, state.sequenceFrame + 1);
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Prev Changed")) {
+        jumpToChangedFrame(state, -1);
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Next Changed")) {
+        jumpToChangedFrame(state, 1);
+    }
+    
+    if (!state.sequenceJob) {
+        if (ImGui::Button("Scan All Frames")) {
+            startSequenceScan(state);
+        }
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Diff every pair with the current tolerance and resampling to fill the timeline");
+        }
+    }
+    else {
+        std::size_t done = state.sequenceJob->progress.done.load();
+        char progress[64];
+        std::snprintf(progress, sizeof(progress), "%zu / %d", done, count);
+        ImGui::ProgressBar(static_cast<float>(done) / static_cast<float>(count), ImVec2(200.0f, 0.0f), progress);
+        ImGui::SameLine();
+        if (ImGui::Button("Cancel Scan")) {
+            state.sequenceJob->progress.cancelRequested = true;
+        }
+    }
+}
+
+int multiImageCount(const AppState& state) {
+    return 2 + static_cast<int>(state.extraImages.size());
+}
+
+std::shared_ptr<const DecodedImage> multiImageSource(const AppState& state, int index) {
+    if (index == 0) {
+        return state.image1Loaded ? state.source1 : nullptr;
+    }
+    if (index == 1) {
+        return state.image2Loaded ? state.source2 : nullptr;
+    }
+    return state.extraImages[index - 2]->source;
+}
+
+TiledTexture& multiImageTexture(AppState& state, int index) {
+    if (index == 0) {
+        return state.texture1;
+    }
+    if (index == 1) {
+        return state.texture2;
+    }
+    return state.extraImages[index - 2]->texture;
+}
+
+void clearMultiComparison(AppState& state) {
+    // A comparison still running would land on images that changed.
+    state.multiJob.reset();
+    // The textures draw from the results' pixels, so they go first.
+    state.multiDiffTextures.clear();
+    state.multiResults.clear();
+    state.multiTargets.clear();
+    state.multiReference = -1;
+}
+
+void finishExtraImageLoads(AppState& state) {
+    for (const std::unique_ptr<ExtraImage>& extra : state.extraImages) {
+        if (finishImageLoad(extra->loadJob, extra->source, extra->texture, state.statusMessage)) {
+            clearMultiComparison(state);
+        }
+    }
+}
+
+void removeExtraImage(AppState& state, int index) {
+    clearMultiComparison(state);
+    std::unique_ptr<ExtraImage>& extra = state.extraImages[index - 2];
+    if (extra->loadJob) {
+        extra->loadJob->cancelRequested = true;
+    }
+    state.extraImages.erase(state.extraImages.begin() + (index - 2));
+    
+    if (state.referenceIndex == index) {
+        state.referenceIndex = 0;
+    }
+    else if (state.referenceIndex > index) {
+        --state.referenceIndex;
+    }
+}
+
+// Diffs every loaded image against the reference on the load pool; 8-bit
+// images share one pass over the reference's rows.
+void compareAllAgainstReference(AppState& state) {
+    std::shared_ptr<const DecodedImage> reference = multiImageSource(state, state.referenceIndex);
+    if (!reference) {
+        state.statusMessage = "Load the reference image first!";
+        return;
+    }
+    
+    clearMultiComparison(state);
+    auto job = std::make_shared<MultiCompareJob>();
+    job->referenceIndex = state.referenceIndex;
+    job->reference = reference;
+    job->tolerance = static_cast<std::uint8_t>(state.diffTolerance);
+    for (int i = 0; i < multiImageCount(state); ++i) {
+        std::shared_ptr<const DecodedImage> source = multiImageSource(state, i);
+        if (i != state.referenceIndex && source) {
+            job->targetIndices.push_back(i);
+            job->targets.push_back(std::move(source));
+        }
+    }
+    if (job->targets.empty()) {
+        state.statusMessage = "Load at least one more image to compare against the reference!";
+        return;
+    }
+    
+    state.multiJob = job;
+    state.statusMessage = "Comparing " + std::to_string(job->targets.size()) + " image(s) against Image " +
+                          std::to_string(job->referenceIndex + 1);
+    state.jobPool.enqueue([job] {
+        sf::Clock clock;
+        std::vector<const DecodedImage*> targets;
+        for (const std::shared_ptr<const DecodedImage>& target : job->targets) {
+            targets.push_back(target.get());
+        }
+        job->ok = compareDecodedMulti(*job->reference, targets, job->tolerance, job->results);
+        job->elapsedMs = clock.getElapsedTime().asMilliseconds();
+        job->finished.store(true, std::memory_order_release);
+    });
+}
+
+void updateMultiComparison(AppState& state) {
+    if (!state.multiJob || !state.multiJob->finished.load(std::memory_order_acquire)) {
+        return;
+    }
+    
+    std::shared_ptr<MultiCompareJob> job = std::move(state.multiJob);
+    if (!job->ok) {
+        state.statusMessage = "Error: No image overlaps the reference";
+        return;
+    }
+    
+    state.multiResults = std::move(job->results);
+    state.multiTargets = job->targetIndices;
+    for (const ReferenceComparison& result : state.multiResults) {
+        auto texture = std::make_unique<TiledTexture>();
+        if (result.valid) {
+            texture->loadFromImage(result.diffImage);
+        }
+        state.multiDiffTextures.push_back(std::move(texture));
+    }
+    state.multiReference = job->referenceIndex;
+    state.showReferenceGrid = true;
+    state.statusMessage = std::to_string(job->targets.size()) + " image(s) compared against Image " +
+                          std::to_string(job->referenceIndex + 1) + " in " + std::to_string(job->elapsedMs) + " ms";
+}
+
+void renderMultiComparePanel(AppState& state) {
+    for (int i = 0; i < static_cast<int>(state.extraImages.size()); ++i) {
+        ExtraImage& extra = *state.extraImages[i];
+        ImGui::PushID(i);
+        ImGui::Text("Image %d:", i + 3);
+        ImGui::InputText("Path", extra.path, sizeof(extra.path));
+        if (ImGui::Button("Load Image")) {
+            requestImageLoad(state.loadPool, state.imageCache, extra.path, extra.loadJob, state.statusMessage);
+        }
+        ImGui::SameLine();
+        bool remove = ImGui::Button("Remove");
+        if (extra.source) {
+            sf::Vector2u size = extra.source->image.getSize();
+            ImGui::SameLine();
+            ImGui::Text("(%ux%u)", size.x, size.y);
+        }
+        renderLoadProgress(extra.loadJob, state.statusMessage);
+        ImGui::PopID();
+        
+        if (remove) {
+            removeExtraImage(state, i + 2);
+            break;
+        }
+    }
+    if (ImGui::Button("Add Image")) {
+        state.extraImages.push_back(std::make_unique<ExtraImage>());
+    }
+    
+    std::string names;
+    for (int i = 0; i < multiImageCount(state); ++i) {
+        names += "Image " + std::to_string(i + 1);
+        names += '\0';
+    }
+    ImGui::SetNextItemWidth(160);
+    ImGui::Combo("Reference", &state.referenceIndex, names.c_str());
+    if (ImGui::Button("Compare All Against Reference")) {
+        compareAllAgainstReference(state);
+    }
+    if (state.multiJob) {
+        ImGui::SameLine();
+        ImGui::TextUnformatted("Comparing...");
+    }
+    if (ImGui::IsItemHovered()) {
+        ImGui::SetTooltip("Diff every loaded image against the reference with the current tolerance");
+    }
+    
+    if (state.multiReference < 0) {
+        return;
+    }
+    ImGui::SameLine();
+    ImGui::Checkbox("Grid", &state.showReferenceGrid);
+    
+    if (ImGui::BeginTable("ReferenceResults", 5, ImGuiTableFlags_Borders | ImGuiTableFlags_SizingFixedFit)) {
+        ImGui::TableSetupColumn("Image");
+        ImGui::TableSetupColumn("Differing");
+        ImGui::TableSetupColumn("Max delta");
+        ImGui::TableSetupColumn("PSNR");
+        ImGui::TableSetupColumn("SSIM");
+        ImGui::TableHeadersRow();
+        
+        for (std::size_t r = 0; r < state.multiResults.size(); ++r) {
+            const ReferenceComparison& result = state.multiResults[r];
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::Text("Image %d%s", state.multiTargets[r] + 1, result.summary.sizeMismatch ? " (size)" : "");
+            ImGui::TableNextColumn();
+            if (!result.valid) {
+                ImGui::TextDisabled("no overlap");
+                continue;
+            }
+            ImGui::Text("%.4f%%", result.summary.differingPercent());
+            ImGui::TableNextColumn();
+            ImGui::Text("%u", static_cast<unsigned>(result.summary.maxDelta));
+            ImGui::TableNextColumn();
+            if (std::isfinite(result.metrics.psnrAll)) {
+                ImGui::Text("%.2f dB", result.metrics.psnrAll);
+            } else {
+                ImGui::Text("inf");
+            }
+            ImGui::TableNextColumn();
+            ImGui::Text("%.4f", result.metrics.ssim);
+        }
+        ImGui::EndTable();
+    }
+}
+
+// The reference and every compared image in a grid of panes sharing the
+// main view's zoom and pan, so all of them show the same spot.
+void renderReferenceGrid(AppState& state, float zoom) {
+    std::vector<int> cells;
+    cells.push_back(state.multiReference);
+    cells.insert(cells.end(), state.multiTargets.begin(), state.multiTargets.end());
+    int count = static_cast<int>(cells.size());
+    int columns = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(count))));
+    int rows = (count + columns - 1) / columns;
+    
+    ImVec2 center = ImGui::GetMainViewport()->GetCenter();
+    ImGui::SetNextWindowPos(center, ImGuiCond_Appearing, ImVec2(0.5f, 0.5f));
+    ImGui::SetNextWindowSize(ImVec2(900, 700), ImGuiCond_Appearing);
+    ImGui::Begin("Reference Grid", &state.showReferenceGrid);
+    ImGui::Checkbox("Show differences", &state.gridShowsDiffs);
+    
+    constexpr float CellSpacing = 8.0f;
+    ImVec2 available = ImGui::GetContentRegionAvail();
+    ImVec2 cellSize(std::max(50.0f, (available.x - CellSpacing * (columns - 1)) / columns),
+                    std::max(50.0f, (available.y - CellSpacing * (rows - 1)) / rows));
+    
+    for (int c = 0; c < count; ++c) {
+        if (c % columns != 0) {
+            ImGui::SameLine(0.0f, CellSpacing);
+        }
+        
+        char label[32];
+        std::snprintf(label, sizeof(label), "GridCell%d", c);
+        ImGui::BeginChild(label, cellSize, true, ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_NoScrollWithMouse);
+        
+        char caption[64];
+        TiledTexture* texture = &multiImageTexture(state, cells[c]);
+        if (c == 0) {
+            std::snprintf(caption, sizeof(caption), "Image %d (reference)", cells[c] + 1);
+        }
+        else {
+            const ReferenceComparison& result = state.multiResults[c - 1];
+            if (state.gridShowsDiffs) {
+                texture = state.multiDiffTextures[c - 1].get();
+            }
+            std::snprintf(caption, sizeof(caption), result.valid ? "Image %d: %.4f%% differ" : "Image %d: no overlap",
+                          cells[c] + 1, result.summary.differingPercent());
+        }
+        
+        if (texture->getSize().x > 0) {
+            ImGui::SetCursorPos(ImVec2(state.panOffset.x + 5, state.panOffset.y + 5));
+            texture->draw(zoom);
+        }
+        ImVec2 windowPos = ImGui::GetWindowPos();
+        ImDrawList* drawList = ImGui::GetWindowDrawList();
+        drawList->AddRectFilled(ImVec2(windowPos.x + 2, windowPos.y + 2), ImVec2(windowPos.x + 230, windowPos.y + 22),
+                                IM_COL32(0, 0, 0, 160));
+        drawList->AddText(ImVec2(windowPos.x + 6, windowPos.y + 5), IM_COL32(255, 255, 255, 255), caption);
+        
+        ImGui::EndChild();
+    }
+    
+    ImGui::End();
+}
+
+// Image 2 shows the content of Image 1 at scale * p2 + offset.
+float image2Scale(const AppState& state) {
+    if (state.alignmentValid) {
+        return state.alignment.scale;
+    }
+    return state.autoMatchSizes ? state.relativeZoom2 : 1.0f;
+}
+
+sf::Vector2f image2Offset(const AppState& state) {
+    return state.alignmentValid ? state.alignment.offset : sf::Vector2f(0.0f, 0.0f);
+}
+
+// How Image 2 enters the diff: at its own size or resampled to `size`, then
+// moved by `shift` in Image 1's pixels.
+struct Image2Placement {
+    sf::Vector2u size;
+    sf::Vector2i shift = {0, 0};
+    bool resample = false;
+};
+
+// A pure translation diffs Image 2 as it is. A scaled alignment or a size
+// mismatch needs resampling; without it the images are diffed unscaled.
+Image2Placement image2Placement(const AppState& state) {
+    sf::Vector2u size1 = state.source1->image.getSize();
+    sf::Vector2u size2 = state.source2->image.getSize();
+    Image2Placement placement;
+    placement.size = size2;
+    if (state.alignmentValid) {
+        if (integerShift(state.alignment, placement.shift)) {
+            return placement;
+        }
+        placement.shift = {0, 0};
+        if (state.resampleImage2) {
+            float scale = state.alignment.scale;
+            placement.size = {std::max(1u, static_cast<unsigned>(std::lround(size2.x * scale))),
+                              std::max(1u, static_cast<unsigned>(std::lround(size2.y * scale)))};
+            placement.shift = {static_cast<int>(std::lround(state.alignment.offset.x)),
+                               static_cast<int>(std::lround(state.alignment.offset.y))};
+            placement.resample = true;
+        }
+        return placement;
+    }
+    if (state.resampleImage2 && size1 != size2) {
+        placement.size = size1;
+        placement.resample = true;
+    }
+    return placement;
+}
+
+// Image 2 as the diff sees it; resampled versions are cached until the
+// geometry or the filter changes.
+std::shared_ptr<const DecodedImage> comparisonImage2(AppState& state, const Image2Placement& placement) {
+    if (!placement.resample) {
+        return state.source2;
+    }
+    return state.resampledImage2.get(state.source2, placement.size, static_cast<ResampleFilter>(state.resampleFilter));
+}
+
+// Drops the results that depend on both images and how they line up.
+void invalidateComparisons(AppState& state) {
+    ++state.diffGeneration;
+    state.diffImageGenerated = false;
+    state.fullDiffComputed = false;
+    state.lazyDiff.clear();
+    state.diffSource2.reset();
+    state.compactDiff.clear();
+    state.selectionImageGenerated = false;
+    state.selectionView.clear();
+}
+
+void alignImages(AppState& state) {
+    if (!state.image1Loaded || !state.image2Loaded) {
+        state.statusMessage = "Load both images first!";
+        return;
+    }
+    
+    AlignmentOptions options;
+    options.estimateScale = state.alignEstimateScale;
+    options.scaleGuess = state.autoMatchSizes ? state.relativeZoom2 : 1.0f;
+    
+    sf::Clock clock;
+    std::string error;
+    Alignment alignment;
+    if (!estimateAlignment(state.source1->image, state.source2->image, options, alignment, error)) {
+        state.alignmentValid = false;
+        state.statusMessage = error;
+        return;
+    }
+    state.alignmentMs = clock.getElapsedTime().asSeconds() * 1000.0f;
+    state.alignment = alignment;
+    state.alignmentValid = true;
+    invalidateComparisons(state);
+    
+    char message[160];
+    std::snprintf(message, sizeof(message), "Aligned in %.0f ms: offset (%.1f, %.1f), scale %.4f, confidence %.2f",
+                  state.alignmentMs, alignment.offset.x, alignment.offset.y, alignment.scale, alignment.confidence);
+    state.statusMessage = message;
+}
+
+// Replaces diffImage by its compact form; the metrics and regions are
+// already computed from the full one.
+void compactDifference(AppState& state) {
+    sf::Vector2u overlapStart(static_cast<unsigned>(std::max(0, state.diffShift.x)),
+                              static_cast<unsigned>(std::max(0, state.diffShift.y)));
+    state.compactDiff.build(state.diffImage, overlapStart);
+    state.diffImage = sf::Image();
+}
+
+// Diffs the images of the last full diff again on the load pool, for when
+// only the compact deltas were kept. Metrics and regions are already known,
+// so only the delta image is made.
+void startRediff(AppState& state, const std::string& savePath, std::optional<DiffDisplaySettings> display) {
+    auto job = std::make_shared<RediffJob>();
+    job->image1 = state.source1;
+    job->image2 = state.diffSource2;
+    job->shift = state.diffShift;
+    job->tolerance = state.fullDiffTolerance;
+    job->display = display;
+    job->savePath = savePath;
+    job->diffGeneration = state.diffGeneration;
+    state.rediffJobs.push_back(job);
+    
+    state.jobPool.enqueue([job] {
+        ScopedTimer timer("Re-diff");
+        DiffSummary summary;
+        job->ok = job->image2 &&
+                  computeDecodedDifference(*job->image1, *job->image2, job->shift, job->image, summary, job->tolerance);
+        if (job->ok && job->display) {
+            sf::Image deltas = std::move(job->image);
+            job->ok = renderDiffDisplay(deltas, job->image1->image, job->image2->image, job->shift, *job->display,
+                                        job->image);
+        }
+        job->finished.store(true, std::memory_order_release);
+    });
+}
+
+// Computes the whole difference image with its metrics and changed regions.
+// Lazy mode only diffs what is on screen, so saving and metrics go through
+// here first.
+bool computeFullDifference(AppState& state, bool& identicalFiles) {
+    ScopedTimer timer("Full difference");
+    std::uint8_t tolerance = state.lazyDiff.active() ? state.lazyDiff.getTolerance()
+                                                     : static_cast<std::uint8_t>(state.diffTolerance);
+    Image2Placement placement = image2Placement(state);
+    std::shared_ptr<const DecodedImage> image2 = comparisonImage2(state, placement);
+    if (!image2) {
+        state.statusMessage = "Failed to resample Image 2!";
+        return false;
+    }
+    if (!compareDecodedImages(*state.source1, *image2, tolerance, placement.shift, state.diffImage,
+                              state.diffMetrics, state.changeRegions, identicalFiles)) {
+        state.statusMessage = "Invalid image dimensions!";
+        return false;
+    }
+    state.currentRegion = -1;
+    state.fullDiffComputed = true;
+    state.diffSource2 = image2;
+    state.diffShift = placement.shift;
+    state.fullDiffTolerance = tolerance;
+    ++state.diffGeneration;
+    if (state.lowFootprint) {
+        compactDifference(state);
+    }
+    else {
+        state.compactDiff = CompactDiff();
+    }
+    return true;
+}
+
+bool ensureFullDifference(AppState& state) {
+    bool identicalFiles = false;
+    return state.fullDiffComputed || computeFullDifference(state, identicalFiles);
+}
+
+// Uploads the difference in the current display mode. Every mode but Raw is
+// re-mapped from the cached deltas, so switching modes or moving the gain
+// never diffs again; a lazy diff is completed once on the first switch.
+bool refreshDiffDisplay(AppState& state) {
+    if (!state.diffImageGenerated) {
+        return false;
+    }
+    // Flicker draws the images' own textures, see drawFlicker.
+    if (state.diffDisplay.mode == DiffDisplayMode::Flicker ||
+        (state.diffDisplay.mode == DiffDisplayMode::Raw && state.lazyDiff.active())) {
+        return true;
+    }
+    if (state.lazyDiff.active()) {
+        if (!ensureFullDifference(state)) {
+            return false;
+        }
+        state.lazyDiff.clear();
+    }
+    
+    state.diffDisplay.threshold = static_cast<std::uint8_t>(state.diffTolerance);
+    
+    // Compact deltas are expanded and rendered one tile row at a time straight
+    // into a resident texture, so no whole image is built for them.
+    bool compact = !state.compactDiff.empty();
+    if (compact && state.diffSource2) {
+        sf::Image deltas;
+        bool loaded = state.diffTexture.loadResident(
+            state.compactDiff.getSize(), [&](unsigned firstRow, unsigned rows, sf::Image& band) {
+                if (state.diffDisplay.mode == DiffDisplayMode::Raw) {
+                    state.compactDiff.expandRows(firstRow, rows, band);
+                    return true;
+                }
+                state.compactDiff.expandRows(firstRow, rows, deltas);
+                return renderDiffDisplayRows(deltas, firstRow, state.source1->image, state.diffSource2->image,
+                                             state.diffShift, state.diffDisplay, band);
+            });
+        if (loaded) {
+            state.diffDisplayImage = sf::Image();
+            return true;
+        }
+    }
+    
+    // Otherwise, e.g. when the pyramid exceeds the GPU budget, the compact
+    // deltas are expanded whole.
+    sf::Image expanded;
+    const sf::Image* shown = &state.diffImage;
+    if (compact) {
+        state.compactDiff.expand(expanded);
+        shown = &expanded;
+    }
+    if (state.diffDisplay.mode != DiffDisplayMode::Raw) {
+        if (!state.diffSource2 || !renderDiffDisplay(*shown, state.source1->image, state.diffSource2->image,
+                                                     state.diffShift, state.diffDisplay, state.diffDisplayImage)) {
+            state.statusMessage = "Failed to render the difference display!";
+            return false;
+        }
+        shown = &state.diffDisplayImage;
+    }
+    
+    // Without every tile resident, tiles are uploaded as they come into view
+    // and need their pixels kept.
+    if (shown == &expanded) {
+        state.diffDisplayImage = std::move(expanded);
+        shown = &state.diffDisplayImage;
+    }
+    if (!state.diffTexture.loadFromImage(*shown)) {
+        state.statusMessage = "Failed to create difference texture!";
+        return false;
+    }
+    return true;
+}
+
+// Moves an existing difference between its full and compact forms.
+void applyFootprintMode(AppState& state) {
+    TiledTexture::setTexturePoolBudget(state.lowFootprint ? TexturePoolBytes : 0);
+    if (!state.diffImageGenerated || !state.fullDiffComputed) {
+        if (!state.lowFootprint) {
+            state.compactDiff = CompactDiff();
+        }
+        return;
+    }
+    
+    if (state.lowFootprint) {
+        // A restore still running is not needed anymore; the compact deltas
+        // were kept until it would have finished.
+        state.rediffJobs.erase(std::remove_if(state.rediffJobs.begin(), state.rediffJobs.end(),
+                                              [](const auto& job) { return job->savePath.empty(); }),
+                               state.rediffJobs.end());
+        if (state.compactDiff.empty()) {
+            compactDifference(state);
+        }
+        refreshDiffDisplay(state);
+        return;
+    }
+    
+    // The compact deltas stay in use until the re-diff lands.
+    if (!state.compactDiff.empty()) {
+        startRediff(state, "", std::nullopt);
+        state.statusMessage = "Restoring the full difference image...";
+    }
+}
+
+// Swaps the image flicker mode shows once per period. Both are already on
+// the GPU, so a swap only changes which one the next frame draws.
+void updateFlicker(AppState& state) {
+    if (!state.diffImageGenerated || !state.showDiffWindow || state.diffDisplay.mode != DiffDisplayMode::Flicker) {
+        return;
+    }
+    float period = std::max(0.05f, state.flickerPeriod);
+    state.diffDisplay.showImage2 = std::fmod(state.flickerClock.getElapsedTime().asSeconds(), 2.0f * period) >= period;
+}
+
+// Lays out the same item as the difference texture and draws image 1 or
+// image 2, placed as the diff saw it, clipped to the overlap.
+void drawFlicker(AppState& state, float zoom) {
+    Image2Placement placement = image2Placement(state);
+    sf::Vector2u size1 = state.source1->image.getSize();
+    sf::Vector2u size2 = state.source2->image.getSize();
+    sf::Vector2i shift = placement.shift;
+    float left = static_cast<float>(std::max(0, shift.x));
+    float top = static_cast<float>(std::max(0, shift.y));
+    float right = static_cast<float>(std::min<long long>(size1.x, static_cast<long long>(shift.x) + placement.size.x));
+    float bottom = static_cast<float>(std::min<long long>(size1.y, static_cast<long long>(shift.y) + placement.size.y));
+    
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    ImGui::Dummy(ImVec2(std::max(0.0f, right) * zoom, std::max(0.0f, bottom) * zoom));
+    if (right <= left || bottom <= top) {
+        return;
+    }
+    
+    ImGui::PushClipRect(ImVec2(origin.x + left * zoom, origin.y + top * zoom),
+                        ImVec2(origin.x + right * zoom, origin.y + bottom * zoom), true);
+    if (state.diffDisplay.showImage2) {
+        state.texture2.drawAt({origin.x + shift.x * zoom, origin.y + shift.y * zoom},
+                              {zoom * placement.size.x / size2.x, zoom * placement.size.y / size2.y});
+    }
+    else {
+        state.texture1.drawAt({origin.x, origin.y}, {zoom, zoom});
+    }
+    ImGui::PopClipRect();
+}
+
+void generateDifferenceImage(AppState& state) {
+    ScopedTimer timer("Generate difference");
+    if (!state.image1Loaded || !state.image2Loaded) {
+        state.statusMessage = "Load both images first!";
+        return;
+    }
+    
+    Image2Placement placement = image2Placement(state);
+    sf::Vector2u size1 = state.source1->image.getSize();
+    sf::Vector2u size2 = placement.size;
+    std::uint64_t overlapPixels = static_cast<std::uint64_t>(std::min(size1.x, size2.x)) * std::min(size1.y, size2.y);
+    bool identicalFiles = !placement.resample && placement.shift == sf::Vector2i(0, 0) &&
+                          haveSamePixels(*state.source1, *state.source2);
+    
+    ++state.diffGeneration;
+    state.fullDiffComputed = false;
+    state.diffImage = sf::Image();
+    state.changeRegions.clear();
+    state.currentRegion = -1;
+    
+    // Lazy tiles are 8-bit; 16-bit and float pairs are always diffed whole.
+    // Display modes other than Raw are mapped from the whole delta image.
+    bool precise = !placement.resample && state.source1->precise && state.source2->precise;
+    if (state.lazyDiffEnabled && state.diffDisplay.mode == DiffDisplayMode::Raw && !identicalFiles && !precise &&
+        overlapPixels >= LazyDiffMinPixels) {
+        std::shared_ptr<const DecodedImage> image2 = comparisonImage2(state, placement);
+        if (!image2) {
+            state.statusMessage = "Failed to resample Image 2!";
+            return;
+        }
+        if (!state.lazyDiff.start(state.source1, image2, static_cast<std::uint8_t>(state.diffTolerance),
+                                  placement.shift)) {
+            state.statusMessage = "Invalid image dimensions!";
+            return;
+        }
+        state.diffTexture.clear();
+        state.diffImageGenerated = true;
+        state.showDiffWindow = true;
+        state.statusMessage = "Computing the visible part of the difference. Metrics and regions need a full diff.";
+        return;
+    }
+    
+    state.lazyDiff.clear();
+    if (!computeFullDifference(state, identicalFiles)) {
+        return;
+    }
+    
+    state.diffImageGenerated = true;
+    if (!refreshDiffDisplay(state)) {
+        state.diffImageGenerated = false;
+        return;
+    }
+    
+    state.showDiffWindow = true;
+    if (identicalFiles) {
+        state.statusMessage = "Files are byte-identical (same content hash); no pixels were compared.";
+        return;
+    }
+    state.statusMessage = "Difference image generated! " + std::to_string(state.changeRegions.regions().size()) +
+                          " changed region(s). See popup window.";
+}
+
+void queueImageSave(AppState& state, sf::Image image, const std::string& path) {
+    ImageSaveOptions options;
+    options.pngLevel = state.pngLevel;
+    state.saves.push_back({startImageSave(state.savePool, std::move(image), path, options)});
+    state.statusMessage = "Saving: " + path;
+}
+
+void updateImageSaves(AppState& state) {
+    for (SaveEntry& entry : state.saves) {
+        if (entry.reported || !entry.job->finished()) {
+            continue;
+        }
+        entry.reported = true;
+        const ImageSaveJob& job = *entry.job;
+        state.statusMessage = job.stage.load() == SaveStage::Failed ? job.error : "Saved: " + job.path;
+    }
+}
+
+void updateRediffs(AppState& state) {
+    for (std::size_t i = 0; i < state.rediffJobs.size();) {
+        std::shared_ptr<RediffJob> job = state.rediffJobs[i];
+        if (!job->finished.load(std::memory_order_acquire)) {
+            ++i;
+            continue;
+        }
+        state.rediffJobs.erase(state.rediffJobs.begin() + static_cast<std::ptrdiff_t>(i));
+        
+        if (!job->savePath.empty()) {
+            if (job->ok) {
+                queueImageSave(state, std::move(job->image), job->savePath);
+            }
+            else {
+                state.statusMessage = "Failed to diff the images again!";
+            }
+        }
+        else if (job->diffGeneration == state.diffGeneration && !state.lowFootprint) {
+            if (!job->ok) {
+                state.statusMessage = "Failed to restore the difference image!";
+                invalidateComparisons(state);
+                continue;
+            }
+            state.diffImage = std::move(job->image);
+            state.compactDiff = CompactDiff();
+            refreshDiffDisplay(state);
+            state.statusMessage = "Restored the full difference image.";
+        }
+    }
+}
+
+bool hasPendingSaves(const AppState& state) {
+    return std::any_of(state.saves.begin(), state.saves.end(),
+                       [](const SaveEntry& entry) { return !entry.reported; });
+}
+
+void renderImageSaves(AppState& state) {
+    ImGui::SliderInt("PNG level", &state.pngLevel, 0, 9);
+    if (ImGui::IsItemHovered()) {
+        ImGui::SetTooltip("0 stores, 1 is fastest, 9 is smallest. Also: .qoi (fast) and .sdiff (changed tiles only)");
+    }
+    
+    if (state.saves.empty()) {
+        return;
+    }
+    
+    for (const SaveEntry& entry : state.saves) {
+        const ImageSaveJob& job = *entry.job;
+        SaveStage stage = job.stage.load(std::memory_order_acquire);
+        if (stage == SaveStage::Done) {
+            ImGui::Text("%s: %s (%.1f KB, %.0f ms)", saveStageName(stage), job.path.c_str(),
+                        static_cast<double>(job.bytes) / 1024.0, job.encodeMs);
+        }
+        else {
+            ImGui::Text("%s: %s", saveStageName(stage), job.path.c_str());
+        }
+    }
+    
+    if (ImGui::Button("Clear Finished Saves")) {
+        state.saves.erase(std::remove_if(state.saves.begin(), state.saves.end(),
+                                         [](const SaveEntry& entry) { return entry.reported; }),
+                          state.saves.end());
+    }
+}
+
+bool saveDifferenceImage(AppState& state) {
+    if (!state.diffImageGenerated) {
+        state.statusMessage = "Generate difference image first!";
+        return false;
+    }
+    
+    std::string path = state.savePathDiff;
+    if (path.empty()) {
+        path = "difference.png";
+    }
+    
+    if (!ensureFullDifference(state)) {
+        return false;
+    }
     
-    std::string statusMessage = "Load two images to compare";
-};
+    // Delta modes save what is shown; onion skin and flicker save the deltas.
+    bool displayed = state.diffDisplay.mode != DiffDisplayMode::Raw && isDeltaDisplayMode(state.diffDisplay.mode);
+    if (state.compactDiff.empty()) {
+        queueImageSave(state, displayed ? state.diffDisplayImage : state.diffImage, path);
+        return true;
+    }
+    
+    // Low-footprint mode dropped both, so they are rebuilt on the load pool
+    // and saved from there.
+    startRediff(state, path, displayed ? std::optional<DiffDisplaySettings>(state.diffDisplay) : std::nullopt);
+    state.statusMessage = "Diffing again to save: " + path;
+    return true;
+}
 
-bool loadImage(const std::string& path, sf::Image& image, sf::Texture& texture, std::string& statusMessage) {
-    if (path.empty()) {
-        statusMessage = "Error: Please enter a file path first";
+bool saveDifferenceMetrics(AppState& state) {
+    if (!state.diffImageGenerated) {
+        state.statusMessage = "Generate difference image first!";
         return false;
     }
     
-    if (!image.loadFromFile(path)) {
-        statusMessage = "Failed to load image: " + path;
+    std::string path = state.savePathMetrics;
+    if (path.empty()) {
+        path = "metrics.json";
+    }
+    
+    if (!ensureFullDifference(state)) {
         return false;
     }
     
-    if (!texture.loadFromImage(image)) {
-        statusMessage = "Failed to create texture from image: " + path;
+    if (!saveDiffMetricsJson(path, state.diffMetrics)) {
+        state.statusMessage = "Failed to save metrics!";
         return false;
     }
     
-    statusMessage = "Loaded: " + path;
+    state.statusMessage = "Saved metrics to: " + path;
     return true;
 }
 
-void generateDifferenceImage(AppState& state) {
-    if (!state.image1Loaded || !state.image2Loaded) {
-        state.statusMessage = "Load both images first!";
+std::size_t imageBytes(const sf::Image& image) {
+    return rowStride(image) * image.getSize().y;
+}
+
+// CPU and GPU bytes held per buffer. Image 1 and 2 are shared with the image
+// cache rather than copied, so they also count towards its total.
+void renderMemoryUsage(AppState& state) {
+    if (ImGui::Checkbox("Low memory footprint", &state.lowFootprint)) {
+        applyFootprintMode(state);
+    }
+    if (ImGui::IsItemHovered()) {
+        ImGui::SetTooltip("Keep the difference as compact largest-channel deltas and on the GPU only, re-diffing "
+                          "on save, and reuse tile textures across loads");
+    }
+    if (!ImGui::TreeNode("Memory")) {
         return;
     }
     
-    sf::Vector2u size1 = state.image1.getSize();
-    sf::Vector2u size2 = state.image2.getSize();
+    struct Row {
+        const char* name;
+        std::size_t cpu;
+        std::size_t gpu;
+    };
+    auto sourceBytes = [](const std::shared_ptr<const DecodedImage>& source) {
+        return source ? source->byteSize() : 0;
+    };
+    std::size_t extraCpu = 0;
+    std::size_t extraGpu = 0;
+    for (const std::unique_ptr<ExtraImage>& extra : state.extraImages) {
+        extraCpu += sourceBytes(extra->source) + extra->texture.getCpuBytes();
+        extraGpu += extra->texture.getResidentBytes();
+    }
+    std::size_t multiCpu = 0;
+    std::size_t multiGpu = 0;
+    for (const ReferenceComparison& result : state.multiResults) {
+        multiCpu += imageBytes(result.diffImage);
+    }
+    for (const std::unique_ptr<TiledTexture>& texture : state.multiDiffTextures) {
+        multiCpu += texture->getCpuBytes();
+        multiGpu += texture->getResidentBytes();
+    }
+    const Row rows[] = {
+        {"Image 1", sourceBytes(state.source1) + state.texture1.getCpuBytes(), state.texture1.getResidentBytes()},
+        {"Image 2", sourceBytes(state.source2) + state.texture2.getCpuBytes(), state.texture2.getResidentBytes()},
+        {"Image 2 resampled", state.resampledImage2.byteSize(), 0},
+        {"Extra images", extraCpu, extraGpu},
+        {"Difference", imageBytes(state.diffImage) + state.compactDiff.byteSize() + state.diffTexture.getCpuBytes(),
+         state.diffTexture.getResidentBytes()},
+        {"Difference display", imageBytes(state.diffDisplayImage), 0},
+        {"Lazy difference tiles", 0, state.lazyDiff.getResidentBytes()},
+        {"Selection", state.selectionView.getCpuBytes(), state.selectionView.getGpuBytes()},
+        {"N-way differences", multiCpu, multiGpu},
+        {"Texture pool", 0, TiledTexture::getTexturePoolBytes()},
+    };
     
-    unsigned int width = std::min(size1.x, size2.x);
-    unsigned int height = std::min(size1.y, size2.y);
+    constexpr double MiB = 1024.0 * 1024.0;
+    std::size_t totalCpu = 0;
+    std::size_t totalGpu = 0;
+    if (ImGui::BeginTable("MemoryUsage", 3, ImGuiTableFlags_Borders | ImGuiTableFlags_SizingFixedFit)) {
+        ImGui::TableSetupColumn("Buffer");
+        ImGui::TableSetupColumn("CPU (MB)");
+        ImGui::TableSetupColumn("GPU (MB)");
+        ImGui::TableHeadersRow();
+        
+        for (const Row& row : rows) {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::Text("%s", row.name);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.1f", static_cast<double>(row.cpu) / MiB);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.1f", static_cast<double>(row.gpu) / MiB);
+            totalCpu += row.cpu;
+            totalGpu += row.gpu;
+        }
+        
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::Text("Total");
+        ImGui::TableNextColumn();
+        ImGui::Text("%.1f", static_cast<double>(totalCpu) / MiB);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.1f", static_cast<double>(totalGpu) / MiB);
+        ImGui::EndTable();
+    }
+    if (!state.compactDiff.empty()) {
+        ImGui::Text("Compact difference: %zu of %zu tiles changed", state.compactDiff.getStoredTiles(),
+                    state.compactDiff.getTileCount());
+    }
+    ImGui::TreePop();
+}
+
+void renderDiffDisplayControls(AppState& state) {
+    bool changed = false;
+    int mode = static_cast<int>(state.diffDisplay.mode);
+    ImGui::SetNextItemWidth(160);
+    if (ImGui::Combo("Display", &mode,
+                     "Raw\0Amplified\0Luminance\0Heatmap\0Threshold mask\0Overlay\0Onion skin\0Flicker\0")) {
+        changed = mode != static_cast<int>(state.diffDisplay.mode);
+        state.diffDisplay.mode = static_cast<DiffDisplayMode>(mode);
+    }
+    if (ImGui::IsItemHovered()) {
+        ImGui::SetTooltip("Re-maps the cached deltas without diffing again; the mask uses the tolerance");
+    }
     
-    if (width == 0 || height == 0) {
-        state.statusMessage = "Invalid image dimensions!";
-        return;
+    DiffDisplayMode current = state.diffDisplay.mode;
+    if (current == DiffDisplayMode::Amplified || current == DiffDisplayMode::Luminance ||
+        current == DiffDisplayMode::Heatmap || current == DiffDisplayMode::Overlay) {
+        changed |= ImGui::SliderFloat("Gain", &state.diffDisplay.gain, 1.0f, MaxDisplayGain, "%.1fx",
+                                      ImGuiSliderFlags_Logarithmic);
+    }
+    if (current == DiffDisplayMode::Overlay || current == DiffDisplayMode::OnionSkin) {
+        changed |= ImGui::SliderFloat("Mix", &state.diffDisplay.mix, 0.0f, 1.0f, "%.2f");
+    }
+    if (current == DiffDisplayMode::Flicker) {
+        ImGui::SliderFloat("Flicker period (s)", &state.flickerPeriod, 0.1f, 2.0f, "%.2f");
     }
     
-    state.diffImage.resize({width, height});
+    if (changed && state.diffImageGenerated) {
+        refreshDiffDisplay(state);
+    }
+}
+
+void renderDifferenceMetrics(const DiffMetrics& metrics) {
+    auto formatPsnr = [](double psnr, char* buffer, std::size_t size) {
+        if (std::isfinite(psnr)) {
+            std::snprintf(buffer, size, "%.2f dB", psnr);
+        } else {
+            std::snprintf(buffer, size, "inf");
+        }
+    };
     
-    for (unsigned int y = 0; y < height; ++y) {
-        for (unsigned int x = 0; x < width; ++x) {
-            sf::Color c1 = state.image1.getPixel({x, y});
-            sf::Color c2 = state.image2.getPixel({x, y});
-            
-            uint8_t r = static_cast<uint8_t>(std::abs(static_cast<int>(c1.r) - static_cast<int>(c2.r)));
-            uint8_t g = static_cast<uint8_t>(std::abs(static_cast<int>(c1.g) - static_cast<int>(c2.g)));
-            uint8_t b = static_cast<uint8_t>(std::abs(static_cast<int>(c1.b) - static_cast<int>(c2.b)));
-            
-            state.diffImage.setPixel({x, y}, sf::Color(r, g, b, 255));
+    char psnr[32];
+    bool precise = metrics.sampleType != SampleType::UInt8;
+    if (ImGui::BeginTable("DiffMetrics", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_SizingFixedFit)) {
+        ImGui::TableSetupColumn("Channel");
+        ImGui::TableSetupColumn("MSE");
+        ImGui::TableSetupColumn("PSNR");
+        ImGui::TableSetupColumn("Max delta");
+        ImGui::TableHeadersRow();
+        
+        const char* names[3] = {"R", "G", "B"};
+        for (int c = 0; c < 3; ++c) {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::Text("%s", names[c]);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", metrics.mse[c]);
+            ImGui::TableNextColumn();
+            formatPsnr(metrics.psnr[c], psnr, sizeof(psnr));
+            ImGui::Text("%s", psnr);
+            ImGui::TableNextColumn();
+            if (precise) {
+                ImGui::Text("%.6f", metrics.maxDeltaFraction[c]);
+            } else {
+                ImGui::Text("%u", static_cast<unsigned>(metrics.maxDelta[c]));
+            }
         }
+        
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::Text("All");
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", metrics.mseAll);
+        ImGui::TableNextColumn();
+        formatPsnr(metrics.psnrAll, psnr, sizeof(psnr));
+        ImGui::Text("%s", psnr);
+        ImGui::TableNextColumn();
+        if (precise) {
+            ImGui::Text("%.6f", std::max({metrics.maxDeltaFraction[0], metrics.maxDeltaFraction[1],
+                                          metrics.maxDeltaFraction[2]}));
+        } else {
+            ImGui::Text("%u", static_cast<unsigned>(std::max({metrics.maxDelta[0], metrics.maxDelta[1], metrics.maxDelta[2]})));
+        }
+        ImGui::EndTable();
     }
     
-    if (!state.diffTexture.loadFromImage(state.diffImage)) {
-        state.statusMessage = "Failed to create difference texture!";
+    if (precise) {
+        ImGui::Text("Compared at %s precision: MSE in 8-bit units, max delta as a fraction of full scale",
+                    sampleTypeName(metrics.sampleType));
+    }
+    ImGui::Text("SSIM: %.5f", metrics.ssim);
+    ImGui::Text("Pixels over tolerance %u: %llu (%.3f%%)", static_cast<unsigned>(metrics.tolerance),
+                static_cast<unsigned long long>(metrics.pixelsOverTolerance), metrics.overTolerancePercent());
+    
+    float histogram[256];
+    for (std::size_t i = 0; i < metrics.histogram.size(); ++i) {
+        histogram[i] = std::log10(1.0f + static_cast<float>(metrics.histogram[i]));
+    }
+    ImGui::PlotHistogram("##deltaHistogram", histogram, 256, 0, "Delta histogram (log)", 0.0f, FLT_MAX,
+                         ImVec2(256.0f, 80.0f));
+}
+
+void focusChangeRegion(AppState& state, int index) {
+    const std::vector<ChangeRegion>& regions = state.changeRegions.regions();
+    if (index < 0 || index >= static_cast<int>(regions.size())) {
         return;
     }
     
-    state.diffImageGenerated = true;
-    state.showDiffWindow = true;
-    state.statusMessage = "Difference image generated! See popup window.";
+    const ChangeRegion& region = regions[index];
+    float centerX = (region.left + region.right) / 2.0f;
+    float centerY = (region.top + region.bottom) / 2.0f;
+    
+    state.panOffset.x = state.paneSize.x / 2.0f - centerX * state.zoomLevel - 5.0f;
+    state.panOffset.y = state.paneSize.y / 2.0f - centerY * state.zoomLevel - 5.0f;
+    
+    state.selectionStart = {static_cast<float>(region.left), static_cast<float>(region.top)};
+    state.selectionEnd = {static_cast<float>(region.right), static_cast<float>(region.bottom)};
+    state.hasSelection = true;
+    state.selectionImageGenerated = false;
+    state.currentRegion = index;
 }
 
-bool saveDifferenceImage(AppState& state) {
-    if (!state.diffImageGenerated) {
-        state.statusMessage = "Generate difference image first!";
-        return false;
+void renderChangeRegions(AppState& state) {
+    const std::vector<ChangeRegion>& regions = state.changeRegions.regions();
+    int count = static_cast<int>(regions.size());
+    
+    ImGui::Text("Changed regions: %d", count);
+    if (count == 0) {
+        return;
     }
     
-    std::string path = state.savePathDiff;
-    if (path.empty()) {
-        path = "difference.bmp";
+    if (ImGui::Button("< Prev")) {
+        focusChangeRegion(state, state.currentRegion <= 0 ? count - 1 : state.currentRegion - 1);
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Next >")) {
+        focusChangeRegion(state, (state.currentRegion + 1) % count);
     }
+    ImGui::SameLine();
+    ImGui::Text("%d / %d", state.currentRegion + 1, count);
     
-    if (!state.diffImage.saveToFile(path)) {
-        state.statusMessage = "Failed to save difference image!";
-        return false;
+    ImGui::BeginChild("RegionList", ImVec2(0, 120), true);
+    ImGuiListClipper clipper;
+    clipper.Begin(count);
+    while (clipper.Step()) {
+        for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
+            const ChangeRegion& region = regions[i];
+            char label[128];
+            std::snprintf(label, sizeof(label), "#%d  %ux%u at (%u, %u)  %llu px", i + 1,
+                          region.width(), region.height(), region.left, region.top,
+                          static_cast<unsigned long long>(region.pixelCount));
+            if (ImGui::Selectable(label, i == state.currentRegion)) {
+                focusChangeRegion(state, i);
+            }
+        }
     }
+    ImGui::EndChild();
+}
+
+void drawChangeRegionOutlines(const AppState& state, ImVec2 imageOrigin, float zoom) {
+    ImDrawList* drawList = ImGui::GetWindowDrawList();
+    ImVec2 clipMin = drawList->GetClipRectMin();
+    ImVec2 clipMax = drawList->GetClipRectMax();
     
-    state.statusMessage = "Saved difference image to: " + path;
-    return true;
+    unsigned left = static_cast<unsigned>(std::max(0.0f, (clipMin.x - imageOrigin.x) / zoom));
+    unsigned top = static_cast<unsigned>(std::max(0.0f, (clipMin.y - imageOrigin.y) / zoom));
+    unsigned right = static_cast<unsigned>(std::max(0.0f, (clipMax.x - imageOrigin.x) / zoom + 1.0f));
+    unsigned bottom = static_cast<unsigned>(std::max(0.0f, (clipMax.y - imageOrigin.y) / zoom + 1.0f));
+    
+    const std::vector<ChangeRegion>& regions = state.changeRegions.regions();
+    for (std::size_t i : state.changeRegions.query(left, top, right, bottom)) {
+        const ChangeRegion& region = regions[i];
+        ImU32 color = static_cast<int>(i) == state.currentRegion ? IM_COL32(255, 0, 0, 255) : IM_COL32(255, 255, 0, 160);
+        drawList->AddRect(ImVec2(imageOrigin.x + region.left * zoom - 1.0f, imageOrigin.y + region.top * zoom - 1.0f),
+                          ImVec2(imageOrigin.x + region.right * zoom + 1.0f, imageOrigin.y + region.bottom * zoom + 1.0f),
+                          color);
+    }
 }
 
 void calculateRelativeZoom(AppState& state) {
@@ -141,8 +1804,8 @@ void calculateRelativeZoom(AppState& state) {
         return;
     }
     
-    sf::Vector2u size1 = state.image1.getSize();
-    sf::Vector2u size2 = state.image2.getSize();
+    sf::Vector2u size1 = state.source1->image.getSize();
+    sf::Vector2u size2 = state.source2->image.getSize();
     
     if (size2.x == 0 || size2.y == 0) {
         state.relativeZoom2 = 1.0f;
@@ -162,89 +1825,53 @@ void getNormalizedSelection(const AppState& state, sf::Vector2f& minCoord, sf::V
     maxCoord.y = std::max(state.selectionStart.y, state.selectionEnd.y);
 }
 
-void extractAndCombineSelection(AppState& state) {
-    if (!state.image1Loaded || !state.image2Loaded) {
-        state.statusMessage = "Load both images first!";
-        return;
-    }
-    
-    if (!state.hasSelection) {
-        state.statusMessage = "No area selected! Left-click and drag to select an area.";
-        return;
-    }
-    
+// Refreshes the selection panels; only the parts of each crop that changed
+// since the previous call are uploaded.
+bool updateSelectionComparison(AppState& state, std::string& error) {
+    ScopedTimer timer("Update selection");
     sf::Vector2f minCoord, maxCoord;
     getNormalizedSelection(state, minCoord, maxCoord);
     
-    sf::Vector2u size1 = state.image1.getSize();
-    sf::Vector2u size2 = state.image2.getSize();
-    
-    unsigned int x1 = static_cast<unsigned int>(std::max(0.0f, minCoord.x));
-    unsigned int y1 = static_cast<unsigned int>(std::max(0.0f, minCoord.y));
-    unsigned int x2 = static_cast<unsigned int>(std::min(static_cast<float>(size1.x), maxCoord.x));
-    unsigned int y2 = static_cast<unsigned int>(std::min(static_cast<float>(size1.y), maxCoord.y));
-    
-    unsigned int selWidth = x2 - x1;
-    unsigned int selHeight = y2 - y1;
-    
-    if (selWidth == 0 || selHeight == 0) {
-        state.statusMessage = "Selection is empty!";
-        return;
+    // A resampled Image 2 already has Image 1's scale, so only the shift is left.
+    Image2Placement placement = image2Placement(state);
+    std::shared_ptr<const DecodedImage> image2 = comparisonImage2(state, placement);
+    if (!image2) {
+        error = "Failed to resample Image 2!";
+        return false;
     }
+    float relativeZoom = placement.resample ? 1.0f : image2Scale(state);
+    sf::Vector2f offset = placement.resample ? sf::Vector2f(placement.shift) : image2Offset(state);
     
-    float relZoom = state.autoMatchSizes ? state.relativeZoom2 : 1.0f;
-    
-    unsigned int x1_img2 = static_cast<unsigned int>(std::max(0.0f, minCoord.x / relZoom));
-    unsigned int y1_img2 = static_cast<unsigned int>(std::max(0.0f, minCoord.y / relZoom));
-    unsigned int x2_img2 = static_cast<unsigned int>(std::min(static_cast<float>(size2.x), maxCoord.x / relZoom));
-    unsigned int y2_img2 = static_cast<unsigned int>(std::min(static_cast<float>(size2.y), maxCoord.y / relZoom));
-    
-    unsigned int selWidth2 = x2_img2 - x1_img2;
-    unsigned int selHeight2 = y2_img2 - y1_img2;
-    
-    if (selWidth2 == 0 || selHeight2 == 0) {
-        selWidth2 = std::min(selWidth, size2.x - x1_img2);
-        selHeight2 = std::min(selHeight, size2.y - y1_img2);
-        x2_img2 = x1_img2 + selWidth2;
-        y2_img2 = y1_img2 + selHeight2;
-        
-        if (selWidth2 == 0 || selHeight2 == 0) {
-            state.statusMessage = "Cannot map selection to Image 2!";
-            return;
-        }
+    PixelRect rect1, rect2;
+    if (!mapSelectionRects(state.source1->image.getSize(), image2->image.getSize(), minCoord, maxCoord,
+                           relativeZoom, offset, rect1, rect2, error)) {
+        return false;
     }
     
-    unsigned int combinedWidth = selWidth + selWidth2;
-    unsigned int combinedHeight = std::max(selHeight, selHeight2);
-    
-    state.selectionImage.resize({combinedWidth, combinedHeight});
-    
-    for (unsigned int y = 0; y < combinedHeight; ++y) {
-        for (unsigned int x = 0; x < combinedWidth; ++x) {
-            state.selectionImage.setPixel({x, y}, sf::Color::Black);
-        }
+    if (!state.selectionView.update(state.source1->image, rect1, image2->image, rect2,
+                                    static_cast<std::uint8_t>(state.diffTolerance))) {
+        error = "Failed to create selection texture!";
+        return false;
     }
-    
-    for (unsigned int y = 0; y < selHeight; ++y) {
-        for (unsigned int x = 0; x < selWidth; ++x) {
-            if (x1 + x < size1.x && y1 + y < size1.y) {
-                sf::Color pixel = state.image1.getPixel({x1 + x, y1 + y});
-                state.selectionImage.setPixel({x, y}, pixel);
-            }
-        }
+    return true;
+}
+
+void extractAndCombineSelection(AppState& state) {
+    ScopedTimer timer("Extract selection");
+    if (!state.image1Loaded || !state.image2Loaded) {
+        state.statusMessage = "Load both images first!";
+        return;
     }
     
-    for (unsigned int y = 0; y < selHeight2; ++y) {
-        for (unsigned int x = 0; x < selWidth2; ++x) {
-            if (x1_img2 + x < size2.x && y1_img2 + y < size2.y) {
-                sf::Color pixel = state.image2.getPixel({x1_img2 + x, y1_img2 + y});
-                state.selectionImage.setPixel({selWidth + x, y}, pixel);
-            }
-        }
+    if (!state.hasSelection) {
+        state.statusMessage = "No area selected! Left-click and drag to select an area.";
+        return;
     }
     
-    if (!state.selectionTexture.loadFromImage(state.selectionImage)) {
-        state.statusMessage = "Failed to create selection texture!";
+    std::string error;
+    if (!updateSelectionComparison(state, error)) {
+        state.selectionImageGenerated = false;
+        state.statusMessage = error;
         return;
     }
     
@@ -261,32 +1888,23 @@ bool saveSelectionImage(AppState& state) {
     
     std::string path = state.savePathSelection;
     if (path.empty()) {
-        path = "selection.bmp";
-    }
-    
-    if (!state.selectionImage.saveToFile(path)) {
-        state.statusMessage = "Failed to save selection image!";
-        return false;
+        path = "selection.png";
     }
     
-    state.statusMessage = "Saved selection image to: " + path;
+    sf::Image selectionImage;
+    state.selectionView.composeImage(selectionImage);
+    queueImageSave(state, std::move(selectionImage), path);
     return true;
 }
 
-void renderImageView(const char* label, sf::Texture& texture, bool loaded, 
+void renderImageView(const char* label, TiledTexture& texture, bool loaded, 
                      float zoom, const sf::Vector2f& panOffset, float viewWidth, float viewHeight) {
     ImGui::BeginChild(label, ImVec2(viewWidth, viewHeight), true, 
                       ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_NoScrollWithMouse);
     
     if (loaded) {
-        sf::Vector2u texSize = texture.getSize();
-        float scaledWidth = texSize.x * zoom;
-        float scaledHeight = texSize.y * zoom;
-        
         ImGui::SetCursorPos(ImVec2(panOffset.x, panOffset.y));
-        
-        ImTextureID texId = static_cast<ImTextureID>(static_cast<uintptr_t>(texture.getNativeHandle()));
-        ImGui::Image(texId, ImVec2(scaledWidth, scaledHeight));
+        texture.draw(zoom);
     }
     else {
         ImGui::Text("No image loaded");
@@ -296,7 +1914,80 @@ void renderImageView(const char* label, sf::Texture& texture, bool loaded,
     ImGui::EndChild();
 }
 
-int main() {
+void handleWindowEvent(sf::RenderWindow& window, AppState& state, const sf::Event& event) {
+    ImGui::SFML::ProcessEvent(window, event);
+    
+    if (event.is<sf::Event::Closed>()) {
+        window.close();
+    }
+    
+    if (auto* scrollEvent = event.getIf<sf::Event::MouseWheelScrolled>()) {
+        if (!ImGui::GetIO().WantCaptureMouse) {
+            if (scrollEvent->delta > 0) {
+                state.zoomLevel = std::min(state.zoomMax, state.zoomLevel + state.zoomStep);
+            } else if (scrollEvent->delta < 0) {
+                state.zoomLevel = std::max(state.zoomMin, state.zoomLevel - state.zoomStep);
+            }
+        }
+    }
+    
+    if (auto* buttonEvent = event.getIf<sf::Event::MouseButtonPressed>()) {
+        if (buttonEvent->button == sf::Mouse::Button::Middle ||
+            buttonEvent->button == sf::Mouse::Button::Right) {
+            state.isPanning = true;
+            state.lastMousePos = sf::Mouse::getPosition(window);
+        }
+    }
+    
+    if (auto* buttonEvent = event.getIf<sf::Event::MouseButtonReleased>()) {
+        if (buttonEvent->button == sf::Mouse::Button::Middle ||
+            buttonEvent->button == sf::Mouse::Button::Right) {
+            state.isPanning = false;
+        }
+    }
+    
+    if (event.is<sf::Event::MouseMoved>()) {
+        if (state.isPanning) {
+            sf::Vector2i currentPos = sf::Mouse::getPosition(window);
+            sf::Vector2i delta = currentPos - state.lastMousePos;
+            state.panOffset.x += delta.x;
+            state.panOffset.y += delta.y;
+            state.lastMousePos = currentPos;
+        }
+    }
+}
+
+// How soon the next frame is needed when no input arrives.
+RedrawNeed redrawNeed(const AppState& state) {
+    bool extraUploads = false;
+    bool extraLoads = false;
+    for (const std::unique_ptr<ExtraImage>& extra : state.extraImages) {
+        extraUploads = extraUploads || extra->texture.hasPendingUploads();
+        extraLoads = extraLoads || extra->loadJob;
+    }
+    for (const std::unique_ptr<TiledTexture>& texture : state.multiDiffTextures) {
+        extraUploads = extraUploads || texture->hasPendingUploads();
+    }
+    
+    if (state.isPanning || state.isSelecting || state.showProfiler || state.lazyDiff.isBusy() ||
+        state.texture1.hasPendingUploads() || state.texture2.hasPendingUploads() ||
+        state.diffTexture.hasPendingUploads() || extraUploads) {
+        return RedrawNeed::Continuous;
+    }
+    bool flickering = state.diffImageGenerated && state.showDiffWindow &&
+                      state.diffDisplay.mode == DiffDisplayMode::Flicker;
+    if (state.loadJob1 || state.loadJob2 || state.indexJob || state.sequenceJob || state.multiJob || !state.rediffJobs.empty() ||
+        hasPendingSaves(state) || flickering || extraLoads) {
+        return RedrawNeed::Background;
+    }
+    return RedrawNeed::Idle;
+}
+
+int main(int argc, char* argv[]) {
+    if (isHeadlessInvocation(argc, argv)) {
+        return runHeadless(argc, argv);
+    }
+
     sf::RenderWindow window(sf::VideoMode({1280, 800}), "Compare Images - Image Comparison Tool");
     window.setFramerateLimit(60);
 
@@ -305,53 +1996,66 @@ int main() {
     }
 
     AppState state;
+    state.threadCount = static_cast<int>(sharedThreadCount());
     sf::Clock deltaClock;
     
+    int settleFrames = FramesAfterInput;
+    
     while (window.isOpen()) {
-        while (auto event = window.pollEvent()) {
-            ImGui::SFML::ProcessEvent(window, *event);
-            
-            if (event->is<sf::Event::Closed>()) {
-                window.close();
-            }
-            
-            if (auto* scrollEvent = event->getIf<sf::Event::MouseWheelScrolled>()) {
-                if (!ImGui::GetIO().WantCaptureMouse) {
-                    if (scrollEvent->delta > 0) {
-                        state.zoomLevel = std::min(state.zoomMax, state.zoomLevel + state.zoomStep);
-                    } else if (scrollEvent->delta < 0) {
-                        state.zoomLevel = std::max(state.zoomMin, state.zoomLevel - state.zoomStep);
-                    }
+        // Nothing on screen can change without input or pending work, so
+        // instead of redrawing at 60 FPS the loop sleeps in waitEvent.
+        if (state.powerSaving && settleFrames == 0) {
+            RedrawNeed need = redrawNeed(state);
+            if (need != RedrawNeed::Continuous) {
+                sf::Time timeout = sf::milliseconds(need == RedrawNeed::Background ? BackgroundPollMs : IdleWakeMs);
+                if (auto event = window.waitEvent(timeout)) {
+                    handleWindowEvent(window, state, *event);
+                    settleFrames = FramesAfterInput;
                 }
-            }
-            
-            if (auto* buttonEvent = event->getIf<sf::Event::MouseButtonPressed>()) {
-                if (buttonEvent->button == sf::Mouse::Button::Middle ||
-                    buttonEvent->button == sf::Mouse::Button::Right) {
-                    state.isPanning = true;
-                    state.lastMousePos = sf::Mouse::getPosition(window);
+                else if (need == RedrawNeed::Idle && !state.uiHasTimers) {
+                    continue;
                 }
             }
-            
-            if (auto* buttonEvent = event->getIf<sf::Event::MouseButtonReleased>()) {
-                if (buttonEvent->button == sf::Mouse::Button::Middle ||
-                    buttonEvent->button == sf::Mouse::Button::Right) {
-                    state.isPanning = false;
-                }
+        }
+        
+        ScopedTimer frameTimer("Frame");
+        ScopedTimer pollTimer("Event poll");
+        while (auto event = window.pollEvent()) {
+            handleWindowEvent(window, state, *event);
+            settleFrames = FramesAfterInput;
+        }
+
+        pollTimer.stop();
+        
+        {
+            ScopedTimer timer("ImGui::SFML::Update");
+            ImGui::SFML::Update(window, deltaClock.restart());
+        }
+        ScopedTimer uiTimer("Build UI");
+        
+        finishIndexBuild(state);
+        updateSequenceScan(state);
+        updateRediffs(state);
+        updateMultiComparison(state);
+        updateImageSaves(state);
+        updateFlicker(state);
+        bool loaded1 = finishImageLoad(state.loadJob1, state.source1, state.texture1, state.statusMessage);
+        bool loaded2 = finishImageLoad(state.loadJob2, state.source2, state.texture2, state.statusMessage);
+        if (loaded1 || loaded2) {
+            state.image1Loaded = state.image1Loaded || loaded1;
+            state.image2Loaded = state.image2Loaded || loaded2;
+            invalidateComparisons(state);
+            clearMultiComparison(state);
+            state.alignmentValid = false;
+            if (loaded2) {
+                state.resampledImage2.clear();
             }
-            
-            if (event->is<sf::Event::MouseMoved>()) {
-                if (state.isPanning) {
-                    sf::Vector2i currentPos = sf::Mouse::getPosition(window);
-                    sf::Vector2i delta = currentPos - state.lastMousePos;
-                    state.panOffset.x += delta.x;
-                    state.panOffset.y += delta.y;
-                    state.lastMousePos = currentPos;
-                }
+            calculateRelativeZoom(state);
+            if (state.alignOnLoad && state.image1Loaded && state.image2Loaded) {
+                alignImages(state);
             }
         }
-
-        ImGui::SFML::Update(window, deltaClock.restart());
+        finishExtraImageLoads(state);
 
         ImGui::Begin("Control Panel", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
         
@@ -359,19 +2063,15 @@ int main() {
         ImGui::PushID("img1");
         ImGui::InputText("Path", state.filePath1, sizeof(state.filePath1));
         if (ImGui::Button("Load Image")) {
-            if (loadImage(state.filePath1, state.image1, state.texture1, state.statusMessage)) {
-                state.image1Loaded = true;
-                state.diffImageGenerated = false;
-                state.selectionImageGenerated = false;
-                calculateRelativeZoom(state);
-            }
+            requestImageLoad(state.loadPool, state.imageCache, state.filePath1, state.loadJob1, state.statusMessage);
         }
-        ImGui::PopID();
         if (state.image1Loaded) {
-            sf::Vector2u size = state.image1.getSize();
+            sf::Vector2u size = state.source1->image.getSize();
             ImGui::SameLine();
             ImGui::Text("(%ux%u)", size.x, size.y);
         }
+        renderLoadProgress(state.loadJob1, state.statusMessage);
+        ImGui::PopID();
         
         ImGui::Separator();
         
@@ -379,19 +2079,22 @@ int main() {
         ImGui::PushID("img2");
         ImGui::InputText("Path", state.filePath2, sizeof(state.filePath2));
         if (ImGui::Button("Load Image")) {
-            if (loadImage(state.filePath2, state.image2, state.texture2, state.statusMessage)) {
-                state.image2Loaded = true;
-                state.diffImageGenerated = false;
-                state.selectionImageGenerated = false;
-                calculateRelativeZoom(state);
-            }
+            requestImageLoad(state.loadPool, state.imageCache, state.filePath2, state.loadJob2, state.statusMessage);
         }
-        ImGui::PopID();
         if (state.image2Loaded) {
-            sf::Vector2u size = state.image2.getSize();
+            sf::Vector2u size = state.source2->image.getSize();
             ImGui::SameLine();
             ImGui::Text("(%ux%u)", size.x, size.y);
         }
+        renderLoadProgress(state.loadJob2, state.statusMessage);
+        ImGui::PopID();
+        
+        ImGui::Separator();
+        
+        if (ImGui::Button("Load Both Images")) {
+            requestImageLoad(state.loadPool, state.imageCache, state.filePath1, state.loadJob1, state.statusMessage);
+            requestImageLoad(state.loadPool, state.imageCache, state.filePath2, state.loadJob2, state.statusMessage);
+        }
         
         ImGui::Separator();
         
@@ -416,9 +2119,51 @@ int main() {
         
         ImGui::Text("Size Matching:");
         ImGui::Checkbox("Auto-match different image sizes", &state.autoMatchSizes);
-        if (state.autoMatchSizes && state.image1Loaded && state.image2Loaded) {
+        if (state.autoMatchSizes && state.image1Loaded && state.image2Loaded && !state.alignmentValid) {
             ImGui::Text("Relative zoom for Image 2: %.2fx", state.relativeZoom2);
         }
+        if (ImGui::Checkbox("Resample Image 2 onto Image 1's grid", &state.resampleImage2)) {
+            invalidateComparisons(state);
+        }
+        if (state.resampleImage2) {
+            ImGui::SetNextItemWidth(120);
+            if (ImGui::Combo("Filter", &state.resampleFilter, "Area\0Bilinear\0Lanczos3\0")) {
+                invalidateComparisons(state);
+            }
+            if (state.image1Loaded && state.image2Loaded) {
+                Image2Placement placement = image2Placement(state);
+                if (placement.resample) {
+                    ImGui::Text("Diffed at %ux%u (%.1f MB cached)", placement.size.x, placement.size.y,
+                                state.resampledImage2.byteSize() / (1024.0 * 1024.0));
+                }
+            }
+        }
+        
+        ImGui::Separator();
+        
+        ImGui::Text("Alignment:");
+        if (ImGui::Button("Align Images")) {
+            alignImages(state);
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Reset Alignment") && state.alignmentValid) {
+            state.alignmentValid = false;
+            invalidateComparisons(state);
+        }
+        ImGui::Checkbox("Align on load", &state.alignOnLoad);
+        ImGui::SameLine();
+        ImGui::Checkbox("Estimate scale", &state.alignEstimateScale);
+        if (state.alignmentValid) {
+            ImGui::Text("Offset (%.1f, %.1f), scale %.4f", state.alignment.offset.x, state.alignment.offset.y,
+                        state.alignment.scale);
+            ImGui::Text("Confidence %.2f (%.0f ms)", state.alignment.confidence, state.alignmentMs);
+            sf::Vector2i shift;
+            if (!integerShift(state.alignment, shift)) {
+                ImGui::TextWrapped(state.resampleImage2
+                                       ? "Image 2 is resampled to the aligned scale for the difference."
+                                       : "The difference ignores alignments that change the scale.");
+            }
+        }
         
         ImGui::Separator();
         
@@ -437,10 +2182,24 @@ int main() {
             if (ImGui::Button("Clear Selection")) {
                 state.hasSelection = false;
                 state.selectionImageGenerated = false;
+                state.selectionView.clear();
             }
         } else {
             ImGui::TextDisabled("No selection");
         }
+        ImGui::Checkbox("Live selection", &state.liveSelection);
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Update the selection comparison while dragging");
+        }
+        
+        if (state.selectionImageGenerated) {
+            const DiffSummary& selectionDiff = state.selectionView.getDiffSummary();
+            ImGui::Text("Selection diff: %llu pixels (%.2f%%), max delta %u",
+                        static_cast<unsigned long long>(selectionDiff.differingPixels),
+                        selectionDiff.differingPercent(), static_cast<unsigned>(selectionDiff.maxDelta));
+            ImGui::Text("Last selection upload: %.1f KB",
+                        static_cast<double>(state.selectionView.getLastUploadBytes()) / 1024.0);
+        }
         
         if (state.selectionImageGenerated) {
             ImGui::InputText("Selection Save Path", state.savePathSelection, sizeof(state.savePathSelection));
@@ -452,14 +2211,84 @@ int main() {
         ImGui::Separator();
         
         ImGui::Text("Difference Image:");
+        if (ImGui::SliderInt("Tolerance", &state.diffTolerance, 0, 255)) {
+            if (state.selectionImageGenerated) {
+                std::string error;
+                updateSelectionComparison(state, error);
+            }
+            if (state.diffDisplay.mode == DiffDisplayMode::ThresholdMask) {
+                refreshDiffDisplay(state);
+            }
+        }
         if (ImGui::Button("Generate Difference")) {
             generateDifferenceImage(state);
         }
+        renderDiffDisplayControls(state);
         
         ImGui::InputText("Diff Save Path", state.savePathDiff, sizeof(state.savePathDiff));
         if (ImGui::Button("Save Difference")) {
             saveDifferenceImage(state);
         }
+        renderImageSaves(state);
+        
+        ImGui::Checkbox("Lazy diff for large images", &state.lazyDiffEnabled);
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Only diff the tiles shown in the Difference window, nearest first");
+        }
+        
+        if (state.diffImageGenerated && state.lazyDiff.active()) {
+            if (state.lazyDiff.getPendingTiles() > 0) {
+                ImGui::Text("Diffing visible tiles: %zu left", state.lazyDiff.getPendingTiles());
+            }
+            if (!state.fullDiffComputed && ImGui::Button("Compute Full Difference")) {
+                if (ensureFullDifference(state)) {
+                    state.statusMessage = "Full difference computed! " +
+                                          std::to_string(state.changeRegions.regions().size()) + " changed region(s).";
+                }
+            }
+        }
+        
+        if (state.diffImageGenerated && state.fullDiffComputed) {
+            renderDifferenceMetrics(state.diffMetrics);
+            renderChangeRegions(state);
+            ImGui::InputText("Metrics Save Path", state.savePathMetrics, sizeof(state.savePathMetrics));
+            if (ImGui::Button("Export Metrics (JSON)")) {
+                saveDifferenceMetrics(state);
+            }
+        }
+        
+        ImGui::Separator();
+        
+        ImGui::Text("Near-duplicate Search:");
+        renderSimilarImages(state);
+        
+        ImGui::Separator();
+        
+        ImGui::Text("Image Sequences:");
+        renderSequencePanel(state);
+        
+        ImGui::Separator();
+        
+        ImGui::Text("N-way Comparison:");
+        renderMultiComparePanel(state);
+        
+        ImGui::Separator();
+        
+        ImGui::Text("Performance:");
+        ImGui::SliderInt("Worker threads", &state.threadCount, 1,
+                         static_cast<int>(ThreadPool::defaultThreadCount()));
+        if (ImGui::IsItemDeactivatedAfterEdit()) {
+            setSharedThreadCount(static_cast<unsigned>(state.threadCount));
+        }
+        renderImageCacheStats(state);
+        renderMemoryUsage(state);
+        ImGui::Checkbox("Power saving", &state.powerSaving);
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Only redraw on input or while work is pending, instead of at 60 FPS");
+        }
+        if (ImGui::Checkbox("Profiler", &state.showProfiler)) {
+            setProfilingEnabled(state.showProfiler);
+        }
         
         ImGui::Separator();
         if (ImGui::Button("Reset Pan")) {
@@ -478,7 +2307,8 @@ int main() {
         float viewWidth = availableWidth / 2.0f - 10.0f;
         float viewHeight = windowSize.y - 20.0f;
         float currentZoom = state.zoomLevel;
-        float zoom2 = state.autoMatchSizes ? currentZoom * state.relativeZoom2 : currentZoom;
+        float zoom2 = currentZoom * image2Scale(state);
+        sf::Vector2f offset2 = image2Offset(state);
         
         ImVec2 leftPanePos, rightPanePos;
         ImVec2 leftPaneSize, rightPaneSize;
@@ -492,16 +2322,12 @@ int main() {
                           ImGuiWindowFlags_HorizontalScrollbar);
         leftPanePos = ImGui::GetWindowPos();
         leftPaneSize = ImGui::GetWindowSize();
+        state.paneSize = {leftPaneSize.x, leftPaneSize.y};
         
         if (state.image1Loaded) {
-            sf::Vector2u texSize = state.texture1.getSize();
-            float scaledWidth = texSize.x * currentZoom;
-            float scaledHeight = texSize.y * currentZoom;
-            
             ImVec2 imagePos = ImVec2(state.panOffset.x + 5, state.panOffset.y + 5);
             ImGui::SetCursorPos(imagePos);
-            ImTextureID texId = static_cast<ImTextureID>(static_cast<uintptr_t>(state.texture1.getNativeHandle()));
-            ImGui::Image(texId, ImVec2(scaledWidth, scaledHeight));
+            state.texture1.draw(currentZoom);
             
             if (ImGui::IsWindowHovered() && ImGui::IsMouseClicked(ImGuiMouseButton_Left)) {
                 ImVec2 mousePos = ImGui::GetMousePos();
@@ -520,6 +2346,14 @@ int main() {
                 float imgX = (mousePos.x - windowPos.x - imagePos.x) / currentZoom;
                 float imgY = (mousePos.y - windowPos.y - imagePos.y) / currentZoom;
                 state.selectionEnd = {imgX, imgY};
+                
+                // Mid-drag selections are often empty, so failures here stay
+                // out of the status bar.
+                std::string error;
+                if (state.liveSelection && state.image2Loaded && updateSelectionComparison(state, error)) {
+                    state.selectionImageGenerated = true;
+                    state.showSelectionWindow = true;
+                }
             }
             
             if (state.isSelecting && ImGui::IsMouseReleased(ImGuiMouseButton_Left)) {
@@ -558,27 +2392,23 @@ int main() {
         rightPaneSize = ImGui::GetWindowSize();
         
         if (state.image2Loaded) {
-            sf::Vector2u texSize = state.texture2.getSize();
-            float scaledWidth = texSize.x * zoom2;
-            float scaledHeight = texSize.y * zoom2;
-            
-            ImVec2 imagePos = ImVec2(state.panOffset.x + 5, state.panOffset.y + 5);
+            ImVec2 imagePos = ImVec2(state.panOffset.x + 5 + offset2.x * currentZoom,
+                                     state.panOffset.y + 5 + offset2.y * currentZoom);
             ImGui::SetCursorPos(imagePos);
-            ImTextureID texId = static_cast<ImTextureID>(static_cast<uintptr_t>(state.texture2.getNativeHandle()));
-            ImGui::Image(texId, ImVec2(scaledWidth, scaledHeight));
+            state.texture2.draw(zoom2);
             
             if (state.hasSelection || state.isSelecting) {
                 ImDrawList* drawList = ImGui::GetWindowDrawList();
                 sf::Vector2f minCoord, maxCoord;
                 getNormalizedSelection(state, minCoord, maxCoord);
                 
-                float relZoom = state.autoMatchSizes ? state.relativeZoom2 : 1.0f;
+                float relZoom = image2Scale(state);
                 
                 ImVec2 windowPos = ImGui::GetWindowPos();
-                float rectX1 = windowPos.x + imagePos.x + (minCoord.x / relZoom) * zoom2;
-                float rectY1 = windowPos.y + imagePos.y + (minCoord.y / relZoom) * zoom2;
-                float rectX2 = windowPos.x + imagePos.x + (maxCoord.x / relZoom) * zoom2;
-                float rectY2 = windowPos.y + imagePos.y + (maxCoord.y / relZoom) * zoom2;
+                float rectX1 = windowPos.x + imagePos.x + ((minCoord.x - offset2.x) / relZoom) * zoom2;
+                float rectY1 = windowPos.y + imagePos.y + ((minCoord.y - offset2.y) / relZoom) * zoom2;
+                float rectX2 = windowPos.x + imagePos.x + ((maxCoord.x - offset2.x) / relZoom) * zoom2;
+                float rectY2 = windowPos.y + imagePos.y + ((maxCoord.y - offset2.y) / relZoom) * zoom2;
                 
                 drawList->AddRect(ImVec2(rectX1, rectY1), ImVec2(rectX2, rectY2), 
                                   IM_COL32(0, 255, 0, 255), 0.0f, 0, 2.0f);
@@ -600,19 +2430,27 @@ int main() {
             ImGui::SetNextWindowFocus();
             ImGui::Begin("Difference Image", &state.showDiffWindow);
             
-            sf::Vector2u texSize = state.diffTexture.getSize();
-            float scaledWidth = texSize.x * currentZoom;
-            float scaledHeight = texSize.y * currentZoom;
-            
             ImGui::BeginChild("DiffView", ImVec2(0, 0), true, ImGuiWindowFlags_HorizontalScrollbar);
             ImGui::SetCursorPos(ImVec2(state.panOffset.x + 5, state.panOffset.y + 5));
-            ImTextureID texId = static_cast<ImTextureID>(static_cast<uintptr_t>(state.diffTexture.getNativeHandle()));
-            ImGui::Image(texId, ImVec2(scaledWidth, scaledHeight));
+            if (state.diffDisplay.mode == DiffDisplayMode::Flicker) {
+                drawFlicker(state, currentZoom);
+            }
+            else if (state.lazyDiff.active()) {
+                state.lazyDiff.draw(currentZoom);
+            }
+            else {
+                state.diffTexture.draw(currentZoom);
+            }
+            drawChangeRegionOutlines(state, ImGui::GetItemRectMin(), currentZoom);
             ImGui::EndChild();
             
             ImGui::End();
         }
         
+        if (state.multiReference >= 0 && state.showReferenceGrid) {
+            renderReferenceGrid(state, currentZoom);
+        }
+        
         if (state.selectionImageGenerated && state.showSelectionWindow) {
             ImVec2 center = ImGui::GetMainViewport()->GetCenter();
             ImGui::SetNextWindowPos(center, ImGuiCond_Appearing, ImVec2(0.5f, 0.5f));
@@ -620,27 +2458,48 @@ int main() {
             ImGui::SetNextWindowFocus();
             ImGui::Begin("Selection Comparison", &state.showSelectionWindow);
             
-            sf::Vector2u texSize = state.selectionTexture.getSize();
-            float scaledWidth = texSize.x * currentZoom;
-            float scaledHeight = texSize.y * currentZoom;
-            
-            ImGui::Text("Left: Image 1 selection | Right: Image 2 selection");
-            ImGui::Separator();
-            
             ImGui::BeginChild("SelectionView", ImVec2(0, 0), true, ImGuiWindowFlags_HorizontalScrollbar);
             ImGui::SetCursorPos(ImVec2(5, 5));
-            ImTextureID texId = static_cast<ImTextureID>(static_cast<uintptr_t>(state.selectionTexture.getNativeHandle()));
-            ImGui::Image(texId, ImVec2(scaledWidth, scaledHeight));
+            state.selectionView.draw(currentZoom);
             ImGui::EndChild();
             
             ImGui::End();
         }
 
+        if (state.showProfiler) {
+            renderProfiler(state);
+            if (!state.showProfiler) {
+                setProfilingEnabled(false);
+            }
+        }
+        // Tooltips and the text cursor change with time alone.
+        state.uiHasTimers = ImGui::IsAnyItemHovered() || ImGui::GetIO().WantTextInput;
+        uiTimer.stop();
+
         window.clear(sf::Color(50, 50, 50));
-        ImGui::SFML::Render(window);
-        window.display();
+        {
+            ScopedTimer timer("ImGui::SFML::Render");
+            ImGui::SFML::Render(window);
+        }
+        {
+            ScopedTimer timer("Display");
+            window.display();
+        }
+        if (settleFrames > 0) {
+            --settleFrames;
+        }
     }
 
+    if (state.indexJob) {
+        state.indexJob->progress.cancelRequested = true;
+    }
+    if (state.sequenceJob) {
+        state.sequenceJob->progress.cancelRequested = true;
+    }
+    // Queued saves are the user's data, so they finish rather than cancel.
+    state.savePool.waitIdle();
+    // Pooled textures must go while the window's GL context still exists.
+    TiledTexture::setTexturePoolBudget(0);
     ImGui::SFML::Shutdown();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,292 @@
+#include "mapped_image.hpp"
+
+#include "image_utils.hpp"
+#include "precise_image.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+#ifdef _WIN32
+
+namespace {
+
+bool mapWholeFile(HANDLE file, std::size_t bytes, bool writable, void*& mapping, std::uint8_t*& view) {
+    DWORD protect = writable ? PAGE_READWRITE : PAGE_READONLY;
+    DWORD access = writable ? FILE_MAP_WRITE : FILE_MAP_READ;
+    mapping = CreateFileMappingW(file, nullptr, protect, static_cast<DWORD>(static_cast<std::uint64_t>(bytes) >> 32),
+                                 static_cast<DWORD>(bytes & 0xFFFFFFFFu), nullptr);
+    if (!mapping) {
+        return false;
+    }
+    view = static_cast<std::uint8_t*>(MapViewOfFile(mapping, access, 0, 0, bytes));
+    return view != nullptr;
+}
+
+}
+
+bool MappedFile::openReadOnly(const std::string& path, std::string& error) {
+    close();
+
+    HANDLE file = CreateFileW(std::filesystem::path(path).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    LARGE_INTEGER fileSize{};
+    if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize) || fileSize.QuadPart <= 0) {
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        error = "Failed to open image: " + path;
+        return false;
+    }
+
+    fileHandle = file;
+    length = static_cast<std::size_t>(fileSize.QuadPart);
+    if (!mapWholeFile(file, length, false, mappingHandle, bytes)) {
+        close();
+        error = "Failed to map image: " + path;
+        return false;
+    }
+    return true;
+}
+
+bool MappedFile::create(const std::string& path, std::size_t size, std::string& error) {
+    close();
+
+    HANDLE file = CreateFileW(std::filesystem::path(path).c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+                              CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        error = "Failed to create output: " + path;
+        return false;
+    }
+
+    fileHandle = file;
+    length = size;
+    writable = true;
+    if (!mapWholeFile(file, length, true, mappingHandle, bytes)) {
+        close();
+        error = "Failed to map output: " + path;
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::close() {
+    if (bytes) UnmapViewOfFile(bytes);
+    if (mappingHandle) CloseHandle(mappingHandle);
+    if (fileHandle) CloseHandle(fileHandle);
+    bytes = nullptr;
+    mappingHandle = nullptr;
+    fileHandle = nullptr;
+    length = 0;
+    writable = false;
+}
+
+#else
+
+bool MappedFile::openReadOnly(const std::string& path, std::string& error) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat info {};
+    if (fd < 0 || fstat(fd, &info) != 0 || info.st_size <= 0) {
+        if (fd >= 0) ::close(fd);
+        error = "Failed to open image: " + path;
+        return false;
+    }
+
+    length = static_cast<std::size_t>(info.st_size);
+    void* view = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (view == MAP_FAILED) {
+        length = 0;
+        error = "Failed to map image: " + path;
+        return false;
+    }
+
+    // The diff walks the file front to back exactly once.
+    posix_madvise(view, length, POSIX_MADV_SEQUENTIAL);
+    bytes = static_cast<std::uint8_t*>(view);
+    return true;
+}
+
+bool MappedFile::create(const std::string& path, std::size_t size, std::string& error) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        error = "Failed to create output: " + path;
+        return false;
+    }
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        ::close(fd);
+        error = "Failed to allocate output: " + path;
+        return false;
+    }
+
+    void* view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (view == MAP_FAILED) {
+        error = "Failed to map output: " + path;
+        return false;
+    }
+
+    bytes = static_cast<std::uint8_t*>(view);
+    length = size;
+    writable = true;
+    return true;
+}
+
+void MappedFile::close() {
+    if (bytes) {
+        munmap(bytes, length);
+    }
+    bytes = nullptr;
+    length = 0;
+    writable = false;
+}
+
+#endif
+
+bool MappedImage::open(const std::string& path, std::string& error) {
+    header = RawImageHeader{};
+    if (!file.openReadOnly(path, error)) {
+        return false;
+    }
+
+    std::size_t headerBytes = std::min(file.size(), MaxRawHeaderBytes);
+    if (!parseRawImageHeader(path, file.data(), headerBytes, header, error)) {
+        file.close();
+        return false;
+    }
+    if (file.size() - header.dataOffset < header.dataBytes()) {
+        file.close();
+        error = "Image data is truncated: " + path;
+        return false;
+    }
+    return true;
+}
+
+bool MappedImage::create(const std::string& path, sf::Vector2u size, std::string& error) {
+    header = RawImageHeader{};
+    if (!isRgbaRawFormatPath(path)) {
+        error = "Mapped output must be .pam or .rgba: " + path;
+        return false;
+    }
+
+    std::string prefix = createRawImageHeader(path, size);
+    header.size = size;
+    header.channels = 4;
+    header.dataOffset = prefix.size();
+
+    if (!file.create(path, header.dataOffset + header.dataBytes(), error)) {
+        return false;
+    }
+    std::memcpy(file.mutableData(), prefix.data(), prefix.size());
+    return true;
+}
+
+void MappedImage::copyRowsAsRgba(unsigned firstRow, unsigned rows, std::uint8_t* rgba) const {
+    expandToRgba(getSamples() + firstRow * getStride(), header.channels, rgba,
+                 static_cast<std::size_t>(header.size.x) * rows);
+}
+
+bool refersToSameFile(const std::string& path1, const std::string& path2) {
+    std::error_code ec;
+    return std::filesystem::equivalent(path1, path2, ec) && !ec;
+}
+
+bool isExactImageOutputPath(const std::string& path) {
+    std::string extension = lowercaseExtension(path);
+    return extension == ".png" || extension == ".qoi" || extension == ".sdiff" || extension == ".pfm" ||
+           extension == ".bmp" || extension == ".tga" || extension == ".ppm" || extension == ".pnm" ||
+           isRgbaRawFormatPath(path);
+}
+
+bool saveImageFile(const sf::Image& image, const std::string& path, const ImageSaveOptions& options) {
+    std::string extension = lowercaseExtension(path);
+    if (extension == ".png" || extension == ".qoi" || extension == ".sdiff") {
+        std::vector<std::uint8_t> bytes;
+        bool encoded = extension == ".png"   ? encodePng(image, options.pngLevel, bytes)
+                       : extension == ".qoi" ? encodeQoi(image, bytes)
+                                             : encodeSparseDiff(image, bytes);
+        if (!encoded) {
+            return false;
+        }
+        // Written next to the target and renamed over it, so a failed write
+        // leaves the previous file intact.
+        std::string temporaryPath = path + ".tmp";
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        file.close();
+        std::error_code ec;
+        if (!file) {
+            std::filesystem::remove(temporaryPath, ec);
+            return false;
+        }
+        std::filesystem::rename(temporaryPath, path, ec);
+        if (ec) {
+            std::filesystem::remove(temporaryPath, ec);
+            return false;
+        }
+        return true;
+    }
+
+    if (extension == ".pfm") {
+        PixelView<std::uint8_t> view{image.getPixelsPtr(), image.getSize(), 4, rowStride(image)};
+        PrecisePixels floats{std::in_place_type<PixelBuffer<float>>};
+        convertPixels(view, 4, std::get<PixelBuffer<float>>(floats));
+        std::string error;
+        return savePreciseImage(floats, path, error);
+    }
+
+    std::string prefix = createRawImageHeader(path, image.getSize());
+    if (prefix.empty()) {
+        return image.saveToFile(path);
+    }
+
+    unsigned channels = isRgbaRawFormatPath(path) ? 4 : extension == ".pgm" ? 1 : 3;
+    std::size_t pixels = static_cast<std::size_t>(image.getSize().x) * image.getSize().y;
+    std::size_t dataBytes = pixels * channels;
+
+    MappedFile file;
+    std::string error;
+    if (!file.create(path, prefix.size() + dataBytes, error)) {
+        return false;
+    }
+
+    std::uint8_t* out = file.mutableData();
+    std::memcpy(out, prefix.data(), prefix.size());
+    out += prefix.size();
+
+    const std::uint8_t* in = image.getPixelsPtr();
+    if (channels == 4) {
+        std::memcpy(out, in, dataBytes);
+    }
+    else if (channels == 3) {
+        for (std::size_t i = 0; i < pixels; ++i) {
+            std::memcpy(out + i * 3, in + i * 4, 3);
+        }
+    }
+    else {
+        // Same luma weights as the Luminance display mode.
+        for (std::size_t i = 0; i < pixels; ++i, in += 4) {
+            out[i] = static_cast<std::uint8_t>((77u * in[0] + 150u * in[1] + 29u * in[2]) >> 8);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "image_codecs.hpp"
+#include "raw_formats.hpp"
+
+#include <SFML/Graphics.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// A whole file mapped into memory, either read-only or read-write.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool openReadOnly(const std::string& path, std::string& error);
+
+    // Creates (or truncates) `path` to `bytes` and maps it for writing.
+    bool create(const std::string& path, std::size_t bytes, std::string& error);
+
+    // Closing unmaps; dirty pages are written back by the OS.
+    void close();
+
+    const std::uint8_t* data() const { return bytes; }
+    std::uint8_t* mutableData() { return writable ? bytes : nullptr; }
+    std::size_t size() const { return length; }
+
+private:
+    std::uint8_t* bytes = nullptr;
+    std::size_t length = 0;
+    bool writable = false;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+};
+
+// An image in one of the raw formats, used in place from the mapping. RGBA
+// data (.pam with DEPTH 4, .rgba) can be handed straight to the diff kernels;
+// other layouts are widened a few rows at a time with copyRowsAsRgba. The
+// row accessors assume 8-bit samples; 16-bit and float files are decoded
+// with decodePrecisePixels instead.
+class MappedImage {
+public:
+    bool open(const std::string& path, std::string& error);
+
+    // Maps a new .pam or .rgba file of `size` whose pixels can be written
+    // through getMutableSamples.
+    bool create(const std::string& path, sf::Vector2u size, std::string& error);
+
+    void close() { file.close(); }
+
+    sf::Vector2u getSize() const { return header.size; }
+    unsigned getChannels() const { return header.channels; }
+    bool isRgba() const { return header.channels == 4; }
+    bool isEightBit() const { return header.sampleType == SampleType::UInt8; }
+    const RawImageHeader& getHeader() const { return header; }
+    std::size_t getStride() const { return static_cast<std::size_t>(header.size.x) * header.channels; }
+
+    const std::uint8_t* getSamples() const { return file.data() + header.dataOffset; }
+    std::uint8_t* getMutableSamples() { return file.mutableData() + header.dataOffset; }
+
+    void copyRowsAsRgba(unsigned firstRow, unsigned rows, std::uint8_t* rgba) const;
+
+    // The whole file, header included.
+    const MappedFile& getFile() const { return file; }
+
+private:
+    MappedFile file;
+    RawImageHeader header;
+};
+
+// True when both paths name the same existing file, e.g. through a link or
+// a different spelling. Writing an output over an input that is still mapped
+// would truncate it under the mapping.
+bool refersToSameFile(const std::string& path1, const std::string& path2);
+
+// True for the formats saveImageFile writes without losing RGB deltas:
+// not .jpg or the gray .pgm.
+bool isExactImageOutputPath(const std::string& path);
+
+// Writes the raw formats through a mapping (.pgm as gray), PNG, QOI and
+// sparse differences (.sdiff) with the built-in encoders, .pfm as floats, and
+// everything else through sf::Image::saveToFile.
+bool saveImageFile(const sf::Image& image, const std::string& path, const ImageSaveOptions& options = {});
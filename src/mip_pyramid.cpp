@@ -0,0 +1,55 @@
+#include "mip_pyramid.hpp"
+
+#include "image_utils.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+void downsampleHalf(const sf::Image& source, sf::Image& target) {
+    sf::Vector2u size = source.getSize();
+    unsigned width = std::max(1u, (size.x + 1) / 2);
+    unsigned height = std::max(1u, (size.y + 1) / 2);
+
+    target.resize({width, height});
+    if (size.x == 0 || size.y == 0) {
+        return;
+    }
+
+    const std::uint8_t* src = source.getPixelsPtr();
+    std::uint8_t* dst = mutablePixelsPtr(target);
+    std::size_t srcStride = rowStride(source);
+    std::size_t dstStride = rowStride(target);
+
+    parallelForRows(height, width * 4, [&](unsigned firstRow, unsigned endRow) {
+        for (unsigned y = firstRow; y < endRow; ++y) {
+            const std::uint8_t* row0 = src + static_cast<std::size_t>(2 * y) * srcStride;
+            const std::uint8_t* row1 = src + static_cast<std::size_t>(std::min(2 * y + 1, size.y - 1)) * srcStride;
+            std::uint8_t* out = dst + y * dstStride;
+
+            for (unsigned x = 0; x < width; ++x) {
+                std::size_t left = static_cast<std::size_t>(2 * x) * 4;
+                std::size_t right = static_cast<std::size_t>(std::min(2 * x + 1, size.x - 1)) * 4;
+                for (unsigned c = 0; c < 4; ++c) {
+                    unsigned sum = row0[left + c] + row0[right + c] + row1[left + c] + row1[right + c];
+                    out[x * 4 + c] = static_cast<std::uint8_t>((sum + 2) / 4);
+                }
+            }
+        }
+    });
+}
+
+void buildMipChain(const sf::Image& base, std::vector<sf::Image>& levels) {
+    sf::Vector2u size = base.getSize();
+    std::size_t levelCount = 0;
+    while (size.x > PyramidTileSize || size.y > PyramidTileSize) {
+        size = {(size.x + 1) / 2, (size.y + 1) / 2};
+        ++levelCount;
+    }
+
+    levels.clear();
+    levels.resize(levelCount);
+    for (std::size_t i = 0; i < levelCount; ++i) {
+        downsampleHalf(i == 0 ? base : levels[i - 1], levels[i]);
+    }
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <vector>
+
+// Edge length of the square tiles the GUI uploads. 1024 is the smallest
+// GL_MAX_TEXTURE_SIZE any OpenGL 3 driver may report.
+constexpr unsigned PyramidTileSize = 1024;
+
+// Halves `source` with a 2x2 box filter. Odd trailing rows/columns are
+// averaged with themselves, so every level keeps covering the whole image.
+void downsampleHalf(const sf::Image& source, sf::Image& target);
+
+// Fills `levels` with the successively halved versions of `base` (level 1
+// onwards) until the coarsest fits in a single tile. Images that already fit
+// produce no levels.
+void buildMipChain(const sf::Image& base, std::vector<sf::Image>& levels);
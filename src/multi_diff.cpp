@@ -0,0 +1,158 @@
+#include "multi_diff.hpp"
+
+#include "image_utils.hpp"
+#include "parallel.hpp"
+#include "precise_diff.hpp"
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <mutex>
+
+namespace {
+
+// Per-target state of one band of the fused pass.
+struct LaneBand {
+    DiffAccumulator accumulator;
+    SsimAccumulator ssim;
+
+    explicit LaneBand(unsigned width) : ssim(width) {}
+};
+
+}
+
+bool computeMultiDifference(const sf::Image& reference, const std::vector<const sf::Image*>& targets,
+                            std::vector<ReferenceComparison>& results, std::uint8_t tolerance,
+                            bool withMetrics) {
+    ScopedTimer timer("Compute multi difference");
+    sf::Vector2u referenceSize = reference.getSize();
+    // Entries are reset rather than recreated so their pixel buffers are
+    // reused when the same set is compared again.
+    results.resize(targets.size());
+
+    // Lanes are the targets that overlap the reference at all.
+    std::vector<std::size_t> lanes;
+    unsigned rows = 0;
+    unsigned widestLane = 0;
+    for (std::size_t i = 0; i < targets.size(); ++i) {
+        sf::Vector2u size = targets[i]->getSize();
+        ReferenceComparison& result = results[i];
+        result.summary = DiffSummary{};
+        result.metrics = DiffMetrics{};
+        result.identicalFiles = false;
+        result.valid = false;
+        result.summary.sizeMismatch = size != referenceSize;
+        result.summary.width = std::min(size.x, referenceSize.x);
+        result.summary.height = std::min(size.y, referenceSize.y);
+        if (result.summary.width == 0 || result.summary.height == 0) {
+            result.summary.width = 0;
+            result.summary.height = 0;
+            continue;
+        }
+        result.valid = true;
+        result.diffImage.resize({result.summary.width, result.summary.height}, sf::Color::Transparent);
+        lanes.push_back(i);
+        rows = std::max(rows, result.summary.height);
+        widestLane = std::max(widestLane, result.summary.width);
+    }
+    if (lanes.empty()) {
+        return false;
+    }
+
+    const DiffKernel& kernel = activeDiffKernel();
+    const std::uint8_t* referencePixels = reference.getPixelsPtr();
+    std::size_t referenceStride = rowStride(reference);
+    std::vector<DiffAccumulator> accumulators(lanes.size());
+    std::mutex accumulatorMutex;
+
+    // As in diffStrip, bands are whole SSIM strips; within a band every
+    // reference row is diffed against all lanes before moving on.
+    unsigned ssimStrips = (rows + SsimBlockSize - 1) / SsimBlockSize;
+    unsigned workPerStrip = widestLane * SsimBlockSize * static_cast<unsigned>(lanes.size());
+    parallelForRows(ssimStrips, workPerStrip, [&](unsigned firstStrip, unsigned endStrip) {
+        std::vector<LaneBand> bands;
+        bands.reserve(lanes.size());
+        for (std::size_t lane : lanes) {
+            bands.emplace_back(withMetrics ? results[lane].summary.width : 0);
+        }
+
+        unsigned firstRow = firstStrip * SsimBlockSize;
+        unsigned endRow = std::min(endStrip * SsimBlockSize, rows);
+        for (unsigned y = firstRow; y < endRow; ++y) {
+            const std::uint8_t* referenceRow = referencePixels + y * referenceStride;
+            for (std::size_t l = 0; l < lanes.size(); ++l) {
+                ReferenceComparison& result = results[lanes[l]];
+                unsigned width = result.summary.width;
+                unsigned height = result.summary.height;
+                if (y >= height) {
+                    continue;
+                }
+                const sf::Image& target = *targets[lanes[l]];
+                const std::uint8_t* targetRow = target.getPixelsPtr() + y * rowStride(target);
+                std::uint8_t* rowOut = mutablePixelsPtr(result.diffImage) + y * rowStride(result.diffImage);
+                LaneBand& band = bands[l];
+
+                kernel.run(referenceRow, targetRow, rowOut, width, tolerance, band.accumulator.rows);
+                if (withMetrics) {
+                    kernel.accumulate(rowOut, width, band.accumulator.delta);
+                    band.ssim.addRow(referenceRow, targetRow);
+                    if ((y + 1) % SsimBlockSize == 0 || y + 1 == height) {
+                        band.ssim.finishStrip();
+                    }
+                }
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(accumulatorMutex);
+        for (std::size_t l = 0; l < lanes.size(); ++l) {
+            bands[l].accumulator.ssimSum = bands[l].ssim.ssimSum;
+            bands[l].accumulator.ssimWindows = bands[l].ssim.windows;
+            accumulators[l].merge(bands[l].accumulator);
+        }
+    });
+
+    for (std::size_t l = 0; l < lanes.size(); ++l) {
+        ReferenceComparison& result = results[lanes[l]];
+        finishDifference(accumulators[l], tolerance, result.summary, withMetrics ? &result.metrics : nullptr);
+    }
+    return true;
+}
+
+bool compareDecodedMulti(const DecodedImage& reference, const std::vector<const DecodedImage*>& targets,
+                         std::uint8_t tolerance, std::vector<ReferenceComparison>& results) {
+    results.clear();
+    results.resize(targets.size());
+
+    std::vector<std::size_t> fused;
+    std::vector<const sf::Image*> fusedImages;
+    for (std::size_t i = 0; i < targets.size(); ++i) {
+        const DecodedImage& target = *targets[i];
+        ReferenceComparison& result = results[i];
+        result.identicalFiles = haveSamePixels(target, reference);
+        if (result.identicalFiles) {
+            identicalDifference(reference.image.getSize(), result.diffImage, result.summary, tolerance,
+                                &result.metrics);
+            if (reference.precise) {
+                result.metrics.sampleType = sampleTypeOf(*reference.precise);
+            }
+            result.valid = true;
+        }
+        else if (reference.precise && target.precise) {
+            result.valid = computeDecodedDifference(reference, target, {0, 0}, result.diffImage, result.summary,
+                                                    tolerance, &result.metrics);
+        }
+        else {
+            fused.push_back(i);
+            fusedImages.push_back(&target.image);
+        }
+    }
+
+    if (!fusedImages.empty()) {
+        std::vector<ReferenceComparison> fusedResults;
+        computeMultiDifference(reference.image, fusedImages, fusedResults, tolerance, true);
+        for (std::size_t f = 0; f < fused.size(); ++f) {
+            results[fused[f]] = std::move(fusedResults[f]);
+        }
+    }
+
+    return std::any_of(results.begin(), results.end(), [](const ReferenceComparison& result) { return result.valid; });
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "diff_metrics.hpp"
+#include "image_cache.hpp"
+#include "image_diff.hpp"
+
+#include <SFML/Graphics.hpp>
+#include <cstdint>
+#include <vector>
+
+// One image compared against the reference.
+struct ReferenceComparison {
+    sf::Image diffImage;
+    DiffSummary summary;
+    DiffMetrics metrics;
+    bool identicalFiles = false;
+    // False when the image and the reference do not overlap at all.
+    bool valid = false;
+};
+
+// Diffs every target against `reference` in one pass: each reference row is
+// read once and diffed against the same row of all targets while it is still
+// in cache, instead of one full pass over the reference per target. Results
+// match computeDifference for each pair (top-left aligned, overlap only).
+// `results` gets one entry per target; returns false if none overlaps.
+bool computeMultiDifference(const sf::Image& reference, const std::vector<const sf::Image*>& targets,
+                            std::vector<ReferenceComparison>& results, std::uint8_t tolerance = 0,
+                            bool withMetrics = false);
+
+// As compareDecodedImages for every target, with metrics. Change regions are
+// left out; nothing browses them per target.
+// Byte-identical targets skip the pixel pass and pairs that both carry
+// precise samples take the precise path; all other targets share one fused
+// pass over the reference.
+bool compareDecodedMulti(const DecodedImage& reference, const std::vector<const DecodedImage*>& targets,
+                         std::uint8_t tolerance, std::vector<ReferenceComparison>& results);
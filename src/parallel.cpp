@@ -0,0 +1,99 @@
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+constexpr std::size_t MinParallelPixels = 512 * 512;
+constexpr std::size_t MinBandPixels = 64 * 1024;
+constexpr unsigned BandsPerThread = 4;
+
+std::mutex poolMutex;
+std::shared_ptr<ThreadPool> pool;
+
+// Joins the thread retiring the last replaced pool. Each reaper joins its
+// predecessor first, so joining the latest one at exit waits for all of them
+// before the statics the old workers may still use are destroyed.
+struct PoolReaper {
+    std::mutex mutex;
+    std::thread thread;
+
+    ~PoolReaper() {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+};
+
+// Constructed on the first resize, after the texture pool and the other
+// lazily created statics, so it is destroyed before them.
+PoolReaper& poolReaper() {
+    static PoolReaper reaper;
+    return reaper;
+}
+
+}
+
+std::shared_ptr<ThreadPool> sharedThreadPool() {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    if (!pool) {
+        pool = std::make_shared<ThreadPool>();
+    }
+    return pool;
+}
+
+void setSharedThreadCount(unsigned threadCount) {
+    if (threadCount == 0) {
+        threadCount = ThreadPool::defaultThreadCount();
+    }
+
+    std::shared_ptr<ThreadPool> previous;
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        if (pool && pool->size() == threadCount) {
+            return;
+        }
+        previous = std::move(pool);
+        pool = std::make_shared<ThreadPool>(threadCount);
+    }
+
+    // Destroying the old pool joins its workers once their queued work is
+    // done, which must not stall the caller (usually the UI thread).
+    if (previous) {
+        PoolReaper& reaper = poolReaper();
+        std::lock_guard<std::mutex> lock(reaper.mutex);
+        reaper.thread = std::thread([previous = std::move(previous), before = std::move(reaper.thread)]() mutable {
+            if (before.joinable()) {
+                before.join();
+            }
+            previous.reset();
+        });
+    }
+}
+
+unsigned sharedThreadCount() {
+    return sharedThreadPool()->size();
+}
+
+void parallelForRows(unsigned height, unsigned width, const std::function<void(unsigned, unsigned)>& body) {
+    std::size_t pixels = static_cast<std::size_t>(width) * height;
+    if (height == 0 || width == 0) {
+        return;
+    }
+    if (pixels < MinParallelPixels) {
+        body(0, height);
+        return;
+    }
+
+    std::shared_ptr<ThreadPool> threads = sharedThreadPool();
+    std::size_t minRows = (MinBandPixels + width - 1) / width;
+    std::size_t balancedRows = height / (static_cast<std::size_t>(threads->size()) * BandsPerThread);
+    std::size_t grain = std::max<std::size_t>({1, minRows, balancedRows});
+
+    threads->parallelFor(height, grain, [&body](std::size_t begin, std::size_t end) {
+        body(static_cast<unsigned>(begin), static_cast<unsigned>(end));
+    });
+}
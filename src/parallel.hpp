@@ -0,0 +1,18 @@
+#pragma once
+
+#include "thread_pool.hpp"
+
+#include <functional>
+
+#include <memory>
+
+// Process-wide pool shared by the GUI and batch mode. Resizing swaps in a new
+// pool; callers holding the old one keep it alive until they are done.
+std::shared_ptr<ThreadPool> sharedThreadPool();
+void setSharedThreadCount(unsigned threadCount);
+unsigned sharedThreadCount();
+
+// Splits [0, height) into row bands and runs body(firstRow, endRow) on the
+// shared pool. Images below a few hundred thousand pixels run inline on the
+// calling thread so small comparisons don't pay for the hand-off.
+void parallelForRows(unsigned height, unsigned width, const std::function<void(unsigned, unsigned)>& body);
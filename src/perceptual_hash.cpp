@@ -0,0 +1,190 @@
+#include "perceptual_hash.hpp"
+
+#include "image_utils.hpp"
+#include "scanline_io.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <numbers>
+#include <vector>
+
+namespace {
+
+constexpr unsigned DHashWidth = 9;
+constexpr unsigned DHashHeight = 8;
+constexpr unsigned PHashSize = 32;
+constexpr unsigned PHashKept = 8;
+constexpr unsigned HashStripRows = 64;
+
+// Box-filters the luma of an image into a gridWidth x gridHeight thumbnail,
+// one source row at a time.
+class LumaGrid {
+public:
+    LumaGrid(unsigned width, unsigned height, unsigned gridWidth, unsigned gridHeight)
+        : width(width), height(height), gridWidth(gridWidth), gridHeight(gridHeight),
+          columnCell(width), sums(static_cast<std::size_t>(gridWidth) * gridHeight, 0.0),
+          counts(sums.size(), 0) {
+        for (unsigned x = 0; x < width; ++x) {
+            columnCell[x] = static_cast<unsigned>(static_cast<std::uint64_t>(x) * gridWidth / width);
+        }
+    }
+
+    void addRow(const std::uint8_t* rgba, unsigned y) {
+        std::size_t rowOffset = static_cast<std::size_t>(static_cast<std::uint64_t>(y) * gridHeight / height) *
+                                gridWidth;
+        for (unsigned x = 0; x < width; ++x, rgba += 4) {
+            std::size_t cell = rowOffset + columnCell[x];
+            sums[cell] += 0.299 * rgba[0] + 0.587 * rgba[1] + 0.114 * rgba[2];
+            ++counts[cell];
+        }
+    }
+
+    // Images smaller than the grid leave some cells empty; those repeat the
+    // cell that holds the nearest source pixel.
+    std::vector<double> finish() const {
+        std::vector<double> values(sums.size());
+        for (unsigned gy = 0; gy < gridHeight; ++gy) {
+            for (unsigned gx = 0; gx < gridWidth; ++gx) {
+                std::size_t cell = static_cast<std::size_t>(gy) * gridWidth + gx;
+                if (counts[cell] == 0) {
+                    unsigned sourceX = static_cast<unsigned>(static_cast<std::uint64_t>(gx) * width / gridWidth);
+                    unsigned sourceY = static_cast<unsigned>(static_cast<std::uint64_t>(gy) * height / gridHeight);
+                    cell = static_cast<std::size_t>(static_cast<std::uint64_t>(sourceY) * gridHeight / height) *
+                               gridWidth + columnCell[sourceX];
+                }
+                values[static_cast<std::size_t>(gy) * gridWidth + gx] =
+                    sums[cell] / static_cast<double>(std::max<std::uint64_t>(counts[cell], 1));
+            }
+        }
+        return values;
+    }
+
+private:
+    unsigned width;
+    unsigned height;
+    unsigned gridWidth;
+    unsigned gridHeight;
+    std::vector<unsigned> columnCell;
+    std::vector<double> sums;
+    std::vector<std::uint64_t> counts;
+};
+
+std::uint64_t differenceHashFromGrid(const std::vector<double>& grid) {
+    std::uint64_t hash = 0;
+    for (unsigned y = 0; y < DHashHeight; ++y) {
+        for (unsigned x = 0; x + 1 < DHashWidth; ++x) {
+            hash <<= 1;
+            hash |= grid[y * DHashWidth + x] < grid[y * DHashWidth + x + 1] ? 1 : 0;
+        }
+    }
+    return hash;
+}
+
+const std::array<double, PHashKept * PHashSize>& dctBasis() {
+    static const std::array<double, PHashKept * PHashSize> basis = [] {
+        std::array<double, PHashKept * PHashSize> table{};
+        for (unsigned k = 0; k < PHashKept; ++k) {
+            for (unsigned n = 0; n < PHashSize; ++n) {
+                table[k * PHashSize + n] = std::cos(std::numbers::pi * (2.0 * n + 1.0) * k / (2.0 * PHashSize));
+            }
+        }
+        return table;
+    }();
+    return basis;
+}
+
+// Only the lowest 8x8 frequencies of the 32x32 DCT-II are needed, so the
+// separable transform computes just those.
+std::uint64_t perceptualHashFromGrid(const std::vector<double>& grid) {
+    const auto& basis = dctBasis();
+
+    std::array<double, PHashSize * PHashKept> rows{};
+    for (unsigned y = 0; y < PHashSize; ++y) {
+        for (unsigned k = 0; k < PHashKept; ++k) {
+            double sum = 0.0;
+            for (unsigned x = 0; x < PHashSize; ++x) {
+                sum += grid[y * PHashSize + x] * basis[k * PHashSize + x];
+            }
+            rows[y * PHashKept + k] = sum;
+        }
+    }
+
+    std::array<double, PHashKept * PHashKept> coefficients{};
+    for (unsigned v = 0; v < PHashKept; ++v) {
+        for (unsigned u = 0; u < PHashKept; ++u) {
+            double sum = 0.0;
+            for (unsigned y = 0; y < PHashSize; ++y) {
+                sum += rows[y * PHashKept + u] * basis[v * PHashSize + y];
+            }
+            coefficients[v * PHashKept + u] = sum;
+        }
+    }
+
+    // The DC term only tracks overall brightness and is left out of the median.
+    std::array<double, PHashKept * PHashKept - 1> ac;
+    std::copy(coefficients.begin() + 1, coefficients.end(), ac.begin());
+    std::nth_element(ac.begin(), ac.begin() + ac.size() / 2, ac.end());
+    double median = ac[ac.size() / 2];
+
+    std::uint64_t hash = 0;
+    for (double coefficient : coefficients) {
+        hash = (hash << 1) | (coefficient > median ? 1 : 0);
+    }
+    return hash;
+}
+
+}
+
+unsigned hammingDistance(std::uint64_t a, std::uint64_t b) {
+    return static_cast<unsigned>(std::popcount(a ^ b));
+}
+
+PerceptualHashes computePerceptualHashes(const sf::Image& image) {
+    PerceptualHashes hashes;
+    sf::Vector2u size = image.getSize();
+    if (size.x == 0 || size.y == 0) {
+        return hashes;
+    }
+
+    LumaGrid small(size.x, size.y, DHashWidth, DHashHeight);
+    LumaGrid large(size.x, size.y, PHashSize, PHashSize);
+    const std::uint8_t* pixels = image.getPixelsPtr();
+    for (unsigned y = 0; y < size.y; ++y) {
+        const std::uint8_t* row = pixels + y * rowStride(image);
+        small.addRow(row, y);
+        large.addRow(row, y);
+    }
+
+    hashes.dHash = differenceHashFromGrid(small.finish());
+    hashes.pHash = perceptualHashFromGrid(large.finish());
+    return hashes;
+}
+
+bool computePerceptualHashes(ScanlineReader& reader, PerceptualHashes& hashes) {
+    sf::Vector2u size = reader.getSize();
+    if (size.x == 0 || size.y == 0) {
+        return false;
+    }
+
+    LumaGrid small(size.x, size.y, DHashWidth, DHashHeight);
+    LumaGrid large(size.x, size.y, PHashSize, PHashSize);
+    std::size_t stride = static_cast<std::size_t>(size.x) * 4;
+    std::vector<std::uint8_t> strip(stride * HashStripRows);
+
+    for (unsigned y = 0; y < size.y; y += HashStripRows) {
+        unsigned rows = std::min(HashStripRows, size.y - y);
+        if (!reader.readRows(strip.data(), rows)) {
+            return false;
+        }
+        for (unsigned r = 0; r < rows; ++r) {
+            small.addRow(strip.data() + r * stride, y + r);
+            large.addRow(strip.data() + r * stride, y + r);
+        }
+    }
+
+    hashes.dHash = differenceHashFromGrid(small.finish());
+    hashes.pHash = perceptualHashFromGrid(large.finish());
+    return true;
+}
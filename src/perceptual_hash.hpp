@@ -0,0 +1,24 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <cstdint>
+
+class ScanlineReader;
+
+// 64-bit fingerprints that stay close (in Hamming distance) under resizing,
+// recompression and small edits.
+//   dHash: signs of horizontal gradients on a 9x8 luma thumbnail
+//   pHash: low 8x8 DCT coefficients of a 32x32 luma thumbnail against their
+//          median
+struct PerceptualHashes {
+    std::uint64_t dHash = 0;
+    std::uint64_t pHash = 0;
+};
+
+unsigned hammingDistance(std::uint64_t a, std::uint64_t b);
+
+PerceptualHashes computePerceptualHashes(const sf::Image& image);
+
+// Same result from rows read a strip at a time, so huge images never have to
+// be fully decoded to be indexed.
+bool computePerceptualHashes(ScanlineReader& reader, PerceptualHashes& hashes);
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+enum class SampleType {
+    UInt8,
+    UInt16,
+    Float32,
+};
+
+template <typename T>
+struct SampleTraits;
+
+template <>
+struct SampleTraits<std::uint8_t> {
+    static constexpr SampleType type = SampleType::UInt8;
+    static constexpr float fullScale = 255.0f;
+};
+
+template <>
+struct SampleTraits<std::uint16_t> {
+    static constexpr SampleType type = SampleType::UInt16;
+    static constexpr float fullScale = 65535.0f;
+};
+
+// Floating-point samples are nominally 0-1 but may exceed it (HDR).
+template <>
+struct SampleTraits<float> {
+    static constexpr SampleType type = SampleType::Float32;
+    static constexpr float fullScale = 1.0f;
+};
+
+// Read-only rows of interleaved samples; `stride` counts samples, not bytes.
+template <typename T>
+struct PixelView {
+    const T* samples = nullptr;
+    sf::Vector2u size;
+    unsigned channels = 0;
+    std::size_t stride = 0;
+
+    const T* row(unsigned y) const { return samples + y * stride; }
+};
+
+// Tightly packed interleaved samples with 1, 3 or 4 channels. Four channels
+// are RGBA; gray and RGB images are implicitly opaque.
+template <typename T>
+struct PixelBuffer {
+    using value_type = T;
+
+    sf::Vector2u size;
+    unsigned channels = 0;
+    std::vector<T> samples;
+
+    void resize(sf::Vector2u newSize, unsigned newChannels) {
+        size = newSize;
+        channels = newChannels;
+        samples.assign(static_cast<std::size_t>(size.x) * size.y * channels, T{});
+    }
+
+    std::size_t stride() const { return static_cast<std::size_t>(size.x) * channels; }
+    T* row(unsigned y) { return samples.data() + y * stride(); }
+    const T* row(unsigned y) const { return samples.data() + y * stride(); }
+    std::size_t byteSize() const { return samples.size() * sizeof(T); }
+
+    PixelView<T> view() const { return {samples.data(), size, channels, stride()}; }
+};
+
+// Samples of a 16-bit or floating-point file, kept beside the 8-bit copy the
+// textures are made from. 16-bit samples are rescaled to the full 0-65535
+// range when the file's maximum is lower.
+using PrecisePixels = std::variant<PixelBuffer<std::uint16_t>, PixelBuffer<float>>;
+
+inline SampleType sampleTypeOf(const PrecisePixels& pixels) {
+    return std::holds_alternative<PixelBuffer<float>>(pixels) ? SampleType::Float32 : SampleType::UInt16;
+}
+
+inline sf::Vector2u sizeOf(const PrecisePixels& pixels) {
+    return std::visit([](const auto& buffer) { return buffer.size; }, pixels);
+}
+
+inline std::size_t byteSizeOf(const PrecisePixels& pixels) {
+    return std::visit([](const auto& buffer) { return buffer.byteSize(); }, pixels);
+}
+
+const char* sampleTypeName(SampleType type);
+
+// One sample rescaled between types, e.g. 0-65535 to 0-1. Float to integer
+// clamps and rounds.
+template <typename To, typename From>
+inline To convertSample(From value) {
+    if constexpr (std::is_same_v<To, From>) {
+        return value;
+    }
+    else if constexpr (std::is_floating_point_v<To>) {
+        // Divided rather than multiplied by the reciprocal, so v / 65535 is
+        // the correctly rounded float a float file would hold.
+        return static_cast<To>(value) / (SampleTraits<From>::fullScale / SampleTraits<To>::fullScale);
+    }
+    else {
+        float scaled = static_cast<float>(value) * (SampleTraits<To>::fullScale / SampleTraits<From>::fullScale);
+        // Written so that NaN, which fails every comparison, becomes 0.
+        scaled = scaled > 0.0f ? scaled : 0.0f;
+        scaled = scaled > SampleTraits<To>::fullScale ? SampleTraits<To>::fullScale : scaled;
+        return static_cast<To>(scaled + 0.5f);
+    }
+}
+
+// Copies `view` into `out` as samples of type To with `channels` channels
+// (at least as many colour channels as the view has). Gray is replicated
+// into RGB, missing alpha becomes opaque and a dropped alpha is discarded.
+template <typename To, typename From>
+void convertPixels(const PixelView<From>& view, unsigned channels, PixelBuffer<To>& out) {
+    out.resize(view.size, channels);
+    constexpr To opaque = static_cast<To>(SampleTraits<To>::fullScale);
+    for (unsigned y = 0; y < view.size.y; ++y) {
+        const From* in = view.row(y);
+        To* target = out.row(y);
+        for (unsigned x = 0; x < view.size.x; ++x, in += view.channels, target += channels) {
+            for (unsigned c = 0; c < channels; ++c) {
+                if (c == 3) {
+                    target[c] = view.channels == 4 ? convertSample<To>(in[3]) : opaque;
+                }
+                else {
+                    target[c] = convertSample<To>(in[view.channels == 1 ? 0 : c]);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,419 @@
+#include "precise_diff.hpp"
+
+#include "image_utils.hpp"
+#include "parallel.hpp"
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+namespace {
+
+template <typename T>
+using SquareSum = std::conditional_t<std::is_floating_point_v<T>, double, std::uint64_t>;
+
+template <typename A, typename B>
+using WiderSample = std::conditional_t<std::is_floating_point_v<A> || std::is_floating_point_v<B>, float,
+                                       std::conditional_t<(sizeof(A) >= sizeof(B)), A, B>>;
+
+template <typename T>
+struct PreciseAccumulator {
+    std::uint64_t differingPixels = 0;
+    std::uint64_t nonFinitePixels = 0;
+    T maxDelta = 0;
+    std::array<SquareSum<T>, 3> sumSquares{};
+    std::array<T, 3> channelMax{};
+    std::array<std::uint64_t, 256> histogram{};
+    double ssimSum = 0.0;
+    std::uint64_t ssimWindows = 0;
+
+    void merge(const PreciseAccumulator& other) {
+        differingPixels += other.differingPixels;
+        nonFinitePixels += other.nonFinitePixels;
+        maxDelta = std::max(maxDelta, other.maxDelta);
+        for (int c = 0; c < 3; ++c) {
+            sumSquares[c] += other.sumSquares[c];
+            channelMax[c] = std::max(channelMax[c], other.channelMax[c]);
+        }
+        for (std::size_t i = 0; i < histogram.size(); ++i) {
+            histogram[i] += other.histogram[i];
+        }
+        ssimSum += other.ssimSum;
+        ssimWindows += other.ssimWindows;
+    }
+};
+
+// Float samples that cannot be subtracted, NaN on one side or infinities
+// of opposite sign, differ by an infinite delta, so they count as differing
+// however high the tolerance. The same NaN or infinity on both sides is no
+// difference.
+template <typename T>
+inline T absoluteDelta(T a, T b) {
+    if constexpr (std::is_floating_point_v<T>) {
+        T d = std::fabs(a - b);
+        if (std::isnan(d)) {
+            return a == b || (std::isnan(a) && std::isnan(b)) ? T(0) : std::numeric_limits<T>::infinity();
+        }
+        return d;
+    }
+    else {
+        return static_cast<T>(a > b ? a - b : b - a);
+    }
+}
+
+// A delta in 8-bit units, rounded up: the result exceeds an 8-bit tolerance
+// exactly when the delta exceeds the scaled tolerance.
+template <typename T>
+inline std::uint8_t displayDelta(T delta) {
+    if constexpr (std::is_floating_point_v<T>) {
+        float scaled = std::ceil(delta * 255.0f);
+        return scaled < 255.0f ? static_cast<std::uint8_t>(scaled) : 255;
+    }
+    else if constexpr (sizeof(T) == 2) {
+        return static_cast<std::uint8_t>((static_cast<std::uint32_t>(delta) * 255u + 65534u) / 65535u);
+    }
+    else {
+        return delta;
+    }
+}
+
+template <typename T>
+T scaledTolerance(std::uint8_t tolerance) {
+    if constexpr (std::is_floating_point_v<T>) {
+        return static_cast<float>(tolerance) / 255.0f;
+    }
+    else {
+        return static_cast<T>(tolerance * (static_cast<unsigned>(SampleTraits<T>::fullScale) / 255u));
+    }
+}
+
+// out = |a - b| per colour channel (alpha forced opaque), plus its 8-bit
+// RGBA version. Channels is a compile-time constant so the inner loops
+// unroll and vectorize like the 8-bit kernels.
+template <typename T, unsigned Channels>
+void diffRow(const T* a, const T* b, T* delta, std::uint8_t* display, unsigned width, T tolerance,
+             PreciseAccumulator<T>& stats) {
+    constexpr unsigned Colours = Channels == 4 ? 3 : Channels;
+    constexpr T Opaque = static_cast<T>(SampleTraits<T>::fullScale);
+    T maxDelta = stats.maxDelta;
+    std::uint64_t differing = 0;
+    std::uint64_t nonFinite = 0;
+
+    for (unsigned x = 0; x < width; ++x) {
+        const T* pa = a + x * Channels;
+        const T* pb = b + x * Channels;
+        T* pd = delta + x * Channels;
+        std::uint8_t* po = display + x * 4;
+
+        T channelMax = 0;
+        for (unsigned c = 0; c < Colours; ++c) {
+            T d = absoluteDelta(pa[c], pb[c]);
+            pd[c] = d;
+            channelMax = std::max(channelMax, d);
+        }
+        if constexpr (Channels == 4) {
+            pd[3] = Opaque;
+        }
+
+        for (unsigned c = 0; c < 3; ++c) {
+            po[c] = displayDelta(pd[Colours == 1 ? 0 : c]);
+        }
+        po[3] = 255;
+
+        maxDelta = std::max(maxDelta, channelMax);
+        differing += channelMax > tolerance ? 1 : 0;
+        if constexpr (std::is_floating_point_v<T>) {
+            nonFinite += std::isinf(channelMax) ? 1 : 0;
+        }
+    }
+
+    stats.maxDelta = maxDelta;
+    stats.differingPixels += differing;
+    stats.nonFinitePixels += nonFinite;
+}
+
+template <typename T, unsigned Channels>
+void accumulateRow(const T* delta, unsigned width, PreciseAccumulator<T>& stats) {
+    constexpr unsigned Colours = Channels == 4 ? 3 : Channels;
+    for (unsigned x = 0; x < width; ++x) {
+        const T* pd = delta + x * Channels;
+        T channelMax = 0;
+        for (unsigned c = 0; c < Colours; ++c) {
+            SquareSum<T> d = pd[c];
+            // Infinite deltas are counted on their own rather than turning
+            // the MSE of every finite pixel into infinity.
+            if constexpr (std::is_floating_point_v<T>) {
+                d = std::isinf(d) ? 0.0 : d;
+            }
+            stats.sumSquares[c] += d * d;
+            stats.channelMax[c] = std::max(stats.channelMax[c], pd[c]);
+            channelMax = std::max(channelMax, pd[c]);
+        }
+        ++stats.histogram[displayDelta(channelMax)];
+    }
+}
+
+// Luma in 0-255 units without rounding, weighted like the 8-bit SSIM.
+template <typename T, unsigned Channels>
+void lumaRow(const T* row, unsigned width, float* luma) {
+    constexpr float Scale = 255.0f / SampleTraits<T>::fullScale;
+    for (unsigned x = 0; x < width; ++x) {
+        const T* p = row + x * Channels;
+        if constexpr (Channels == 1) {
+            luma[x] = static_cast<float>(p[0]) * Scale;
+        }
+        else {
+            luma[x] = (77.0f * static_cast<float>(p[0]) + 150.0f * static_cast<float>(p[1]) +
+                       29.0f * static_cast<float>(p[2])) * (Scale / 256.0f);
+        }
+        // NaN and infinite samples would poison every window sum they touch.
+        if constexpr (std::is_floating_point_v<T>) {
+            luma[x] = std::isfinite(luma[x]) ? luma[x] : 0.0f;
+        }
+    }
+}
+
+// SsimAccumulator over unrounded luma.
+class PreciseSsim {
+public:
+    explicit PreciseSsim(unsigned width) : width(width), strip((width + SsimBlockSize - 1) / SsimBlockSize) {}
+
+    void addRow(const float* luma1, const float* luma2) {
+        for (unsigned x = 0; x < width; ++x) {
+            double a = luma1[x];
+            double b = luma2[x];
+            Window& window = strip[x / SsimBlockSize];
+            window.sum1 += a;
+            window.sum2 += b;
+            window.sumSq1 += a * a;
+            window.sumSq2 += b * b;
+            window.sumProduct += a * b;
+        }
+        ++rows;
+    }
+
+    void finishStrip() {
+        if (rows == 0) {
+            return;
+        }
+        for (std::size_t w = 0; w < strip.size(); ++w) {
+            unsigned columns = std::min(SsimBlockSize, width - static_cast<unsigned>(w) * SsimBlockSize);
+            const Window& window = strip[w];
+            ssimSum += windowSsim(window.sum1, window.sum2, window.sumSq1, window.sumSq2, window.sumProduct,
+                                  static_cast<double>(columns) * rows);
+            ++windows;
+        }
+        std::fill(strip.begin(), strip.end(), Window{});
+        rows = 0;
+    }
+
+    double ssimSum = 0.0;
+    std::uint64_t windows = 0;
+
+private:
+    struct Window {
+        double sum1 = 0.0;
+        double sum2 = 0.0;
+        double sumSq1 = 0.0;
+        double sumSq2 = 0.0;
+        double sumProduct = 0.0;
+    };
+
+    unsigned width;
+    unsigned rows = 0;
+    std::vector<Window> strip;
+};
+
+// Where the two images overlap, in image 1's coordinates.
+struct Overlap {
+    unsigned left = 0;
+    unsigned top = 0;
+    unsigned right = 0;
+    unsigned bottom = 0;
+
+    unsigned width() const { return right - left; }
+    unsigned height() const { return bottom - top; }
+};
+
+bool findOverlap(sf::Vector2u size1, sf::Vector2u size2, sf::Vector2i shift, Overlap& overlap) {
+    long long left = std::max(0, shift.x);
+    long long top = std::max(0, shift.y);
+    long long right = std::min<long long>(size1.x, static_cast<long long>(size2.x) + shift.x);
+    long long bottom = std::min<long long>(size1.y, static_cast<long long>(size2.y) + shift.y);
+    if (right <= left || bottom <= top) {
+        return false;
+    }
+    overlap = {static_cast<unsigned>(left), static_cast<unsigned>(top), static_cast<unsigned>(right),
+               static_cast<unsigned>(bottom)};
+    return true;
+}
+
+template <typename T, unsigned Channels>
+void diffPrecise(const PixelView<T>& view1, const PixelView<T>& view2, sf::Vector2i shift, const Overlap& overlap,
+                 std::uint8_t tolerance, bool withMetrics, sf::Image& diffImage, PixelBuffer<T>* deltaOut,
+                 PreciseAccumulator<T>& total) {
+    unsigned width = overlap.width();
+    unsigned rows = overlap.height();
+    T threshold = scaledTolerance<T>(tolerance);
+    std::uint8_t* display = mutablePixelsPtr(diffImage);
+    std::size_t displayStride = rowStride(diffImage);
+    std::mutex totalMutex;
+
+    // Bands are whole SSIM strips, as in diffStrip.
+    unsigned ssimStrips = (rows + SsimBlockSize - 1) / SsimBlockSize;
+    parallelForRows(ssimStrips, width * SsimBlockSize, [&](unsigned firstStrip, unsigned endStrip) {
+        PreciseAccumulator<T> band;
+        PreciseSsim ssim(withMetrics ? width : 0);
+        std::vector<T> scratch(deltaOut ? 0 : static_cast<std::size_t>(width) * Channels);
+        std::vector<float> luma1(withMetrics ? width : 0);
+        std::vector<float> luma2(withMetrics ? width : 0);
+
+        unsigned firstRow = firstStrip * SsimBlockSize;
+        unsigned endRow = std::min(endStrip * SsimBlockSize, rows);
+        for (unsigned y = firstRow; y < endRow; ++y) {
+            unsigned y1 = overlap.top + y;
+            const T* row1 = view1.row(y1) + static_cast<std::size_t>(overlap.left) * Channels;
+            const T* row2 = view2.row(static_cast<unsigned>(static_cast<long long>(y1) - shift.y)) +
+                            static_cast<std::size_t>(static_cast<long long>(overlap.left) - shift.x) * Channels;
+            T* delta = deltaOut ? deltaOut->row(y1) + static_cast<std::size_t>(overlap.left) * Channels
+                                : scratch.data();
+            std::uint8_t* rowDisplay = display + y1 * displayStride + static_cast<std::size_t>(overlap.left) * 4;
+
+            diffRow<T, Channels>(row1, row2, delta, rowDisplay, width, threshold, band);
+            if (withMetrics) {
+                accumulateRow<T, Channels>(delta, width, band);
+                lumaRow<T, Channels>(row1, width, luma1.data());
+                lumaRow<T, Channels>(row2, width, luma2.data());
+                ssim.addRow(luma1.data(), luma2.data());
+                if ((y + 1) % SsimBlockSize == 0 || y + 1 == rows) {
+                    ssim.finishStrip();
+                }
+            }
+        }
+        band.ssimSum = ssim.ssimSum;
+        band.ssimWindows = ssim.windows;
+
+        std::lock_guard<std::mutex> lock(totalMutex);
+        total.merge(band);
+    });
+}
+
+template <typename T>
+void finishPreciseDifference(const PreciseAccumulator<T>& total, unsigned channels, std::uint8_t tolerance,
+                             DiffSummary& summary, DiffMetrics* metrics) {
+    constexpr double FullScale = SampleTraits<T>::fullScale;
+    summary.differingPixels = total.differingPixels;
+    summary.nonFinitePixels = total.nonFinitePixels;
+    summary.maxDelta = displayDelta(total.maxDelta);
+    summary.maxDeltaFraction = static_cast<double>(total.maxDelta) / FullScale;
+    summary.sampleType = SampleTraits<T>::type;
+    if (!metrics) {
+        return;
+    }
+
+    *metrics = DiffMetrics{};
+    metrics->width = summary.width;
+    metrics->height = summary.height;
+    metrics->tolerance = tolerance;
+    metrics->sampleType = summary.sampleType;
+
+    // Gray images report their one channel as R, G and B.
+    std::array<double, 3> sumSquares{};
+    std::array<double, 3> maxDeltaFraction{};
+    double toEightBit = (255.0 / FullScale) * (255.0 / FullScale);
+    for (unsigned c = 0; c < 3; ++c) {
+        unsigned source = channels == 1 ? 0 : c;
+        sumSquares[c] = static_cast<double>(total.sumSquares[source]) * toEightBit;
+        maxDeltaFraction[c] = static_cast<double>(total.channelMax[source]) / FullScale;
+    }
+    finalizeDiffMetrics(*metrics, sumSquares, maxDeltaFraction, total.histogram, total.differingPixels,
+                        total.ssimSum, total.ssimWindows);
+}
+
+template <typename T>
+bool diffSameLayout(const PixelView<T>& view1, const PixelView<T>& view2, sf::Vector2i shift, std::uint8_t tolerance,
+                    sf::Image& diffImage, DiffSummary& summary, DiffMetrics* metrics,
+                    std::optional<PrecisePixels>* preciseDiff) {
+    Overlap overlap;
+    if (!findOverlap(view1.size, view2.size, shift, overlap)) {
+        return false;
+    }
+    summary.width = overlap.width();
+    summary.height = overlap.height();
+    diffImage.resize({overlap.right, overlap.bottom}, sf::Color::Transparent);
+
+    PixelBuffer<T>* deltaOut = nullptr;
+    if (preciseDiff) {
+        deltaOut = &preciseDiff->emplace().template emplace<PixelBuffer<T>>();
+        deltaOut->resize({overlap.right, overlap.bottom}, view1.channels);
+    }
+
+    PreciseAccumulator<T> total;
+    bool withMetrics = metrics != nullptr;
+    switch (view1.channels) {
+        case 1:
+            diffPrecise<T, 1>(view1, view2, shift, overlap, tolerance, withMetrics, diffImage, deltaOut, total);
+            break;
+        case 3:
+            diffPrecise<T, 3>(view1, view2, shift, overlap, tolerance, withMetrics, diffImage, deltaOut, total);
+            break;
+        default:
+            diffPrecise<T, 4>(view1, view2, shift, overlap, tolerance, withMetrics, diffImage, deltaOut, total);
+            break;
+    }
+    finishPreciseDifference(total, view1.channels, tolerance, summary, metrics);
+    return true;
+}
+
+}
+
+bool computeDecodedDifference(const DecodedImage& image1, const DecodedImage& image2, sf::Vector2i shift,
+                              sf::Image& diffImage, DiffSummary& summary, std::uint8_t tolerance,
+                              DiffMetrics* metrics, std::optional<PrecisePixels>* preciseDiff) {
+    if (!image1.precise || !image2.precise) {
+        if (preciseDiff) {
+            preciseDiff->reset();
+        }
+        return computeShiftedDifference(image1.image, image2.image, shift, diffImage, summary, tolerance, metrics);
+    }
+
+    ScopedTimer timer("Compute precise difference");
+    summary = DiffSummary{};
+    summary.sizeMismatch = image1.image.getSize() != image2.image.getSize();
+
+    return std::visit(
+        [&](const auto& buffer1, const auto& buffer2) {
+            using T1 = typename std::decay_t<decltype(buffer1)>::value_type;
+            using T2 = typename std::decay_t<decltype(buffer2)>::value_type;
+            using Common = WiderSample<T1, T2>;
+            unsigned channels = std::max(buffer1.channels, buffer2.channels);
+
+            PixelBuffer<Common> widened1;
+            PixelBuffer<Common> widened2;
+            PixelView<Common> view1;
+            PixelView<Common> view2;
+            if constexpr (std::is_same_v<T1, Common>) {
+                view1 = buffer1.view();
+            }
+            if constexpr (std::is_same_v<T2, Common>) {
+                view2 = buffer2.view();
+            }
+            if (!std::is_same_v<T1, Common> || buffer1.channels != channels) {
+                ScopedTimer widenTimer("Widen samples");
+                convertPixels(buffer1.view(), channels, widened1);
+                view1 = widened1.view();
+            }
+            if (!std::is_same_v<T2, Common> || buffer2.channels != channels) {
+                ScopedTimer widenTimer("Widen samples");
+                convertPixels(buffer2.view(), channels, widened2);
+                view2 = widened2.view();
+            }
+            return diffSameLayout(view1, view2, shift, tolerance, diffImage, summary, metrics, preciseDiff);
+        },
+        *image1.precise, *image2.precise);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "image_cache.hpp"
+#include "image_diff.hpp"
+#include "pixel_buffer.hpp"
+
+#include <SFML/Graphics.hpp>
+#include <cstdint>
+
+// The dispatch point for whole-image differences. When both images carry
+// 16-bit or float samples they are diffed at that precision, by kernels
+// specialized for the sample type and channel count (1, 3 or 4); a 16-bit
+// image against a float one, or gray against colour, is widened to the
+// common layout first. Everything else takes the 8-bit path of
+// computeShiftedDifference.
+//
+// `diffImage` is always the 8-bit version for display, with deltas rounded
+// up so that it marks exactly the pixels over `tolerance`. The tolerance is
+// in 8-bit units and scaled to the sample type (x257 for 16-bit, /255 for
+// float). `preciseDiff`, when given, receives the delta at full precision, or
+// is reset when the 8-bit path ran.
+bool computeDecodedDifference(const DecodedImage& image1, const DecodedImage& image2, sf::Vector2i shift,
+                              sf::Image& diffImage, DiffSummary& summary, std::uint8_t tolerance = 0,
+                              DiffMetrics* metrics = nullptr, std::optional<PrecisePixels>* preciseDiff = nullptr);
@@ -0,0 +1,237 @@
+#include "precise_image.hpp"
+
+#include "image_utils.hpp"
+#include "parallel.hpp"
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace {
+
+bool hostIsLittleEndian() {
+    const std::uint16_t probe = 1;
+    std::uint8_t first;
+    std::memcpy(&first, &probe, 1);
+    return first == 1;
+}
+
+std::uint32_t swapBytes(std::uint32_t value) {
+    return (value >> 24) | ((value >> 8) & 0xFF00u) | ((value << 8) & 0xFF0000u) | (value << 24);
+}
+
+// Netpbm rows are big-endian and may use any maximum up to 65535.
+void decodeUInt16Rows(const RawImageHeader& header, const std::uint8_t* data, PixelBuffer<std::uint16_t>& out) {
+    unsigned channels = out.channels;
+    std::size_t fileStride = static_cast<std::size_t>(header.size.x) * header.channels * 2;
+    std::uint32_t maxValue = header.maxValue;
+
+    parallelForRows(header.size.y, header.size.x, [&](unsigned firstRow, unsigned endRow) {
+        for (unsigned y = firstRow; y < endRow; ++y) {
+            const std::uint8_t* in = data + y * fileStride;
+            std::uint16_t* target = out.row(y);
+            for (unsigned x = 0; x < header.size.x; ++x, target += channels) {
+                for (unsigned c = 0; c < header.channels; ++c, in += 2) {
+                    std::uint32_t value = std::min<std::uint32_t>((in[0] << 8) | in[1], maxValue);
+                    if (maxValue != 65535) {
+                        value = (value * 65535u + maxValue / 2) / maxValue;
+                    }
+                    // Gray+alpha lands in RGB and A.
+                    unsigned slot = header.channels == 2 && c == 1 ? 3 : c;
+                    target[slot] = static_cast<std::uint16_t>(value);
+                }
+                if (header.channels == 2) {
+                    target[1] = target[2] = target[0];
+                }
+            }
+        }
+    });
+}
+
+void decodeFloatRows(const RawImageHeader& header, const std::uint8_t* data, PixelBuffer<float>& out) {
+    std::size_t rowSamples = out.stride();
+    bool swap = header.littleEndian != hostIsLittleEndian();
+
+    parallelForRows(header.size.y, header.size.x, [&](unsigned firstRow, unsigned endRow) {
+        for (unsigned y = firstRow; y < endRow; ++y) {
+            unsigned fileRow = header.bottomUp ? header.size.y - 1 - y : y;
+            const std::uint8_t* in = data + fileRow * rowSamples * 4;
+            float* target = out.row(y);
+            std::memcpy(target, in, rowSamples * 4);
+            if (swap) {
+                for (std::size_t i = 0; i < rowSamples; ++i) {
+                    std::uint32_t bits;
+                    std::memcpy(&bits, target + i, 4);
+                    bits = swapBytes(bits);
+                    std::memcpy(target + i, &bits, 4);
+                }
+            }
+        }
+    });
+}
+
+template <typename T>
+void convertRowsToDisplay(const PixelBuffer<T>& buffer, sf::Image& image) {
+    image.resize(buffer.size);
+    std::uint8_t* pixels = mutablePixelsPtr(image);
+    std::size_t stride = rowStride(image);
+
+    parallelForRows(buffer.size.y, buffer.size.x, [&](unsigned firstRow, unsigned endRow) {
+        for (unsigned y = firstRow; y < endRow; ++y) {
+            const T* in = buffer.row(y);
+            std::uint8_t* out = pixels + y * stride;
+            for (unsigned x = 0; x < buffer.size.x; ++x, in += buffer.channels, out += 4) {
+                out[0] = convertSample<std::uint8_t>(in[0]);
+                out[1] = buffer.channels == 1 ? out[0] : convertSample<std::uint8_t>(in[1]);
+                out[2] = buffer.channels == 1 ? out[0] : convertSample<std::uint8_t>(in[2]);
+                out[3] = buffer.channels == 4 ? convertSample<std::uint8_t>(in[3]) : 255;
+            }
+        }
+    });
+}
+
+bool writeFloatMap(const PixelBuffer<float>& buffer, const std::string& path, std::string& error) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        error = "Failed to create output: " + path;
+        return false;
+    }
+
+    unsigned channels = buffer.channels == 1 ? 1 : 3;
+    file << (channels == 1 ? "Pf\n" : "PF\n") << buffer.size.x << ' ' << buffer.size.y << '\n'
+         << (hostIsLittleEndian() ? "-1.0\n" : "1.0\n");
+
+    std::vector<float> row(static_cast<std::size_t>(buffer.size.x) * channels);
+    for (unsigned y = buffer.size.y; y-- > 0;) {
+        const float* in = buffer.row(y);
+        for (unsigned x = 0; x < buffer.size.x; ++x) {
+            for (unsigned c = 0; c < channels; ++c) {
+                row[x * channels + c] = in[x * buffer.channels + c];
+            }
+        }
+        file.write(reinterpret_cast<const char*>(row.data()), static_cast<std::streamsize>(row.size() * 4));
+    }
+    if (!file) {
+        error = "Failed to write image: " + path;
+        return false;
+    }
+    return true;
+}
+
+bool writeNetpbm16(const PixelBuffer<std::uint16_t>& buffer, const std::string& path, std::string& error) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        error = "Failed to create output: " + path;
+        return false;
+    }
+
+    bool pam = lowercaseExtension(path) == ".pam";
+    unsigned channels = pam ? buffer.channels : 3;
+    if (pam) {
+        static const char* const TupleTypes[] = {"", "GRAYSCALE", "", "RGB", "RGB_ALPHA"};
+        file << "P7\nWIDTH " << buffer.size.x << "\nHEIGHT " << buffer.size.y << "\nDEPTH " << channels
+             << "\nMAXVAL 65535\nTUPLTYPE " << TupleTypes[channels] << "\nENDHDR\n";
+    }
+    else {
+        file << "P6\n" << buffer.size.x << ' ' << buffer.size.y << "\n65535\n";
+    }
+
+    std::vector<std::uint8_t> row(static_cast<std::size_t>(buffer.size.x) * channels * 2);
+    for (unsigned y = 0; y < buffer.size.y; ++y) {
+        const std::uint16_t* in = buffer.row(y);
+        std::uint8_t* out = row.data();
+        for (unsigned x = 0; x < buffer.size.x; ++x, in += buffer.channels) {
+            for (unsigned c = 0; c < channels; ++c, out += 2) {
+                std::uint16_t value = in[buffer.channels == 1 ? 0 : c];
+                out[0] = static_cast<std::uint8_t>(value >> 8);
+                out[1] = static_cast<std::uint8_t>(value);
+            }
+        }
+        file.write(reinterpret_cast<const char*>(row.data()), static_cast<std::streamsize>(row.size()));
+    }
+    if (!file) {
+        error = "Failed to write image: " + path;
+        return false;
+    }
+    return true;
+}
+
+}
+
+const char* sampleTypeName(SampleType type) {
+    switch (type) {
+        case SampleType::UInt8: return "8-bit";
+        case SampleType::UInt16: return "16-bit";
+        case SampleType::Float32: return "float";
+    }
+    return "";
+}
+
+bool decodePrecisePixels(const RawImageHeader& header, const std::uint8_t* data, PrecisePixels& pixels) {
+    ScopedTimer timer("Decode precise samples");
+    unsigned channels = header.channels == 2 ? 4 : header.channels;
+    if (header.sampleType == SampleType::UInt16) {
+        PixelBuffer<std::uint16_t>& buffer = pixels.emplace<PixelBuffer<std::uint16_t>>();
+        buffer.resize(header.size, channels);
+        decodeUInt16Rows(header, data, buffer);
+        return true;
+    }
+    if (header.sampleType == SampleType::Float32) {
+        PixelBuffer<float>& buffer = pixels.emplace<PixelBuffer<float>>();
+        buffer.resize(header.size, channels);
+        decodeFloatRows(header, data, buffer);
+        return true;
+    }
+    return false;
+}
+
+bool isPreciseImageFile(const std::string& path) {
+    if (!isRawFormatPath(path)) {
+        return false;
+    }
+    std::ifstream file(path, std::ios::binary);
+    std::vector<std::uint8_t> prefix(MaxRawHeaderBytes);
+    file.read(reinterpret_cast<char*>(prefix.data()), static_cast<std::streamsize>(prefix.size()));
+    RawImageHeader header;
+    std::string error;
+    return parseRawImageHeader(path, prefix.data(), static_cast<std::size_t>(file.gcount()), header, error) &&
+           header.sampleType != SampleType::UInt8;
+}
+
+void convertToDisplay(const PrecisePixels& pixels, sf::Image& image) {
+    ScopedTimer timer("Convert for display");
+    std::visit([&](const auto& buffer) { convertRowsToDisplay(buffer, image); }, pixels);
+}
+
+bool isPreciseOutputPath(const std::string& path) {
+    std::string extension = lowercaseExtension(path);
+    return extension == ".pfm" || extension == ".ppm" || extension == ".pam";
+}
+
+bool savePreciseImage(const PrecisePixels& pixels, const std::string& path, std::string& error) {
+    ScopedTimer timer("Save precise image");
+    std::string extension = lowercaseExtension(path);
+    if (extension == ".pfm") {
+        if (const auto* floats = std::get_if<PixelBuffer<float>>(&pixels)) {
+            return writeFloatMap(*floats, path, error);
+        }
+        PixelBuffer<float> converted;
+        const auto& words = std::get<PixelBuffer<std::uint16_t>>(pixels);
+        convertPixels(words.view(), words.channels, converted);
+        return writeFloatMap(converted, path, error);
+    }
+    if (extension == ".ppm" || extension == ".pam") {
+        if (const auto* words = std::get_if<PixelBuffer<std::uint16_t>>(&pixels)) {
+            return writeNetpbm16(*words, path, error);
+        }
+        PixelBuffer<std::uint16_t> converted;
+        const auto& floats = std::get<PixelBuffer<float>>(pixels);
+        convertPixels(floats.view(), floats.channels, converted);
+        return writeNetpbm16(converted, path, error);
+    }
+
+    error = "Precise output must be .pfm, .ppm or .pam: " + path;
+    return false;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "pixel_buffer.hpp"
+#include "raw_formats.hpp"
+
+#include <SFML/Graphics.hpp>
+#include <cstdint>
+#include <string>
+
+// Decodes the samples of a 16-bit or float raw-format file; `data` points at
+// the sample data described by `header`. Gray+alpha is widened to RGBA.
+bool decodePrecisePixels(const RawImageHeader& header, const std::uint8_t* data, PrecisePixels& pixels);
+
+// True for raw-format files whose header declares 16-bit or float samples;
+// only the header is read.
+bool isPreciseImageFile(const std::string& path);
+
+// The 8-bit RGBA copy shown on screen: 16-bit samples are rounded, floats
+// clamped to 0-1.
+void convertToDisplay(const PrecisePixels& pixels, sf::Image& image);
+
+// .pfm (float, alpha dropped), .ppm (16-bit RGB) and .pam (16-bit, every
+// channel) keep a precise image's samples; other formats need convertToDisplay.
+bool isPreciseOutputPath(const std::string& path);
+bool savePreciseImage(const PrecisePixels& pixels, const std::string& path, std::string& error);
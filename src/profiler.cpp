@@ -0,0 +1,146 @@
+#include "profiler.hpp"
+
+#include "diff_metrics.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string_view>
+#include <unordered_map>
+
+std::atomic<bool> profilingEnabledFlag{false};
+
+namespace {
+
+static_assert((ProfileRingCapacity & (ProfileRingCapacity - 1)) == 0, "ring capacity must be a power of two");
+
+// `sequence` is the event index + 1 once the slot is complete and 0 while a
+// writer is filling it, so readers can tell a stable slot from a torn one.
+struct Slot {
+    std::atomic<std::uint64_t> sequence{0};
+    std::atomic<const char*> name{nullptr};
+    std::atomic<std::uint64_t> startNs{0};
+    std::atomic<std::uint64_t> durationNs{0};
+    std::atomic<std::uint32_t> threadId{0};
+};
+
+Slot ring[ProfileRingCapacity];
+std::atomic<std::uint64_t> ringHead{0};
+std::atomic<std::uint64_t> ringClearedAt{0};
+std::atomic<std::uint32_t> nextThreadId{0};
+
+std::uint32_t currentThreadId() {
+    thread_local std::uint32_t id = nextThreadId.fetch_add(1, std::memory_order_relaxed) + 1;
+    return id;
+}
+
+double percentile(const std::vector<std::uint64_t>& sorted, double fraction) {
+    std::size_t rank = static_cast<std::size_t>(fraction * static_cast<double>(sorted.size()) + 0.999999);
+    rank = std::clamp<std::size_t>(rank, 1, sorted.size());
+    return static_cast<double>(sorted[rank - 1]) / 1e6;
+}
+
+}
+
+void setProfilingEnabled(bool enabled) {
+    profileClockNs();
+    profilingEnabledFlag.store(enabled, std::memory_order_relaxed);
+}
+
+std::uint64_t profileClockNs() {
+    static const auto epoch = std::chrono::steady_clock::now();
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count());
+}
+
+void recordProfileEvent(const char* name, std::uint64_t startNs, std::uint64_t durationNs) {
+    std::uint64_t index = ringHead.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = ring[index & (ProfileRingCapacity - 1)];
+
+    slot.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.startNs.store(startNs, std::memory_order_relaxed);
+    slot.durationNs.store(durationNs, std::memory_order_relaxed);
+    slot.threadId.store(currentThreadId(), std::memory_order_relaxed);
+    slot.sequence.store(index + 1, std::memory_order_release);
+}
+
+void snapshotProfileEvents(std::vector<ProfileEvent>& events) {
+    events.clear();
+    std::uint64_t head = ringHead.load(std::memory_order_acquire);
+    std::uint64_t first = head > ProfileRingCapacity ? head - ProfileRingCapacity : 0;
+    first = std::max(first, ringClearedAt.load(std::memory_order_relaxed));
+    events.reserve(static_cast<std::size_t>(head - first));
+
+    for (std::uint64_t index = first; index < head; ++index) {
+        const Slot& slot = ring[index & (ProfileRingCapacity - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != index + 1) {
+            continue;
+        }
+
+        ProfileEvent event;
+        event.name = slot.name.load(std::memory_order_relaxed);
+        event.startNs = slot.startNs.load(std::memory_order_relaxed);
+        event.durationNs = slot.durationNs.load(std::memory_order_relaxed);
+        event.threadId = slot.threadId.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) == index + 1 && event.name) {
+            events.push_back(event);
+        }
+    }
+}
+
+void clearProfileEvents() {
+    ringClearedAt.store(ringHead.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+std::vector<StageTimings> summarizeProfileEvents(const std::vector<ProfileEvent>& events) {
+    std::unordered_map<std::string_view, std::vector<std::uint64_t>> durations;
+    for (const ProfileEvent& event : events) {
+        durations[event.name].push_back(event.durationNs);
+    }
+
+    std::vector<StageTimings> stages;
+    stages.reserve(durations.size());
+    for (auto& [name, samples] : durations) {
+        std::sort(samples.begin(), samples.end());
+
+        StageTimings stage;
+        stage.name = std::string(name);
+        stage.count = samples.size();
+        for (std::uint64_t sample : samples) {
+            stage.totalMs += static_cast<double>(sample) / 1e6;
+        }
+        stage.p50Ms = percentile(samples, 0.50);
+        stage.p95Ms = percentile(samples, 0.95);
+        stage.p99Ms = percentile(samples, 0.99);
+        stage.maxMs = static_cast<double>(samples.back()) / 1e6;
+        stages.push_back(std::move(stage));
+    }
+
+    std::sort(stages.begin(), stages.end(),
+              [](const StageTimings& a, const StageTimings& b) { return a.totalMs > b.totalMs; });
+    return stages;
+}
+
+bool saveChromeTrace(const std::string& path, const std::vector<ProfileEvent>& events) {
+    std::ofstream file(path);
+    if (!file) {
+        return false;
+    }
+
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    char timing[96];
+    for (std::size_t i = 0; i < events.size(); ++i) {
+        const ProfileEvent& event = events[i];
+        std::snprintf(timing, sizeof(timing), "\"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %u",
+                      static_cast<double>(event.startNs) / 1e3, static_cast<double>(event.durationNs) / 1e3,
+                      event.threadId);
+        file << "  {\"name\": " << jsonQuote(event.name) << ", \"cat\": \"compare-images\", \"ph\": \"X\", "
+             << timing << "}" << (i + 1 < events.size() ? ",\n" : "\n");
+    }
+    file << "]}\n";
+    return static_cast<bool>(file);
+}
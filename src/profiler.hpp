@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Finished events kept in the ring before the oldest are overwritten.
+constexpr std::size_t ProfileRingCapacity = std::size_t{1} << 16;
+
+// One timed scope. `name` is not copied: pass string literals.
+struct ProfileEvent {
+    const char* name = nullptr;
+    std::uint64_t startNs = 0;
+    std::uint64_t durationNs = 0;
+    std::uint32_t threadId = 0;
+};
+
+struct StageTimings {
+    std::string name;
+    std::size_t count = 0;
+    double totalMs = 0.0;
+    double p50Ms = 0.0;
+    double p95Ms = 0.0;
+    double p99Ms = 0.0;
+    double maxMs = 0.0;
+};
+
+// Recording is off by default; timers then cost one relaxed load.
+extern std::atomic<bool> profilingEnabledFlag;
+
+inline bool isProfilingEnabled() {
+    return profilingEnabledFlag.load(std::memory_order_relaxed);
+}
+void setProfilingEnabled(bool enabled);
+
+// Nanoseconds on a steady clock since the first call in the process.
+std::uint64_t profileClockNs();
+
+// Lock-free and safe from any thread. Slots being rewritten while a snapshot
+// is taken are skipped instead of being read torn.
+void recordProfileEvent(const char* name, std::uint64_t startNs, std::uint64_t durationNs);
+
+// Events still in the ring, oldest first.
+void snapshotProfileEvents(std::vector<ProfileEvent>& events);
+void clearProfileEvents();
+
+// Per-name count, total and nearest-rank percentiles, slowest total first.
+std::vector<StageTimings> summarizeProfileEvents(const std::vector<ProfileEvent>& events);
+
+// Trace-event JSON ("X" complete events) for chrome://tracing or Perfetto.
+bool saveChromeTrace(const std::string& path, const std::vector<ProfileEvent>& events);
+
+// Records the lifetime of a scope when profiling was on at its start.
+class ScopedTimer {
+public:
+    explicit ScopedTimer(const char* name)
+        : name(name), active(isProfilingEnabled()), startNs(active ? profileClockNs() : 0) {}
+
+    ~ScopedTimer() { stop(); }
+
+    // Ends the scope early; the destructor then records nothing.
+    void stop() {
+        if (active) {
+            recordProfileEvent(name, startNs, profileClockNs() - startNs);
+            active = false;
+        }
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    const char* name;
+    bool active;
+    std::uint64_t startNs;
+};
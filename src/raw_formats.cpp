@@ -0,0 +1,238 @@
+#include "raw_formats.hpp"
+
+#include "image_utils.hpp"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+class HeaderTokenizer {
+public:
+    HeaderTokenizer(const std::uint8_t* data, std::size_t size) : data(data), size(size) {}
+
+    bool next(std::string& token) {
+        token.clear();
+        while (pos < size) {
+            char ch = static_cast<char>(data[pos]);
+            if (ch == '#') {
+                while (pos < size && data[pos] != '\n') {
+                    ++pos;
+                }
+            }
+            else if (std::isspace(static_cast<unsigned char>(ch))) {
+                ++pos;
+            }
+            else {
+                break;
+            }
+        }
+
+        while (pos < size && !std::isspace(data[pos]) && data[pos] != '#') {
+            token.push_back(static_cast<char>(data[pos++]));
+        }
+        return !token.empty();
+    }
+
+    bool nextNumber(double& value) {
+        std::string token;
+        if (!next(token)) {
+            return false;
+        }
+        char* end = nullptr;
+        value = std::strtod(token.c_str(), &end);
+        return end == token.c_str() + token.size();
+    }
+
+    bool nextUnsigned(unsigned& value) {
+        std::string token;
+        if (!next(token) || token.size() > 9) {
+            return false;
+        }
+        value = 0;
+        for (char ch : token) {
+            if (ch < '0' || ch > '9') {
+                return false;
+            }
+            value = value * 10 + static_cast<unsigned>(ch - '0');
+        }
+        return true;
+    }
+
+    // The single whitespace byte that ends a Netpbm header.
+    bool skipTerminator() {
+        if (pos >= size || !std::isspace(data[pos])) {
+            return false;
+        }
+        ++pos;
+        return true;
+    }
+
+    std::size_t position() const { return pos; }
+
+private:
+    const std::uint8_t* data;
+    std::size_t size;
+    std::size_t pos = 0;
+};
+
+std::uint32_t readLittleEndian32(const std::uint8_t* bytes) {
+    return static_cast<std::uint32_t>(bytes[0]) | static_cast<std::uint32_t>(bytes[1]) << 8 |
+           static_cast<std::uint32_t>(bytes[2]) << 16 | static_cast<std::uint32_t>(bytes[3]) << 24;
+}
+
+void appendLittleEndian32(std::string& out, std::uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+}
+
+bool parseNetpbmHeader(const std::uint8_t* data, std::size_t size, RawImageHeader& header) {
+    HeaderTokenizer tokens(data, size);
+    std::string magic;
+    if (!tokens.next(magic)) {
+        return false;
+    }
+
+    unsigned maxValue = 0;
+    if (magic == "PF" || magic == "Pf") {
+        double scale = 0.0;
+        header.channels = magic == "PF" ? 3 : 1;
+        if (!tokens.nextUnsigned(header.size.x) || !tokens.nextUnsigned(header.size.y) ||
+            !tokens.nextNumber(scale) || scale == 0.0 || !tokens.skipTerminator()) {
+            return false;
+        }
+        header.sampleType = SampleType::Float32;
+        header.maxValue = 0;
+        header.littleEndian = scale < 0.0;
+        header.bottomUp = true;
+        header.dataOffset = tokens.position();
+        return true;
+    }
+    if (magic == "P5" || magic == "P6") {
+        header.channels = magic == "P5" ? 1 : 3;
+        if (!tokens.nextUnsigned(header.size.x) || !tokens.nextUnsigned(header.size.y) ||
+            !tokens.nextUnsigned(maxValue) || !tokens.skipTerminator()) {
+            return false;
+        }
+    }
+    else if (magic == "P7") {
+        bool haveWidth = false, haveHeight = false, haveDepth = false, haveMax = false;
+        std::string key;
+        while (true) {
+            if (!tokens.next(key)) {
+                return false;
+            }
+            if (key == "ENDHDR") {
+                if (!tokens.skipTerminator() || !(haveWidth && haveHeight && haveDepth && haveMax)) {
+                    return false;
+                }
+                break;
+            }
+
+            // TUPLTYPE is implied by DEPTH for the layouts supported here.
+            if (key == "WIDTH") haveWidth = tokens.nextUnsigned(header.size.x);
+            else if (key == "HEIGHT") haveHeight = tokens.nextUnsigned(header.size.y);
+            else if (key == "DEPTH") haveDepth = tokens.nextUnsigned(header.channels);
+            else if (key == "MAXVAL") haveMax = tokens.nextUnsigned(maxValue);
+            else if (std::string value; !tokens.next(value)) return false;
+        }
+    }
+    else {
+        return false;
+    }
+
+    header.dataOffset = tokens.position();
+    header.maxValue = maxValue;
+    header.sampleType = maxValue > 255 ? SampleType::UInt16 : SampleType::UInt8;
+    return (maxValue == 255 || (maxValue > 255 && maxValue <= 65535)) && header.channels >= 1 && header.channels <= 4;
+}
+
+}
+
+bool isRawFormatPath(const std::string& path) {
+    std::string extension = lowercaseExtension(path);
+    return extension == ".pgm" || extension == ".ppm" || extension == ".pnm" || extension == ".pam" ||
+           extension == ".pfm" || extension == ".rgba";
+}
+
+bool isRgbaRawFormatPath(const std::string& path) {
+    std::string extension = lowercaseExtension(path);
+    return extension == ".pam" || extension == ".rgba";
+}
+
+bool parseRawImageHeader(const std::string& path, const std::uint8_t* data, std::size_t size,
+                         RawImageHeader& header, std::string& error) {
+    header = RawImageHeader{};
+
+    bool ok = false;
+    if (lowercaseExtension(path) == ".rgba") {
+        if (size >= RawRgbaHeaderBytes && std::memcmp(data, "RGBA", 4) == 0) {
+            header.size = {readLittleEndian32(data + 4), readLittleEndian32(data + 8)};
+            header.channels = 4;
+            header.dataOffset = RawRgbaHeaderBytes;
+            ok = true;
+        }
+    }
+    else {
+        ok = parseNetpbmHeader(data, size, header);
+    }
+
+    if (!ok || header.size.x == 0 || header.size.y == 0) {
+        error = "Unsupported or malformed header: " + path;
+        return false;
+    }
+    return true;
+}
+
+std::string createRawImageHeader(const std::string& path, sf::Vector2u size) {
+    std::string extension = lowercaseExtension(path);
+    std::string header;
+
+    if (extension == ".rgba") {
+        header = "RGBA";
+        appendLittleEndian32(header, size.x);
+        appendLittleEndian32(header, size.y);
+        appendLittleEndian32(header, 0);
+    }
+    else if (extension == ".pam") {
+        header = "P7\nWIDTH " + std::to_string(size.x) + "\nHEIGHT " + std::to_string(size.y) +
+                 "\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n";
+    }
+    else if (extension == ".pgm") {
+        header = "P5\n" + std::to_string(size.x) + " " + std::to_string(size.y) + "\n255\n";
+    }
+    else if (extension == ".ppm" || extension == ".pnm") {
+        header = "P6\n" + std::to_string(size.x) + " " + std::to_string(size.y) + "\n255\n";
+    }
+    return header;
+}
+
+void expandToRgba(const std::uint8_t* samples, unsigned channels, std::uint8_t* rgba, std::size_t pixels) {
+    switch (channels) {
+        case 1:
+            for (std::size_t i = 0; i < pixels; ++i, rgba += 4) {
+                rgba[0] = rgba[1] = rgba[2] = samples[i];
+                rgba[3] = 255;
+            }
+            break;
+        case 2:
+            for (std::size_t i = 0; i < pixels; ++i, samples += 2, rgba += 4) {
+                rgba[0] = rgba[1] = rgba[2] = samples[0];
+                rgba[3] = samples[1];
+            }
+            break;
+        case 3:
+            for (std::size_t i = 0; i < pixels; ++i, samples += 3, rgba += 4) {
+                rgba[0] = samples[0];
+                rgba[1] = samples[1];
+                rgba[2] = samples[2];
+                rgba[3] = 255;
+            }
+            break;
+        default:
+            std::memcpy(rgba, samples, pixels * 4);
+            break;
+    }
+}
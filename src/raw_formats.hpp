@@ -0,0 +1,59 @@
+#pragma once
+
+#include "pixel_buffer.hpp"
+
+#include <SFML/Graphics.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Uncompressed formats that are read and written without going through SFML:
+//   .pgm/.ppm/.pnm  binary P5/P6, 8-bit (MAXVAL 255) or 16-bit big-endian
+//                   (MAXVAL 256-65535) samples
+//   .pam            P7 with DEPTH 1-4 and MAXVAL as above
+//   .pfm            PF (RGB) or Pf (gray) 32-bit floats, rows bottom-up,
+//                   little-endian when the scale is negative
+//   .rgba           16-byte header ("RGBA", width, height, 0 as little-endian
+//                   uint32) followed by tightly packed 8-bit RGBA rows
+// Only the 8-bit layouts are mapped and diffed in place; 16-bit and float
+// files are decoded by precise_image.hpp.
+struct RawImageHeader {
+    sf::Vector2u size;
+    unsigned channels = 0;
+    std::size_t dataOffset = 0;
+    SampleType sampleType = SampleType::UInt8;
+    unsigned maxValue = 255;
+    bool littleEndian = false;
+    bool bottomUp = false;
+
+    std::size_t bytesPerSample() const {
+        return sampleType == SampleType::UInt8 ? 1 : sampleType == SampleType::UInt16 ? 2 : 4;
+    }
+
+    std::size_t dataBytes() const {
+        return static_cast<std::size_t>(size.x) * size.y * channels * bytesPerSample();
+    }
+};
+
+constexpr std::size_t RawRgbaHeaderBytes = 16;
+
+// Headers longer than this (mostly comments) are rejected.
+constexpr std::size_t MaxRawHeaderBytes = 64 * 1024;
+
+bool isRawFormatPath(const std::string& path);
+
+// True for the formats whose pixel data is stored as RGBA, i.e. .pam and
+// .rgba, which is what createRawImageHeader writes for them.
+bool isRgbaRawFormatPath(const std::string& path);
+
+// Parses the header at the start of `data`, which may be just a prefix of the
+// file. `path` only picks between the Netpbm and .rgba layouts.
+bool parseRawImageHeader(const std::string& path, const std::uint8_t* data, std::size_t size,
+                         RawImageHeader& header, std::string& error);
+
+// Header for a gray (.pgm), RGB (.ppm/.pnm) or RGBA (.pam/.rgba) image of
+// `size`. Returns an empty string for other extensions.
+std::string createRawImageHeader(const std::string& path, sf::Vector2u size);
+
+// Widens gray, gray+alpha or RGB samples to RGBA. Four-channel input is copied.
+void expandToRgba(const std::uint8_t* samples, unsigned channels, std::uint8_t* rgba, std::size_t pixels);
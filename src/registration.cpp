@@ -0,0 +1,455 @@
+#include "registration.hpp"
+
+#include "parallel.hpp"
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <vector>
+
+namespace {
+
+using Complex = std::complex<float>;
+
+// Longest side of the coarse luma images and the coarse FFT size.
+constexpr unsigned CoarseFftSize = 512;
+// The scale search runs one level further down.
+constexpr unsigned ScaleFftSize = 256;
+// Full-resolution window used to refine the coarse estimate.
+constexpr unsigned RefineWindow = 256;
+constexpr int RefinePasses = 3;
+// Relative step of the scale search.
+constexpr float ScaleStep = 0.005f;
+// Scales this close to 1 leave the diff on a plain pixel grid.
+constexpr float UnitScaleTolerance = 0.002f;
+
+constexpr float Pi = 3.14159265358979f;
+
+struct LumaImage {
+    unsigned width = 0;
+    unsigned height = 0;
+    std::vector<float> values;
+
+    float at(unsigned x, unsigned y) const { return values[static_cast<std::size_t>(y) * width + x]; }
+
+    // Bilinear sample; outside the image it reads as `outside`.
+    float sample(float x, float y, float outside) const {
+        if (x < 0.0f || y < 0.0f || x > static_cast<float>(width - 1) || y > static_cast<float>(height - 1)) {
+            return outside;
+        }
+        unsigned x0 = static_cast<unsigned>(x);
+        unsigned y0 = static_cast<unsigned>(y);
+        unsigned x1 = std::min(x0 + 1, width - 1);
+        unsigned y1 = std::min(y0 + 1, height - 1);
+        float fx = x - static_cast<float>(x0);
+        float fy = y - static_cast<float>(y0);
+        float top = at(x0, y0) + (at(x1, y0) - at(x0, y0)) * fx;
+        float bottom = at(x0, y1) + (at(x1, y1) - at(x0, y1)) * fx;
+        return top + (bottom - top) * fy;
+    }
+};
+
+inline float pixelLuma(const std::uint8_t* p) {
+    return 0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2];
+}
+
+// Luma averaged over factor x factor blocks; trailing partial blocks average
+// what they cover.
+LumaImage boxLuma(const sf::Image& image, unsigned factor) {
+    sf::Vector2u size = image.getSize();
+    LumaImage luma;
+    luma.width = (size.x + factor - 1) / factor;
+    luma.height = (size.y + factor - 1) / factor;
+    luma.values.resize(static_cast<std::size_t>(luma.width) * luma.height);
+
+    const std::uint8_t* pixels = image.getPixelsPtr();
+    const std::size_t stride = static_cast<std::size_t>(size.x) * 4;
+    parallelForRows(luma.height, size.x * factor, [&](unsigned firstRow, unsigned endRow) {
+        std::vector<float> sums(luma.width);
+        for (unsigned row = firstRow; row < endRow; ++row) {
+            std::fill(sums.begin(), sums.end(), 0.0f);
+            unsigned y0 = row * factor;
+            unsigned y1 = std::min(y0 + factor, size.y);
+            for (unsigned y = y0; y < y1; ++y) {
+                const std::uint8_t* source = pixels + y * stride;
+                for (unsigned x = 0; x < size.x; ++x) {
+                    sums[x / factor] += pixelLuma(source + static_cast<std::size_t>(x) * 4);
+                }
+            }
+            for (unsigned column = 0; column < luma.width; ++column) {
+                unsigned columns = std::min(factor, size.x - column * factor);
+                luma.values[static_cast<std::size_t>(row) * luma.width + column] =
+                    sums[column] / static_cast<float>(columns * (y1 - y0));
+            }
+        }
+    });
+    return luma;
+}
+
+LumaImage halve(const LumaImage& source) {
+    LumaImage half;
+    half.width = (source.width + 1) / 2;
+    half.height = (source.height + 1) / 2;
+    half.values.resize(static_cast<std::size_t>(half.width) * half.height);
+    for (unsigned y = 0; y < half.height; ++y) {
+        for (unsigned x = 0; x < half.width; ++x) {
+            unsigned x1 = std::min(2 * x + 1, source.width - 1);
+            unsigned y1 = std::min(2 * y + 1, source.height - 1);
+            half.values[static_cast<std::size_t>(y) * half.width + x] =
+                0.25f * (source.at(2 * x, 2 * y) + source.at(x1, 2 * y) + source.at(2 * x, y1) + source.at(x1, y1));
+        }
+    }
+    return half;
+}
+
+// In-place iterative radix-2 FFT; `size` must be a power of two.
+void fft(Complex* data, unsigned size, bool inverse) {
+    // Forward twiddles for the largest stage; smaller stages stride through
+    // them, and the inverse uses their conjugates.
+    thread_local std::vector<Complex> twiddles;
+    if (twiddles.size() != size / 2) {
+        twiddles.resize(size / 2);
+        for (unsigned k = 0; k < size / 2; ++k) {
+            float angle = -2.0f * Pi * static_cast<float>(k) / static_cast<float>(size);
+            twiddles[k] = Complex(std::cos(angle), std::sin(angle));
+        }
+    }
+
+    for (unsigned i = 1, j = 0; i < size; ++i) {
+        unsigned bit = size >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            std::swap(data[i], data[j]);
+        }
+    }
+
+    // Products are spelled out: std::complex's operator* goes through the
+    // slow NaN-checking path without -ffast-math.
+    float sign = inverse ? -1.0f : 1.0f;
+    for (unsigned length = 2; length <= size; length <<= 1) {
+        unsigned half = length / 2;
+        unsigned stride = size / length;
+        for (unsigned start = 0; start < size; start += length) {
+            for (unsigned k = 0; k < half; ++k) {
+                Complex twiddle = twiddles[k * stride];
+                float twiddleImag = sign * twiddle.imag();
+                Complex even = data[start + k];
+                Complex value = data[start + k + half];
+                Complex odd(value.real() * twiddle.real() - value.imag() * twiddleImag,
+                            value.real() * twiddleImag + value.imag() * twiddle.real());
+                data[start + k] = even + odd;
+                data[start + k + half] = even - odd;
+            }
+        }
+    }
+}
+
+// Row FFTs, then column FFTs, each spread over the shared pool when
+// `parallel` is set (scale candidates already run one per worker). Rows from
+// `filledRows` on are zero padding and transform to zero.
+void fft2d(std::vector<Complex>& grid, unsigned size, bool inverse, bool parallel, unsigned filledRows) {
+    auto rows = [&](std::size_t begin, std::size_t end) {
+        for (std::size_t row = begin; row < end; ++row) {
+            fft(grid.data() + row * size, size, inverse);
+        }
+    };
+    auto columns = [&](std::size_t begin, std::size_t end) {
+        std::vector<Complex> column(size);
+        for (std::size_t x = begin; x < end; ++x) {
+            for (unsigned y = 0; y < size; ++y) {
+                column[y] = grid[static_cast<std::size_t>(y) * size + x];
+            }
+            fft(column.data(), size, inverse);
+            for (unsigned y = 0; y < size; ++y) {
+                grid[static_cast<std::size_t>(y) * size + x] = column[y];
+            }
+        }
+    };
+
+    if (parallel) {
+        std::shared_ptr<ThreadPool> pool = sharedThreadPool();
+        pool->parallelFor(filledRows, 16, rows);
+        pool->parallelFor(size, 16, columns);
+    }
+    else {
+        rows(0, filledRows);
+        columns(0, size);
+    }
+}
+
+// Copies `source` (a width x height grid of samples) into a zero-padded
+// size x size grid with its mean removed and a Hann window applied, which
+// keeps the image borders from dominating the spectrum.
+std::vector<Complex> windowedGrid(const std::vector<float>& source, unsigned width, unsigned height, unsigned size) {
+    double mean = 0.0;
+    for (float value : source) {
+        mean += value;
+    }
+    mean /= static_cast<double>(source.size());
+
+    std::vector<float> windowX(width);
+    std::vector<float> windowY(height);
+    for (unsigned x = 0; x < width; ++x) {
+        windowX[x] = width > 1 ? 0.5f - 0.5f * std::cos(2.0f * Pi * x / static_cast<float>(width - 1)) : 1.0f;
+    }
+    for (unsigned y = 0; y < height; ++y) {
+        windowY[y] = height > 1 ? 0.5f - 0.5f * std::cos(2.0f * Pi * y / static_cast<float>(height - 1)) : 1.0f;
+    }
+
+    std::vector<Complex> grid(static_cast<std::size_t>(size) * size);
+    for (unsigned y = 0; y < height; ++y) {
+        for (unsigned x = 0; x < width; ++x) {
+            float value = source[static_cast<std::size_t>(y) * width + x] - static_cast<float>(mean);
+            grid[static_cast<std::size_t>(y) * size + x] = Complex(value * windowX[x] * windowY[y], 0.0f);
+        }
+    }
+    return grid;
+}
+
+// Offset of a peak's apex from its centre sample, from a parabola through
+// the sample and its two neighbours.
+float parabolicOffset(float left, float center, float right) {
+    float denominator = left - 2.0f * center + right;
+    return std::abs(denominator) > 1e-12f ? std::clamp(0.5f * (left - right) / denominator, -0.5f, 0.5f) : 0.0f;
+}
+
+struct CorrelationPeak {
+    sf::Vector2f shift;
+    float height = 0.0f;
+};
+
+std::vector<Complex> spectrum(std::vector<Complex> grid, unsigned size, unsigned filledRows, bool parallel) {
+    fft2d(grid, size, false, parallel, filledRows);
+    return grid;
+}
+
+// Finds t with grid2(x) ~ grid1(x - t) from the normalized cross-power
+// spectrum, with a parabolic fit around the peak for sub-pixel precision.
+// The reference comes already transformed since it is matched repeatedly.
+CorrelationPeak phaseCorrelate(const std::vector<Complex>& spectrum1, std::vector<Complex> grid2, unsigned size,
+                               unsigned filledRows, bool parallel) {
+    std::vector<Complex>& correlation = grid2;
+    fft2d(correlation, size, false, parallel, filledRows);
+    for (std::size_t i = 0; i < correlation.size(); ++i) {
+        Complex a = correlation[i];
+        Complex b = spectrum1[i];
+        Complex cross(a.real() * b.real() + a.imag() * b.imag(), a.imag() * b.real() - a.real() * b.imag());
+        float magnitude = std::sqrt(cross.real() * cross.real() + cross.imag() * cross.imag());
+        correlation[i] = magnitude > 1e-12f ? cross / magnitude : Complex(0.0f, 0.0f);
+    }
+    fft2d(correlation, size, true, parallel, size);
+
+    std::size_t best = 0;
+    for (std::size_t i = 1; i < correlation.size(); ++i) {
+        if (correlation[i].real() > correlation[best].real()) {
+            best = i;
+        }
+    }
+
+    auto value = [&](int x, int y) {
+        x = (x + static_cast<int>(size)) % static_cast<int>(size);
+        y = (y + static_cast<int>(size)) % static_cast<int>(size);
+        return correlation[static_cast<std::size_t>(y) * size + static_cast<std::size_t>(x)].real();
+    };
+
+    int peakX = static_cast<int>(best % size);
+    int peakY = static_cast<int>(best / size);
+    float center = value(peakX, peakY);
+    float dx = parabolicOffset(value(peakX - 1, peakY), center, value(peakX + 1, peakY));
+    float dy = parabolicOffset(value(peakX, peakY - 1), center, value(peakX, peakY + 1));
+
+    CorrelationPeak peak;
+    peak.shift.x = static_cast<float>(peakX > static_cast<int>(size) / 2 ? peakX - static_cast<int>(size) : peakX) + dx;
+    peak.shift.y = static_cast<float>(peakY > static_cast<int>(size) / 2 ? peakY - static_cast<int>(size) : peakY) + dy;
+    peak.height = center / static_cast<float>(static_cast<std::size_t>(size) * size);
+    return peak;
+}
+
+// Bilinear luma sample of an RGBA image, clamped to its edges.
+float sampleLuma(const sf::Image& image, float x, float y) {
+    sf::Vector2u size = image.getSize();
+    x = std::clamp(x, 0.0f, static_cast<float>(size.x - 1));
+    y = std::clamp(y, 0.0f, static_cast<float>(size.y - 1));
+    unsigned x0 = static_cast<unsigned>(x);
+    unsigned y0 = static_cast<unsigned>(y);
+    unsigned x1 = std::min(x0 + 1, size.x - 1);
+    unsigned y1 = std::min(y0 + 1, size.y - 1);
+    float fx = x - static_cast<float>(x0);
+    float fy = y - static_cast<float>(y0);
+
+    const std::uint8_t* pixels = image.getPixelsPtr();
+    auto at = [&](unsigned px, unsigned py) {
+        return pixelLuma(pixels + (static_cast<std::size_t>(py) * size.x + px) * 4);
+    };
+    float top = at(x0, y0) + (at(x1, y0) - at(x0, y0)) * fx;
+    float bottom = at(x0, y1) + (at(x1, y1) - at(x0, y1)) * fx;
+    return top + (bottom - top) * fy;
+}
+
+// Corrects a coarse offset on a full-resolution window in the middle of the
+// overlap. Image 2 is resampled at the current estimate each pass, so the
+// residual shrinks towards zero where the peak interpolation is unbiased.
+sf::Vector2f refineOffset(const sf::Image& image1, const sf::Image& image2, float scale, sf::Vector2f offset,
+                          float maxResidual) {
+    sf::Vector2u size1 = image1.getSize();
+    sf::Vector2u size2 = image2.getSize();
+    float left = std::max(0.0f, offset.x);
+    float top = std::max(0.0f, offset.y);
+    float right = std::min(static_cast<float>(size1.x), offset.x + scale * static_cast<float>(size2.x));
+    float bottom = std::min(static_cast<float>(size1.y), offset.y + scale * static_cast<float>(size2.y));
+    float extent = std::min(right - left, bottom - top);
+    if (extent < 32.0f) {
+        return offset;
+    }
+
+    unsigned window = std::min(RefineWindow, 1u << static_cast<unsigned>(std::floor(std::log2(extent))));
+    unsigned x0 = static_cast<unsigned>((left + right) / 2.0f) - window / 2;
+    unsigned y0 = static_cast<unsigned>((top + bottom) / 2.0f) - window / 2;
+
+    std::vector<float> patch1(static_cast<std::size_t>(window) * window);
+    std::vector<float> patch2(patch1.size());
+    const std::uint8_t* pixels1 = image1.getPixelsPtr();
+    for (unsigned y = 0; y < window; ++y) {
+        for (unsigned x = 0; x < window; ++x) {
+            patch1[static_cast<std::size_t>(y) * window + x] =
+                pixelLuma(pixels1 + (static_cast<std::size_t>(y0 + y) * size1.x + x0 + x) * 4);
+        }
+    }
+    std::vector<Complex> spectrum1 = spectrum(windowedGrid(patch1, window, window, window), window, window, true);
+
+    sf::Vector2f total = {0.0f, 0.0f};
+    for (int pass = 0; pass < RefinePasses; ++pass) {
+        for (unsigned y = 0; y < window; ++y) {
+            for (unsigned x = 0; x < window; ++x) {
+                patch2[static_cast<std::size_t>(y) * window + x] =
+                    sampleLuma(image2, (static_cast<float>(x0 + x) - offset.x + total.x) / scale,
+                               (static_cast<float>(y0 + y) - offset.y + total.y) / scale);
+            }
+        }
+        CorrelationPeak fine =
+            phaseCorrelate(spectrum1, windowedGrid(patch2, window, window, window), window, window, true);
+        total += fine.shift;
+        // A residual beyond one coarse pixel means the window matched
+        // something else; keep the coarse estimate then.
+        if (std::abs(total.x) > maxResidual || std::abs(total.y) > maxResidual) {
+            return offset;
+        }
+        if (std::abs(fine.shift.x) < 0.02f && std::abs(fine.shift.y) < 0.02f) {
+            break;
+        }
+    }
+    return offset - total;
+}
+
+// Image 2's luma resampled onto Image 1's grid for a given scale
+// (p1 = scale * p2), filled with its mean where it has no data.
+std::vector<float> rescaled(const LumaImage& luma, float scale, unsigned width, unsigned height) {
+    double mean = 0.0;
+    for (float value : luma.values) {
+        mean += value;
+    }
+    float fill = static_cast<float>(mean / static_cast<double>(luma.values.size()));
+
+    std::vector<float> out(static_cast<std::size_t>(width) * height);
+    for (unsigned y = 0; y < height; ++y) {
+        for (unsigned x = 0; x < width; ++x) {
+            out[static_cast<std::size_t>(y) * width + x] =
+                luma.sample(static_cast<float>(x) / scale, static_cast<float>(y) / scale, fill);
+        }
+    }
+    return out;
+}
+
+// Peak height for each candidate scale, one candidate per worker.
+std::vector<float> scaleResponses(const LumaImage& luma1, const LumaImage& luma2, const std::vector<float>& candidates,
+                                  unsigned fftSize) {
+    std::vector<Complex> spectrum1 =
+        spectrum(windowedGrid(luma1.values, luma1.width, luma1.height, fftSize), fftSize, luma1.height, true);
+    std::vector<float> heights(candidates.size());
+    sharedThreadPool()->parallelFor(candidates.size(), 1, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            std::vector<float> resampled = rescaled(luma2, candidates[i], luma1.width, luma1.height);
+            std::vector<Complex> grid2 = windowedGrid(resampled, luma1.width, luma1.height, fftSize);
+            heights[i] = phaseCorrelate(spectrum1, std::move(grid2), fftSize, luma1.height, false).height;
+        }
+    });
+    return heights;
+}
+
+std::vector<float> scaleCandidates(float center, float range, float step) {
+    std::vector<float> candidates;
+    for (float offset = -range; offset <= range + 1e-6f; offset += step) {
+        candidates.push_back(center * (1.0f + offset));
+    }
+    return candidates;
+}
+
+// Coarse-to-fine scale search: a wide sweep on half the coarse level, then a
+// narrow one on the coarse level with the peak interpolated between steps.
+float searchScale(const LumaImage& coarse1, const LumaImage& coarse2, const AlignmentOptions& options) {
+    std::vector<float> wide = scaleCandidates(options.scaleGuess, options.scaleRange, ScaleStep * 2.0f);
+    std::vector<float> wideHeights = scaleResponses(halve(coarse1), halve(coarse2), wide, ScaleFftSize);
+    float best = wide[static_cast<std::size_t>(std::max_element(wideHeights.begin(), wideHeights.end()) -
+                                               wideHeights.begin())];
+
+    std::vector<float> narrow = scaleCandidates(best, ScaleStep * 2.0f, ScaleStep / 2.0f);
+    std::vector<float> heights = scaleResponses(coarse1, coarse2, narrow, CoarseFftSize);
+    std::size_t peak = static_cast<std::size_t>(std::max_element(heights.begin(), heights.end()) - heights.begin());
+    if (peak == 0 || peak + 1 == heights.size()) {
+        return narrow[peak];
+    }
+    float fraction = parabolicOffset(heights[peak - 1], heights[peak], heights[peak + 1]);
+    return narrow[peak] + fraction * (narrow[peak + 1] - narrow[peak]);
+}
+
+}
+
+bool estimateAlignment(const sf::Image& image1, const sf::Image& image2, const AlignmentOptions& options,
+                       Alignment& alignment, std::string& error) {
+    ScopedTimer timer("Estimate alignment");
+    sf::Vector2u size1 = image1.getSize();
+    sf::Vector2u size2 = image2.getSize();
+    if (size1.x < 16 || size1.y < 16 || size2.x < 16 || size2.y < 16) {
+        error = "Images are too small to align";
+        return false;
+    }
+
+    // Both images share one factor, so the scale between them is preserved.
+    unsigned factor = 1;
+    while (std::max({size1.x, size1.y, size2.x, size2.y}) > CoarseFftSize * factor) {
+        factor *= 2;
+    }
+    LumaImage coarse1 = boxLuma(image1, factor);
+    LumaImage coarse2 = boxLuma(image2, factor);
+
+    float scale = options.estimateScale ? searchScale(coarse1, coarse2, options) : options.scaleGuess;
+
+    // Coarse translation with image 2 brought to image 1's scale.
+    std::vector<float> scaled2 = rescaled(coarse2, scale, coarse1.width, coarse1.height);
+    CorrelationPeak coarse = phaseCorrelate(
+        spectrum(windowedGrid(coarse1.values, coarse1.width, coarse1.height, CoarseFftSize), CoarseFftSize,
+                 coarse1.height, true),
+        windowedGrid(scaled2, coarse1.width, coarse1.height, CoarseFftSize), CoarseFftSize, coarse1.height, true);
+    // scaled2(x) = coarse1(x - t) with scaled2(x) = image2(x / scale), so
+    // p1 = scale * p2 - t.
+    sf::Vector2f offset = -coarse.shift * static_cast<float>(factor);
+
+    offset = refineOffset(image1, image2, scale, offset, static_cast<float>(std::max(factor, 2u)));
+
+    alignment.offset = offset;
+    alignment.scale = scale;
+    alignment.confidence = std::clamp(coarse.height, 0.0f, 1.0f);
+    return true;
+}
+
+bool integerShift(const Alignment& alignment, sf::Vector2i& shift) {
+    if (std::abs(alignment.scale - 1.0f) > UnitScaleTolerance) {
+        return false;
+    }
+    shift = {static_cast<int>(std::lround(alignment.offset.x)), static_cast<int>(std::lround(alignment.offset.y))};
+    return true;
+}
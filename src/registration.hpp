@@ -0,0 +1,33 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <string>
+
+// Maps Image 2 onto Image 1: a pixel at p2 in Image 2 shows the content of
+// p1 = scale * p2 + offset in Image 1.
+struct Alignment {
+    sf::Vector2f offset = {0.0f, 0.0f};
+    float scale = 1.0f;
+    // Height of the normalized phase-correlation peak, 0-1. Clean shifts of
+    // the same scene score well above 0.1; unrelated images stay near 0.
+    float confidence = 0.0f;
+
+    bool isIdentity() const { return offset.x == 0.0f && offset.y == 0.0f && scale == 1.0f; }
+};
+
+struct AlignmentOptions {
+    bool estimateScale = false;
+    // Scales tried are scaleGuess * (1 +- scaleRange).
+    float scaleGuess = 1.0f;
+    float scaleRange = 0.1f;
+};
+
+// Phase correlation on box-filtered luma pyramids: a coarse pass over the
+// whole frame (plus a scale search when asked), then a full-resolution
+// window around the coarse estimate for sub-pixel accuracy.
+bool estimateAlignment(const sf::Image& image1, const sf::Image& image2, const AlignmentOptions& options,
+                       Alignment& alignment, std::string& error);
+
+// The alignment as a whole-pixel shift, when its scale is close enough to 1
+// for the diff to use it without resampling.
+bool integerShift(const Alignment& alignment, sf::Vector2i& shift);
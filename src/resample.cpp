@@ -0,0 +1,416 @@
+#include "resample.hpp"
+
+#include "diff_kernels.hpp"
+#include "image_utils.hpp"
+#include "parallel.hpp"
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CI_RESAMPLE_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define CI_RESAMPLE_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define CI_RESAMPLE_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define CI_RESAMPLE_TARGET_AVX2
+#endif
+
+namespace {
+
+constexpr float Pi = 3.14159265358979f;
+
+// Output rows filtered vertically per refill of a band's row buffer.
+constexpr unsigned ResampleChunkRows = 64;
+
+inline std::uint8_t roundToByte(float value) {
+    return static_cast<std::uint8_t>(std::clamp(std::nearbyint(value), 0.0f, 255.0f));
+}
+
+void horizontalScalar(const std::uint8_t* source, float* out, std::size_t outputs, const int* starts,
+                      const float* weights, unsigned taps) {
+    for (std::size_t i = 0; i < outputs; ++i) {
+        const std::uint8_t* pixel = source + static_cast<std::size_t>(starts[i]) * 4;
+        const float* w = weights + i * taps;
+        float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        for (unsigned t = 0; t < taps; ++t) {
+            for (int c = 0; c < 4; ++c) {
+                sum[c] += w[t] * static_cast<float>(pixel[t * 4 + c]);
+            }
+        }
+        std::memcpy(out + i * 4, sum, sizeof(sum));
+    }
+}
+
+// Elements [first, count) of a vertical pass, summed in kernel order.
+void verticalTail(const float* const* rows, const float* weights, unsigned taps, std::uint8_t* out,
+                  std::size_t first, std::size_t count) {
+    for (std::size_t i = first; i < count; ++i) {
+        float sum = 0.0f;
+        for (unsigned t = 0; t < taps; ++t) {
+            sum += weights[t] * rows[t][i];
+        }
+        out[i] = roundToByte(sum);
+    }
+}
+
+void verticalScalar(const float* const* rows, const float* weights, unsigned taps, std::uint8_t* out,
+                    std::size_t count) {
+    verticalTail(rows, weights, taps, out, 0, count);
+}
+
+#if CI_RESAMPLE_X86
+// One RGBA pixel per register: four float lanes per tap.
+void horizontalSse2(const std::uint8_t* source, float* out, std::size_t outputs, const int* starts,
+                    const float* weights, unsigned taps) {
+    const __m128i zero = _mm_setzero_si128();
+    for (std::size_t i = 0; i < outputs; ++i) {
+        const std::uint8_t* pixel = source + static_cast<std::size_t>(starts[i]) * 4;
+        const float* w = weights + i * taps;
+        __m128 sum = _mm_setzero_ps();
+        for (unsigned t = 0; t < taps; ++t) {
+            int packed;
+            std::memcpy(&packed, pixel + t * 4, 4);
+            __m128i wide = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(w[t]), _mm_cvtepi32_ps(wide)));
+        }
+        _mm_storeu_ps(out + i * 4, sum);
+    }
+}
+
+void verticalSse2(const float* const* rows, const float* weights, unsigned taps, std::uint8_t* out,
+                  std::size_t count) {
+    std::size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128 sums[4] = {_mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps()};
+        for (unsigned t = 0; t < taps; ++t) {
+            __m128 w = _mm_set1_ps(weights[t]);
+            for (int k = 0; k < 4; ++k) {
+                sums[k] = _mm_add_ps(sums[k], _mm_mul_ps(w, _mm_loadu_ps(rows[t] + i + k * 4)));
+            }
+        }
+        // Round to nearest even like nearbyint, then saturate to bytes.
+        __m128i low = _mm_packs_epi32(_mm_cvtps_epi32(sums[0]), _mm_cvtps_epi32(sums[1]));
+        __m128i high = _mm_packs_epi32(_mm_cvtps_epi32(sums[2]), _mm_cvtps_epi32(sums[3]));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(low, high));
+    }
+    verticalTail(rows, weights, taps, out, i, count);
+}
+
+CI_RESAMPLE_TARGET_AVX2
+void verticalAvx2(const float* const* rows, const float* weights, unsigned taps, std::uint8_t* out,
+                  std::size_t count) {
+    std::size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256 sums[4] = {_mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps()};
+        for (unsigned t = 0; t < taps; ++t) {
+            __m256 w = _mm256_set1_ps(weights[t]);
+            for (int k = 0; k < 4; ++k) {
+                sums[k] = _mm256_add_ps(sums[k], _mm256_mul_ps(w, _mm256_loadu_ps(rows[t] + i + k * 8)));
+            }
+        }
+        // The packs work per 128-bit lane; the permutes put the bytes back
+        // in order.
+        __m256i low = _mm256_packs_epi32(_mm256_cvtps_epi32(sums[0]), _mm256_cvtps_epi32(sums[1]));
+        __m256i high = _mm256_packs_epi32(_mm256_cvtps_epi32(sums[2]), _mm256_cvtps_epi32(sums[3]));
+        low = _mm256_permute4x64_epi64(low, 0xD8);
+        high = _mm256_permute4x64_epi64(high, 0xD8);
+        __m256i bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(low, high), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), bytes);
+    }
+    verticalTail(rows, weights, taps, out, i, count);
+}
+#endif
+
+#if CI_RESAMPLE_NEON
+void horizontalNeon(const std::uint8_t* source, float* out, std::size_t outputs, const int* starts,
+                    const float* weights, unsigned taps) {
+    for (std::size_t i = 0; i < outputs; ++i) {
+        const std::uint8_t* pixel = source + static_cast<std::size_t>(starts[i]) * 4;
+        const float* w = weights + i * taps;
+        float32x4_t sum = vdupq_n_f32(0.0f);
+        for (unsigned t = 0; t < taps; ++t) {
+            std::uint32_t packed;
+            std::memcpy(&packed, pixel + t * 4, 4);
+            uint16x8_t wide = vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(packed)));
+            float32x4_t value = vcvtq_f32_u32(vmovl_u16(vget_low_u16(wide)));
+            sum = vaddq_f32(sum, vmulq_n_f32(value, w[t]));
+        }
+        vst1q_f32(out + i * 4, sum);
+    }
+}
+
+void verticalNeon(const float* const* rows, const float* weights, unsigned taps, std::uint8_t* out,
+                  std::size_t count) {
+    std::size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        float32x4_t sums[4] = {vdupq_n_f32(0.0f), vdupq_n_f32(0.0f), vdupq_n_f32(0.0f), vdupq_n_f32(0.0f)};
+        for (unsigned t = 0; t < taps; ++t) {
+            for (int k = 0; k < 4; ++k) {
+                sums[k] = vaddq_f32(sums[k], vmulq_n_f32(vld1q_f32(rows[t] + i + k * 4), weights[t]));
+            }
+        }
+        int16x8_t low = vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(sums[0])), vqmovn_s32(vcvtnq_s32_f32(sums[1])));
+        int16x8_t high = vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(sums[2])), vqmovn_s32(vcvtnq_s32_f32(sums[3])));
+        vst1q_u8(out + i, vcombine_u8(vqmovun_s16(low), vqmovun_s16(high)));
+    }
+    verticalTail(rows, weights, taps, out, i, count);
+}
+#endif
+
+// Where each output sample reads from along one axis: `taps` consecutive
+// source samples from starts[i], weighted by weights[i * taps ...].
+struct AxisTaps {
+    unsigned taps = 0;
+    std::vector<int> starts;
+    std::vector<float> weights;
+};
+
+float filterRadius(ResampleFilter filter) {
+    switch (filter) {
+        case ResampleFilter::Area:
+            return 0.5f;
+        case ResampleFilter::Bilinear:
+            return 1.0f;
+        case ResampleFilter::Lanczos3:
+            return 3.0f;
+    }
+    return 1.0f;
+}
+
+float filterWeight(ResampleFilter filter, float x) {
+    x = std::abs(x);
+    if (filter == ResampleFilter::Bilinear) {
+        return x < 1.0f ? 1.0f - x : 0.0f;
+    }
+    if (x < 1e-6f) {
+        return 1.0f;
+    }
+    if (x >= 3.0f) {
+        return 0.0f;
+    }
+    float px = Pi * x;
+    return 3.0f * std::sin(px) * std::sin(px / 3.0f) / (px * px);
+}
+
+AxisTaps computeAxisTaps(unsigned inSize, unsigned outSize, ResampleFilter filter) {
+    // Source samples per output sample; downscaling widens the filter by it.
+    const double ratio = static_cast<double>(inSize) / static_cast<double>(outSize);
+    const double stretch = std::max(ratio, 1.0);
+    const double support = filterRadius(filter) * stretch;
+
+    std::vector<std::vector<float>> perOutput(outSize);
+    std::vector<int> firsts(outSize);
+    unsigned taps = 1;
+    for (unsigned i = 0; i < outSize; ++i) {
+        double center = (i + 0.5) * ratio;
+        int first = std::max(0, static_cast<int>(std::floor(center - support)));
+        int end = std::min(static_cast<int>(inSize), static_cast<int>(std::ceil(center + support)));
+
+        std::vector<float>& w = perOutput[i];
+        double total = 0.0;
+        for (int j = first; j < end; ++j) {
+            double weight;
+            if (filter == ResampleFilter::Area) {
+                // Share of the output sample's span covered by source sample j.
+                double low = std::max(static_cast<double>(j), center - ratio / 2.0);
+                double high = std::min(static_cast<double>(j + 1), center + ratio / 2.0);
+                weight = std::max(0.0, high - low);
+            }
+            else {
+                weight = filterWeight(filter, static_cast<float>((j + 0.5 - center) / stretch));
+            }
+            w.push_back(static_cast<float>(weight));
+            total += weight;
+        }
+        // Drop zero-weight samples at both ends.
+        while (w.size() > 1 && w.back() == 0.0f) {
+            w.pop_back();
+        }
+        std::size_t leading = 0;
+        while (leading + 1 < w.size() && w[leading] == 0.0f) {
+            ++leading;
+        }
+        w.erase(w.begin(), w.begin() + static_cast<std::ptrdiff_t>(leading));
+        first += static_cast<int>(leading);
+
+        if (total <= 0.0) {
+            w.assign(1, 1.0f);
+            total = 1.0;
+        }
+        for (float& value : w) {
+            value = static_cast<float>(value / total);
+        }
+        firsts[i] = first;
+        taps = std::max(taps, static_cast<unsigned>(w.size()));
+    }
+
+    // A fixed tap count keeps the kernels branch-free; windows that would run
+    // past the end slide back and pad their weights with zeros.
+    taps = std::min(taps, inSize);
+    AxisTaps axis;
+    axis.taps = taps;
+    axis.starts.resize(outSize);
+    axis.weights.assign(static_cast<std::size_t>(outSize) * taps, 0.0f);
+    for (unsigned i = 0; i < outSize; ++i) {
+        int start = std::min(firsts[i], static_cast<int>(inSize - taps));
+        axis.starts[i] = start;
+        for (std::size_t k = 0; k < perOutput[i].size(); ++k) {
+            axis.weights[static_cast<std::size_t>(i) * taps + (firsts[i] - start) + k] = perOutput[i][k];
+        }
+    }
+    return axis;
+}
+
+}
+
+const char* resampleFilterName(ResampleFilter filter) {
+    switch (filter) {
+        case ResampleFilter::Area:
+            return "area";
+        case ResampleFilter::Bilinear:
+            return "bilinear";
+        case ResampleFilter::Lanczos3:
+            return "lanczos3";
+    }
+    return "area";
+}
+
+bool parseResampleFilter(std::string_view name, ResampleFilter& filter) {
+    for (ResampleFilter candidate : {ResampleFilter::Area, ResampleFilter::Bilinear, ResampleFilter::Lanczos3}) {
+        if (name == resampleFilterName(candidate)) {
+            filter = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<ResampleKernel> supportedResampleKernels() {
+    std::vector<ResampleKernel> kernels;
+    kernels.push_back({"scalar", horizontalScalar, verticalScalar});
+#if CI_RESAMPLE_X86
+    kernels.push_back({"sse2", horizontalSse2, verticalSse2});
+    if (cpuHasAvx2()) {
+        kernels.push_back({"avx2", horizontalSse2, verticalAvx2});
+    }
+#endif
+#if CI_RESAMPLE_NEON
+    kernels.push_back({"neon", horizontalNeon, verticalNeon});
+#endif
+    return kernels;
+}
+
+const ResampleKernel& activeResampleKernel() {
+    static const ResampleKernel kernel = supportedResampleKernels().back();
+    return kernel;
+}
+
+bool resampleImage(const sf::Image& source, sf::Vector2u size, ResampleFilter filter, sf::Image& target,
+                   const ResampleKernel& kernel) {
+    ScopedTimer timer("Resample image");
+    sf::Vector2u sourceSize = source.getSize();
+    if (sourceSize.x == 0 || sourceSize.y == 0 || size.x == 0 || size.y == 0) {
+        return false;
+    }
+    if (sourceSize == size) {
+        target = source;
+        return true;
+    }
+
+    const AxisTaps columns = computeAxisTaps(sourceSize.x, size.x, filter);
+    const AxisTaps rows = computeAxisTaps(sourceSize.y, size.y, filter);
+    target.resize(size);
+
+    const std::uint8_t* sourcePixels = source.getPixelsPtr();
+    const std::size_t sourceStride = rowStride(source);
+    std::uint8_t* targetPixels = mutablePixelsPtr(target);
+    const std::size_t targetStride = rowStride(target);
+    const std::size_t floatsPerRow = static_cast<std::size_t>(size.x) * 4;
+
+    // Each band walks its output rows in chunks, filtering the source rows
+    // they need horizontally into a sliding buffer: rows shared by two
+    // chunks are kept, and memory stays at about one chunk's worth.
+    parallelForRows(size.y, size.x, [&](unsigned firstRow, unsigned endRow) {
+        std::vector<float> horizontal;
+        int bufferFirst = 0;
+        int bufferEnd = 0;
+        std::vector<const float*> taps(rows.taps);
+
+        for (unsigned chunk = firstRow; chunk < endRow; chunk += ResampleChunkRows) {
+            unsigned chunkEnd = std::min(chunk + ResampleChunkRows, endRow);
+            // Window starts never decrease, so the chunk's first and last
+            // rows bound the source rows it reads.
+            int needFirst = rows.starts[chunk];
+            int needEnd = rows.starts[chunkEnd - 1] + static_cast<int>(rows.taps);
+
+            std::vector<float> next(static_cast<std::size_t>(needEnd - needFirst) * floatsPerRow);
+            int keepFirst = std::max(needFirst, bufferFirst);
+            int keepEnd = std::min(needEnd, bufferEnd);
+            if (keepFirst < keepEnd) {
+                std::memcpy(next.data() + static_cast<std::size_t>(keepFirst - needFirst) * floatsPerRow,
+                            horizontal.data() + static_cast<std::size_t>(keepFirst - bufferFirst) * floatsPerRow,
+                            static_cast<std::size_t>(keepEnd - keepFirst) * floatsPerRow * sizeof(float));
+            }
+            for (int sy = needFirst; sy < needEnd; ++sy) {
+                if (sy >= keepFirst && sy < keepEnd) {
+                    continue;
+                }
+                kernel.horizontal(sourcePixels + static_cast<std::size_t>(sy) * sourceStride,
+                                  next.data() + static_cast<std::size_t>(sy - needFirst) * floatsPerRow, size.x,
+                                  columns.starts.data(), columns.weights.data(), columns.taps);
+            }
+            horizontal = std::move(next);
+            bufferFirst = needFirst;
+            bufferEnd = needEnd;
+
+            for (unsigned y = chunk; y < chunkEnd; ++y) {
+                for (unsigned t = 0; t < rows.taps; ++t) {
+                    taps[t] = horizontal.data() +
+                              static_cast<std::size_t>(rows.starts[y] + static_cast<int>(t) - bufferFirst) *
+                                  floatsPerRow;
+                }
+                kernel.vertical(taps.data(), rows.weights.data() + static_cast<std::size_t>(y) * rows.taps,
+                                rows.taps, targetPixels + y * targetStride, floatsPerRow);
+            }
+        }
+    });
+    return true;
+}
+
+std::shared_ptr<const DecodedImage> ResampledImageCache::get(const std::shared_ptr<const DecodedImage>& image,
+                                                             sf::Vector2u targetSize, ResampleFilter targetFilter) {
+    if (result && source == image && size == targetSize && filter == targetFilter) {
+        return result;
+    }
+
+    // Resampled pixels have no file behind them; a zero hash keeps them out
+    // of the identical-files shortcut.
+    auto resampled = std::make_shared<DecodedImage>();
+    if (!image || !resampleImage(image->image, targetSize, targetFilter, resampled->image)) {
+        clear();
+        return nullptr;
+    }
+    source = image;
+    size = targetSize;
+    filter = targetFilter;
+    result = std::move(resampled);
+    return result;
+}
+
+void ResampledImageCache::clear() {
+    source.reset();
+    result.reset();
+    size = {0, 0};
+}
+
+std::size_t ResampledImageCache::byteSize() const {
+    return result ? result->byteSize() : 0;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "image_cache.hpp"
+
+#include <SFML/Graphics.hpp>
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+enum class ResampleFilter {
+    // Exact coverage-weighted average; the reference for downscaling.
+    Area,
+    Bilinear,
+    Lanczos3,
+};
+
+const char* resampleFilterName(ResampleFilter filter);
+bool parseResampleFilter(std::string_view name, ResampleFilter& filter);
+
+// Horizontal pass: `outputs` RGBA pixels of a float row, each the weighted sum
+// of `taps` consecutive source pixels from starts[i] with weights[i * taps].
+using ResampleRowFn = void (*)(const std::uint8_t* source, float* out, std::size_t outputs, const int* starts,
+                               const float* weights, unsigned taps);
+
+// Vertical pass: out[i] = round(sum_k weights[k] * rows[k][i]) clamped to
+// 0-255 for `count` floats.
+using ResampleColumnFn = void (*)(const float* const* rows, const float* weights, unsigned taps, std::uint8_t* out,
+                                  std::size_t count);
+
+// Same summation order in every kernel, so all of them produce identical bytes.
+struct ResampleKernel {
+    const char* name;
+    ResampleRowFn horizontal;
+    ResampleColumnFn vertical;
+};
+
+// Best kernel for the running CPU, chosen once on first use.
+const ResampleKernel& activeResampleKernel();
+
+// Every kernel the running CPU can execute, scalar first.
+std::vector<ResampleKernel> supportedResampleKernels();
+
+// Separable resampling of RGBA pixels (alpha filtered like the colour
+// channels) to `size`, in row bands on the shared pool.
+bool resampleImage(const sf::Image& source, sf::Vector2u size, ResampleFilter filter, sf::Image& target,
+                   const ResampleKernel& kernel = activeResampleKernel());
+
+// Keeps the last resampled version of an image, so diffing again with the
+// same geometry and filter reuses it.
+class ResampledImageCache {
+public:
+    std::shared_ptr<const DecodedImage> get(const std::shared_ptr<const DecodedImage>& source, sf::Vector2u size,
+                                            ResampleFilter filter);
+    void clear();
+    std::size_t byteSize() const;
+
+private:
+    std::shared_ptr<const DecodedImage> source;
+    sf::Vector2u size;
+    ResampleFilter filter = ResampleFilter::Area;
+    std::shared_ptr<const DecodedImage> result;
+};
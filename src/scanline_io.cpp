@@ -0,0 +1,331 @@
+#include "scanline_io.hpp"
+
+#include "image_codecs.hpp"
+#include "image_loader.hpp"
+#include "image_utils.hpp"
+#include "precise_image.hpp"
+#include "raw_formats.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <vector>
+
+namespace {
+
+class RawFormatReader : public ScanlineReader {
+public:
+    bool open(const std::string& path, std::string& error) {
+        file.open(path, std::ios::binary);
+        if (!file) {
+            error = "Failed to open image: " + path;
+            return false;
+        }
+
+        std::vector<std::uint8_t> prefix(MaxRawHeaderBytes);
+        file.read(reinterpret_cast<char*>(prefix.data()), static_cast<std::streamsize>(prefix.size()));
+        std::size_t prefixBytes = static_cast<std::size_t>(file.gcount());
+        file.clear();
+
+        if (!parseRawImageHeader(path, prefix.data(), prefixBytes, header, error)) {
+            return false;
+        }
+        file.seekg(static_cast<std::streamoff>(header.dataOffset));
+        return static_cast<bool>(file);
+    }
+
+    sf::Vector2u getSize() const override { return header.size; }
+    bool isStreaming() const override { return true; }
+
+    bool readRows(std::uint8_t* rgba, unsigned rows) override {
+        std::size_t pixels = static_cast<std::size_t>(header.size.x) * rows;
+        if (header.channels == 4) {
+            return static_cast<bool>(file.read(reinterpret_cast<char*>(rgba), static_cast<std::streamsize>(pixels * 4)));
+        }
+
+        scratch.resize(pixels * header.channels);
+        if (!file.read(reinterpret_cast<char*>(scratch.data()), static_cast<std::streamsize>(scratch.size()))) {
+            return false;
+        }
+        expandToRgba(scratch.data(), header.channels, rgba, pixels);
+        return true;
+    }
+
+private:
+    std::ifstream file;
+    RawImageHeader header;
+    std::vector<std::uint8_t> scratch;
+};
+
+class DecodedImageReader : public ScanlineReader {
+public:
+    bool open(const std::string& path, std::string& error) {
+        // 16-bit and float raw files are read through their 8-bit copy.
+        if (isRawFormatPath(path)) {
+            DecodedImage decoded;
+            if (!decodeImage(path, decoded, error)) {
+                return false;
+            }
+            image = std::move(decoded.image);
+            return true;
+        }
+        if (!loadImageFile(path, image)) {
+            error = "Failed to load image: " + path;
+            return false;
+        }
+        return true;
+    }
+
+    sf::Vector2u getSize() const override { return image.getSize(); }
+    bool isStreaming() const override { return false; }
+
+    bool readRows(std::uint8_t* rgba, unsigned rows) override {
+        sf::Vector2u size = image.getSize();
+        if (nextRow + rows > size.y) {
+            return false;
+        }
+        std::size_t rowBytes = static_cast<std::size_t>(size.x) * 4;
+        std::memcpy(rgba, image.getPixelsPtr() + nextRow * rowBytes, rowBytes * rows);
+        nextRow += rows;
+        return true;
+    }
+
+private:
+    sf::Image image;
+    unsigned nextRow = 0;
+};
+
+void writeLittleEndian(std::ostream& out, std::uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+        out.put(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+}
+
+class BmpWriter : public ScanlineWriter {
+public:
+    static constexpr std::uint32_t HeaderBytes = 14 + 108;
+
+    bool open(const std::string& path, sf::Vector2u imageSize, std::string& error) {
+        size = imageSize;
+
+        // The file size field is 32-bit and the dimensions are signed.
+        std::uint64_t pixelBytes = static_cast<std::uint64_t>(size.x) * size.y * 4;
+        if (HeaderBytes + pixelBytes > std::numeric_limits<std::uint32_t>::max() ||
+            size.x > static_cast<unsigned>(std::numeric_limits<std::int32_t>::max()) ||
+            size.y > static_cast<unsigned>(std::numeric_limits<std::int32_t>::max())) {
+            error = "Image is too large for BMP: " + path;
+            return false;
+        }
+
+        file.open(path, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            error = "Failed to create output: " + path;
+            return false;
+        }
+
+        // BITMAPV4HEADER with BI_BITFIELDS, matching stb_image_write's RGBA output.
+        file.put('B');
+        file.put('M');
+        writeLittleEndian(file, static_cast<std::uint32_t>(HeaderBytes + pixelBytes), 4);
+        writeLittleEndian(file, 0, 2);
+        writeLittleEndian(file, 0, 2);
+        writeLittleEndian(file, HeaderBytes, 4);
+
+        writeLittleEndian(file, 108, 4);
+        writeLittleEndian(file, size.x, 4);
+        writeLittleEndian(file, size.y, 4);
+        writeLittleEndian(file, 1, 2);
+        writeLittleEndian(file, 32, 2);
+        writeLittleEndian(file, 3, 4);
+        for (int i = 0; i < 5; ++i) {
+            writeLittleEndian(file, 0, 4);
+        }
+        writeLittleEndian(file, 0x00FF0000u, 4);
+        writeLittleEndian(file, 0x0000FF00u, 4);
+        writeLittleEndian(file, 0x000000FFu, 4);
+        writeLittleEndian(file, 0xFF000000u, 4);
+        for (int i = 0; i < 13; ++i) {
+            writeLittleEndian(file, 0, 4);
+        }
+        return static_cast<bool>(file);
+    }
+
+    // BMP rows are stored bottom-up, so each strip is written reversed at
+    // its final offset.
+    bool writeRows(const std::uint8_t* rgba, unsigned rows) override {
+        if (rows == 0 || nextRow + rows > size.y) {
+            return false;
+        }
+
+        std::size_t rowBytes = static_cast<std::size_t>(size.x) * 4;
+        scratch.resize(rowBytes * rows);
+
+        for (unsigned r = 0; r < rows; ++r) {
+            const std::uint8_t* in = rgba + r * rowBytes;
+            std::uint8_t* out = scratch.data() + (rows - 1 - r) * rowBytes;
+            for (unsigned x = 0; x < size.x; ++x, in += 4, out += 4) {
+                out[0] = in[2];
+                out[1] = in[1];
+                out[2] = in[0];
+                out[3] = in[3];
+            }
+        }
+
+        unsigned lastRow = nextRow + rows - 1;
+        std::streamoff offset = HeaderBytes + static_cast<std::streamoff>(size.y - 1 - lastRow) * static_cast<std::streamoff>(rowBytes);
+        file.seekp(offset);
+        file.write(reinterpret_cast<const char*>(scratch.data()), static_cast<std::streamsize>(scratch.size()));
+        nextRow += rows;
+        return static_cast<bool>(file);
+    }
+
+    bool finish() override {
+        file.close();
+        return nextRow == size.y && !file.fail();
+    }
+
+private:
+    std::ofstream file;
+    sf::Vector2u size;
+    unsigned nextRow = 0;
+    std::vector<std::uint8_t> scratch;
+};
+
+class RawFormatWriter : public ScanlineWriter {
+public:
+    bool open(const std::string& path, sf::Vector2u imageSize, std::string& error) {
+        size = imageSize;
+        withAlpha = isRgbaRawFormatPath(path);
+        file.open(path, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            error = "Failed to create output: " + path;
+            return false;
+        }
+
+        file << createRawImageHeader(path, size);
+        return static_cast<bool>(file);
+    }
+
+    bool writeRows(const std::uint8_t* rgba, unsigned rows) override {
+        std::size_t pixels = static_cast<std::size_t>(size.x) * rows;
+        if (withAlpha) {
+            file.write(reinterpret_cast<const char*>(rgba), static_cast<std::streamsize>(pixels * 4));
+        }
+        else {
+            scratch.resize(pixels * 3);
+            for (std::size_t i = 0; i < pixels; ++i) {
+                std::memcpy(&scratch[i * 3], rgba + i * 4, 3);
+            }
+            file.write(reinterpret_cast<const char*>(scratch.data()), static_cast<std::streamsize>(scratch.size()));
+        }
+        nextRow += rows;
+        return static_cast<bool>(file);
+    }
+
+    bool finish() override {
+        file.close();
+        return nextRow == size.y && !file.fail();
+    }
+
+private:
+    std::ofstream file;
+    sf::Vector2u size;
+    bool withAlpha = false;
+    unsigned nextRow = 0;
+    std::vector<std::uint8_t> scratch;
+};
+
+class QoiWriter : public ScanlineWriter {
+public:
+    bool open(const std::string& path, sf::Vector2u imageSize, std::string& error) {
+        size = imageSize;
+        file.open(path, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            error = "Failed to create output: " + path;
+            return false;
+        }
+
+        encoder.begin(size, scratch);
+        return flush();
+    }
+
+    bool writeRows(const std::uint8_t* rgba, unsigned rows) override {
+        if (rows == 0 || nextRow + rows > size.y) {
+            return false;
+        }
+        encoder.encode(rgba, static_cast<std::size_t>(size.x) * rows, scratch);
+        nextRow += rows;
+        return flush();
+    }
+
+    bool finish() override {
+        encoder.finish(scratch);
+        bool written = flush();
+        file.close();
+        return written && nextRow == size.y && !file.fail();
+    }
+
+private:
+    bool flush() {
+        file.write(reinterpret_cast<const char*>(scratch.data()), static_cast<std::streamsize>(scratch.size()));
+        scratch.clear();
+        return static_cast<bool>(file);
+    }
+
+    std::ofstream file;
+    sf::Vector2u size;
+    unsigned nextRow = 0;
+    QoiStreamEncoder encoder;
+    std::vector<std::uint8_t> scratch;
+};
+
+}
+
+std::unique_ptr<ScanlineReader> openScanlineReader(const std::string& path, std::string& error) {
+    if (isRawFormatPath(path) && !isPreciseImageFile(path)) {
+        auto reader = std::make_unique<RawFormatReader>();
+        if (reader->open(path, error)) {
+            return reader;
+        }
+        return nullptr;
+    }
+
+    auto reader = std::make_unique<DecodedImageReader>();
+    if (reader->open(path, error)) {
+        return reader;
+    }
+    return nullptr;
+}
+
+bool isScanlineWriterPath(const std::string& path) {
+    std::string extension = lowercaseExtension(path);
+    return extension == ".bmp" || extension == ".ppm" || extension == ".qoi" || isRgbaRawFormatPath(path);
+}
+
+std::unique_ptr<ScanlineWriter> createScanlineWriter(const std::string& path, sf::Vector2u size, std::string& error) {
+    std::string extension = lowercaseExtension(path);
+    if (extension == ".bmp") {
+        auto writer = std::make_unique<BmpWriter>();
+        if (writer->open(path, size, error)) {
+            return writer;
+        }
+        return nullptr;
+    }
+    if (extension == ".ppm" || isRgbaRawFormatPath(path)) {
+        auto writer = std::make_unique<RawFormatWriter>();
+        if (writer->open(path, size, error)) {
+            return writer;
+        }
+        return nullptr;
+    }
+    if (extension == ".qoi") {
+        auto writer = std::make_unique<QoiWriter>();
+        if (writer->open(path, size, error)) {
+            return writer;
+        }
+        return nullptr;
+    }
+
+    error = "Streaming output supports .bmp, .ppm, .pam, .rgba and .qoi: " + path;
+    return nullptr;
+}
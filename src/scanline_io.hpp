@@ -0,0 +1,39 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Sequential top-to-bottom access to an image, a few rows at a time, as
+// tightly packed RGBA.
+class ScanlineReader {
+public:
+    virtual ~ScanlineReader() = default;
+
+    virtual sf::Vector2u getSize() const = 0;
+    virtual bool readRows(std::uint8_t* rgba, unsigned rows) = 0;
+
+    // False when the whole image had to be decoded up front.
+    virtual bool isStreaming() const = 0;
+};
+
+class ScanlineWriter {
+public:
+    virtual ~ScanlineWriter() = default;
+
+    virtual bool writeRows(const std::uint8_t* rgba, unsigned rows) = 0;
+    virtual bool finish() = 0;
+};
+
+// The 8-bit uncompressed formats in raw_formats.hpp are read strip by strip.
+// Any other supported format, 16-bit and float files included, is decoded
+// whole and then served row by row as 8-bit RGBA.
+std::unique_ptr<ScanlineReader> openScanlineReader(const std::string& path, std::string& error);
+
+// True for the extensions createScanlineWriter accepts.
+bool isScanlineWriterPath(const std::string& path);
+
+// Writes .bmp (the same 32-bit layout sf::Image::saveToFile produces), .ppm,
+// .pam, .rgba or .qoi incrementally.
+std::unique_ptr<ScanlineWriter> createScanlineWriter(const std::string& path, sf::Vector2u size, std::string& error);
@@ -0,0 +1,233 @@
+#include "selection_view.hpp"
+
+#include "image_utils.hpp"
+#include "parallel.hpp"
+#include "imgui.h"
+
+#include <algorithm>
+#include <mutex>
+
+namespace {
+
+// The parts of `next` not covered by `previous`, both anchored at (0, 0):
+// a strip on the right and one along the bottom.
+std::vector<PixelRect> exposedArea(sf::Vector2u previous, sf::Vector2u next) {
+    std::vector<PixelRect> dirty;
+    if (next.x > previous.x) {
+        dirty.push_back({{previous.x, 0}, {next.x - previous.x, next.y}});
+    }
+    unsigned keptWidth = std::min(previous.x, next.x);
+    if (next.y > previous.y && keptWidth > 0) {
+        dirty.push_back({{0, previous.y}, {keptWidth, next.y - previous.y}});
+    }
+    return dirty;
+}
+
+sf::Vector2u clampToTextureLimit(sf::Vector2u size) {
+    unsigned limit = sf::Texture::getMaximumSize();
+    return {std::min(size.x, limit), std::min(size.y, limit)};
+}
+
+ImTextureID textureId(const sf::Texture& texture) {
+    return static_cast<ImTextureID>(static_cast<uintptr_t>(texture.getNativeHandle()));
+}
+
+}
+
+bool SelectionComparison::reservePanel(Panel& panel, sf::Vector2u size, bool& reallocated) {
+    sf::Vector2u capacity = panel.texture.getSize();
+    reallocated = size.x > capacity.x || size.y > capacity.y;
+    if (reallocated) {
+        // Grow with headroom so a drag does not reallocate on every frame.
+        sf::Vector2u grown = clampToTextureLimit({std::max(size.x, capacity.x + capacity.x / 2),
+                                                  std::max(size.y, capacity.y + capacity.y / 2)});
+        if (!panel.texture.resize(grown)) {
+            return false;
+        }
+    }
+    panel.size = size;
+    return true;
+}
+
+void SelectionComparison::uploadCrop(Panel& panel, const sf::Image& image, PixelRect rect, PixelRect dirty) {
+    if (dirty.size.x == 0 || dirty.size.y == 0) {
+        return;
+    }
+
+    std::size_t rowBytes = static_cast<std::size_t>(dirty.size.x) * 4;
+    scratch.resize(rowBytes * dirty.size.y);
+    const std::uint8_t* source = image.getPixelsPtr() + (rect.position.y + dirty.position.y) * rowStride(image) +
+                                 static_cast<std::size_t>(rect.position.x + dirty.position.x) * 4;
+    copyPixelRows(source, rowStride(image), scratch.data(), rowBytes, dirty.size.x, dirty.size.y);
+
+    panel.texture.update(scratch.data(), dirty.size, dirty.position);
+    lastUploadBytes += scratch.size();
+}
+
+void SelectionComparison::uploadDiff(PixelRect dirty, std::uint8_t tolerance) {
+    if (dirty.size.x == 0 || dirty.size.y == 0) {
+        return;
+    }
+
+    std::size_t rowBytes = static_cast<std::size_t>(dirty.size.x) * 4;
+    scratch.resize(rowBytes * dirty.size.y);
+    const std::uint8_t* pixels1 = source1->getPixelsPtr() +
+                                  (rect1.position.y + dirty.position.y) * rowStride(*source1) +
+                                  static_cast<std::size_t>(rect1.position.x + dirty.position.x) * 4;
+    const std::uint8_t* pixels2 = source2->getPixelsPtr() +
+                                  (rect2.position.y + dirty.position.y) * rowStride(*source2) +
+                                  static_cast<std::size_t>(rect2.position.x + dirty.position.x) * 4;
+
+    DiffAccumulator unused;
+    diffStrip(pixels1, rowStride(*source1), pixels2, rowStride(*source2), scratch.data(), rowBytes,
+              dirty.size.x, dirty.size.y, tolerance, false, unused);
+
+    diffPanel.texture.update(scratch.data(), dirty.size, dirty.position);
+    lastUploadBytes += scratch.size();
+}
+
+void SelectionComparison::countArea(PixelRect area, std::uint8_t tolerance) {
+    const DiffKernel& kernel = activeDiffKernel();
+    std::mutex countedMutex;
+    parallelForRows(area.size.y, area.size.x, [&](unsigned firstRow, unsigned endRow) {
+        DiffAccumulator band;
+        std::vector<std::uint8_t> deltas(static_cast<std::size_t>(area.size.x) * 4);
+        for (unsigned y = area.position.y + firstRow; y < area.position.y + endRow; ++y) {
+            const std::uint8_t* row1 = source1->getPixelsPtr() + (rect1.position.y + y) * rowStride(*source1) +
+                                       static_cast<std::size_t>(rect1.position.x + area.position.x) * 4;
+            const std::uint8_t* row2 = source2->getPixelsPtr() + (rect2.position.y + y) * rowStride(*source2) +
+                                       static_cast<std::size_t>(rect2.position.x + area.position.x) * 4;
+            kernel.run(row1, row2, deltas.data(), area.size.x, tolerance, band.rows);
+        }
+        std::lock_guard<std::mutex> lock(countedMutex);
+        counted.merge(band);
+    });
+}
+
+// A selection growing from the same anchor only counts the area it gained;
+// anything else counts the whole overlap again, in parallel bands.
+void SelectionComparison::recountDifferences(bool sameAnchor, std::uint8_t tolerance) {
+    sf::Vector2u overlap{std::min(rect1.size.x, rect2.size.x), std::min(rect1.size.y, rect2.size.y)};
+    if (!sameAnchor || overlap.x < countedSize.x || overlap.y < countedSize.y) {
+        counted = DiffAccumulator{};
+        countedSize = {0, 0};
+    }
+    for (const PixelRect& area : exposedArea(countedSize, overlap)) {
+        countArea(area, tolerance);
+    }
+    countedSize = overlap;
+
+    summary = DiffSummary{};
+    summary.width = overlap.x;
+    summary.height = overlap.y;
+    summary.sizeMismatch = rect1.size != rect2.size;
+    finishDifference(counted, tolerance, summary, nullptr);
+}
+
+bool SelectionComparison::update(const sf::Image& image1, PixelRect newRect1, const sf::Image& image2,
+                                 PixelRect newRect2, std::uint8_t tolerance) {
+    lastUploadBytes = 0;
+    if (newRect1.size.x == 0 || newRect1.size.y == 0 || newRect2.size.x == 0 || newRect2.size.y == 0) {
+        clear();
+        return false;
+    }
+
+    sf::Vector2u previous1 = panel1.size;
+    sf::Vector2u previous2 = panel2.size;
+    sf::Vector2u previousDiff = diffPanel.size;
+
+    // Growing or shrinking from the same anchor keeps what is already on the
+    // GPU valid; anything else starts over.
+    bool sameAnchor = !empty() && source1 == &image1 && source2 == &image2 &&
+                      rect1.position == newRect1.position && rect2.position == newRect2.position &&
+                      lastTolerance == tolerance;
+
+    if (sameAnchor && rect1.size == newRect1.size && rect2.size == newRect2.size) {
+        return true;
+    }
+
+    // The crops keep their full size for the count and the saved image; only
+    // the panels are clamped to what a texture can hold.
+    source1 = &image1;
+    source2 = &image2;
+    rect1 = newRect1;
+    rect2 = newRect2;
+    lastTolerance = tolerance;
+
+    sf::Vector2u overlap{std::min(rect1.size.x, rect2.size.x), std::min(rect1.size.y, rect2.size.y)};
+    bool grew1, grew2, grewDiff;
+    if (!reservePanel(panel1, clampToTextureLimit(rect1.size), grew1) ||
+        !reservePanel(panel2, clampToTextureLimit(rect2.size), grew2) ||
+        !reservePanel(diffPanel, clampToTextureLimit(overlap), grewDiff)) {
+        clear();
+        return false;
+    }
+
+    auto dirtyArea = [&](bool reallocated, sf::Vector2u before, sf::Vector2u after) {
+        if (!sameAnchor || reallocated) {
+            return std::vector<PixelRect>{{{0, 0}, after}};
+        }
+        return exposedArea(before, after);
+    };
+
+    for (const PixelRect& dirty : dirtyArea(grew1, previous1, panel1.size)) {
+        uploadCrop(panel1, image1, rect1, dirty);
+    }
+    for (const PixelRect& dirty : dirtyArea(grew2, previous2, panel2.size)) {
+        uploadCrop(panel2, image2, rect2, dirty);
+    }
+    for (const PixelRect& dirty : dirtyArea(grewDiff, previousDiff, diffPanel.size)) {
+        uploadDiff(dirty, tolerance);
+    }
+
+    recountDifferences(sameAnchor, tolerance);
+    return true;
+}
+
+std::size_t SelectionComparison::getGpuBytes() const {
+    std::size_t bytes = 0;
+    for (const Panel* panel : {&panel1, &panel2, &diffPanel}) {
+        bytes += static_cast<std::size_t>(panel->texture.getSize().x) * panel->texture.getSize().y * 4;
+    }
+    return bytes;
+}
+
+void SelectionComparison::clear() {
+    panel1.size = panel2.size = diffPanel.size = {0, 0};
+    source1 = source2 = nullptr;
+    rect1 = rect2 = PixelRect{};
+    summary = DiffSummary{};
+    counted = DiffAccumulator{};
+    countedSize = {0, 0};
+}
+
+void SelectionComparison::draw(float zoom) const {
+    const Panel* panels[] = {&panel1, &panel2, &diffPanel};
+    const char* labels[] = {"Image 1", "Image 2", "Difference"};
+
+    for (int i = 0; i < 3; ++i) {
+        const Panel& panel = *panels[i];
+        if (i > 0) {
+            ImGui::SameLine();
+        }
+
+        ImGui::BeginGroup();
+        ImGui::TextUnformatted(labels[i]);
+        sf::Vector2u capacity = panel.texture.getSize();
+        if (panel.size.x > 0 && panel.size.y > 0 && capacity.x > 0 && capacity.y > 0) {
+            ImVec2 uvMax(static_cast<float>(panel.size.x) / static_cast<float>(capacity.x),
+                         static_cast<float>(panel.size.y) / static_cast<float>(capacity.y));
+            ImGui::Image(textureId(panel.texture), ImVec2(panel.size.x * zoom, panel.size.y * zoom),
+                         ImVec2(0.0f, 0.0f), uvMax);
+        }
+        ImGui::EndGroup();
+    }
+}
+
+void SelectionComparison::composeImage(sf::Image& output) const {
+    if (empty()) {
+        output = sf::Image();
+        return;
+    }
+    composeSelectionPair(*source1, rect1, *source2, rect2, output);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "comparison.hpp"
+#include "image_diff.hpp"
+
+#include <SFML/Graphics.hpp>
+#include <cstdint>
+#include <vector>
+
+// The two crops of a selection and their difference, shown side by side.
+// Each panel lives in a texture that only grows, so dragging a selection
+// re-uploads just the part of each panel that changed.
+class SelectionComparison {
+public:
+    // `rect1` and `rect2` must lie inside their images. Both images must stay
+    // alive and unchanged until the next update/clear, or call clear() first.
+    bool update(const sf::Image& image1, PixelRect rect1, const sf::Image& image2, PixelRect rect2,
+                std::uint8_t tolerance);
+    void clear();
+
+    bool empty() const { return rect1.size.x == 0; }
+    const DiffSummary& getDiffSummary() const { return summary; }
+    // Bytes the last update sent to the GPU.
+    std::size_t getLastUploadBytes() const { return lastUploadBytes; }
+    // Panel textures (allocated with headroom) and the upload staging buffer.
+    std::size_t getGpuBytes() const;
+    std::size_t getCpuBytes() const { return scratch.capacity(); }
+
+    // Image 1 crop | Image 2 crop | difference, scaled by `zoom`.
+    void draw(float zoom) const;
+
+    // Both crops side by side on black, the same layout Extract Selection
+    // always produced.
+    void composeImage(sf::Image& output) const;
+
+private:
+    struct Panel {
+        sf::Texture texture;
+        sf::Vector2u size;
+    };
+
+    bool reservePanel(Panel& panel, sf::Vector2u size, bool& reallocated);
+    void uploadCrop(Panel& panel, const sf::Image& image, PixelRect rect, PixelRect dirty);
+    void uploadDiff(PixelRect dirty, std::uint8_t tolerance);
+    void countArea(PixelRect area, std::uint8_t tolerance);
+    void recountDifferences(bool sameAnchor, std::uint8_t tolerance);
+
+    Panel panel1;
+    Panel panel2;
+    Panel diffPanel;
+
+    const sf::Image* source1 = nullptr;
+    const sf::Image* source2 = nullptr;
+    PixelRect rect1;
+    PixelRect rect2;
+    std::uint8_t lastTolerance = 0;
+
+    DiffSummary summary;
+    // Totals over the top-left countedSize part of the overlap.
+    DiffAccumulator counted;
+    sf::Vector2u countedSize;
+    std::size_t lastUploadBytes = 0;
+    std::vector<std::uint8_t> scratch;
+};
@@ -0,0 +1,529 @@
+#include "sequence.hpp"
+
+#include "image_loader.hpp"
+#include "image_utils.hpp"
+#include "mapped_image.hpp"
+#include "parallel.hpp"
+#include "precise_diff.hpp"
+#include "precise_image.hpp"
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string_view>
+#include <system_error>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Diffs are row-parallel on the shared pool, so two stage threads keep it
+// fed while one of them finishes its metrics.
+constexpr unsigned DiffThreads = 2;
+
+// Blocking FIFO with a fixed capacity: producers wait while it is full, so a
+// slow stage holds back the ones before it instead of piling up frames.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(std::size_t capacity) : capacity(std::max<std::size_t>(1, capacity)) {}
+
+    // False once the queue is closed; the item is dropped then.
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [&] { return closed || items.size() < capacity; });
+        if (closed) {
+            return false;
+        }
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    // False once the queue is closed and drained.
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [&] { return closed || !items.empty(); });
+        if (items.empty()) {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+private:
+    std::size_t capacity;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+    bool closed = false;
+};
+
+struct DecodedFrame {
+    std::size_t index = 0;
+    DecodedImage image1;
+    DecodedImage image2;
+};
+
+struct DiffedFrame {
+    std::size_t index = 0;
+    sf::Image diffImage;
+    std::optional<PrecisePixels> preciseDiff;
+};
+
+float elapsedMs(std::uint64_t startNs) {
+    return static_cast<float>(profileClockNs() - startNs) / 1e6f;
+}
+
+bool parseFrameNumber(std::string_view digits, long& number) {
+    const char* end = digits.data() + digits.size();
+    auto result = std::from_chars(digits.data(), end, number);
+    return !digits.empty() && result.ec == std::errc() && result.ptr == end;
+}
+
+// A sequence given as a pattern: files in `directory` named prefix, digits,
+// suffix. With `width` > 0 the number is zero-padded to at least that many
+// digits, as printf's %0Nd or a run of N '#' would write it.
+struct FramePattern {
+    fs::path directory;
+    std::string prefix;
+    std::string suffix;
+    std::size_t width = 0;
+};
+
+bool parseFramePattern(const std::string& input, FramePattern& pattern) {
+    fs::path path(input);
+    std::string name = path.filename().string();
+    pattern.directory = path.has_parent_path() ? path.parent_path() : fs::path(".");
+
+    std::size_t percent = name.find('%');
+    if (percent != std::string::npos) {
+        std::size_t pos = percent + 1;
+        while (pos < name.size() && name[pos] >= '0' && name[pos] <= '9') {
+            ++pos;
+        }
+        if (pos >= name.size() || name[pos] != 'd') {
+            return false;
+        }
+        std::string_view widthText(name.data() + percent + 1, pos - percent - 1);
+        if (!widthText.empty() && widthText[0] == '0') {
+            long width = 0;
+            if (!parseFrameNumber(widthText.substr(1), width)) {
+                return false;
+            }
+            pattern.width = static_cast<std::size_t>(width);
+        }
+        pattern.prefix = name.substr(0, percent);
+        pattern.suffix = name.substr(pos + 1);
+        return true;
+    }
+
+    std::size_t hash = name.find('#');
+    if (hash != std::string::npos) {
+        std::size_t end = name.find_first_not_of('#', hash);
+        end = end == std::string::npos ? name.size() : end;
+        pattern.width = end - hash;
+        pattern.prefix = name.substr(0, hash);
+        pattern.suffix = name.substr(end);
+        return true;
+    }
+    return false;
+}
+
+bool matchFramePattern(const FramePattern& pattern, const std::string& name, long& number) {
+    if (name.size() <= pattern.prefix.size() + pattern.suffix.size() ||
+        name.compare(0, pattern.prefix.size(), pattern.prefix) != 0 ||
+        name.compare(name.size() - pattern.suffix.size(), pattern.suffix.size(), pattern.suffix) != 0) {
+        return false;
+    }
+    std::string_view digits(name.data() + pattern.prefix.size(),
+                            name.size() - pattern.prefix.size() - pattern.suffix.size());
+    if (digits.size() < pattern.width || digits.find_first_not_of("0123456789") != std::string_view::npos) {
+        return false;
+    }
+    return parseFrameNumber(digits, number);
+}
+
+// The last run of digits in the file name without its extension.
+bool trailingFrameNumber(const fs::path& path, long& number) {
+    std::string stem = path.stem().string();
+    std::size_t end = stem.find_last_of("0123456789");
+    if (end == std::string::npos) {
+        return false;
+    }
+    std::size_t begin = stem.find_last_not_of("0123456789", end);
+    begin = begin == std::string::npos ? 0 : begin + 1;
+    return parseFrameNumber(std::string_view(stem).substr(begin, end + 1 - begin), number);
+}
+
+bool listSequence(const std::string& input, std::map<long, std::string>& frames, std::string& error) {
+    std::error_code ec;
+    FramePattern pattern;
+    bool isDirectory = fs::is_directory(input, ec);
+    if (!isDirectory && !parseFramePattern(input, pattern)) {
+        error = "Not a directory or a frame pattern (%04d or ####): " + input;
+        return false;
+    }
+
+    fs::path directory = isDirectory ? fs::path(input) : pattern.directory;
+    // error_code overloads throughout, as in the --diff-dir scan.
+    fs::directory_iterator iterator(directory, ec);
+    for (; !ec && iterator != fs::directory_iterator(); iterator.increment(ec)) {
+        const fs::directory_entry& entry = *iterator;
+        if (!entry.is_regular_file(ec)) {
+            if (ec && ec != std::errc::no_such_file_or_directory) {
+                error = "Cannot read " + entry.path().string() + ": " + ec.message();
+                return false;
+            }
+            ec.clear();
+            continue;
+        }
+
+        long number = 0;
+        bool numbered = isDirectory ? trailingFrameNumber(entry.path(), number)
+                                    : matchFramePattern(pattern, entry.path().filename().string(), number);
+        if (!numbered) {
+            continue;
+        }
+        if (!frames.emplace(number, entry.path().string()).second) {
+            error = "Two files are frame " + std::to_string(number) + " in " + input;
+            return false;
+        }
+    }
+
+    if (ec) {
+        error = "Cannot read directory: " + directory.string() + ": " + ec.message();
+        return false;
+    }
+    if (frames.empty()) {
+        error = "No numbered frames found: " + input;
+        return false;
+    }
+    return true;
+}
+
+// CSV fields are quoted only when they contain a separator, quote or newline.
+std::string csvField(const std::string& text) {
+    if (text.find_first_of(",\"\n\r") == std::string::npos) {
+        return text;
+    }
+    std::string quoted = "\"";
+    for (char c : text) {
+        quoted += c;
+        if (c == '"') {
+            quoted += '"';
+        }
+    }
+    quoted += '"';
+    return quoted;
+}
+
+std::string formatValue(double value) {
+    char buffer[64];
+    std::snprintf(buffer, sizeof(buffer), "%.6g", value);
+    return buffer;
+}
+
+bool writeSequenceCsv(std::ofstream& file, const std::vector<SequenceFrame>& frames,
+                      const std::vector<SequenceFrameResult>& results) {
+    file << "frame,image_a,image_b,width,height,differing_pixels,differing_percent,max_delta,"
+            "mse,psnr,ssim,over_threshold,resampled,decode_ms,diff_ms,encode_ms,error\n";
+    for (std::size_t i = 0; i < frames.size(); ++i) {
+        const SequenceFrame& frame = frames[i];
+        const SequenceFrameResult& result = results[i];
+        file << frame.number << ',' << csvField(frame.pathA) << ',' << csvField(frame.pathB) << ',';
+        if (result.failed) {
+            file << ",,,,,,,,,," << formatValue(result.decodeMs) << ",,," << csvField(result.error) << '\n';
+            continue;
+        }
+
+        const DiffSummary& s = result.summary;
+        const DiffMetrics& m = result.metrics;
+        bool hasMetrics = m.width > 0;
+        file << s.width << ',' << s.height << ',' << s.differingPixels << ',' << formatValue(s.differingPercent())
+             << ',' << static_cast<unsigned>(s.maxDelta) << ','
+             << (hasMetrics ? formatValue(m.mseAll) : "") << ','
+             << (hasMetrics ? formatValue(m.psnrAll) : "") << ','
+             << (hasMetrics ? formatValue(m.ssim) : "") << ','
+             << (result.overThreshold ? 1 : 0) << ',' << (result.resampled ? 1 : 0) << ','
+             << formatValue(result.decodeMs) << ',' << formatValue(result.diffMs) << ','
+             << formatValue(result.encodeMs) << ",\n";
+    }
+    return static_cast<bool>(file);
+}
+
+bool writeSequenceJson(std::ofstream& file, const std::vector<SequenceFrame>& frames,
+                       const std::vector<SequenceFrameResult>& results) {
+    file << "[\n";
+    for (std::size_t i = 0; i < frames.size(); ++i) {
+        const SequenceFrame& frame = frames[i];
+        const SequenceFrameResult& result = results[i];
+        file << "  {\n"
+             << "    \"frame\": " << frame.number << ",\n"
+             << "    \"image_a\": " << jsonQuote(frame.pathA) << ",\n"
+             << "    \"image_b\": " << jsonQuote(frame.pathB) << ",\n";
+        if (result.failed) {
+            file << "    \"error\": " << jsonQuote(result.error) << "\n";
+        }
+        else {
+            const DiffSummary& s = result.summary;
+            file << "    \"width\": " << s.width << ",\n"
+                 << "    \"height\": " << s.height << ",\n"
+                 << "    \"differing_pixels\": " << s.differingPixels << ",\n"
+                 << "    \"differing_percent\": " << formatValue(s.differingPercent()) << ",\n"
+                 << "    \"max_delta\": " << static_cast<unsigned>(s.maxDelta) << ",\n"
+                 << "    \"over_threshold\": " << (result.overThreshold ? "true" : "false") << ",\n"
+                 << "    \"resampled\": " << (result.resampled ? "true" : "false") << ",\n"
+                 << "    \"timings_ms\": {\"decode\": " << formatValue(result.decodeMs)
+                 << ", \"diff\": " << formatValue(result.diffMs)
+                 << ", \"encode\": " << formatValue(result.encodeMs) << "}";
+            if (result.metrics.width > 0) {
+                file << ",\n    \"metrics\": " << diffMetricsToJson(result.metrics, 4);
+            }
+            file << "\n";
+        }
+        file << (i + 1 < frames.size() ? "  },\n" : "  }\n");
+    }
+    file << "]\n";
+    return static_cast<bool>(file);
+}
+
+}
+
+bool collectSequenceFrames(const std::string& inputA, const std::string& inputB, std::vector<SequenceFrame>& frames,
+                           std::size_t& unmatched, std::string& error) {
+    std::map<long, std::string> framesA;
+    std::map<long, std::string> framesB;
+    if (!listSequence(inputA, framesA, error) || !listSequence(inputB, framesB, error)) {
+        return false;
+    }
+
+    frames.clear();
+    for (auto& [number, path] : framesA) {
+        auto counterpart = framesB.find(number);
+        if (counterpart != framesB.end()) {
+            frames.push_back({number, std::move(path), std::move(counterpart->second)});
+        }
+    }
+    unmatched = framesA.size() + framesB.size() - 2 * frames.size();
+
+    if (frames.empty()) {
+        error = "The two sequences have no frame numbers in common";
+        return false;
+    }
+    return true;
+}
+
+void runSequenceComparison(const std::vector<SequenceFrame>& frames, const SequenceOptions& options,
+                           std::vector<SequenceFrameResult>& results, SequenceProgress* progress,
+                           const std::function<void(std::size_t)>& frameDone) {
+    results.assign(frames.size(), SequenceFrameResult{});
+    if (frames.empty()) {
+        return;
+    }
+
+    unsigned cores = std::max(1u, sharedThreadCount());
+    bool encoding = !options.outputDirectory.empty();
+    std::size_t decodeThreads = options.decodeThreads > 0 ? options.decodeThreads : cores;
+    std::size_t encodeThreads = !encoding ? 0 : options.encodeThreads > 0 ? options.encodeThreads
+                                                                           : std::max(1u, cores / 2);
+    decodeThreads = std::min(decodeThreads, frames.size());
+    encodeThreads = std::min(encodeThreads, frames.size());
+    std::size_t diffThreads = std::min<std::size_t>(DiffThreads, frames.size());
+
+    BoundedQueue<DecodedFrame> decodedQueue(options.queueDepth);
+    BoundedQueue<DiffedFrame> encodeQueue(options.queueDepth);
+    std::atomic<std::size_t> nextFrame{0};
+    // Written once per frame by whichever stage finishes it.
+    std::vector<std::uint8_t> finished(frames.size(), 0);
+
+    auto cancelled = [&] { return progress && progress->cancelRequested.load(std::memory_order_relaxed); };
+    auto complete = [&](std::size_t index) {
+        finished[index] = 1;
+        if (progress) {
+            progress->done.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (frameDone) {
+            frameDone(index);
+        }
+    };
+
+    auto decodeStage = [&] {
+        while (!cancelled()) {
+            std::size_t index = nextFrame.fetch_add(1);
+            if (index >= frames.size()) {
+                break;
+            }
+
+            ScopedTimer timer("Decode frame");
+            std::uint64_t startNs = profileClockNs();
+            SequenceFrameResult& result = results[index];
+            DecodedFrame frame;
+            frame.index = index;
+            if (!decodeImage(frames[index].pathA, frame.image1, result.error) ||
+                !decodeImage(frames[index].pathB, frame.image2, result.error)) {
+                result.failed = true;
+                result.decodeMs = elapsedMs(startNs);
+                complete(index);
+                continue;
+            }
+            result.decodeMs = elapsedMs(startNs);
+            timer.stop();
+
+            if (!decodedQueue.push(std::move(frame))) {
+                break;
+            }
+        }
+    };
+
+    auto diffStage = [&] {
+        DecodedFrame frame;
+        while (decodedQueue.pop(frame)) {
+            if (cancelled()) {
+                continue;
+            }
+
+            ScopedTimer timer("Diff frame");
+            std::uint64_t startNs = profileClockNs();
+            SequenceFrameResult& result = results[frame.index];
+            const sf::Image* image2 = &frame.image2.image;
+            sf::Image resampled;
+            if (options.resample && frame.image1.image.getSize() != image2->getSize()) {
+                if (!resampleImage(*image2, frame.image1.image.getSize(), options.resampleFilter, resampled)) {
+                    result.failed = true;
+                    result.error = "Failed to resample image: " + frames[frame.index].pathB;
+                    complete(frame.index);
+                    continue;
+                }
+                image2 = &resampled;
+                result.resampled = true;
+            }
+
+            // 16-bit and float frames are diffed at full precision unless
+            // image 2 was resampled, and saved that way to .pfm/.ppm/.pam.
+            DiffedFrame diffed;
+            diffed.index = frame.index;
+            DiffMetrics* metrics = options.withMetrics ? &result.metrics : nullptr;
+            bool keepPrecise = encoding && isPreciseOutputPath(frames[frame.index].pathA);
+            bool ok = result.resampled
+                          ? computeDifference(frame.image1.image, *image2, diffed.diffImage, result.summary,
+                                              options.tolerance, metrics)
+                          : computeDecodedDifference(frame.image1, frame.image2, {0, 0}, diffed.diffImage,
+                                                     result.summary, options.tolerance, metrics,
+                                                     keepPrecise ? &diffed.preciseDiff : nullptr);
+            if (!ok) {
+                result.failed = true;
+                result.error = "Invalid image dimensions";
+                complete(frame.index);
+                continue;
+            }
+            result.overThreshold = result.summary.sizeMismatch ||
+                                   result.summary.differingPercent() > options.thresholdPercent;
+            result.diffMs = elapsedMs(startNs);
+            timer.stop();
+
+            // The inputs are done with; only the difference moves on.
+            frame = DecodedFrame();
+            resampled = sf::Image();
+            if (!encoding) {
+                complete(diffed.index);
+            }
+            else if (!encodeQueue.push(std::move(diffed))) {
+                break;
+            }
+        }
+    };
+
+    auto encodeStage = [&] {
+        DiffedFrame diffed;
+        while (encodeQueue.pop(diffed)) {
+            if (cancelled()) {
+                continue;
+            }
+
+            ScopedTimer timer("Encode frame");
+            std::uint64_t startNs = profileClockNs();
+            SequenceFrameResult& result = results[diffed.index];
+            fs::path outputPath = fs::path(options.outputDirectory) / fs::path(frames[diffed.index].pathA).filename();
+            // A's format may not hold the deltas exactly (JPEG frames, say).
+            if (diffed.preciseDiff && !isPreciseOutputPath(outputPath.string())) {
+                outputPath.replace_extension(".pam");
+            }
+            else if (!diffed.preciseDiff && !isExactImageOutputPath(outputPath.string())) {
+                outputPath.replace_extension(".qoi");
+            }
+            if (diffed.preciseDiff) {
+                if (!savePreciseImage(*diffed.preciseDiff, outputPath.string(), result.error)) {
+                    result.failed = true;
+                }
+            }
+            else if (!saveImageFile(diffed.diffImage, outputPath.string(), {options.pngLevel})) {
+                result.failed = true;
+                result.error = "Failed to save difference image: " + outputPath.string();
+            }
+            result.encodeMs = elapsedMs(startNs);
+            diffed.diffImage = sf::Image();
+            diffed.preciseDiff.reset();
+            complete(diffed.index);
+        }
+    };
+
+    std::vector<std::thread> decoders, differs, encoders;
+    for (std::size_t i = 0; i < decodeThreads; ++i) {
+        decoders.emplace_back(decodeStage);
+    }
+    for (std::size_t i = 0; i < diffThreads; ++i) {
+        differs.emplace_back(diffStage);
+    }
+    for (std::size_t i = 0; i < encodeThreads; ++i) {
+        encoders.emplace_back(encodeStage);
+    }
+
+    // Each stage ends when the one before it has and its queue is drained.
+    for (std::thread& thread : decoders) {
+        thread.join();
+    }
+    decodedQueue.close();
+    for (std::thread& thread : differs) {
+        thread.join();
+    }
+    encodeQueue.close();
+    for (std::thread& thread : encoders) {
+        thread.join();
+    }
+
+    for (std::size_t i = 0; i < frames.size(); ++i) {
+        if (!finished[i]) {
+            results[i].failed = true;
+            results[i].error = "Cancelled";
+        }
+    }
+}
+
+bool writeSequenceReport(const std::string& path, const std::vector<SequenceFrame>& frames,
+                         const std::vector<SequenceFrameResult>& results) {
+    std::ofstream file(path);
+    if (!file) {
+        return false;
+    }
+
+    return lowercaseExtension(path) == ".csv" ? writeSequenceCsv(file, frames, results) : writeSequenceJson(file, frames, results);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "diff_metrics.hpp"
+#include "image_codecs.hpp"
+#include "image_diff.hpp"
+#include "resample.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// One frame pair of two rendered sequences, matched by frame number.
+struct SequenceFrame {
+    long number = 0;
+    std::string pathA;
+    std::string pathB;
+};
+
+// Lists the frames of two sequences. Each input is either a directory, whose
+// files are numbered by the last run of digits in their names, or a pattern
+// such as "shots/render_%04d.png" or "shots/render_####.png". Frames present
+// in only one sequence are counted in `unmatched` and skipped.
+bool collectSequenceFrames(const std::string& inputA, const std::string& inputB, std::vector<SequenceFrame>& frames,
+                           std::size_t& unmatched, std::string& error);
+
+struct SequenceOptions {
+    std::uint8_t tolerance = 0;
+    double thresholdPercent = 0.0;
+    bool withMetrics = true;
+    // Frames of different sizes are resampled onto A's grid when set.
+    bool resample = false;
+    ResampleFilter resampleFilter = ResampleFilter::Lanczos3;
+    // Difference images go here, named after A's frames, when not empty.
+    std::string outputDirectory;
+    int pngLevel = DefaultPngLevel;
+    // Decoded pairs and finished differences waiting for the next stage.
+    unsigned queueDepth = 4;
+    // 0 picks from the shared pool's size.
+    unsigned decodeThreads = 0;
+    unsigned encodeThreads = 0;
+};
+
+struct SequenceFrameResult {
+    DiffSummary summary;
+    DiffMetrics metrics;
+    bool resampled = false;
+    bool failed = false;
+    bool overThreshold = false;
+    std::string error;
+    float decodeMs = 0.0f;
+    float diffMs = 0.0f;
+    float encodeMs = 0.0f;
+};
+
+struct SequenceProgress {
+    std::atomic<std::size_t> done{0};
+    std::atomic<bool> cancelRequested{false};
+};
+
+// Runs decode -> diff and metrics -> encode over `frames`, each stage on its
+// own threads with bounded queues in between. At most decodeThreads +
+// queueDepth + 2 decoded pairs and queueDepth + encodeThreads + 2 difference
+// images are alive at once. Row bands of each diff run on the shared pool.
+// `results` is indexed like `frames`; `frameDone` is called from the
+// pipeline threads as frames complete.
+void runSequenceComparison(const std::vector<SequenceFrame>& frames, const SequenceOptions& options,
+                           std::vector<SequenceFrameResult>& results, SequenceProgress* progress = nullptr,
+                           const std::function<void(std::size_t)>& frameDone = {});
+
+// Per-frame report; the format follows the extension (.csv, otherwise JSON).
+bool writeSequenceReport(const std::string& path, const std::vector<SequenceFrame>& frames,
+                         const std::vector<SequenceFrameResult>& results);
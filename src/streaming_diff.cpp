@@ -0,0 +1,194 @@
+#include "streaming_diff.hpp"
+
+#include "image_utils.hpp"
+#include "mapped_image.hpp"
+#include "profiler.hpp"
+#include "scanline_io.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+namespace {
+
+// Rows widened per step when a mapped input is not already RGBA.
+constexpr unsigned MappedStripRows = 256;
+
+}
+
+bool streamDifference(const std::string& pathA, const std::string& pathB, const std::string& outputPath,
+                      unsigned stripRows, std::uint8_t tolerance, DiffSummary& summary, DiffMetrics* metrics,
+                      std::string& error) {
+    ScopedTimer timer("Stream difference");
+    summary = DiffSummary{};
+    if (!outputPath.empty() && (refersToSameFile(outputPath, pathA) || refersToSameFile(outputPath, pathB))) {
+        error = "Output would overwrite an input: " + outputPath;
+        return false;
+    }
+
+    std::unique_ptr<ScanlineReader> reader1 = openScanlineReader(pathA, error);
+    if (!reader1) {
+        return false;
+    }
+    std::unique_ptr<ScanlineReader> reader2 = openScanlineReader(pathB, error);
+    if (!reader2) {
+        return false;
+    }
+
+    sf::Vector2u size1 = reader1->getSize();
+    sf::Vector2u size2 = reader2->getSize();
+    summary.width = std::min(size1.x, size2.x);
+    summary.height = std::min(size1.y, size2.y);
+    summary.sizeMismatch = size1 != size2;
+
+    if (summary.width == 0 || summary.height == 0) {
+        error = "Invalid image dimensions";
+        return false;
+    }
+
+    std::unique_ptr<ScanlineWriter> writer;
+    if (!outputPath.empty()) {
+        writer = createScanlineWriter(outputPath, {summary.width, summary.height}, error);
+        if (!writer) {
+            return false;
+        }
+    }
+
+    stripRows = std::max(stripRows, 1u);
+    stripRows = (stripRows + SsimBlockSize - 1) / SsimBlockSize * SsimBlockSize;
+
+    // Inputs are read at their full width; only the overlap is diffed.
+    std::size_t stride1 = static_cast<std::size_t>(size1.x) * 4;
+    std::size_t stride2 = static_cast<std::size_t>(size2.x) * 4;
+    std::size_t strideOut = static_cast<std::size_t>(summary.width) * 4;
+    std::vector<std::uint8_t> strip1(stride1 * stripRows);
+    std::vector<std::uint8_t> strip2(stride2 * stripRows);
+    std::vector<std::uint8_t> stripOut(strideOut * stripRows);
+
+    DiffAccumulator accumulator;
+    for (unsigned y = 0; y < summary.height; y += stripRows) {
+        unsigned rows = std::min(stripRows, summary.height - y);
+
+        if (!reader1->readRows(strip1.data(), rows)) {
+            error = "Unexpected end of image data: " + pathA;
+            return false;
+        }
+        if (!reader2->readRows(strip2.data(), rows)) {
+            error = "Unexpected end of image data: " + pathB;
+            return false;
+        }
+
+        diffStrip(strip1.data(), stride1, strip2.data(), stride2, stripOut.data(), strideOut, summary.width, rows,
+                  tolerance, metrics != nullptr, accumulator);
+
+        if (writer && !writer->writeRows(stripOut.data(), rows)) {
+            error = "Failed to write difference image: " + outputPath;
+            return false;
+        }
+    }
+
+    if (writer && !writer->finish()) {
+        error = "Failed to write difference image: " + outputPath;
+        return false;
+    }
+
+    finishDifference(accumulator, tolerance, summary, metrics);
+    return true;
+}
+
+bool mappedDifference(const std::string& pathA, const std::string& pathB, const std::string& outputPath,
+                      std::uint8_t tolerance, DiffSummary& summary, DiffMetrics* metrics, std::string& error,
+                      const ImageSaveOptions& saveOptions) {
+    ScopedTimer timer("Mapped difference");
+    summary = DiffSummary{};
+    if (!outputPath.empty() && (refersToSameFile(outputPath, pathA) || refersToSameFile(outputPath, pathB))) {
+        error = "Output would overwrite an input: " + outputPath;
+        return false;
+    }
+
+    MappedImage input1;
+    MappedImage input2;
+    if (!input1.open(pathA, error) || !input2.open(pathB, error)) {
+        return false;
+    }
+    if (!input1.isEightBit() || !input2.isEightBit()) {
+        error = "16-bit and float images are compared whole, not through a mapping";
+        return false;
+    }
+
+    sf::Vector2u size1 = input1.getSize();
+    sf::Vector2u size2 = input2.getSize();
+    summary.width = std::min(size1.x, size2.x);
+    summary.height = std::min(size1.y, size2.y);
+    summary.sizeMismatch = size1 != size2;
+    sf::Vector2u overlap{summary.width, summary.height};
+
+    std::size_t strideOut = static_cast<std::size_t>(summary.width) * 4;
+    MappedImage mappedOutput;
+    std::unique_ptr<ScanlineWriter> writer;
+    sf::Image imageOutput;
+    std::uint8_t* outputPixels = nullptr;
+
+    if (!outputPath.empty()) {
+        if (isRgbaRawFormatPath(outputPath)) {
+            if (!mappedOutput.create(outputPath, overlap, error)) {
+                return false;
+            }
+            outputPixels = mappedOutput.getMutableSamples();
+        }
+        else if (lowercaseExtension(outputPath) == ".bmp" || lowercaseExtension(outputPath) == ".ppm" ||
+                 lowercaseExtension(outputPath) == ".qoi") {
+            writer = createScanlineWriter(outputPath, overlap, error);
+            if (!writer) {
+                return false;
+            }
+        }
+        else {
+            imageOutput.resize(overlap);
+            outputPixels = mutablePixelsPtr(imageOutput);
+        }
+    }
+
+    // Everything in place: one pass over the whole image.
+    bool inPlace = input1.isRgba() && input2.isRgba() && outputPixels;
+    unsigned stripRows = inPlace ? summary.height : MappedStripRows;
+
+    std::vector<std::uint8_t> strip1;
+    std::vector<std::uint8_t> strip2;
+    std::vector<std::uint8_t> stripOut;
+    if (!input1.isRgba()) strip1.resize(static_cast<std::size_t>(size1.x) * 4 * stripRows);
+    if (!input2.isRgba()) strip2.resize(static_cast<std::size_t>(size2.x) * 4 * stripRows);
+    if (!outputPixels) stripOut.resize(strideOut * stripRows);
+
+    auto inputRows = [](const MappedImage& input, std::vector<std::uint8_t>& strip, unsigned y, unsigned rows) {
+        if (input.isRgba()) {
+            return input.getSamples() + y * input.getStride();
+        }
+        input.copyRowsAsRgba(y, rows, strip.data());
+        return static_cast<const std::uint8_t*>(strip.data());
+    };
+
+    DiffAccumulator accumulator;
+    for (unsigned y = 0; y < summary.height; y += stripRows) {
+        unsigned rows = std::min(stripRows, summary.height - y);
+        const std::uint8_t* rows1 = inputRows(input1, strip1, y, rows);
+        const std::uint8_t* rows2 = inputRows(input2, strip2, y, rows);
+        std::uint8_t* rowsOut = outputPixels ? outputPixels + y * strideOut : stripOut.data();
+
+        diffStrip(rows1, static_cast<std::size_t>(size1.x) * 4, rows2, static_cast<std::size_t>(size2.x) * 4,
+                  rowsOut, strideOut, summary.width, rows, tolerance, metrics != nullptr, accumulator);
+
+        if (writer && !writer->writeRows(rowsOut, rows)) {
+            error = "Failed to write difference image: " + outputPath;
+            return false;
+        }
+    }
+
+    if ((writer && !writer->finish()) || (imageOutput.getSize().x > 0 && !saveImageFile(imageOutput, outputPath, saveOptions))) {
+        error = "Failed to write difference image: " + outputPath;
+        return false;
+    }
+
+    finishDifference(accumulator, tolerance, summary, metrics);
+    return true;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "image_codecs.hpp"
+#include "image_diff.hpp"
+
+#include <cstdint>
+#include <string>
+
+constexpr unsigned DefaultStreamStripRows = 64;
+
+// Same result as computeDifference + saveToFile, but only `stripRows` rows of
+// each input and of the output are held in memory at a time. Inputs that
+// cannot be read incrementally (see openScanlineReader) are decoded whole.
+// `stripRows` is rounded up to a multiple of SsimBlockSize.
+bool streamDifference(const std::string& pathA, const std::string& pathB, const std::string& outputPath,
+                      unsigned stripRows, std::uint8_t tolerance, DiffSummary& summary, DiffMetrics* metrics,
+                      std::string& error);
+
+// Diffs two raw-format files (see raw_formats.hpp) through memory mappings.
+// RGBA inputs are used in place; .pam/.rgba output is written straight into
+// a mapped file. Other inputs are widened in strips, and other outputs go
+// through the scanline writers or, failing that, saveImageFile.
+bool mappedDifference(const std::string& pathA, const std::string& pathB, const std::string& outputPath,
+                      std::uint8_t tolerance, DiffSummary& summary, DiffMetrics* metrics, std::string& error,
+                      const ImageSaveOptions& saveOptions = {});
@@ -0,0 +1,184 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+namespace {
+
+constexpr unsigned NoWorker = ~0u;
+
+thread_local const ThreadPool* currentPool = nullptr;
+thread_local unsigned currentWorker = NoWorker;
+
+}
+
+unsigned ThreadPool::defaultThreadCount() {
+    unsigned count = std::thread::hardware_concurrency();
+    return count == 0 ? 1 : count;
+}
+
+ThreadPool::ThreadPool(unsigned threadCount) {
+    if (threadCount == 0) {
+        threadCount = defaultThreadCount();
+    }
+
+    queues.reserve(threadCount);
+    for (unsigned i = 0; i < threadCount; ++i) {
+        queues.push_back(std::make_unique<WorkerQueue>());
+    }
+
+    workers.reserve(threadCount);
+    for (unsigned i = 0; i < threadCount; ++i) {
+        workers.emplace_back([this, i] { workerLoop(i); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    taskAvailable.notify_all();
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+unsigned ThreadPool::callerIndex() const {
+    return currentPool == this ? currentWorker : NoWorker;
+}
+
+void ThreadPool::enqueue(std::function<void()> task) {
+    unsigned self = callerIndex();
+    unsigned index = self != NoWorker ? self : nextQueue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+
+    unfinishedTasks.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        queuedTasks.fetch_add(1);
+    }
+    taskAvailable.notify_one();
+}
+
+void ThreadPool::waitIdle() {
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    idle.wait(lock, [this] { return unfinishedTasks.load() == 0; });
+}
+
+bool ThreadPool::tryRunOne(unsigned self) {
+    std::function<void()> task;
+
+    if (self != NoWorker) {
+        WorkerQueue& own = *queues[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+        }
+    }
+
+    if (!task) {
+        unsigned count = static_cast<unsigned>(queues.size());
+        unsigned start = self != NoWorker ? self + 1 : nextQueue.load(std::memory_order_relaxed);
+        for (unsigned i = 0; i < count && !task; ++i) {
+            WorkerQueue& victim = *queues[(start + i) % count];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+            }
+        }
+    }
+
+    if (!task) {
+        return false;
+    }
+
+    queuedTasks.fetch_sub(1);
+    task();
+
+    if (unfinishedTasks.fetch_sub(1) == 1) {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        idle.notify_all();
+    }
+    return true;
+}
+
+void ThreadPool::workerLoop(unsigned index) {
+    currentPool = this;
+    currentWorker = index;
+
+    while (true) {
+        if (tryRunOne(index)) {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        taskAvailable.wait(lock, [this] { return stopping || queuedTasks.load() > 0; });
+        if (stopping && queuedTasks.load() == 0) {
+            return;
+        }
+    }
+}
+
+void ThreadPool::parallelFor(std::size_t count, std::size_t grain,
+                             const std::function<void(std::size_t, std::size_t)>& body) {
+    if (count == 0) {
+        return;
+    }
+
+    grain = std::max<std::size_t>(1, grain);
+    std::size_t chunks = (count + grain - 1) / grain;
+    if (chunks == 1 || workers.size() <= 1) {
+        body(0, count);
+        return;
+    }
+
+    struct ForState {
+        std::atomic<std::size_t> next{0};
+        std::atomic<std::size_t> done{0};
+        std::size_t chunks = 0;
+        std::size_t count = 0;
+        std::size_t grain = 0;
+        const std::function<void(std::size_t, std::size_t)>* body = nullptr;
+    };
+
+    auto state = std::make_shared<ForState>();
+    state->chunks = chunks;
+    state->count = count;
+    state->grain = grain;
+    state->body = &body;
+
+    // Late helpers only touch the shared counters, never `body`, once every
+    // chunk has been claimed, so they may outlive this call safely.
+    auto runChunks = [](ForState& s) {
+        std::size_t chunk;
+        while ((chunk = s.next.fetch_add(1)) < s.chunks) {
+            std::size_t begin = chunk * s.grain;
+            (*s.body)(begin, std::min(begin + s.grain, s.count));
+            if (s.done.fetch_add(1) + 1 == s.chunks) {
+                s.done.notify_all();
+            }
+        }
+    };
+
+    std::size_t helpers = std::min<std::size_t>(chunks - 1, workers.size() - 1);
+    for (std::size_t i = 0; i < helpers; ++i) {
+        enqueue([state, runChunks] { runChunks(*state); });
+    }
+
+    runChunks(*state);
+
+    // Every chunk has been claimed by now, so the rest are running on other
+    // threads and finish without help. The caller does not pick up unrelated
+    // queued tasks meanwhile: on the UI thread one of those could take far
+    // longer than this loop.
+    std::size_t done;
+    while ((done = state->done.load()) < chunks) {
+        state->done.wait(done);
+    }
+}
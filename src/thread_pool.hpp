@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing pool: every worker owns a deque, pops its own work LIFO and
+// steals FIFO from the others when it runs dry.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void enqueue(std::function<void()> task);
+    void waitIdle();
+
+    // Calls body(begin, end) over [0, count) in chunks of `grain` and returns
+    // once every chunk has run. The calling thread works on chunks too, so
+    // this is safe to call from inside a pool task; it never runs other
+    // queued tasks while it waits.
+    void parallelFor(std::size_t count, std::size_t grain,
+                     const std::function<void(std::size_t, std::size_t)>& body);
+
+    unsigned size() const { return static_cast<unsigned>(workers.size()); }
+
+    static unsigned defaultThreadCount();
+
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void workerLoop(unsigned index);
+    bool tryRunOne(unsigned self);
+    unsigned callerIndex() const;
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<unsigned> nextQueue{0};
+    std::atomic<std::size_t> queuedTasks{0};
+    std::atomic<std::size_t> unfinishedTasks{0};
+    std::mutex sleepMutex;
+    std::condition_variable taskAvailable;
+    std::condition_variable idle;
+    bool stopping = false;
+};
@@ -0,0 +1,439 @@
+#include "tiled_texture.hpp"
+
+#include "image_utils.hpp"
+#include "mip_pyramid.hpp"
+#include "profiler.hpp"
+#include "imgui.h"
+
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+
+namespace {
+
+constexpr int MaxUploadsPerFrame = 8;
+constexpr std::size_t GpuBudgetBytes = std::size_t{1} << 30;
+
+// Released tile textures waiting to be reused. Textures are only touched on
+// the GUI thread, so this needs no lock.
+struct TexturePool {
+    std::vector<std::unique_ptr<sf::Texture>> textures;
+    std::size_t bytes = 0;
+    std::size_t budget = 0;
+    // Tile pixels made contiguous for Texture::update.
+    std::vector<std::uint8_t> scratch;
+};
+
+TexturePool& texturePool() {
+    static TexturePool pool;
+    return pool;
+}
+
+std::size_t textureBytes(const sf::Texture& texture) {
+    return static_cast<std::size_t>(texture.getSize().x) * texture.getSize().y * 4;
+}
+
+std::unique_ptr<sf::Texture> takePooledTexture(sf::Vector2u size) {
+    TexturePool& pool = texturePool();
+    for (std::size_t i = 0; i < pool.textures.size(); ++i) {
+        if (pool.textures[i]->getSize() == size) {
+            std::unique_ptr<sf::Texture> texture = std::move(pool.textures[i]);
+            pool.textures[i] = std::move(pool.textures.back());
+            pool.textures.pop_back();
+            pool.bytes -= textureBytes(*texture);
+            return texture;
+        }
+    }
+    return nullptr;
+}
+
+}
+
+void TiledTexture::setTexturePoolBudget(std::size_t bytes) {
+    TexturePool& pool = texturePool();
+    pool.budget = bytes;
+    while (pool.bytes > pool.budget) {
+        pool.bytes -= textureBytes(*pool.textures.back());
+        pool.textures.pop_back();
+    }
+    if (pool.budget == 0) {
+        pool.scratch = std::vector<std::uint8_t>();
+    }
+}
+
+std::size_t TiledTexture::getTexturePoolBytes() {
+    return texturePool().bytes;
+}
+
+bool TiledTexture::loadFromImage(const sf::Image& base, std::vector<sf::Image> mipLevels) {
+    clear();
+
+    sf::Vector2u baseSize = base.getSize();
+    if (baseSize.x == 0 || baseSize.y == 0) {
+        return false;
+    }
+
+    if (mipLevels.empty()) {
+        buildMipChain(base, mipLevels);
+    }
+    ownedLevels = std::move(mipLevels);
+    return buildLevels(base, ownedLevels);
+}
+
+bool TiledTexture::loadFromImage(std::shared_ptr<const DecodedImage> source) {
+    clear();
+
+    if (!source || source->image.getSize().x == 0 || source->image.getSize().y == 0) {
+        return false;
+    }
+
+    sharedSource = std::move(source);
+    if (sharedSource->mipLevels.empty()) {
+        buildMipChain(sharedSource->image, ownedLevels);
+        return buildLevels(sharedSource->image, ownedLevels);
+    }
+    return buildLevels(sharedSource->image, sharedSource->mipLevels);
+}
+
+bool TiledTexture::loadResident(const sf::Image& base) {
+    clear();
+
+    sf::Vector2u baseSize = base.getSize();
+    if (baseSize.x == 0 || baseSize.y == 0) {
+        return false;
+    }
+
+    std::vector<sf::Image> mipLevels;
+    buildMipChain(base, mipLevels);
+    std::size_t bytes = rowStride(base) * baseSize.y;
+    for (const sf::Image& level : mipLevels) {
+        bytes += rowStride(level) * level.getSize().y;
+    }
+    if (bytes > GpuBudgetBytes || !buildLevels(base, mipLevels)) {
+        return false;
+    }
+
+    // buildLevels uploaded the top level; everything else follows now, while
+    // the pixels are still around.
+    for (std::size_t l = 0; l + 1 < levels.size(); ++l) {
+        for (unsigned ty = 0; ty < levels[l].tilesY; ++ty) {
+            for (unsigned tx = 0; tx < levels[l].tilesX; ++tx) {
+                if (!uploadTile(l, tx, ty)) {
+                    clear();
+                    return false;
+                }
+            }
+        }
+    }
+    for (Level& level : levels) {
+        level.image = nullptr;
+    }
+    resident = true;
+    return true;
+}
+
+bool TiledTexture::loadResident(sf::Vector2u baseSize, const BandSource& source) {
+    clear();
+
+    if (baseSize.x == 0 || baseSize.y == 0) {
+        return false;
+    }
+
+    // The level sizes buildMipChain produces.
+    std::vector<sf::Vector2u> sizes = {baseSize};
+    std::size_t bytes = 0;
+    while (true) {
+        bytes += static_cast<std::size_t>(sizes.back().x) * sizes.back().y * 4;
+        if (sizes.back().x <= PyramidTileSize && sizes.back().y <= PyramidTileSize) {
+            break;
+        }
+        sizes.push_back({(sizes.back().x + 1) / 2, (sizes.back().y + 1) / 2});
+    }
+    if (bytes > GpuBudgetBytes) {
+        return false;
+    }
+
+    ScopedTimer timer("Texture load");
+    size = baseSize;
+    levels.resize(sizes.size());
+    for (std::size_t i = 0; i < levels.size(); ++i) {
+        Level& level = levels[i];
+        level.width = sizes[i].x;
+        level.height = sizes[i].y;
+        level.tilesX = (level.width + PyramidTileSize - 1) / PyramidTileSize;
+        level.tilesY = (level.height + PyramidTileSize - 1) / PyramidTileSize;
+        level.tiles.resize(static_cast<std::size_t>(level.tilesX) * level.tilesY);
+    }
+
+    // Per coarser level, the tile row being filled from halved bands and how
+    // many of its rows are in.
+    std::vector<sf::Image> pending(levels.size());
+    std::vector<unsigned> pendingRows(levels.size(), 0);
+    sf::Image band;
+    for (unsigned ty = 0; ty < levels[0].tilesY; ++ty) {
+        unsigned firstRow = ty * PyramidTileSize;
+        unsigned rows = std::min(PyramidTileSize, baseSize.y - firstRow);
+        if (!source(firstRow, rows, band) || band.getSize() != sf::Vector2u(baseSize.x, rows) ||
+            !uploadBand(0, ty, band, pending, pendingRows)) {
+            clear();
+            return false;
+        }
+    }
+    resident = true;
+    return true;
+}
+
+// Bands are a whole tile row, an even number of rows but for the last one, so
+// halving them one by one gives the same levels as halving the whole image.
+bool TiledTexture::uploadBand(std::size_t levelIndex, unsigned tileY, const sf::Image& band,
+                              std::vector<sf::Image>& pending, std::vector<unsigned>& pendingRows) {
+    Level& level = levels[levelIndex];
+    for (unsigned tx = 0; tx < level.tilesX; ++tx) {
+        if (!uploadTileFrom(levelIndex, tx, tileY, band, tileY * PyramidTileSize)) {
+            return false;
+        }
+    }
+
+    std::size_t next = levelIndex + 1;
+    if (next == levels.size()) {
+        return true;
+    }
+    sf::Image half;
+    downsampleHalf(band, half);
+
+    Level& coarser = levels[next];
+    unsigned rowsDone = pendingRows[next];
+    unsigned nextTileY = rowsDone / PyramidTileSize;
+    unsigned firstRow = nextTileY * PyramidTileSize;
+    unsigned tileRows = std::min(PyramidTileSize, coarser.height - firstRow);
+    sf::Image& rows = pending[next];
+    if (rowsDone == firstRow) {
+        rows.resize({coarser.width, tileRows});
+    }
+    copyPixelRows(half.getPixelsPtr(), rowStride(half), mutablePixelsPtr(rows) + (rowsDone - firstRow) * rowStride(rows),
+                  rowStride(rows), coarser.width, half.getSize().y);
+    pendingRows[next] = rowsDone + half.getSize().y;
+    if (pendingRows[next] - firstRow < tileRows) {
+        return true;
+    }
+    return uploadBand(next, nextTileY, rows, pending, pendingRows);
+}
+
+std::size_t TiledTexture::getCpuBytes() const {
+    std::size_t bytes = 0;
+    for (const sf::Image& level : ownedLevels) {
+        bytes += rowStride(level) * level.getSize().y;
+    }
+    return bytes;
+}
+
+bool TiledTexture::buildLevels(const sf::Image& base, const std::vector<sf::Image>& mipLevels) {
+    ScopedTimer timer("Texture load");
+    size = base.getSize();
+
+    levels.resize(mipLevels.size() + 1);
+    for (std::size_t i = 0; i < levels.size(); ++i) {
+        Level& level = levels[i];
+        level.image = i == 0 ? &base : &mipLevels[i - 1];
+        level.width = level.image->getSize().x;
+        level.height = level.image->getSize().y;
+        level.tilesX = (level.width + PyramidTileSize - 1) / PyramidTileSize;
+        level.tilesY = (level.height + PyramidTileSize - 1) / PyramidTileSize;
+        level.tiles.resize(static_cast<std::size_t>(level.tilesX) * level.tilesY);
+    }
+
+    std::size_t top = levels.size() - 1;
+    for (unsigned ty = 0; ty < levels[top].tilesY; ++ty) {
+        for (unsigned tx = 0; tx < levels[top].tilesX; ++tx) {
+            if (!uploadTile(top, tx, ty)) {
+                clear();
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void TiledTexture::clear() {
+    TexturePool& pool = texturePool();
+    for (Level& level : levels) {
+        for (Tile& tile : level.tiles) {
+            if (tile.texture && pool.bytes + textureBytes(*tile.texture) <= pool.budget) {
+                pool.bytes += textureBytes(*tile.texture);
+                pool.textures.push_back(std::move(tile.texture));
+            }
+        }
+    }
+    levels.clear();
+    ownedLevels.clear();
+    sharedSource.reset();
+    size = {0, 0};
+    residentBytes = 0;
+    pendingUploads = false;
+    resident = false;
+}
+
+bool TiledTexture::uploadTile(std::size_t levelIndex, unsigned tileX, unsigned tileY) {
+    const sf::Image* image = levels[levelIndex].image;
+    return image && uploadTileFrom(levelIndex, tileX, tileY, *image, 0);
+}
+
+bool TiledTexture::uploadTileFrom(std::size_t levelIndex, unsigned tileX, unsigned tileY, const sf::Image& rows,
+                                  unsigned firstRow) {
+    ScopedTimer timer("Upload tile");
+    Level& level = levels[levelIndex];
+    Tile& tile = level.tiles[static_cast<std::size_t>(tileY) * level.tilesX + tileX];
+
+    unsigned x = tileX * PyramidTileSize;
+    unsigned y = tileY * PyramidTileSize - firstRow;
+    unsigned width = std::min(PyramidTileSize, level.width - x);
+    unsigned height = std::min(PyramidTileSize, level.height - tileY * PyramidTileSize);
+
+    std::unique_ptr<sf::Texture> texture = takePooledTexture({width, height});
+    if (texture) {
+        std::vector<std::uint8_t>& scratch = texturePool().scratch;
+        scratch.resize(static_cast<std::size_t>(width) * height * 4);
+        copyPixelRows(rows.getPixelsPtr() + y * rowStride(rows) + static_cast<std::size_t>(x) * 4, rowStride(rows),
+                      scratch.data(), static_cast<std::size_t>(width) * 4, width, height);
+        texture->update(scratch.data(), {width, height}, {0, 0});
+    }
+    else {
+        texture = std::make_unique<sf::Texture>();
+        sf::IntRect area({static_cast<int>(x), static_cast<int>(y)},
+                         {static_cast<int>(width), static_cast<int>(height)});
+        if (!texture->loadFromImage(rows, false, area)) {
+            return false;
+        }
+    }
+    texture->setSmooth(levelIndex > 0);
+
+    tile.texture = std::move(texture);
+    tile.lastUsedFrame = frame;
+    residentBytes += static_cast<std::size_t>(width) * height * 4;
+    return true;
+}
+
+void TiledTexture::drawTile(std::size_t levelIndex, unsigned tileX, unsigned tileY,
+                            float originX, float originY, sf::Vector2f zoom) {
+    Level& level = levels[levelIndex];
+    Tile& tile = level.tiles[static_cast<std::size_t>(tileY) * level.tilesX + tileX];
+    tile.lastUsedFrame = frame;
+
+    float scaleX = static_cast<float>(size.x) * zoom.x / static_cast<float>(level.width);
+    float scaleY = static_cast<float>(size.y) * zoom.y / static_cast<float>(level.height);
+
+    unsigned x0 = tileX * PyramidTileSize;
+    unsigned y0 = tileY * PyramidTileSize;
+    unsigned x1 = std::min(x0 + PyramidTileSize, level.width);
+    unsigned y1 = std::min(y0 + PyramidTileSize, level.height);
+
+    ImVec2 pMin(originX + x0 * scaleX, originY + y0 * scaleY);
+    ImVec2 pMax(originX + x1 * scaleX, originY + y1 * scaleY);
+    ImTextureID texId = static_cast<ImTextureID>(static_cast<uintptr_t>(tile.texture->getNativeHandle()));
+    ImGui::GetWindowDrawList()->AddImage(texId, pMin, pMax);
+}
+
+void TiledTexture::draw(float zoom) {
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    ImGui::Dummy(ImVec2(size.x * zoom, size.y * zoom));
+    drawAt({origin.x, origin.y}, {zoom, zoom});
+}
+
+void TiledTexture::drawAt(sf::Vector2f origin, sf::Vector2f zoom) {
+    if (levels.empty() || zoom.x <= 0.0f || zoom.y <= 0.0f) {
+        return;
+    }
+    ++frame;
+
+    // The finer axis picks the level, so neither is undersampled.
+    float levelZoom = std::max(zoom.x, zoom.y);
+    std::size_t levelIndex = 0;
+    if (levelZoom < 1.0f) {
+        levelIndex = static_cast<std::size_t>(std::floor(std::log2(1.0f / levelZoom)));
+        levelIndex = std::min(levelIndex, levels.size() - 1);
+    }
+    Level& level = levels[levelIndex];
+
+    ImDrawList* drawList = ImGui::GetWindowDrawList();
+    ImVec2 clipMin = drawList->GetClipRectMin();
+    ImVec2 clipMax = drawList->GetClipRectMax();
+
+    float tileScreenW = static_cast<float>(size.x) * zoom.x / static_cast<float>(level.width) * PyramidTileSize;
+    float tileScreenH = static_cast<float>(size.y) * zoom.y / static_cast<float>(level.height) * PyramidTileSize;
+
+    auto tileRange = [](float lo, float hi, float origin, float tileExtent, unsigned count) {
+        int first = static_cast<int>(std::floor((lo - origin) / tileExtent));
+        int last = static_cast<int>(std::floor((hi - origin) / tileExtent));
+        first = std::clamp(first, 0, static_cast<int>(count) - 1);
+        last = std::clamp(last, 0, static_cast<int>(count) - 1);
+        return std::make_pair(static_cast<unsigned>(first), static_cast<unsigned>(last));
+    };
+    auto [firstX, lastX] = tileRange(clipMin.x, clipMax.x, origin.x, tileScreenW, level.tilesX);
+    auto [firstY, lastY] = tileRange(clipMin.y, clipMax.y, origin.y, tileScreenH, level.tilesY);
+
+    int uploadBudget = MaxUploadsPerFrame;
+    bool missingTiles = false;
+    for (unsigned ty = firstY; ty <= lastY; ++ty) {
+        for (unsigned tx = firstX; tx <= lastX; ++tx) {
+            Tile& tile = level.tiles[static_cast<std::size_t>(ty) * level.tilesX + tx];
+            if (tile.texture) {
+                continue;
+            }
+            if (uploadBudget > 0 && uploadTile(levelIndex, tx, ty)) {
+                --uploadBudget;
+            }
+            else {
+                missingTiles = true;
+            }
+        }
+    }
+    pendingUploads = missingTiles;
+
+    // The top level is always resident, so it stands in for tiles whose
+    // upload was deferred to a later frame.
+    std::size_t top = levels.size() - 1;
+    if (missingTiles && levelIndex != top) {
+        for (unsigned ty = 0; ty < levels[top].tilesY; ++ty) {
+            for (unsigned tx = 0; tx < levels[top].tilesX; ++tx) {
+                drawTile(top, tx, ty, origin.x, origin.y, zoom);
+            }
+        }
+    }
+
+    for (unsigned ty = firstY; ty <= lastY; ++ty) {
+        for (unsigned tx = firstX; tx <= lastX; ++tx) {
+            if (level.tiles[static_cast<std::size_t>(ty) * level.tilesX + tx].texture) {
+                drawTile(levelIndex, tx, ty, origin.x, origin.y, zoom);
+            }
+        }
+    }
+
+    evictUnusedTiles();
+}
+
+void TiledTexture::evictUnusedTiles() {
+    if (resident || residentBytes <= GpuBudgetBytes) {
+        return;
+    }
+
+    std::vector<std::tuple<std::uint64_t, std::size_t, std::size_t>> candidates;
+    for (std::size_t l = 0; l + 1 < levels.size(); ++l) {
+        for (std::size_t i = 0; i < levels[l].tiles.size(); ++i) {
+            const Tile& tile = levels[l].tiles[i];
+            if (tile.texture && tile.lastUsedFrame < frame) {
+                candidates.emplace_back(tile.lastUsedFrame, l, i);
+            }
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    for (const auto& [lastUsed, l, i] : candidates) {
+        if (residentBytes <= GpuBudgetBytes) {
+            break;
+        }
+        Tile& tile = levels[l].tiles[i];
+        sf::Vector2u tileSize = tile.texture->getSize();
+        residentBytes -= static_cast<std::size_t>(tileSize.x) * tileSize.y * 4;
+        tile.texture.reset();
+    }
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "image_cache.hpp"
+
+#include <SFML/Graphics.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// GPU view of an image split into PyramidTileSize tiles over a mip pyramid.
+// Only the tiles visible at the current zoom are uploaded and drawn, so images
+// larger than GL_MAX_TEXTURE_SIZE work and zoomed-out views sample a
+// matching level instead of the full resolution.
+class TiledTexture {
+public:
+    // `base` is not copied: it must outlive this texture and stay unchanged
+    // until the next loadFromImage/clear. Missing mip levels are built here.
+    bool loadFromImage(const sf::Image& base, std::vector<sf::Image> mipLevels = {});
+
+    // Draws from a shared decoded image and its mip chain, keeping it alive
+    // instead of taking a copy.
+    bool loadFromImage(std::shared_ptr<const DecodedImage> source);
+
+    // Uploads every tile of every level right away and keeps no pixels, so
+    // `base` may be released as soon as this returns. Fails, leaving the
+    // texture empty, when the whole pyramid would not fit the GPU budget.
+    bool loadResident(const sf::Image& base);
+
+    // Fills `band` with `rows` rows of the image from `firstRow` on, as wide
+    // as the image.
+    using BandSource = std::function<bool(unsigned firstRow, unsigned rows, sf::Image& band)>;
+
+    // loadResident for an image of `baseSize` that is never whole in memory:
+    // it is requested one tile row at a time and every mip level is built
+    // from those bands as they go up.
+    bool loadResident(sf::Vector2u baseSize, const BandSource& source);
+    void clear();
+
+    sf::Vector2u getSize() const { return size; }
+    std::size_t getResidentBytes() const { return residentBytes; }
+    // Mip levels built and kept here for later uploads; the levels of a
+    // shared DecodedImage count towards that image instead.
+    std::size_t getCpuBytes() const;
+    bool hasPendingUploads() const { return pendingUploads; }
+
+    // Tile textures dropped by clear() are kept, up to `bytes` of them, and
+    // reused for tiles of the same size by later loads instead of allocating
+    // new ones. 0, the default, turns the pool off and empties it.
+    static void setTexturePoolBudget(std::size_t bytes);
+    static std::size_t getTexturePoolBytes();
+
+    // Lays out an item of getSize() * zoom at the ImGui cursor, like
+    // ImGui::Image, and submits only the tiles inside the window's clip rect.
+    void draw(float zoom);
+
+    // Submits the visible tiles with the image's top-left corner at screen
+    // position `origin`, scaled by `zoom` per axis, without laying out an
+    // item.
+    void drawAt(sf::Vector2f origin, sf::Vector2f zoom);
+
+private:
+    struct Tile {
+        std::unique_ptr<sf::Texture> texture;
+        std::uint64_t lastUsedFrame = 0;
+    };
+
+    struct Level {
+        const sf::Image* image = nullptr;
+        unsigned width = 0;
+        unsigned height = 0;
+        unsigned tilesX = 0;
+        unsigned tilesY = 0;
+        std::vector<Tile> tiles;
+    };
+
+    bool buildLevels(const sf::Image& base, const std::vector<sf::Image>& mipLevels);
+    bool uploadTile(std::size_t levelIndex, unsigned tileX, unsigned tileY);
+    // `rows` holds the level's pixels from row `firstRow` on.
+    bool uploadTileFrom(std::size_t levelIndex, unsigned tileX, unsigned tileY, const sf::Image& rows,
+                        unsigned firstRow);
+    bool uploadBand(std::size_t levelIndex, unsigned tileY, const sf::Image& band,
+                    std::vector<sf::Image>& pending, std::vector<unsigned>& pendingRows);
+    void drawTile(std::size_t levelIndex, unsigned tileX, unsigned tileY, float originX, float originY, sf::Vector2f zoom);
+    void evictUnusedTiles();
+
+    std::vector<sf::Image> ownedLevels;
+    std::shared_ptr<const DecodedImage> sharedSource;
+    std::vector<Level> levels;
+    sf::Vector2u size;
+    std::uint64_t frame = 0;
+    std::size_t residentBytes = 0;
+    bool pendingUploads = false;
+    bool resident = false;
+};